@@ -18,6 +18,7 @@
 #include "syscall_handler.hh"
 #include "scheduler.hh"
 #include "fs/dev/acpi_controller.hh"
+#include "hal/smp.hh"
 #ifdef LOONGARCH
 
 extern "C" void main()
@@ -30,12 +31,16 @@ extern "C" void main()
 
     trap_mgr.init();
     trap_mgr.inithart();
+    proc::k_scheduler.init("scheduler"); // 就绪队列需先于任何进程状态变化初始化
     proc::k_pm.init("next pid", "next tid", "wait lock");
     mem::k_pmm.init();
 
     mem::k_vmm.init("virtual_memory_manager");
 
     mem::k_hmm.init("heap_memory_manager", HEAP_START);
+#ifdef KLIB_BENCH
+    klib_bench();
+#endif
 
     if (dev::k_devm.register_stdin(static_cast<dev::VirtualDevice *>(&dev::k_stdin)) < 0)
         while (1)
@@ -52,10 +57,21 @@ extern "C" void main()
     fs::k_bufm.init("buffer manager");
     syscall::k_syscall_handler.init(); // 初始化系统调用处理器
     proc::k_pm.user_init();            // 初始化用户进程
+    k_printer.start_async();           // 日志线程，此后日志异步输出
     printfMagenta("user init\n");
-    proc::k_scheduler.init("scheduler");
+    k_smp.start_secondaries();
+    k_smp.set_online();
     proc::k_scheduler.start_schedule();       // 启动调度器
     dev::acpi::k_acpi_controller.power_off(); // 关机
 }
 
+// 从核：内核页表和陷入都是按核的，初始化完就和主核一起调度
+extern "C" void secondary_main()
+{
+    mem::k_vmm.inithart();
+    trap_mgr.inithart();
+    k_smp.set_online();
+    proc::k_scheduler.start_schedule();
+}
+
 #endif
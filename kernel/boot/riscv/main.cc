@@ -29,7 +29,7 @@
 #include "fs/vfs/inode.hh"
 #include "mem/userspace_stream.hh"
 #include "fs/dev/acpi_controller.hh"
-// 注意华科的main函数可能有问题, 注意多核初始化
+#include "hal/smp.hh"
 void main()
 {
     // riscv::r_mstatus();
@@ -49,11 +49,15 @@ void main()
     plic_mgr.init();     // plic初始化
     plic_mgr.inithart(); // 初始化每个核上的csr
 
+    proc::k_scheduler.init("scheduler"); // 就绪队列需先于任何进程状态变化初始化
     proc::k_pm.init("next pid", "next tid", "wait lock");
 
     mem::k_pmm.init();
     mem::k_vmm.init("virtual_memory_manager");
     mem::k_hmm.init("heap_memory_manager", HEAP_START);
+#ifdef KLIB_BENCH
+    klib_bench();
+#endif
 
     if (dev::k_devm.register_stdin(static_cast<dev::VirtualDevice *>(&dev::k_stdin)) < 0)
         while (1)
@@ -75,6 +79,7 @@ void main()
     syscall::k_syscall_handler.init(); // 初始化系统调用处理器
 
     proc::k_pm.user_init(); // 初始化用户进程
+    k_printer.start_async();      // 日志线程，此后日志异步输出
     printfMagenta("user init\n");
 
     printfMagenta("\n"
@@ -85,7 +90,18 @@ void main()
                   "=== SYSTEM BOOT COMPLETE ===\n"
                   "Kernel space successfully initialized\n"); // ANSI Shadow 字体风格
 
-    proc::k_scheduler.init("scheduler");
+    k_smp.start_secondaries();
+    k_smp.set_online();
     proc::k_scheduler.start_schedule(); // 启动调度器
     sbi_shutdown();
 }
+
+// 从核：内核页表、陷入和 PLIC 都是按核的，初始化完就和主核一起调度
+extern "C" void secondary_main()
+{
+    mem::k_vmm.inithart();
+    trap_mgr.inithart();
+    plic_mgr.inithart();
+    k_smp.set_online();
+    proc::k_scheduler.start_schedule();
+}
@@ -7,6 +7,10 @@
 __attribute__ ((aligned (16))) char stack0[NCPU][4096];
 
 extern void main();
+extern "C" void secondary_main();
+
+// 第一个到达 start 的核负责初始化，其余的核由它经 SBI HSM 启动
+static int boot_hart_claimed = 0;
 
 void trap_loop()
 {
@@ -31,5 +35,8 @@ void start(uint64 hartid, uint64 dtb_entry)
     // 使用tp保存hartid以方便在S态查看
     riscv::w_tp(hartid);
     // 进入main函数完成一系列初始化
-    main();
+    if (__sync_lock_test_and_set(&boot_hart_claimed, 1) == 0)
+        main();
+    else
+        secondary_main();
 }
\ No newline at end of file
@@ -22,6 +22,26 @@ namespace dev
 		u32 buf_size;
 	};
 
+	/// @brief 异步块请求。
+	/// 提交后由驱动排队、与相邻 LBA 的同向请求合并、批量下发；
+	/// 完成时驱动置 done 并填写 status，随后在不持有驱动锁的情况下调用 callback。
+	/// 没有 callback 的请求由提交者调用 wait_request 等待，期间请求本身不能释放。
+	struct BlockRequest
+	{
+		long start_block = 0;
+		long block_count = 0;
+		BufferDescriptor *buf_list = nullptr;
+		int buf_count = 0;
+		bool write = false;
+		volatile bool done = false;
+		int status = 0;							// 0 成功，<0 失败
+		void (*callback)( BlockRequest *req ) = nullptr;
+		void *private_data = nullptr;			// 留给回调使用
+		BlockRequest *next = nullptr;			// 驱动内部使用：等待队列 / 完成链
+		BlockRequest *merge_next = nullptr;		// 驱动内部使用：合并到同一个硬件请求中的后续请求
+		BlockRequest *lower = nullptr;			// 分区设备内部使用：转发给底层设备、起始块已换算的请求
+	};
+
 	class BlockDevice : public VirtualDevice
 	{
 	public:
@@ -33,6 +53,20 @@ namespace dev
 		virtual int write_blocks_sync(long start_block, long block_count, BufferDescriptor *buf_list, int buf_count) = 0;
 		virtual int write_blocks(long start_block, long block_count, BufferDescriptor *buf_list, int buf_count) = 0;
 		virtual int handle_intr() = 0;
+
+		/// @brief 提交异步请求；默认实现同步完成，真正的队列由驱动覆盖
+		virtual int submit_request( BlockRequest *req )
+		{
+			int rc = req->write
+						 ? write_blocks_sync( req->start_block, req->block_count, req->buf_list, req->buf_count )
+						 : read_blocks_sync( req->start_block, req->block_count, req->buf_list, req->buf_count );
+			req->status = rc < 0 ? rc : 0;
+			req->done	= true;
+			if ( req->callback ) req->callback( req );
+			return 0;
+		}
+		/// @brief 等待一个无回调的请求完成，返回其 status
+		virtual int wait_request( BlockRequest *req ) { return req->status; }
 	};
 
 } // namespace dev
@@ -2,6 +2,7 @@
 
 #include <block_device.hh>
 #include <disk_partition_device.hh>
+#include "virtio_blk_queue.hh"
 #include "spinlock.hh"
 #include "platform.hh"
 #include <types.hh>
@@ -20,7 +21,7 @@ namespace loongarch
 {
 	namespace qemu
 	{
-		class VirtioDriver : public dev::BlockDevice
+		class VirtioDriver : public dev::VirtioBlkQueue
 		{
 			friend class DiskDriver;
       // virtio PCI common configuration
@@ -50,38 +51,8 @@ namespace loongarch
       #define VIRTIO_RING_F_INDIRECT_DESC 28
       #define VIRTIO_RING_F_EVENT_IDX		29
 
-      // this many virtio descriptors.
-      // must be a power of two.
-      #define NUM 8
-
-			struct VRingDesc
-			{
-				uint64 addr;
-				uint32 len;
-				uint16 flags;
-				uint16 next;
-			};
-      #define VRING_DESC_F_NEXT  1 // chained with another descriptor
-      #define VRING_DESC_F_WRITE 2 // device writes (vs read)
-
-      struct VRingUsedElem {
-        uint32 id;   // index of start of completed descriptor chain
-        uint32 len;
-      };
-
-      // for disk ops
-      #define VIRTIO_BLK_T_IN  0 // read the disk
-      #define VIRTIO_BLK_T_OUT 1 // write the disk
-
-      struct UsedArea {
-        uint16 flags;
-        uint16 id;
-        struct VRingUsedElem elems[NUM];
-      };
-
       // the address of virtio mmio register r.
       volatile uint64 _pci_dev;
-      static constexpr int _block_size = 512;
 
       private:
         char _dev_name[8];
@@ -90,55 +61,19 @@ namespace loongarch
         virtio_pci_hw_t			  virtio_blk_hw;
 
         int		   _port_id = 0;
-        struct Disk {
-          // memory for virtio descriptors &c for queue 0.
-          // this is a global instead of allocated because it must
-          // be multiple contiguous pages, which kalloc()
-          // doesn't support, and page aligned.
-          char pages[2*PGSIZE];
-          struct VRingDesc *desc;
-          uint16 *avail;
-          struct UsedArea *used;
-           
-          // our own book-keeping.
-          char free[NUM];  // is a descriptor free?
-          uint16 used_idx; // we've looked this far in used[2..NUM].
-         
-          // track info about in-flight operations,
-          // for use when completion interrupt arrives.
-          // indexed by first descriptor index of chain.
-          struct {
-            dev::BufferDescriptor *b;
-            char status;
-            bool wait;
-          } info[NUM];
-             
-          SpinLock vdisk_lock;
-             
-        } __attribute__ ((aligned (PGSIZE))) disk;
-
-        void virtio_disk_rw( long start_block, long block_count,
-        dev::BufferDescriptor *buf_list, int buf_count, bool write );
-        void free_desc( int i );
-        void free_chain( int i );
-        int	alloc3_desc( int *idx );
-        int	alloc_desc();
 
         // PCI中断相关标志
         static constexpr uint8 VIRTIO_PCI_ISR_INTR = 0x1;    // 数据中断
         static constexpr uint8 VIRTIO_PCI_ISR_CONFIG = 0x2;  // 配置改变中断
 
+      protected:
+        virtual void _notify() override { virtio_pci_set_queue_notify( &virtio_blk_hw, 0 ); }
+        // 读 ISR 即应答中断
+        virtual void _ack_intr() override { virtio_pci_clear_isr( &virtio_blk_hw ); }
+        virtual uint64 _dma_addr( uint64 va ) override { return virt_to_phy_address( va ); }
+
       public:
-        virtual long get_block_size() override { return (long) _block_size; }
-        virtual int  read_blocks_sync( long start_block, long block_count,
-                      dev::BufferDescriptor *buf_list, int buf_count ) override;
-        virtual int read_blocks( long start_block, long block_count, dev::BufferDescriptor *buf_list,
-                    int buf_count ) override;
-        virtual int write_blocks_sync( long start_block, long block_count,
-                      dev::BufferDescriptor *buf_list, int buf_count ) override;
-        virtual int write_blocks( long start_block, long block_count,
-                    dev::BufferDescriptor *buf_list, int buf_count ) override;
-        virtual int handle_intr() override;
+        virtual int wait_request( dev::BlockRequest *req ) override;
 
 		    virtual bool read_ready() override {
           // 检查设备状态
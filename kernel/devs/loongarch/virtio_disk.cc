@@ -124,20 +124,10 @@ namespace loongarch
       if ( qsize == 0 ) panic( "virtio disk has no queue 0" );
       if ( qsize < NUM ) panic( "virtio disk max queue too short" );
 
-      memset( disk.pages, 0, sizeof( disk.pages ) );
-
       // Setup the queue
       virtio_pci_set_queue_size(&virtio_blk_hw, 0, NUM);
 
-      // desc = pages -- num * VRingDesc
-      // avail = pages + 0x40 -- 2 * uint16, then num * uint16
-      // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
-
-      disk.desc  = (VRingDesc *) disk.pages;
-      disk.avail = (uint16 *) ( ( (char *) disk.desc ) + NUM * sizeof( VRingDesc ) );
-      disk.used  = (UsedArea *) ( disk.pages + PGSIZE );
-
-      for ( int i = 0; i < NUM; i++ ) disk.free[i] = 1;
+      _init_queue();
 
       virtio_pci_set_queue_addr(&virtio_blk_hw, 0, disk.desc, disk.avail, disk.used);
 
@@ -163,199 +153,25 @@ namespace loongarch
       dev::k_devm.register_block_device( this, _dev_name );
     }
 
-    // find a free descriptor, mark it non-free, return its index.
-    int VirtioDriver::alloc_desc()
-    {
-      for(int i = 0; i < NUM; i++){
-        if(disk.free[i]){
-          disk.free[i] = 0;
-          return i;
-        }
-      }
-      return -1;
-    }
-
-    // mark a descriptor as free.
-    void VirtioDriver::free_desc(int i)
-    {
-      if(i >= NUM)
-        panic("virtio_disk_intr 1");
-      if(disk.free[i])
-        panic("virtio_disk_intr 2");
-      disk.desc[i].addr = 0;
-      disk.free[i] = 1;
-      proc::k_pm.wakeup(&disk.free[0]);
-    }
-
-    // free a chain of descriptors.
-    void VirtioDriver::free_chain(int i)
-    {
-      while(1){
-        free_desc(i);
-        if(disk.desc[i].flags & VRING_DESC_F_NEXT)
-          i = disk.desc[i].next;
-        else
-          break;
-      }
-    }
-
-    int VirtioDriver::alloc3_desc(int *idx)
+    // PCI 中断并不总能送达，这里轮询 ISR 自行推进完成队列，
+    // 顺带把别人的请求也一并回收
+    int VirtioDriver::wait_request( dev::BlockRequest *req )
     {
-      for(int i = 0; i < 3; i++){
-        idx[i] = alloc_desc();
-        if(idx[i] < 0){
-          for(int j = 0; j < i; j++)
-            free_desc(idx[j]);
-          return -1;
-        }
-      }
-      return 0;
-    }
-
-    void VirtioDriver::virtio_disk_rw( long start_block, long block_count,
-      dev::BufferDescriptor *buf_list, int buf_count, bool write )
-    {
-      if(buf_count > 1)
-        panic( "buf_count > 1 not implement" );
       disk.vdisk_lock.acquire();
-
-      // the spec says that legacy block operations use three
-      // descriptors: one for type/reserved/sector, one for
-      // the data, one for a 1-byte status result.
-
-      int idx[3];
-      while(1){
-        if(alloc3_desc(idx) == 0) {
-          break;
+      while ( !req->done )
+      {
+        dev::BlockRequest *cb = _complete();
+        if ( cb )
+        {
+          disk.vdisk_lock.release();
+          _run_callbacks( cb );
+          disk.vdisk_lock.acquire();
         }
-        proc::k_pm.sleep(&disk.free[0], &disk.vdisk_lock);
       }
-      
-      struct virtio_blk_outhdr {
-        uint32 type;
-        uint32 reserved;
-        uint64 sector;
-      } buf0;
-      
-      buf0.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
-      buf0.reserved = 0;
-      buf0.sector = start_block;
-      
-      // 设置请求头描述符
-      disk.desc[idx[0]].addr = mem::k_pagetable.kwalk_addr((uint64) &buf0);
-      // disk.desc[idx[0]].addr = (uint64)&buf0;
-      // hsai_printf( "%p %p aa\n", &buf0, disk.desc[idx[0]].addr );
-      disk.desc[idx[0]].len	  = sizeof( buf0 );
-      disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-      // hsai_printf( "%p %p dqqq\n", idx[1], disk.desc[idx[0]].addr );
-      disk.desc[idx[0]].next = idx[1];
-      
-      // 设置数据描述符
-      // hsai_printf( "asasa: %d\n", ((uint32 *) (buf_list[0].buf_addr))[0] );
-      disk.desc[idx[1]].addr	   = virt_to_phy_address( buf_list[0].buf_addr );
-      // disk.desc[idx[1]].addr	  = buf_list[0].buf_addr;
-      disk.desc[idx[1]].len		  = _block_size * block_count;
-      disk.desc[idx[1]].flags	 = write ? 0 : VRING_DESC_F_WRITE;
-      disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-      disk.desc[idx[1]].next = idx[2];
-      
-      // 设置状态描述符
-      disk.info[idx[0]].status = 0; // 设置为未完成状态
-      disk.desc[idx[2]].addr   = virt_to_phy_address( (uint64) &disk.info[idx[0]].status );
-      // disk.desc[idx[2]].addr   = (uint64)&disk.info[idx[0]].status;
-      disk.desc[idx[2]].len	   = 1;
-      disk.desc[idx[2]].flags = VRING_DESC_F_WRITE;
-      disk.desc[idx[2]].next = 0;
-      
-      // 记录请求信息
-      disk.info[idx[0]].b = buf_list;
-      // hsai_printf( "buf_list:%p\n", buf_list );
-      disk.info[idx[0]].wait = true;
-
-	    // 通知设备
-      disk.avail[2 + (disk.avail[1] % NUM)] = idx[0];
-      __sync_synchronize();
-      disk.avail[1]++;
-      
-      // PCI方式通知队列
-      virtio_pci_set_queue_notify(&virtio_blk_hw, 0);
-
-	    // 等待操作完成
-      // while(disk.info[idx[0]].wait) {
-      //   if(dev::get_cur_proc())
-      //     dev::sleep_at(buf_list, disk.vdisk_lock);
-      // }
-      // hsai_printf("dafafa:%d\n",virtio_pci_clear_isr(&virtio_blk_hw));
-      // volatile uint16 *pt_used_idx = &disk.used_idx;
-      // volatile uint16 *pt_idx = &disk.used->id;
-      // //     wait cmd done
-      // while ( *pt_used_idx == *pt_idx );
-	    while ( !virtio_pci_clear_isr( &virtio_blk_hw ) );
-	    int id = disk.used->elems[disk.used_idx].id;
-
-	  if ( disk.info[id].status != 0 ) panic( "virtio_disk_intr status" );
-      disk.used_idx		   = ( disk.used_idx + 1 ) % NUM;
-      disk.info[idx[0]].wait = false;
-    // 等待操作完成
-      // while(disk.info[idx[0]].wait) {
-      //   if(dev::get_cur_proc())
-      //     dev::sleep_at(buf_list, disk.vdisk_lock);
-      // }
-
-      disk.info[idx[0]].b = 0; // disk is done with buf
-
-      free_chain( idx[0] );
       disk.vdisk_lock.release();
+      return req->status;
     }
 
-    int	VirtioDriver::read_blocks_sync( long start_block, long block_count, dev::BufferDescriptor *buf_list,
-        int buf_count )
-    {
-      virtio_disk_rw(start_block, block_count, buf_list, buf_count, 0);
-      return 0;
-    }
-    int	VirtioDriver::read_blocks( long start_block, long block_count,
-      dev::BufferDescriptor *buf_list, int buf_count )
-    {
-      panic( "not implement" );
-      while ( 1 );
-    }
-    int	VirtioDriver::write_blocks_sync( long start_block, long block_count,
-      dev::BufferDescriptor *buf_list, int buf_count ) 
-    {
-      virtio_disk_rw(start_block, block_count, buf_list, buf_count, 1);
-      return 0;
-    }
-    int	VirtioDriver::write_blocks( long start_block, long block_count,
-      dev::BufferDescriptor *buf_list, int buf_count )
-    {
-      panic( "not implement" );
-      while ( 1 );
-    }
-
-    int VirtioDriver::handle_intr()
-    {
-      disk.vdisk_lock.acquire();
-
-      // Read ISR to acknowledge the interrupt
-      virtio_pci_clear_isr(&virtio_blk_hw);
-      __sync_synchronize();
-
-      while((disk.used_idx % NUM) != (disk.used->id % NUM)){
-        int id = disk.used->elems[disk.used_idx].id;
-
-        if(disk.info[id].status != 0)
-            panic("virtio_disk_intr status");
-
-        disk.info[id].wait = false;   // disk is done with buf
-        proc::k_pm.wakeup(disk.info[id].b);
-
-        disk.used_idx = (disk.used_idx + 1) % NUM;
-      }
-
-      disk.vdisk_lock.release();
-      return 0;
-    }
 	} // namespace qemu
 
 } // namespace loongarch
\ No newline at end of file
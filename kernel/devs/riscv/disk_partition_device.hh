@@ -17,6 +17,16 @@ namespace dev
 	{
 	private:
 
+		static void _forward_done( BlockRequest * sub )
+		{
+			BlockRequest *req = (BlockRequest *) sub->private_data;
+			req->status = sub->status;
+			req->lower	= nullptr;
+			delete sub;
+			req->done = true;
+			req->callback( req );
+		}
+
 		BlockDevice *	_dev	   = nullptr;
 		long			_start_lba = 0;
 		const char *	_part_name = nullptr;
@@ -82,6 +92,46 @@ namespace dev
 			else
 				return -1;
 		};
+		/// @brief 换算起始块后转发。调用者的请求不改动：另建一个请求交给底层设备，
+		/// 有回调的在底层完成时转交结果，无回调的由 wait_request 等底层请求完成
+		virtual int submit_request( BlockRequest * req ) override
+		{
+			if ( _dev == nullptr ) return -1;
+			BlockRequest *sub = new BlockRequest;
+			sub->start_block  = _start_lba + req->start_block;
+			sub->block_count  = req->block_count;
+			sub->buf_list	  = req->buf_list;
+			sub->buf_count	  = req->buf_count;
+			sub->write		  = req->write;
+			if ( req->callback )
+			{
+				sub->callback	  = _forward_done;
+				sub->private_data = req;
+			}
+			req->done	= false;
+			req->status = 0;
+			req->lower	= sub;
+			// 有回调时 sub 可能在返回前就已完成并连同 req 一起被释放，之后不能再访问
+			int rc = _dev->submit_request( sub );
+			if ( rc < 0 )
+			{
+				req->lower = nullptr;
+				delete sub;
+			}
+			return rc;
+		};
+		virtual int wait_request( BlockRequest * req ) override
+		{
+			BlockRequest *sub = req->lower;
+			if ( _dev == nullptr ) return -1;
+			if ( sub == nullptr ) return req->status;
+			int rc		= _dev->wait_request( sub );
+			req->status = sub->status;
+			req->lower	= nullptr;
+			req->done	= true;
+			delete sub;
+			return rc;
+		};
 		virtual bool read_ready() override
 		{
 			if ( _dev )
@@ -2,6 +2,7 @@
 
 #include "spinlock.hh"
 #include "cpu.hh"
+#include "smp.hh"
 #include "printer.hh"
 
 
@@ -18,8 +19,9 @@
 
 	void SpinLock::acquire()
 	{
+		// 先关中断再取当前核，否则取到之后可能被调度到别的核上
+		Cpu::push_intr_off();
 		Cpu * cpu = Cpu::get_cpu();
-		cpu->push_intr_off();
 
 		if ( is_held() )
 			panic( "lock is already held." );
@@ -28,7 +30,11 @@
 
 		Cpu * expected = nullptr;
 		while ( _locked.compare_exchange_strong( expected, cpu, eastl::memory_order_acq_rel ) == false )
+		{
 			expected = nullptr;
+			// 持锁的核可能正关着中断等我们响应 TLB 击落
+			k_smp.poll();
+		}
 	}
 
 	void SpinLock::release()
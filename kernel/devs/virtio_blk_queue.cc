@@ -0,0 +1,370 @@
+#include "virtio_blk_queue.hh"
+#include "printer.hh"
+#include "klib.hh"
+#include "proc_manager.hh"
+#include "cpu.hh"
+
+namespace dev
+{
+	void VirtioBlkQueue::_init_queue()
+	{
+		memset( disk.pages, 0, sizeof( disk.pages ) );
+
+		// desc = pages -- num * VRingDesc
+		// avail = pages + 0x40 -- 2 * uint16, then num * uint16
+		// used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
+
+		disk.desc  = (VRingDesc *) disk.pages;
+		disk.avail = (uint16 *) ( ( (char *) disk.desc ) + NUM * sizeof( VRingDesc ) );
+		disk.used  = (UsedArea *) ( disk.pages + PGSIZE );
+
+		for ( int i = 0; i < NUM; i++ )
+		{
+			disk.free[i] = 1;
+			disk.info[i].req = nullptr;
+		}
+		disk.nfree = NUM;
+		disk.used_idx = 0;
+		disk.pend_head = disk.pend_tail = nullptr;
+	}
+
+	// find a free descriptor, mark it non-free, return its index.
+	int VirtioBlkQueue::alloc_desc()
+	{
+		for ( int i = 0; i < NUM; i++ )
+		{
+			if ( disk.free[i] )
+			{
+				disk.free[i] = 0;
+				disk.nfree--;
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	// mark a descriptor as free.
+	void VirtioBlkQueue::free_desc( int i )
+	{
+		if ( i >= NUM )
+			panic( "virtio_disk_intr 1" );
+		if ( disk.free[i] )
+			panic( "virtio_disk_intr 2" );
+		disk.desc[i].addr = 0;
+		disk.free[i] = 1;
+		disk.nfree++;
+	}
+
+	// free a chain of descriptors.
+	void VirtioBlkQueue::free_chain( int i )
+	{
+		while ( 1 )
+		{
+			int flags = disk.desc[i].flags;
+			int next = disk.desc[i].next;
+			free_desc( i );
+			if ( flags & VRING_DESC_F_NEXT )
+				i = next;
+			else
+				break;
+		}
+	}
+
+	// 一次拿到 n 个描述符，不够则一个也不拿
+	int VirtioBlkQueue::alloc_descs( int n, int *idx )
+	{
+		if ( disk.nfree < n )
+			return -1;
+		for ( int i = 0; i < n; i++ )
+			idx[i] = alloc_desc();
+		return 0;
+	}
+
+	// 一个请求实际用到的数据段数：超出 block_count 的缓冲区不下发
+	int VirtioBlkQueue::_req_segs( BlockRequest *req )
+	{
+		long remain = req->block_count * _block_size;
+		int n = 0;
+		for ( int b = 0; b < req->buf_count && remain > 0; b++, n++ )
+			remain -= ( req->buf_count == 1 ) ? remain : (long) req->buf_list[b].buf_size;
+		return n;
+	}
+
+	int VirtioBlkQueue::_chain_segs( BlockRequest *head )
+	{
+		int n = 0;
+		for ( BlockRequest *m = head; m; m = m->merge_next )
+			n += _req_segs( m );
+		return n;
+	}
+
+	// 新请求紧接在等待队列尾部请求之后（同向、LBA 相邻）时，直接并入同一个硬件请求
+	bool VirtioBlkQueue::_try_merge( BlockRequest *req )
+	{
+		BlockRequest *tail = disk.pend_tail;
+		if ( tail == nullptr || tail->write != req->write )
+			return false;
+		BlockRequest *last = tail;
+		long end = tail->start_block + tail->block_count;
+		while ( last->merge_next )
+		{
+			last = last->merge_next;
+			end = last->start_block + last->block_count;
+		}
+		if ( end != req->start_block )
+			return false;
+		if ( _chain_segs( tail ) + _req_segs( req ) > VIRTIO_BLK_MAX_SEGS )
+			return false;
+		last->merge_next = req;
+		return true;
+	}
+
+	// 把一条（可能合并过的）请求链写入描述符并放进 avail 环，调用者负责通知设备
+	void VirtioBlkQueue::_start_chain( BlockRequest *head, int *idx )
+	{
+		// the spec says that legacy block operations use three
+		// descriptors: one for type/reserved/sector, one or more for
+		// the data, one for a 1-byte status result.
+		int d0 = idx[0];
+		disk.info[d0].req = head;
+		disk.info[d0].status = 0xff; // 设备完成后写 0
+		disk.info[d0].hdr.type = head->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+		disk.info[d0].hdr.reserved = 0;
+		disk.info[d0].hdr.sector = head->start_block;
+
+		// 设置请求头描述符
+		disk.desc[d0].addr  = _dma_addr( (uint64) &disk.info[d0].hdr );
+		disk.desc[d0].len   = sizeof( disk.info[d0].hdr );
+		disk.desc[d0].flags = VRING_DESC_F_NEXT;
+		disk.desc[d0].next  = idx[1];
+
+		// 设置数据描述符：合并链上每个请求的每个缓冲区各占一个
+		int k = 1;
+		for ( BlockRequest *m = head; m; m = m->merge_next )
+		{
+			long remain = m->block_count * _block_size;
+			for ( int b = 0; b < m->buf_count && remain > 0; b++, k++ )
+			{
+				long len = ( m->buf_count == 1 || (long) m->buf_list[b].buf_size > remain )
+							   ? remain
+							   : (long) m->buf_list[b].buf_size;
+				disk.desc[idx[k]].addr  = _dma_addr( m->buf_list[b].buf_addr );
+				disk.desc[idx[k]].len   = (uint32) len;
+				disk.desc[idx[k]].flags = ( head->write ? 0 : VRING_DESC_F_WRITE ) | VRING_DESC_F_NEXT;
+				disk.desc[idx[k]].next  = idx[k + 1];
+				remain -= len;
+			}
+		}
+
+		// 设置状态描述符
+		disk.desc[idx[k]].addr  = _dma_addr( (uint64) &disk.info[d0].status );
+		disk.desc[idx[k]].len   = 1;
+		disk.desc[idx[k]].flags = VRING_DESC_F_WRITE;
+		disk.desc[idx[k]].next  = 0;
+
+		disk.avail[2 + ( disk.avail[1] % NUM )] = d0;
+		__sync_synchronize();
+		disk.avail[1]++;
+	}
+
+	// 尽可能多地下发等待中的请求，最后只通知设备一次
+	void VirtioBlkQueue::_kick()
+	{
+		int idx[VIRTIO_BLK_MAX_SEGS + 2];
+		bool issued = false;
+		while ( disk.pend_head )
+		{
+			BlockRequest *r = disk.pend_head;
+			if ( alloc_descs( _chain_segs( r ) + 2, idx ) < 0 )
+				break;
+			disk.pend_head = r->next;
+			if ( disk.pend_head == nullptr )
+				disk.pend_tail = nullptr;
+			r->next = nullptr;
+			_start_chain( r, idx );
+			issued = true;
+		}
+		if ( issued )
+		{
+			__sync_synchronize();
+			_notify();
+		}
+	}
+
+	// 回收 used 环上已完成的请求。无回调的请求就地置完成并唤醒等待者
+	// （等待者随时可能返回并释放请求，之后不能再访问它）；
+	// 有回调的请求串成链返回，由调用者在释放锁后执行回调
+	BlockRequest *VirtioBlkQueue::_reap_used()
+	{
+		BlockRequest *cb_head = nullptr;
+		BlockRequest **cb_tail = &cb_head;
+
+		while ( ( disk.used_idx % NUM ) != ( disk.used->id % NUM ) )
+		{
+			__sync_synchronize();
+			int id = disk.used->elems[disk.used_idx % NUM].id;
+			BlockRequest *m = disk.info[id].req;
+			int status = disk.info[id].status == 0 ? 0 : -1;
+			if ( status != 0 )
+				printfRed( "[virtio] request at sector %d failed, status %d\n",
+						   disk.info[id].hdr.sector, disk.info[id].status );
+			disk.info[id].req = nullptr;
+			free_chain( id );
+			disk.used_idx = ( disk.used_idx + 1 ) % NUM;
+
+			while ( m )
+			{
+				BlockRequest *next = m->merge_next;
+				m->merge_next = nullptr;
+				m->status = status;
+				if ( m->callback )
+				{
+					*cb_tail = m;
+					cb_tail = &m->next;
+					*cb_tail = nullptr;
+					m->done = true;
+				}
+				else
+				{
+					m->done = true;
+					proc::k_pm.wakeup( m );
+				}
+				m = next;
+			}
+		}
+		return cb_head;
+	}
+
+	BlockRequest *VirtioBlkQueue::_complete()
+	{
+		_ack_intr();
+		__sync_synchronize();
+
+		BlockRequest *cb = _reap_used();
+		// 完成的请求腾出了描述符，继续下发排队中的请求
+		_kick();
+		return cb;
+	}
+
+	void VirtioBlkQueue::_run_callbacks( BlockRequest *list )
+	{
+		while ( list )
+		{
+			BlockRequest *next = list->next; // 回调可能释放请求
+			list->callback( list );
+			list = next;
+		}
+	}
+
+	int VirtioBlkQueue::submit_request( BlockRequest *req )
+	{
+		if ( req->buf_count <= 0 || req->block_count <= 0 ||
+			 _req_segs( req ) > VIRTIO_BLK_MAX_SEGS )
+			return -1;
+		req->done = false;
+		req->status = 0;
+		req->next = nullptr;
+		req->merge_next = nullptr;
+
+		disk.vdisk_lock.acquire();
+		if ( !_try_merge( req ) )
+		{
+			if ( disk.pend_tail )
+				disk.pend_tail->next = req;
+			else
+				disk.pend_head = req;
+			disk.pend_tail = req;
+		}
+		_kick();
+		disk.vdisk_lock.release();
+		return 0;
+	}
+
+	int VirtioBlkQueue::wait_request( BlockRequest *req )
+	{
+		disk.vdisk_lock.acquire();
+		// 等待操作完成
+		while ( !req->done )
+		{
+			if ( Cpu::get_cpu()->get_cur_proc() )
+				proc::k_pm.sleep( req, &disk.vdisk_lock );
+			else
+			{
+				disk.vdisk_lock.release();
+#ifdef RISCV
+				asm( "wfi" );
+#elif defined( LOONGARCH )
+				asm( "idle 0" );
+#endif
+				disk.vdisk_lock.acquire();
+			}
+		}
+		disk.vdisk_lock.release();
+		return req->status;
+	}
+
+	int VirtioBlkQueue::virtio_disk_rw( long start_block, long block_count,
+										BufferDescriptor *buf_list, int buf_count, bool write )
+	{
+		BlockRequest req;
+		req.start_block = start_block;
+		req.block_count = block_count;
+		req.buf_list = buf_list;
+		req.buf_count = buf_count;
+		req.write = write;
+		if ( submit_request( &req ) < 0 )
+			return -1;
+		return wait_request( &req );
+	}
+
+	// read_blocks/write_blocks 只负责发出请求，不关心完成；请求在完成时自行释放。
+	// 需要完成通知的调用者应直接使用 submit_request。
+	int VirtioBlkQueue::_submit_async( long start_block, long block_count,
+									   BufferDescriptor *buf_list, int buf_count, bool write )
+	{
+		BlockRequest *req = new BlockRequest;
+		req->start_block = start_block;
+		req->block_count = block_count;
+		req->buf_list = buf_list;
+		req->buf_count = buf_count;
+		req->write = write;
+		req->callback = []( BlockRequest *r ) { delete r; };
+		if ( submit_request( req ) < 0 )
+		{
+			delete req;
+			return -1;
+		}
+		return 0;
+	}
+
+	int VirtioBlkQueue::read_blocks_sync( long start_block, long block_count,
+										  BufferDescriptor *buf_list, int buf_count )
+	{
+		return virtio_disk_rw( start_block, block_count, buf_list, buf_count, false );
+	}
+	int VirtioBlkQueue::read_blocks( long start_block, long block_count,
+									 BufferDescriptor *buf_list, int buf_count )
+	{
+		return _submit_async( start_block, block_count, buf_list, buf_count, false );
+	}
+	int VirtioBlkQueue::write_blocks_sync( long start_block, long block_count,
+										   BufferDescriptor *buf_list, int buf_count )
+	{
+		return virtio_disk_rw( start_block, block_count, buf_list, buf_count, true );
+	}
+	int VirtioBlkQueue::write_blocks( long start_block, long block_count,
+									  BufferDescriptor *buf_list, int buf_count )
+	{
+		return _submit_async( start_block, block_count, buf_list, buf_count, true );
+	}
+
+	int VirtioBlkQueue::handle_intr()
+	{
+		disk.vdisk_lock.acquire();
+		BlockRequest *cb = _complete();
+		disk.vdisk_lock.release();
+		_run_callbacks( cb );
+		return 0;
+	}
+
+} // namespace dev
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <block_device.hh>
+#include "spinlock.hh"
+#include "platform.hh"
+#include <types.hh>
+
+// this many virtio descriptors.
+// must be a power of two.
+// 128 个描述符时 desc + avail 仍放得进第一页，used 环在第二页
+#define NUM 128
+// 单个硬件请求最多携带的数据段数（合并后），其余描述符留给其它在途请求
+#define VIRTIO_BLK_MAX_SEGS 32
+
+#define VRING_DESC_F_NEXT 1	 // chained with another descriptor
+#define VRING_DESC_F_WRITE 2 // device writes (vs read)
+
+// for disk ops
+#define VIRTIO_BLK_T_IN 0  // read the disk
+#define VIRTIO_BLK_T_OUT 1 // write the disk
+
+namespace dev
+{
+	/// @brief virtio-blk 的请求队列：描述符环、在途请求、等待队列与合并、完成回收。
+	/// 与传输方式无关，MMIO（riscv）和 PCI（loongarch）驱动都从这里派生，
+	/// 只需负责设备初始化、通知设备、应答中断和 DMA 地址转换
+	class VirtioBlkQueue : public BlockDevice
+	{
+	public:
+		struct VRingDesc
+		{
+			uint64 addr;
+			uint32 len;
+			uint16 flags;
+			uint16 next;
+		};
+
+		struct VRingUsedElem
+		{
+			uint32 id; // index of start of completed descriptor chain
+			uint32 len;
+		};
+
+		struct UsedArea
+		{
+			uint16 flags;
+			uint16 id;
+			struct VRingUsedElem elems[NUM];
+		};
+
+		static constexpr int _block_size = 512;
+
+	protected:
+		struct Disk
+		{
+			// memory for virtio descriptors &c for queue 0.
+			// this is a global instead of allocated because it must
+			// be multiple contiguous pages, which kalloc()
+			// doesn't support, and page aligned.
+			char pages[2 * PGSIZE];
+			struct VRingDesc *desc;
+			uint16 *avail;
+			struct UsedArea *used;
+
+			// our own book-keeping.
+			char free[NUM];	 // is a descriptor free?
+			int nfree;		 // 空闲描述符个数
+			uint16 used_idx; // we've looked this far in used[2..NUM].
+
+			// track info about in-flight operations,
+			// for use when completion interrupt arrives.
+			// indexed by first descriptor index of chain.
+			struct
+			{
+				BlockRequest *req; // 合并链的首个请求
+				volatile uint8 status;
+				struct virtio_blk_outhdr
+				{
+					uint32 type;
+					uint32 reserved;
+					uint64 sector;
+				} hdr;
+			} info[NUM];
+
+			// 描述符不够时排队等待下发的请求，尾部可与新请求合并
+			BlockRequest *pend_head;
+			BlockRequest *pend_tail;
+
+			SpinLock vdisk_lock;
+
+		} __attribute__( ( aligned( PGSIZE ) ) ) disk;
+
+		/// @brief 清空描述符环并划分 desc/avail/used，设备初始化时在告诉设备环地址之前调用
+		void _init_queue();
+
+		/// @brief 通知设备 avail 环上有新请求
+		virtual void _notify() = 0;
+		/// @brief 应答（清除）设备的中断状态，持有 vdisk_lock 时调用
+		virtual void _ack_intr() = 0;
+		/// @brief 内核虚拟地址 -> 设备可见的 DMA 地址
+		virtual uint64 _dma_addr( uint64 va ) = 0;
+
+		/// @brief 应答中断、回收完成的请求并继续下发排队中的请求；
+		/// 回调请求串成链返回，调用者须在放掉 vdisk_lock 之后交给 _run_callbacks
+		BlockRequest *_complete();
+		void _run_callbacks( BlockRequest *list );
+
+	private:
+		int virtio_disk_rw( long start_block, long block_count,
+							BufferDescriptor *buf_list, int buf_count, bool write );
+		void free_desc( int i );
+		void free_chain( int i );
+		int alloc_descs( int n, int *idx );
+		int alloc_desc();
+
+		int _req_segs( BlockRequest *req );
+		int _chain_segs( BlockRequest *head );
+		bool _try_merge( BlockRequest *req );
+		void _start_chain( BlockRequest *head, int *idx );
+		void _kick();
+		BlockRequest *_reap_used();
+		int _submit_async( long start_block, long block_count,
+						   BufferDescriptor *buf_list, int buf_count, bool write );
+
+	public:
+		VirtioBlkQueue() = default;
+		virtual ~VirtioBlkQueue() = default;
+
+		virtual long get_block_size() override { return (long) _block_size; }
+		virtual int read_blocks_sync( long start_block, long block_count,
+									  BufferDescriptor *buf_list, int buf_count ) override;
+		virtual int read_blocks( long start_block, long block_count, BufferDescriptor *buf_list,
+								 int buf_count ) override;
+		virtual int write_blocks_sync( long start_block, long block_count,
+									   BufferDescriptor *buf_list, int buf_count ) override;
+		virtual int write_blocks( long start_block, long block_count,
+								  BufferDescriptor *buf_list, int buf_count ) override;
+		virtual int handle_intr() override;
+		virtual int submit_request( BlockRequest *req ) override;
+		/// @brief 睡眠等待中断把请求置完成；中断送达不可靠的设备覆盖为轮询
+		virtual int wait_request( BlockRequest *req ) override;
+	};
+
+} // namespace dev
@@ -9,11 +9,25 @@
 #include "fs/ext4/ext4_buffer.hh"
 #include "fs/ext4/ext4_fs.hh"
 #include "fs/vfs/buffer_manager.hh"
+#include "devs/device_manager.hh"
+#include "devs/block_device.hh"
+#include "heap_memory_manager.hh"
+#include "proc/proc_manager.hh"
 #include "printer.hh"
 namespace fs
 {
 	namespace ext4
 	{
+		/// @brief 一次异步预读：物理连续的若干块合成一个块设备请求，每块一个数据段
+		struct Ext4ReadaheadReq
+		{
+			dev::BlockRequest req;
+			Ext4BufferPool * pool = nullptr;
+			int nbuf = 0;
+			Ext4Buffer * bufs[ ext4_readahead_batch ];
+			dev::BufferDescriptor descs[ ext4_readahead_batch ];
+		};
+
 		Ext4Buffer::Ext4Buffer( long buf_size )
 			: Ext4Buffer()
 		{
@@ -34,28 +48,48 @@ namespace fs
 			_list_head._prev = &_list_head;
 			_belong_fs = fs;
 
+			// 容量按当前空闲堆内存估算
+			long free_bytes = (long) mem::k_hmm.free_pages() * PGSIZE;
+			_max_count = free_bytes / ext4_buffer_pool_mem_div / block_size;
+			if ( _max_count < ext4_buffer_pool_default_count )
+				_max_count = ext4_buffer_pool_default_count;
+			if ( _max_count > ext4_buffer_pool_max_count )
+				_max_count = ext4_buffer_pool_max_count;
+
+			// 哈希桶数取不小于容量一半的 2 的幂
+			long hash_size = 64;
+			while ( hash_size < _max_count / 2 )
+				hash_size <<= 1;
+			_hash = new Ext4Buffer *[hash_size];
+			for ( long i = 0; i < hash_size; ++i )
+				_hash[i] = nullptr;
+			_hash_mask = hash_size - 1;
+
 			for ( long i = 0; i < ext4_buffer_pool_default_count; ++i )
 			{
 				Ext4Buffer * buf = new Ext4Buffer( block_size );
 				_insert_front( buf );
 			}
+			printfGreen( "[ext4] buffer pool: block size %d, up to %d buffers\n", block_size, _max_count );
 		}
 
 		Ext4Buffer * Ext4BufferPool::request_block( long block_no, bool pin )
 		{
-			Ext4Buffer * pbuf = _search_buffer( block_no );
-
-
 			_lock.acquire();
 
 			// Info( "ext4 buffer get bno %d", block_no );
 
+			Ext4Buffer * pbuf = _search_buffer( block_no );
+			while ( pbuf != nullptr && !pbuf->_flag.valid )
+			{
+				// 另一个进程正在从磁盘读这个块，等它读完；读失败时该 buffer 会被摘出哈希
+				proc::k_pm.sleep( pbuf, &_lock );
+				pbuf = _search_buffer( block_no );
+			}
 			if ( pbuf == nullptr )		// 没有缓存，需要重新分配并读取
 			{
 				// printfBlue( "ext4 buffer no cache block %ld", block_no );
 
-				// 分配一个新buffer
-
 				pbuf = _alloc_buffer();
 				if ( pbuf == nullptr )
 				{
@@ -64,24 +98,22 @@ namespace fs
 					return nullptr;
 				}
 
-				// 拷贝整个块到缓存
+				// 先以无效状态挂进哈希，并 pin 住防止读盘期间被换出
+				pbuf->_block_no = block_no;
+				pbuf->_flag.valid = 0;
+				pbuf->pin();
+				_hash_insert( pbuf );
 
+				_lock.release();
+				int rc = _fill_block( pbuf, block_no );
+				_lock.acquire();
 
-				long num_sector = _block_size / 512;
-				long block_lba = block_no * num_sector;
-				ulong buf_ptr = ( ulong ) pbuf->get_data_ptr();
-				for ( long i = 0; i < num_sector; ++i, buf_ptr += 512 )
+				_finish_load( pbuf, rc >= 0 );
+				if ( rc < 0 )
 				{
 					_lock.release();
-					Buffer buf = k_bufm.read_sync( _belong_fs->owned_device(), _belong_fs->start_lba() + block_lba + i );
-					
-					_lock.acquire();
-					buf.copy_data_to( ( void* ) buf_ptr );
-					k_bufm.release_buffer_sync( buf );
+					return nullptr;
 				}
-
-				pbuf->_flag.valid = 1;
-				pbuf->_block_no = block_no;
 			}
 			// else { printfBlue( "ext4 buffer hit block %ld", block_no ); }
 
@@ -97,12 +129,176 @@ namespace fs
 			return pbuf;
 		}
 
+		int Ext4BufferPool::_fill_block( Ext4Buffer * buf, long block_no )
+		{
+			// 整块一次读入：一个 virtio 请求覆盖块内全部扇区
+			dev::BlockDevice * bd = _block_device();
+			if ( bd == nullptr ) return -1;
+			long sec_size = bd->get_block_size();
+			long num_sector = _block_size / sec_size;
+			long block_lba = _belong_fs->start_lba() + block_no * num_sector;
+			dev::BufferDescriptor buf_des = { .buf_addr = (u64) buf->get_data_ptr(),
+											  .buf_size = (u32) _block_size };
+			return bd->read_blocks_sync( block_lba, num_sector, &buf_des, 1 );
+		}
+
+		dev::BlockDevice * Ext4BufferPool::_block_device()
+		{
+			int dev_num = _belong_fs->owned_device();
+			dev::BlockDevice * bd = (dev::BlockDevice *) dev::k_devm.get_device( (uint) dev_num );
+			if ( bd == nullptr )
+				printfRed( "ext4 buffer : no block device %d\n", dev_num );
+			return bd;
+		}
+
+		// 读盘结束：成功则置有效，失败则摘出哈希让等待者重新查找。调用时持有 _lock
+		void Ext4BufferPool::_finish_load( Ext4Buffer * buf, bool ok )
+		{
+			if ( ok )
+				buf->_flag.valid = 1;
+			else
+			{
+				_hash_remove( buf );
+				buf->_block_no = -1;
+			}
+			buf->unpin();
+			proc::k_pm.wakeup( buf );
+		}
+
+		void Ext4BufferPool::prefetch( long block_no, long count )
+		{
+			if ( count > _max_count / 2 ) count = _max_count / 2;
+			if ( count <= 0 ) return;
+			dev::BlockDevice * bd = _block_device();
+			if ( bd == nullptr ) return;
+			long num_sector = _block_size / bd->get_block_size();
+
+			long b = block_no, end = block_no + count;
+			_lock.acquire();
+			while ( b < end )
+			{
+				if ( _search_buffer( b ) != nullptr )	// 已缓存或正在读
+				{
+					b++;
+					continue;
+				}
+
+				// 收集一段连续的未缓存块
+				Ext4ReadaheadReq * ra = new Ext4ReadaheadReq;
+				ra->pool = this;
+				long start = b;
+				while ( b < end && ra->nbuf < ext4_readahead_batch && _search_buffer( b ) == nullptr )
+				{
+					Ext4Buffer * buf = _alloc_buffer();
+					if ( buf == nullptr ) break;
+					buf->_block_no = b;
+					buf->_flag.valid = 0;
+					buf->pin();
+					_hash_insert( buf );
+					// 放到 LRU 头部，免得同一批后续的分配把它换出
+					_remove( buf );
+					_insert_front( buf );
+
+					ra->bufs[ra->nbuf] = buf;
+					ra->descs[ra->nbuf] = { .buf_addr = (u64) buf->get_data_ptr(),
+											.buf_size = (u32) _block_size };
+					ra->nbuf++;
+					b++;
+				}
+				if ( ra->nbuf == 0 )					// 池中所有 buffer 都被 pin 住
+				{
+					delete ra;
+					break;
+				}
+
+				ra->req.start_block = _belong_fs->start_lba() + start * num_sector;
+				ra->req.block_count = ra->nbuf * num_sector;
+				ra->req.buf_list = ra->descs;
+				ra->req.buf_count = ra->nbuf;
+				ra->req.write = false;
+				ra->req.callback = _readahead_done;
+				ra->req.private_data = ra;
+
+				// 回调会获取 _lock（默认实现甚至在 submit 内同步回调），提交前必须放锁
+				_lock.release();
+				int rc = bd->submit_request( &ra->req );
+				_lock.acquire();
+				if ( rc < 0 )
+				{
+					for ( int i = 0; i < ra->nbuf; ++i )
+						_finish_load( ra->bufs[i], false );
+					delete ra;
+					break;
+				}
+			}
+			_lock.release();
+		}
+
+		void Ext4BufferPool::_readahead_done( dev::BlockRequest * req )
+		{
+			Ext4ReadaheadReq * ra = (Ext4ReadaheadReq *) req->private_data;
+			Ext4BufferPool * pool = ra->pool;
+			pool->_lock.acquire();
+			for ( int i = 0; i < ra->nbuf; ++i )
+				pool->_finish_load( ra->bufs[i], req->status == 0 );
+			pool->_lock.release();
+			delete ra;
+		}
+
+		long Ext4BufferPool::shrink( long nr )
+		{
+			_lock.acquire();
+			long n = _shrink_locked( nr );
+			_lock.release();
+			return n;
+		}
+
+		long Ext4BufferPool::_shrink_locked( long nr )
+		{
+			long freed = 0;
+			Ext4Buffer * p = _list_head._prev;
+			while ( p != &_list_head && freed < nr && _list_len > ext4_buffer_pool_default_count )
+			{
+				Ext4Buffer * prev = p->_prev;
+				if ( !p->is_pinned() )
+				{
+					if ( p->_flag.valid ) _hash_remove( p );
+					_remove( p );
+					delete p;
+					freed++;
+				}
+				p = prev;
+			}
+			return freed;
+		}
+
+		void Ext4BufferPool::_hash_insert( Ext4Buffer * buf )
+		{
+			long h = _hash_of( buf->_block_no );
+			buf->_hash_next = _hash[h];
+			_hash[h] = buf;
+		}
+
+		void Ext4BufferPool::_hash_remove( Ext4Buffer * buf )
+		{
+			Ext4Buffer ** pp = &_hash[_hash_of( buf->_block_no )];
+			for ( ; *pp != nullptr; pp = &( *pp )->_hash_next )
+			{
+				if ( *pp == buf )
+				{
+					*pp = buf->_hash_next;
+					buf->_hash_next = nullptr;
+					return;
+				}
+			}
+		}
+
 		Ext4Buffer * Ext4BufferPool::_search_buffer( long block_no )
 		{
-			Ext4Buffer * p = _list_head._next;
-			for ( ; p != &_list_head; p = p->_next )
+			Ext4Buffer * p = _hash[_hash_of( block_no )];
+			for ( ; p != nullptr; p = p->_hash_next )
 			{
-				if ( p->_flag.valid && p->_block_no == block_no )
+				if ( p->_block_no == block_no )
 				{
 					return p;
 				}
@@ -112,11 +308,27 @@ namespace fs
 
 		Ext4Buffer * Ext4BufferPool::_alloc_buffer()
 		{
+			bool low_mem = (long) mem::k_hmm.free_pages() < ext4_buffer_pool_low_pages;
+
+			// 内存充足且未达上限：新建一个 buffer
+			if ( !low_mem && _list_len < _max_count )
+			{
+				Ext4Buffer * buf = new Ext4Buffer( _block_size );
+				*( u8 * ) &buf->_flag = 0;
+				_insert_back( buf );
+				return buf;
+			}
+
+			// 内存紧张时先归还一批，再复用 LRU 尾部
+			if ( low_mem ) _shrink_locked( ext4_buffer_pool_shrink_batch );
+
 			Ext4Buffer * p = _list_head._prev;
 			for ( ; p != &_list_head; p = p->_prev )
 			{
-				if ( p->_flag.pinned == 0 )
+				if ( !p->is_pinned() )
 				{
+					if ( p->_flag.valid ) _hash_remove( p );
+					p->_flag.valid = 0;
 					return p;
 				}
 			}
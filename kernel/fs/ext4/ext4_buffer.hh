@@ -17,18 +17,24 @@
 
 #include "spinlock.hh"
 
+namespace dev
+{
+	struct BlockRequest;
+	class BlockDevice;
+}
+
 namespace fs
 {
 	namespace ext4
 	{
 		class Ext4BufferPool;
 		class Ext4FS;
+		struct Ext4ReadaheadReq;
 
 		struct Ext4BufferFlag
 		{
-			u8 pinned : 1;
 			u8 valid : 1;
-			u8 _rsv : 6;
+			u8 _rsv : 7;
 		}__attribute__( ( __packed__ ) );
 		static_assert( sizeof( Ext4BufferFlag ) == 1 );
 
@@ -38,9 +44,11 @@ namespace fs
 		private:
 			void * _data = nullptr;				// 动态分配空间，其大小与ext4初始化读出的块大小一致（通常为4KiB）
 			Ext4BufferFlag _flag;
+			eastl::atomic<int> _pin_cnt { 0 };	// 持有者个数，非零时不会被换出；unpin 可以不持池锁
 			long _block_no = -1;				// 在ext4中的块号
 			Ext4Buffer * _next = nullptr;
 			Ext4Buffer * _prev = nullptr;
+			Ext4Buffer * _hash_next = nullptr;	// 块号哈希链
 
 		public:
 			Ext4Buffer() = default;
@@ -48,17 +56,25 @@ namespace fs
 			~Ext4Buffer() { _delete_data(); }
 
 			void * get_data_ptr() const { return _data; }
-			bool is_pinned() const { return _flag.pinned; }
-			void pin() { _flag.pinned = 1; }
-			void unpin() { _flag.pinned = 0; }
+			bool is_pinned() const { return _pin_cnt.load() != 0; }
+			void pin() { _pin_cnt.fetch_add( 1 ); }
+			void unpin() { _pin_cnt.fetch_sub( 1 ); }
 
 		private:
 			void _new_data( long size ) { _data = ( void * ) new char[ size ]; }
 			void _delete_data() { delete[]( char* )_data; }
 		};
 
-		constexpr long ext4_buffer_pool_default_count = 32;
+		constexpr long ext4_buffer_pool_default_count = 32;		// 池容量下限，初始化时预分配
+		constexpr long ext4_buffer_pool_max_count = 16384;		// 池容量上限 (4KiB 块时 64MiB)
+		constexpr long ext4_buffer_pool_mem_div = 8;			// 最多使用初始化时空闲堆内存的 1/8
+		constexpr long ext4_buffer_pool_low_pages = 2048;		// 堆空闲页低于此值视为内存紧张 (8MiB)
+		constexpr long ext4_buffer_pool_shrink_batch = 16;		// 内存紧张时每次回收的 buffer 数
+		constexpr long ext4_readahead_batch = 16;				// 一个异步预读请求最多覆盖的块数
 
+		/// @brief ext4 块缓存：块号哈希索引 + LRU 链表。
+		/// 容量按空闲堆内存估算，按需增长；堆内存紧张时不再增长并主动释放 LRU 尾部。
+		/// 缺失时直接向块设备发一次多扇区读，数据落在本 buffer 中，不经过 BufferManager。
 		class Ext4BufferPool
 		{
 		private:
@@ -67,6 +83,9 @@ namespace fs
 			long _block_size = 0;
 			Ext4Buffer _list_head;
 			long _list_len = 0;
+			long _max_count = 0;
+			Ext4Buffer ** _hash = nullptr;
+			long _hash_mask = 0;
 			Ext4FS * _belong_fs = nullptr;
 
 		public:
@@ -75,6 +94,14 @@ namespace fs
 
 			Ext4Buffer * request_block( long block_no, bool pin = false );
 
+			/// @brief 异步预读 [block_no, block_no + count)。
+			/// 已缓存的块跳过，其余块以“读取中”状态挂进哈希后按连续段发出异步请求，立即返回；
+			/// 之后 request_block 命中读取中的块会等待其完成。一次最多预读池容量的一半。
+			void prefetch( long block_no, long count );
+
+			/// @brief 释放最多 nr 个未被 pin 的 buffer（从 LRU 尾部开始），返回实际释放的个数
+			long shrink( long nr );
+
 		private:
 			void _insert_front( Ext4Buffer * buf )
 			{
@@ -102,9 +129,18 @@ namespace fs
 				_list_len--;
 			}
 
+			long _hash_of( long block_no ) const { return ( block_no ^ ( block_no >> 12 ) ) & _hash_mask; }
+			void _hash_insert( Ext4Buffer * buf );
+			void _hash_remove( Ext4Buffer * buf );
+
 		private:
 			Ext4Buffer * _search_buffer( long block_no );
 			Ext4Buffer * _alloc_buffer();
+			long _shrink_locked( long nr );
+			int _fill_block( Ext4Buffer * buf, long block_no );
+			dev::BlockDevice * _block_device();
+			void _finish_load( Ext4Buffer * buf, bool ok );
+			static void _readahead_done( dev::BlockRequest * req );
 		};
 	} // namespace ext4
 
@@ -87,6 +87,7 @@ namespace fs
 			}
 
 			Ext4Buffer * read_block( long block_no, bool pin = false ) { return _blocks_cacher.request_block( block_no, pin ); }
+			void prefetch_blocks( long block_no, long count ) { _blocks_cacher.prefetch( block_no, count ); }
 
 			/// @brief 计算 inode 归属的块组
 			/// @param inode_no inode 号
@@ -363,6 +363,7 @@ namespace fs
 		{
 			_cal_blocks();
 			_cal_size();
+			_pcache.init( this );
 			//_attrs( 0777 );
 		}
 
@@ -410,8 +411,6 @@ namespace fs
 					if ( res_node != nullptr ) return res_node;
 
 					// 当前块内不包含目标目录项，准备读取下一个块
-
-					dirent_buf->unpin();
 				}
 				// 遍历所有块均不包含目录项
 			}
@@ -432,64 +431,191 @@ namespace fs
 			}
 			
 			fs::ramfs::RamFS *fs = static_cast< fs::ramfs::RamFS *>( root_->getNode()->getFS() );
-			fs::ramfs::Normal *new_node = new fs::ramfs::Normal( fs, fs->alloc_ino(), attrs );  // INode
-			
-			return new_node;
+			// ext4 驱动只读，新建的文件放在根 ramfs 上（tmpfs 式的内存文件）
+			return fs->getSuperBlock()->allocInode( attrs, dev_name );
 		}
 		size_t Ext4IndexNode::nodeRead( u64 dst, size_t off, size_t len )
 		{
-			// if ( !( _inode.mode & ext4_imode_freg ) )
-			// {
-			// 	printfYellow(
-			// 		"ext4-inode:\n"
-			// 		"\ttry to read inode that's not regular file\n"
-			// 		"\tnone to read out" );
-			// 	return 0;
-			// }
-						// printfMagenta("it is a ext4 node\n");
+			if ( off >= (size_t) _has_size ) return 0;
+			if ( len > (size_t) _has_size - off ) len = (size_t) _has_size - off;
+			// 普通读也经过页缓存，与 mmap、exec 映射的是同一份页
+			return _pcache.read( dst, off, len );
+		}
+
+		long Ext4IndexNode::readPage( void *pa, uint64 index )
+		{
+			size_t off = index * PGSIZE;
+			if ( off >= (size_t) _has_size ) return 0;
+			return _read_direct( (u64) pa, off, PGSIZE );
+		}
+
+		long Ext4IndexNode::_read_direct( u64 dst, size_t off, size_t len )
+		{
 			if ( off >= (size_t) _has_size ) return 0;
 
 			long   b_siz	= _belong_fs->rBlockSize(); // 块大小
 			size_t read_len =							// 需要读取的长度
 				( off + len <= (size_t) _has_size ) ? len : ( (size_t) _has_size - off );
 
-			u8	*d		  = (u8 *) dst;	 // 目标地址
-			long block_no = off / b_siz; // 起始数据块
-			long b_idx	  = 0;			 // 数据块索引
-			u8	*f;						 // 数据源地址
-			long b_off;					 // 块内偏移
+			u8	  *d	= (u8 *) dst; // 目标地址
+			size_t done = 0;
 
-			Ext4Buffer *blk_buf = read_logical_block( block_no, true );
-			if ( blk_buf == nullptr )
-			{
-				printfYellow( "ext4-inode : read logical block %d fail\n", block_no );
-				return 0;
-			}
-			f = (u8 *) blk_buf->get_data_ptr();
-			for ( size_t i = 0; i < read_len; i++ )
+			// 非 extent 文件仍逐块走间接索引
+			bool use_runs = _inode.flags.fl.extents && _load_runs();
+
+			while ( done < read_len )
 			{
-				b_off = ( off + i ) % b_siz;
-				if ( b_off == 0 )
+				long   block_no = ( off + done ) / b_siz;	// 当前逻辑块
+				long   b_off	= ( off + done ) % b_siz;	// 块内偏移
+				long   run_left = 1;
+				long   phy		= 0;
+
+				if ( use_runs ) phy = _map_block( block_no, run_left );
+
+				// 一次查找覆盖整段 run，逐块整段 memcpy
+				for ( ; run_left > 0 && done < read_len; --run_left, ++block_no, b_off = 0 )
 				{
-					if ( blk_buf != nullptr ) blk_buf->unpin(); // unpin the buffer last read
-					blk_buf = read_logical_block( block_no + b_idx,
-												  true ); // pin the buffer
+					size_t span = b_siz - b_off;
+					if ( span > read_len - done ) span = read_len - done;
+
+					if ( use_runs && phy == 0 ) // 空洞或未初始化 extent
+					{
+						memset( d + done, 0, span );
+						done += span;
+						continue;
+					}
+
+					Ext4Buffer *blk_buf = use_runs ? _belong_fs->read_block( phy++, true )
+												   : read_logical_block( block_no, true );
 					if ( blk_buf == nullptr )
 					{
-						printfYellow( "ext4-inode : read logical block %d fail\n", block_no + b_idx );
-						return 0;
+						printfYellow( "ext4-inode : read logical block %d fail\n", block_no );
+						return -1;
 					}
-					f = (u8 *) blk_buf->get_data_ptr();
-					b_idx++;
+					memcpy( d + done, (u8 *) blk_buf->get_data_ptr() + b_off, span );
+					blk_buf->unpin();
+					done += span;
 				}
-				d[i] = f[b_off];
 			}
 
-			if ( blk_buf != nullptr ) blk_buf->unpin();
-
 			return read_len;
 		}
 
+		void Ext4IndexNode::readahead( size_t off, size_t len )
+		{
+			if ( off >= (size_t) _has_size || len == 0 ) return;
+			// 只对 extent 文件预读，间接块文件需要逐块查索引，得不偿失
+			if ( !_inode.flags.fl.extents || !_load_runs() ) return;
+
+			long b_siz = _belong_fs->rBlockSize();
+			if ( len > (size_t) _has_size - off ) len = (size_t) _has_size - off;
+
+			// 开头已在页缓存里的页不必再读
+			while ( _pcache.cached( off / PGSIZE ) )
+			{
+				size_t step = PGSIZE - off % PGSIZE;
+				if ( step >= len ) return;
+				off += step;
+				len -= step;
+			}
+
+			long block = off / b_siz;
+			long last  = ( off + len - 1 ) / b_siz;
+
+			// 按 run 切分，每段物理连续的块交给块缓存一次性发出
+			while ( block <= last )
+			{
+				long run_left = 1;
+				long phy	  = _map_block( block, run_left );
+				long n		  = run_left < last - block + 1 ? run_left : last - block + 1;
+				if ( phy != 0 ) _belong_fs->prefetch_blocks( phy, n );
+				block += n;
+			}
+		}
+
+		bool Ext4IndexNode::_load_runs()
+		{
+			if ( _runs_valid ) return true;
+			_runs.clear();
+			if ( !_collect_runs( &_inode.blocks.extents.header, 0 ) )
+			{
+				_runs.clear();
+				return false;
+			}
+			_runs_valid = true;
+			return true;
+		}
+
+		bool Ext4IndexNode::_collect_runs( void *header, int level )
+		{
+			using ex_node = Ext4Inode::_block_u_t_::_extent_s_t_::_node_u_t_;
+
+			Ext4ExtentHeader *ex_header = (Ext4ExtentHeader *) header;
+			ex_node			 *nodes		= (ex_node *) ( ex_header + 1 ); // 节点数组紧跟在头部之后
+
+			if ( ex_header->magic != 0xF30A || level > 5 )
+			{
+				printfRed( "ext4-inode : bad extent header (magic=%x, level=%d)\n",
+						   ex_header->magic, level );
+				return false;
+			}
+
+			for ( int i = 0; i < ex_header->valid_nodes_count; ++i )
+			{
+				if ( ex_header->depth == 0 ) // 叶节点，依次追加即保持逻辑块号有序
+				{
+					Ext4ExtentLeafNode &leaf = nodes[i].leaf;
+					Ext4BlockRun		run;
+					run.lblk   = leaf.logical_block_start;
+					run.pblk   = leaf.start_lo + ( (long) leaf.start_hi << 32 );
+					run.len	   = leaf.length;
+					run.uninit = false;
+					if ( run.len > 32768 ) // 最高位表示未初始化
+					{
+						run.len	  -= 32768;
+						run.uninit = true;
+					}
+					_runs.push_back( run );
+				}
+				else // 中间节点，递归读取下一层
+				{
+					long		next_block = (uint64) nodes[i].internal.next_node_address;
+					Ext4Buffer *buf		   = _belong_fs->read_block( next_block, true );
+					if ( buf == nullptr ) return false;
+					bool ok = _collect_runs( buf->get_data_ptr(), level + 1 );
+					buf->unpin();
+					if ( !ok ) return false;
+				}
+			}
+			return true;
+		}
+
+		long Ext4IndexNode::_map_block( long block, long &run_left )
+		{
+			// 二分查找第一个 lblk > block 的 run，目标只可能在它前一个
+			long lo = 0, hi = (long) _runs.size();
+			while ( lo < hi )
+			{
+				long mid = ( lo + hi ) / 2;
+				if ( _runs[mid].lblk <= block )
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			if ( lo > 0 )
+			{
+				Ext4BlockRun &r = _runs[lo - 1];
+				if ( block < r.lblk + r.len )
+				{
+					run_left = r.lblk + r.len - block;
+					return r.uninit ? 0 : r.pblk + ( block - r.lblk );
+				}
+			}
+			// 空洞：延续到下一个 run 的起点
+			run_left = lo < (long) _runs.size() ? _runs[lo].lblk - block : ( 1L << 40 );
+			return 0;
+		}
+
 		size_t Ext4IndexNode::readSubDir( ubuf &dst, size_t off )
 		{
 			linux_dirent64 lxdir;
@@ -568,97 +694,24 @@ namespace fs
 		{
 			if ( _inode.flags.fl.extents ) // 使用extents方式索引
 			{
-				using ex_node = Ext4Inode::_block_u_t_::_extent_s_t_::_node_u_t_;
-
-				Ext4ExtentHeader *ex_header = &_inode.blocks.extents.header; // extent 头
-				ex_node			 *st, *ed; // (union) extent 中间节点或叶子节点
-				st = &( _inode.blocks.extents.tree_nodes[0] ); // 节点数组起始元素
-				ed = st + _inode.blocks.extents.header.valid_nodes_count - 1; // 节点数组末尾元素
-
-				Ext4Buffer *internal_block = nullptr; // exTree 中间块的 buffer
+				if ( !_load_runs() ) return nullptr;
 
-				// 叶节点二分查找比较函数
-				auto comp_leaf = []( Ext4ExtentLeafNode *mid, long *tar ) -> int
+				long run_left;
+				long phy_block = _map_block( block, run_left );
+				if ( phy_block == 0 ) // 空洞或未初始化 extent
 				{
-					long t = *tar;
-					long l = mid->logical_block_start, r = l + mid->length;
-					if ( l <= t && t < r )
-						return 0;
-					else if ( t < l )
-						return -1;
-					else
-						return 1;
-				};
-				// 中间节点二分查找比较函数
-				auto comp_intr = [&]( Ext4ExtentInternalNode *mid, long *tar ) -> int
-				{
-					long t = *tar;
-					if ( t < mid->logical_block_start ) return -1;
-					if ( mid != &( ed->internal ) && t >= ( mid + 1 )->logical_block_start )
-						return 1;
-					else
-						return 0;
-				};
-
-				while ( 1 ) // 查找 extent 树
-				{
-					if ( ex_header->depth == 0 ) // 已经到达叶节点
-					{
-						// 二分查找
-
-						Ext4ExtentLeafNode *dst_node =
-							binary_search<Ext4ExtentLeafNode, long>(
-								&( st->leaf ), &( ed->leaf ), &block, comp_leaf );
-						if ( dst_node == nullptr ) // 查找失败
-						{
-                            printfYellow("ext4-inode : current file has no extent for block %d, fill with zero\n", block);
-                            
-                            if (internal_block)
-                                internal_block->unpin();// 返回前先将前一个块释放
-
-                            // 自动填充0：分配一个全0的临时buffer
-                            long block_size = _belong_fs->rBlockSize();
-                            Ext4Buffer *zero_buf = new Ext4Buffer(block_size);
-                            memset(zero_buf->get_data_ptr(), 0, block_size);
-                            // 标记为临时buffer，调用者用完后delete
-                            return zero_buf;
-						}
-
-						// 目标块的物理块号
-						long phy_block	= dst_node->start_lo + ( (long) dst_node->start_hi << 32 );
-						phy_block	   += block - dst_node->logical_block_start;
-
-						if ( internal_block ) // 返回前先将前一个块释放
-							internal_block->unpin();
-
-						return _belong_fs->read_block( phy_block, pin );
-					}
-					else // 这是中间节点
-					{
-						// 二分查找
-
-						Ext4ExtentInternalNode *next_node =
-							binary_search<Ext4ExtentInternalNode, long>(
-								&( st->internal ), &( ed->internal ), &block, comp_intr );
-						if ( next_node == nullptr ) // 查找失败
-						{
-							printfRed( "ext4-inode : extents internal biary search " "error" );
-							if ( internal_block ) // 返回前先将前一个块释放
-								internal_block->unpin();
-							return nullptr;
-						}
-						TODO( "ext4-inode : extents 中间节点的 next_node_address 类型换成了uint8的数组""可能存在隐患" );
-						long next_block = (uint64)next_node->next_node_address; // 下一个节点所在块号
-
-						if ( internal_block ) // 读下一个块之前先将前一个块释放
-							internal_block->unpin();
-
-						internal_block = _belong_fs->read_block( next_block, true );
-						ex_header	   = (Ext4ExtentHeader *) internal_block->get_data_ptr();
-						st			   = (ex_node *) ( ex_header + 1 );
-						ed			   = st + ex_header->valid_nodes_count - 1;
-					}
+					printfYellow( "ext4-inode : current file has no extent for block %d, fill with zero\n", block );
+
+					// 自动填充0：分配一个全0的临时buffer
+					long		block_size = _belong_fs->rBlockSize();
+					Ext4Buffer *zero_buf   = new Ext4Buffer( block_size );
+					memset( zero_buf->get_data_ptr(), 0, block_size );
+					// 调用者照常 unpin，pin 计数要与之配对
+					if ( pin ) zero_buf->pin();
+					// 标记为临时buffer，调用者用完后delete
+					return zero_buf;
 				}
+				return _belong_fs->read_block( phy_block, pin );
 			}
 			else // 使用经典的直接/间接索引
 			{
@@ -968,7 +1021,7 @@ namespace fs
 			HashVer hv = HashVer::half_md4;
 			ext4_htree_hash( dir_name.c_str(), dir_name.size(), hash_seed, (int) hv, &hmajor,
 							 &hminor );
-			printfGreen(  "hash dir \"%s\" = 0x%x-0x%x\n" ,
+			log_trace(  "hash dir \"%s\" = 0x%x-0x%x\n" ,
 					dir_name.c_str(), hmajor, hminor );
 		}
 
@@ -10,6 +10,9 @@
 
 #include "fs/ext4/ext4.hh"
 #include "fs/vfs/inode.hh"
+#include "fs/vfs/page_cache.hh"
+
+#include <EASTL/vector.h>
 
 namespace fs
 {
@@ -17,6 +20,16 @@ namespace fs
 	{
 		class Ext4FS;
 		class Ext4Buffer;
+
+		/// @brief 解码后的一段 extent：逻辑块 [lblk, lblk+len) 映射到物理块 [pblk, pblk+len)
+		struct Ext4BlockRun
+		{
+			long lblk;
+			long pblk;
+			long len;
+			bool uninit; // 未初始化的 extent，读出全 0
+		};
+
 		class Ext4IndexNode : public Inode
 		{
 			friend Ext4FS;
@@ -28,6 +41,14 @@ namespace fs
 			long	  _has_size	  = 0; // bytes
 			FileAttrs _attrs;
 
+			// extent 树第一次访问时整体解码到这里 (按逻辑块号有序)，之后查找只需二分这张表。
+			// 当前 ext4 驱动只读，表建立后不会失效。
+			eastl::vector<Ext4BlockRun> _runs;
+			bool _runs_valid = false;
+
+			// 文件内容的页缓存，nodeRead、mmap 缺页和 exec 共用
+			PageCache _pcache;
+
 		public:
 
 			Ext4IndexNode() = default;
@@ -41,6 +62,9 @@ namespace fs
 
 			virtual size_t nodeRead( u64 dst, size_t off, size_t len ) override;
 			virtual size_t nodeWrite( u64 src, size_t off, size_t len ) override { return 0; };
+			virtual void   readahead( size_t off, size_t len ) override;
+			virtual PageCache *pageCache() override { return &_pcache; }
+			virtual long   readPage( void *pa, uint64 index ) override;
 			virtual int	   readlinkat( char *buf, size_t len ) override { return 0; };
 
 			virtual size_t readSubDir( ubuf &dst, size_t off ) override;
@@ -69,6 +93,16 @@ namespace fs
 			void _cal_size();
 			void _cal_blocks();
 
+			/// @brief 不经页缓存直接从块缓存读取，出错返回 -1
+			long _read_direct( u64 dst, size_t off, size_t len );
+
+			bool _load_runs();
+			bool _collect_runs( void *header, int level );
+			/// @brief 查找逻辑块所在的 run
+			/// @param run_left 从 block 起本 run（或空洞）剩余的块数，空洞直到下一个 run 或无穷
+			/// @return 物理块号；空洞或未初始化 extent 返回 0
+			long _map_block( long block, long &run_left );
+
 			Ext4Buffer *_search_direct_block( long target_block_no, long start_block_no,
 											  void *index_block, bool pin = false );
 			Ext4Buffer *_search_sindirect_block( long target_block_no, long start_block_no,
@@ -33,6 +33,7 @@ namespace fs
         fs::dentry *new_parent = new_path_obj.pathSearch(true);
         if (!new_parent)
         {
+            old_dentry->dput();
             return -2; // -ENOENT
         }
 
@@ -42,6 +43,9 @@ namespace fs
         {
             // 目标已存在，需要根据类型决定是否覆盖
             // 这里简化处理，不允许覆盖
+            new_dentry->dput();
+            new_parent->dput();
+            old_dentry->dput();
             return -17; // -EEXIST
         }
 
@@ -51,8 +55,10 @@ namespace fs
         // - 从旧父目录中删除目录项
         // - 更新inode的链接计数等
         ///@todo
-        // 由于当前内核的ext4实现可能不完整，这里返回未实现
-        printfYellow("ext4_do_rename: rename operation not fully implemented yet\n");
-        return 0; // -ENOSYS (函数未实现)
+        // ext4 驱动只读，改名只在目录项缓存里完成：原名字留下负目录项，目标名字上的负目录项被替换
+        old_dentry->move(new_parent, new_path_obj.rFileName());
+        new_parent->dput();
+        old_dentry->dput();
+        return 0;
     }
 }
\ No newline at end of file
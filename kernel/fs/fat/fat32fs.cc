@@ -45,7 +45,9 @@ namespace fs
 			new ( _root ) dentry( rootname, _node, nullptr, false );
 			//_mnt = nullptr;
 
-			_root->EntryCreate( "test_unlink", 0 );
+			dentry *test = _root->EntryCreate( "test_unlink", 0 );
+			if ( test != nullptr )
+				test->dput();
 
 			/// @todo 4. try to mount fat to ramfs's /mnt/fat
 		}
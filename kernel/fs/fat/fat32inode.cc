@@ -150,6 +150,19 @@ namespace fs
 				_belong_fs->get_sectors_per_cluster() * ( cluster - Fat32_first_data_cluster );	// sector offset in DATA
 		}
 
+		int Fat32Inode::sync( bool datasync_ )
+		{
+			// 目录项和 FAT 表没有单独的脏状态，两种同步都只写回文件占用的簇
+			int rc = 0;
+			uint spc = _belong_fs->get_sectors_per_cluster();
+			for ( uint32 cls : _clusters_number )
+			{
+				if ( k_bufm.sync_range( _belong_fs->owned_device(), _cluster_to_lba( cls ), spc ) < 0 )
+					rc = -1;
+			}
+			return rc;
+		}
+
 		uint64 Fat32Inode::_cover_size_bytes()
 		{
 			return
@@ -94,6 +94,7 @@ namespace fs
 			size_t		rFileSize() const override { return _size; };
 			SuperBlock *getSb() const override;
 			FileSystem *getFS() const override;
+			int			sync( bool datasync_ ) override;
 			int			readlinkat( char *buf, size_t len ) override
 			{
 				return 0;
@@ -48,16 +48,17 @@ namespace fs
 			_isroot = true;
 			_mnt = nullptr;
 
-			_root->EntryCreate( "dev", attrs ); // 暂时把第二个参数为正数认为是目录， 还要创建 /dev/sda1, 用来初始化ext4
-			_root->EntryCreate( "proc", attrs );
-			_root->EntryCreate( "sys", attrs );
-			_root->EntryCreate( "tmp", attrs );
-			_root->EntryCreate( "mnt", attrs );
-			_root->EntryCreate( "bin", attrs );
+			// 暂时把第二个参数为正数认为是目录， 还要创建 /dev/sda1, 用来初始化ext4
+			// EntryCreate 返回的目录项带着引用，这里用不到就直接放掉
+			const char *top_dirs[] = { "dev", "proc", "sys", "tmp", "mnt", "bin" };
+			for ( const char *name : top_dirs )
+				_root->EntryCreate( name, attrs )->dput();
 
 			dentry * etc_dent = _root->EntryCreate( "etc", attrs );
 			dentry * conf_dent = etc_dent->EntryCreate( "busybox.conf", attrs );
 			( ( RamInode * ) conf_dent->getNode() )->readable = true;
+			conf_dent->dput();
+			etc_dent->dput();
 
 			// _root->printAllChildrenInfo();
 
@@ -86,22 +87,27 @@ namespace fs
 				dentry *device_ = dev->EntryCreate(dev_table[i], _super_block->rDefaultMod(), dev_table[i]);
 				Device *dev_ = new Device( static_cast<RamFS*>(dev->getNode()->getFS()), alloc_ino(), FileAttrs( FT_DEVICE, 0666), i );
 				device_->setNode( dev_ );
+				device_->dput();
 			}
 			
 			// init /dev/rtc
 			dentry *rtc = dev->EntryCreate( "rtc", FileAttrs( FileTypes::FT_DEVICE, 0444 ) ); //rw
 			RTC *rtc_ = new RTC( static_cast<RamFS*>(rtc->getNode()->getFS()), alloc_ino(), FileAttrs( FT_DEVICE, 0666), 100);
 			rtc->setNode( rtc_ );
+			rtc->dput();
 
 			// init /dev/zero
 			dentry *zero = dev->EntryCreate( "zero", FileAttrs( FileTypes::FT_DEVICE, 0444 ) ); //rw
 			Zero *zero_ = new Zero( static_cast<RamFS*>(zero->getNode()->getFS()), alloc_ino(),FileAttrs( FT_DEVICE, 0666), 101 );
 			zero->setNode( zero_ );
+			zero->dput();
 
 			// init /dev/null
 			dentry *null = dev->EntryCreate( "null", FileAttrs( FileTypes::FT_DEVICE, 0444 ) );  // rw,但是read直接返回-1
 			Null *null_ = new Null( static_cast<RamFS*>(null->getNode()->getFS()), alloc_ino(), FileAttrs( FT_DEVICE, 0666), 102 );
 			null->setNode( null_ );
+			null->dput();
+			dev->dput();
 
 			// init /proc
 			dentry *proc = _root->EntrySearch( "proc" );
@@ -111,25 +117,28 @@ namespace fs
                 return;
 			}
 			
-			proc->EntryCreate( "self", FileAttrs( FileTypes::FT_DIRECT, 0444) );
+			dentry *self = proc->EntryCreate( "self", FileAttrs( FileTypes::FT_DIRECT, 0444) );
 			
 			// init /proc/meminfo
 			dentry *meminfo = proc->EntryCreate( "meminfo", FileAttrs( FileTypes::FT_NORMAL, 0444 ) );
 			MemInfo *meminfo_ = new MemInfo( static_cast<RamFS*>(meminfo->getNode()->getFS()), alloc_ino() );
 			meminfo->setNode( meminfo_ );
+			meminfo->dput();
 
 
-			dentry *self = proc->EntrySearch( "self" );
 			// init /proc/exe
 			dentry *exe = self->EntryCreate( "exe", FileAttrs( FileTypes::FT_NORMAL, 0444 ) );
 			Exe *exe_ = new Exe( static_cast<RamFS*>(self->getNode()->getFS()), alloc_ino() );
 			exe->setNode( exe_ );
+			exe->dput();
+			self->dput();
 
 
 			//init /proc/mount
 			dentry *mounts = proc->EntryCreate( "mounts", FileAttrs( FileTypes::FT_DIRECT, 0444 ) );
 			Mount *mnt_ = new Mount( static_cast<RamFS*>(mounts->getNode()->getFS()), alloc_ino(), FileAttrs( FileTypes::FT_NORMAL, 0444 ) );
 			mounts->setNode( mnt_ );
+			proc->dput();
 
 
 			// init /bin
@@ -147,12 +156,27 @@ namespace fs
 													FileAttrs( FileTypes::FT_NORMAL, 0777 ),  // 这里应该是一个SYMBLE_LINK
                                                     "/mnt/sdcard/busybox" );
 			ls->setNode( ls_link_ );
+			ls->dput();
+			mounts->dput();
+			bin->dput();
 
 
 			// _root->printAllChildrenInfo();
 			return;
 		}
 
+		void RamFS::inittmp( dentry *mnt )
+		{
+			_device = 0;
+			_fstype = "tmpfs";
+			_isroot = false;
+			_mnt = mnt;
+			FileAttrs attrs = _super_block->rDefaultMod();
+			attrs.filetype = FileTypes::FT_DIRECT;
+			_root = fs::dentrycache::k_dentryCache.alloDentry();
+			new ( _root ) dentry( mnt->rName(), _super_block->allocInode( attrs ), nullptr, true );
+		}
+
 		RamFS::RamFS()
 		{
 			_super_block = new RamFSSb( this );
@@ -170,7 +194,8 @@ namespace fs
 			// {
 			// 	printfMagenta( "RamFS::mount: ext4 is  supported in ramfs" );
 			// }
-			if ( mount == nullptr || dev == nullptr )
+			// tmpfs 不需要设备
+			if ( mount == nullptr || ( dev == nullptr && fstype != "tmpfs" ) )
 			{
 				printfRed( "RamFS::mount: mount or dev is nullptr\n" );
 				return -1;
@@ -210,6 +235,7 @@ namespace fs
 
 				root->setParent( mount->getParent() );
 				mount->getParent()->getChildren()[ mount->rName() ] = fatfs->getRoot();
+				fs::mount_add( mount, root );
 				for ( auto it : mount->getChildren() )
 				{
 					Info( "RamFS::mount: %s", it.second->rName().c_str() );
@@ -238,6 +264,7 @@ namespace fs
 
 				root->setParent( mount->getParent() );
 				mount->getParent()->getChildren()[ mount->rName() ] = ext4fs->getRoot();
+				fs::mount_add( mount, root );
 				for ( auto it : mount->getChildren() )
 				{
 					Info( "RamFS::mount: %s", it.second->rName().c_str() );
@@ -245,6 +272,27 @@ namespace fs
 
 				fs::mnt_table[ mnt_path ] = ext4fs;
 			}
+			else if ( fstype == "tmpfs" )
+			{
+				RamFS *tmpfs = new RamFS();
+				tmpfs->inittmp( mount );
+
+				dentry *root = tmpfs->getRoot();
+				dentry *mnt = mount;
+				eastl::string mnt_path;
+				while( mnt != nullptr )
+				{
+					mnt_path = mnt->rName() + "/" + mnt_path;
+					mnt = mnt->getParent();
+				}
+				mnt_path = mnt_path.substr( 1, mnt_path.size() - 2 );
+
+				root->setParent( mount->getParent() );
+				mount->getParent()->getChildren()[ mount->rName() ] = root;
+				fs::mount_add( mount, root );
+
+				fs::mnt_table[ mnt_path ] = tmpfs;
+			}
 			else
 			{
 				printfRed( "RamFS::mount: unknown file system type" );
@@ -267,7 +315,9 @@ namespace fs
 				return -1;
 			}
 			dentry *parent = mount->getParent();
-			dentry *mnt = mount->getNode()->getFS()->getMntPoint();
+			dentry *mnt = fs::mount_del( mount );
+			if ( mnt == nullptr )
+				mnt = mount->getNode()->getFS()->getMntPoint();
 			parent->getChildren()[ mount->rName() ] = mnt;
 			// _root->printAllChildrenInfo(); // 
 			return 0; //卸载完成
@@ -29,6 +29,7 @@ namespace fs{
 
             public:
                 void initfd(); // init ramfs, especially for some essential directories
+                void inittmp( dentry *mnt ); // 作为挂在 mnt 上的 tmpfs 初始化，只有一个空的根目录
 
                 RamFS();
                 RamFS( const RamFS &fs ) = default;
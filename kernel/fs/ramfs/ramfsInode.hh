@@ -1,6 +1,7 @@
 #include "types.hh"
 #include "fs/vfs/inode.hh"
 #include "fs/vfs/kstat.hh"
+#include "fs/vfs/page_cache.hh"
 
 #include <EASTL/vector.h>
 #include <EASTL/string.h>
@@ -21,7 +22,6 @@ namespace fs{
             protected:
                 RamFS *belong_fs;
                 const uint ino;
-                eastl::vector<uint8> data;
                 bool is_dir;
                 FileAttrs attrs; // filetype
                 eastl::string  dev_name;  // 只有设备文件这里不是空
@@ -42,29 +42,11 @@ namespace fs{
                     Inode *lookup( eastl::string dirname ) override { return nullptr ; } ;
                     Inode *mknode( eastl::string dirname, FileAttrs attrs, eastl::string dev_name = "" ) override;
                     size_t nodeRead( uint64 dst_, size_t off_, size_t len_ ) override;
-                    size_t nodeWrite( uint64 src_, size_t off, size_t len ) override { 			size_t write_len = len;
-			char *writecontent = new char[len];
-			memset(writecontent, 0, len);
-			// printfRed("i try to print *src:%p,char:%s\n",src_,(char*)src_);
-			memcpy(writecontent, (void *)src_, len);
-			// printf("test.txt write: %s\n", writecontent);
-			for (size_t i = 0; i < write_len; ++i)
-			{
-				if (off + i < data.size())
-				{
-					data[off + i] = writecontent[i];
-				}
-				else
-				{
-					data.push_back(writecontent[i]);
-				}
-			}
-
-			return write_len; } ;
+                    size_t nodeWrite( uint64 src_, size_t off, size_t len ) override { return 0; }; // 目录等没有内容，普通文件见 Normal
 
                     FileAttrs rMode() const override { return attrs; };
                     dev_t rDev() const override ;
-                    uint64 rFileSize() const override { return data.size(); };
+                    uint64 rFileSize() const override { return 0; };
                     uint64 rIno() const override { return ino; };
                     SuperBlock *getSb() const override;
                     FileSystem *getFS() const override;
@@ -151,15 +133,24 @@ namespace fs{
                 size_t nodeWrite( uint64 src_, size_t off_, size_t len_ ) override { return len_; };
         };
 
+        /// @brief tmpfs 的普通文件：内容是一组按页号索引的物理页，就放在页缓存里。
+        /// 没有分配的页是空洞，读出为 0；读写按页 memcpy，mmap 直接映射这些页，不经过任何磁盘
         class Normal : public RamInode
         {
-            eastl::string data;
+            PageCache _pages;
+            SpinLock _size_lock;    // 保护 _size 和 _fill_end
+            uint64 _size = 0;
+            uint64 _fill_end = 0;   // 写入到过的最远位置：数据拷完才更新 _size，这之前 readPage 也要为新页给出 0
+            uint64 _file_size();
             public:
-                Normal( RamFS *fs, uint ino, FileAttrs attrs, eastl::string data_ ) : ramfs::RamInode( fs, ino, attrs ), data( data_ ) {};
-                Normal( RamFS *fs, uint ino, FileAttrs attrs ) : ramfs::RamInode( fs, ino, attrs ) { data.clear(); };
+                Normal( RamFS *fs, uint ino, FileAttrs attrs, eastl::string data_ );
+                Normal( RamFS *fs, uint ino, FileAttrs attrs ) : ramfs::RamInode( fs, ino, attrs ) { _size_lock.init( "tmpfs size" ); _pages.init( this, true ); };
                 size_t nodeRead( uint64 dst_, size_t off_, size_t len_ ) override;
                 size_t nodeWrite( uint64 src_, size_t off_, size_t len_ ) override;
-                size_t rFileSize() const override { return data.length(); };
+                int truncate( size_t size_ ) override;
+                PageCache *pageCache() override { return &_pages; }
+                long readPage( void *pa, uint64 index ) override;
+                uint64 rFileSize() const override { return _size; };
         };
     }
 }
@@ -9,6 +9,9 @@ namespace fs
         Inode *RamFSSb::allocInode( FileAttrs attrs , eastl::string dev_name)
         {
             RamFS *ram_fs = static_cast<RamFS *>(fs);
+			// 普通文件的内容放在页里，目录和设备节点没有内容
+			if ( attrs.filetype != FileTypes::FT_DIRECT && dev_name.empty() )
+				return new Normal( ram_fs, ram_fs->alloc_ino(), attrs );
 			RamInode * ram_inode =  new RamInode( ram_fs, ram_fs->alloc_ino(), attrs, dev_name );
 			return ram_inode;
 		}
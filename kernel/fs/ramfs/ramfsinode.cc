@@ -7,6 +7,7 @@
 #include "tm/timer_manager.hh"
 
 #include "klib.hh"
+#include "physical_memory_manager.hh"
 
 #include "device_manager.hh"
 #include "stream_device.hh"
@@ -54,7 +55,7 @@ namespace fs
 
 		size_t RamInode::nodeRead(uint64 dst_, size_t off_, size_t len_)
 		{
-						printfMagenta("it is a ram node\n");
+			log_trace("it is a ram node\n");
 			if (readable)
 			{
 				size_t read_len = (off_ + len_ > sizeof busybox_conf) ? ((sizeof busybox_conf) - off_) : len_;
@@ -119,7 +120,12 @@ namespace fs
 		size_t SymbleLink::nodeRead(uint64 dst_, size_t off_, size_t len_)
 		{
 			fs::Path path(target_path); /// @todo 检查目标文件存在与否，不存在就删除此符号链接
-			return path.pathSearch()->getNode()->nodeRead(dst_, off_, len_);
+			dentry *target = path.pathSearch();
+			if ( target == nullptr )
+				return 0;
+			size_t ret = target->getNode()->nodeRead(dst_, off_, len_);
+			target->dput();
+			return ret;
 		}
 
 		size_t MemInfo::nodeRead(uint64 dst_, size_t off_, size_t len_)
@@ -242,50 +248,124 @@ namespace fs
 			return len;
 		}
 
-		size_t Normal::nodeRead(uint64 src_, size_t off, size_t len)
+		Normal::Normal(RamFS *fs, uint ino, FileAttrs attrs, eastl::string data_)
+			: ramfs::RamInode(fs, ino, attrs)
 		{
-			size_t read_len;
-			[[maybe_unused]] size_t len_ = data.length();
-			if (off + len > len_)
-				read_len = len_ - off;
-			else
-				read_len = len;
-			if (read_len == 0)
+			_size_lock.init("tmpfs size");
+			_pages.init(this, true);
+			nodeWrite((uint64)data_.c_str(), 0, data_.size());
+		}
+
+		uint64 Normal::_file_size()
+		{
+			_size_lock.acquire();
+			uint64 sz = _size;
+			_size_lock.release();
+			return sz;
+		}
+
+		size_t Normal::nodeRead(uint64 dst_, size_t off, size_t len)
+		{
+			uint64 size = _file_size();
+			if (off >= size)
 				return 0;
+			if (len > size - off)
+				len = size - off;
 
-			char *readcontent = new char[read_len];
-			memset(readcontent, 0, read_len);
-			for (size_t i = 0; i < read_len; ++i)
+			size_t done = 0;
+			while (done < len)
 			{
-				readcontent[i] = data[off + i];
+				uint64 index = (off + done) / PGSIZE;
+				size_t p_off = (off + done) % PGSIZE;
+				size_t span = PGSIZE - p_off;
+				if (span > len - done)
+					span = len - done;
+
+				// 空洞直接读出 0，不为它分配页
+				void *pa = _pages.find_page(index);
+				if (pa != nullptr)
+				{
+					memcpy((void *)(dst_ + done), (u8 *)pa + p_off, span);
+					mem::k_pmm.free_page(pa);
+				}
+				else
+					memset((void *)(dst_ + done), 0, span);
+				done += span;
 			}
-
-			memcpy((void *)src_, readcontent, read_len);
-			return read_len;
+			return len;
 		}
 
 		size_t Normal::nodeWrite(uint64 src_, size_t off, size_t len)
 		{
-			size_t write_len = len;
-			char *writecontent = new char[len];
-			memset(writecontent, 0, len);
-			// printfRed("i try to print *src:%p,char:%s\n",src_,(char*)src_);
-			memcpy(writecontent, (void *)src_, len);
-			// printf("test.txt write: %s\n", writecontent);
-			for (size_t i = 0; i < write_len; ++i)
+			// 先登记写入范围，readPage 才会为原末尾之后的新页给出内容；文件大小等数据拷完再改，
+			// 免得并发的读者看到还没写进去的部分
+			_size_lock.acquire();
+			if (off + len > _fill_end)
+				_fill_end = off + len;
+			_size_lock.release();
+
+			size_t done = 0;
+			while (done < len)
 			{
-				if (off + i < data.size())
+				uint64 index = (off + done) / PGSIZE;
+				size_t p_off = (off + done) % PGSIZE;
+				size_t span = PGSIZE - p_off;
+				if (span > len - done)
+					span = len - done;
+
+				void *pa = _pages.get_page(index);
+				if (pa == nullptr)
 				{
-					data[off + i] = writecontent[i];
+					printfRed("tmpfs: out of memory at page %d\n", index);
+					break;
 				}
-				else
+				memcpy((u8 *)pa + p_off, (void *)(src_ + done), span);
+				mem::k_pmm.free_page(pa);
+				done += span;
+			}
+
+			_size_lock.acquire();
+			if (off + done > _size)
+				_size = off + done;
+			_size_lock.release();
+			return done;
+		}
+
+		long Normal::readPage(void *pa, uint64 index)
+		{
+			// 只有第一次写到这一页时才会来这里：空洞和新扩展出来的部分都是 0
+			uint64 start = index * PGSIZE;
+			_size_lock.acquire();
+			uint64 end = _size > _fill_end ? _size : _fill_end;
+			_size_lock.release();
+			if (start >= end)
+				return 0;
+			memset(pa, 0, PGSIZE);
+			return end - start < PGSIZE ? end - start : PGSIZE;
+		}
+
+		int Normal::truncate(size_t size_)
+		{
+			if (size_ < _file_size())
+			{
+				// 丢掉新末尾之后的整页；末尾所在页的剩余部分清零，以后再扩大时读出的才是 0
+				_pages.truncate(PGROUNDUP(size_) / PGSIZE);
+				if (size_ % PGSIZE != 0)
 				{
-					data.push_back(writecontent[i]);
+					void *pa = _pages.find_page(size_ / PGSIZE);
+					if (pa != nullptr)
+					{
+						memset((u8 *)pa + size_ % PGSIZE, 0, PGSIZE - size_ % PGSIZE);
+						mem::k_pmm.free_page(pa);
+					}
 				}
 			}
-			// printf("data is %s\n", data.c_str());
-			// printf("data size is %d\n", data.length());
-			return write_len;
+			_size_lock.acquire();
+			_size = size_;
+			if (_fill_end > size_)
+				_fill_end = size_;
+			_size_lock.release();
+			return 0;
 		}
 	}
 }
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include "printer.hh"
 #include "fs/vfs/buffer.hh"
 #include "physical_memory_manager.hh"
+#include "common.hh"
 
 namespace fs
 {
@@ -119,19 +120,25 @@ namespace fs
 	{
 		assert( block_num == _block_number, "对 buffer block 而言非法的块号, 需求 %d, 而输入 %d", _block_number, block_num );
 		_lock.acquire();
+		BufferNode *dirty_node = nullptr;
 		for ( BufferNode *node = _node_head._prev; node != &_node_head; node = node->_prev )
 		{
-			if ( _ref_cnt[ node->_buf_index ] == 0 )
+			int idx = node->_buf_index;
+			if ( _ref_cnt[ idx ] != 0 || bit_test( ( void * ) &_disk_own_map, idx ) )
+				continue;
+			if ( bit_test( ( void * ) &_dirty_map, idx ) )
 			{
-				// _device[ node->_buf_index ] = dev;
-				// _tag_number[ node->_buf_index ] = tag_num;
-				
-				// _ref_cnt[ node->_buf_index ] = 1;
-
-				_lock.release();
-				
-				return node;
+				// 优先换出干净buffer，脏buffer要同步写回，留到最后
+				if ( dirty_node == nullptr ) dirty_node = node;
+				continue;
 			}
+			_lock.release();
+			return node;
+		}
+		if ( dirty_node != nullptr )
+		{
+			_lock.release();
+			return dirty_node;
 		}
 		_lock.release();
 		printfYellow( "BufferBlock : no buffer to alloc" );
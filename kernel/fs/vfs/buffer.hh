@@ -111,6 +111,8 @@ namespace fs
 
 		Buffer get_buffer( BufferNode* buf_node );
 
+		/// @brief 从LRU尾部挑一个没有引用、也不在DMA中的buffer，优先挑干净的，
+		///        脏buffer只在没有干净的可用时才被挑中（调用者需要先把它写回）
 		BufferNode* alloc_buffer( int dev, uint block_num, uint64 tag_num );
 	};
 } // namespace fs
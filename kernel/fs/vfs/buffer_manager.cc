@@ -14,11 +14,36 @@
 #include "klib.hh"
 #include "common.hh"
 #include "physical_memory_manager.hh"
+#include "proc/proc.hh"
+#include "proc/proc_manager.hh"
+
+#include <EASTL/vector.h>
+#include <EASTL/sort.h>
 
 namespace fs
 {
 	BufferManager k_bufm;
 
+	/// @brief 一个待回写的脏buffer
+	struct BufWbItem
+	{
+		int dev;
+		uint64 lba;
+		uint blk;
+		uint idx;
+	};
+
+	/// @brief 一次合并回写：LBA 连续的若干buffer合成一个块设备请求，每个buffer一个数据段
+	struct BufWbReq
+	{
+		dev::BlockRequest req;
+		dev::BlockDevice *bd = nullptr;
+		uint first = 0;		// 在排序后的 BufWbItem 数组中的起始下标
+		uint nbuf = 0;
+		int submit_rc = 0;
+		dev::BufferDescriptor descs[ bufm_wb_max_segs ];
+	};
+
 	// ________________________________________________________________
 	// >>>> class BufferManager
 
@@ -109,11 +134,147 @@ namespace fs
 			return -1;
 		if (idx >= _buffer_pool[blk]._current_buffer_counts)
 			return -2;
-		_buf_set_dirty(blk, idx);
+
+		_lock.acquire();
+		if (!_buf_is_dirty(blk, idx))
+		{
+			_buf_set_dirty(blk, idx);
+			_dirty_count++;
+		}
+		_lock.release();
 		return 0;
 	}
 
-	int BufferManager::flush_buffer(Buffer &buf) { return -1; }
+	int BufferManager::flush_buffer(Buffer &buf)
+	{
+		uint blk = buf._block_number;
+		uint idx = buf._buffer_index;
+		if (blk >= block_per_pool)
+			return -1;
+		if (idx >= _buffer_pool[blk]._current_buffer_counts)
+			return -2;
+
+		// 调用者持有引用，buffer 不会在此期间被换成别的块
+		_lock.acquire();
+		int dev = _buffer_pool[blk]._device[idx];
+		uint64 lba = _buf_lba(blk, idx);
+		_lock.release();
+		return _sync(dev, lba, lba + sector_per_buffer);
+	}
+
+	long BufferManager::_writeback(int dev, uint64 lba_lo, uint64 lba_hi)
+	{
+		eastl::vector<BufWbItem> items;
+		items.reserve(_dirty_count + 1);
+
+		// 取走的buffer先清脏位、置硬盘持有：期间再被写脏会重新置位，不会丢失
+		_lock.acquire();
+		for (uint blk = 0; blk < block_per_pool; ++blk)
+		{
+			BufferBlock &block = _buffer_pool[blk];
+			for (uint idx = 0; idx < block._current_buffer_counts; ++idx)
+			{
+				if (!_buf_is_dirty(blk, idx) || _buf_is_disk_own(blk, idx))
+					continue;
+				if (!_buf_in_range(blk, idx, dev, lba_lo, lba_hi))
+					continue;
+				_buf_reset_dirty(blk, idx);
+				_buf_set_disk_own(blk, idx);
+				_dirty_count--;
+				items.push_back({block._device[idx], _buf_lba(blk, idx), blk, idx});
+			}
+		}
+		_lock.release();
+
+		if (items.empty())
+			return 0;
+
+		eastl::sort(items.begin(), items.end(), [](const BufWbItem &a, const BufWbItem &b)
+					{ return a.dev != b.dev ? a.dev < b.dev : a.lba < b.lba; });
+
+		// LBA 连续的buffer合成一个请求；全部提交后再逐个等待，让驱动批量下发
+		eastl::vector<BufWbReq *> reqs;
+		for (uint i = 0; i < items.size();)
+		{
+			uint j = i + 1;
+			while (j < items.size() && j - i < bufm_wb_max_segs && items[j].dev == items[i].dev &&
+				   items[j].lba == items[j - 1].lba + sector_per_buffer)
+				++j;
+
+			BufWbReq *r = new BufWbReq;
+			r->bd = (dev::BlockDevice *)dev::k_devm.get_device((uint)items[i].dev);
+			r->first = i;
+			r->nbuf = j - i;
+			for (uint k = 0; k < r->nbuf; ++k)
+			{
+				BufWbItem &it = items[i + k];
+				r->descs[k] = {.buf_addr = (uint64)_buffer_pool[it.blk]._buffer_base[it.idx],
+							   .buf_size = default_buffer_size};
+			}
+			r->req.start_block = (long)items[i].lba;
+			r->req.block_count = (long)r->nbuf * (default_buffer_size / r->bd->get_block_size());
+			r->req.buf_list = r->descs;
+			r->req.buf_count = (int)r->nbuf;
+			r->req.write = true;
+			r->submit_rc = r->bd->submit_request(&r->req);
+			reqs.push_back(r);
+			i = j;
+		}
+
+		long written = 0;
+		bool failed = false;
+		for (BufWbReq *r : reqs)
+		{
+			int rc = r->submit_rc < 0 ? r->submit_rc : r->bd->wait_request(&r->req);
+
+			_lock.acquire();
+			for (uint k = 0; k < r->nbuf; ++k)
+			{
+				BufWbItem &it = items[r->first + k];
+				_buf_reset_disk_own(it.blk, it.idx);
+				if (rc < 0 && !_buf_is_dirty(it.blk, it.idx))
+				{
+					// 写失败的buffer重新置脏，下次同步或换出时重试
+					_buf_set_dirty(it.blk, it.idx);
+					_dirty_count++;
+				}
+				proc::k_pm.wakeup(&_buffer_pool[it.blk]._nodes[it.idx]);
+			}
+			_lock.release();
+
+			if (rc < 0)
+			{
+				printfRed("BufferManager : write back LBA %p (%d buffers) failed\n",
+						  items[r->first].lba, r->nbuf);
+				failed = true;
+			}
+			else
+				written += r->nbuf;
+			delete r;
+		}
+
+		return failed ? -1 : written;
+	}
+
+	int BufferManager::_sync(int dev, uint64 lba_lo, uint64 lba_hi)
+	{
+		long rc = _writeback(dev, lba_lo, lba_hi);
+
+		// 区间里可能还有别的同步者或换出正在写的buffer，等它们落盘；
+		// 正在从硬盘读入的buffer（无效位）与同步无关
+		_lock.acquire();
+		for (uint blk = 0; blk < block_per_pool; ++blk)
+		{
+			for (uint idx = 0; idx < _buffer_pool[blk]._current_buffer_counts; ++idx)
+			{
+				while (_buf_is_disk_own(blk, idx) && _buf_is_valid(blk, idx) &&
+					   _buf_in_range(blk, idx, dev, lba_lo, lba_hi))
+					proc::k_pm.sleep(&_buffer_pool[blk]._nodes[idx], &_lock);
+			}
+		}
+		_lock.release();
+		return rc < 0 ? -1 : 0;
+	}
 
 	// -------- private helper function --------
 
@@ -189,29 +350,24 @@ namespace fs
 		BufferNode* node = nullptr;
 		uint64		buf_base;
 
-		node = _buffer_pool[blk].search_buffer( dev, blk, tag );
-		if ( node != nullptr )
-		{ // 命中 buffer
-			// log_info( "BufferManager : 命中buffer ([%d][%d])", blk,
-			// node->_buf_index );
-
-			if ( _buf_is_disk_own( blk, node->_buf_index ) )
-			{ // 虽然命中 buffer，但是这个 buffer
-			  // 被硬盘占用，应当等待硬盘解除占用
-				assert( need_sleep_lock == true,
-					"synchronously get buffer but disk occupies this buffer\n"
-					">> maybe it is asynchronously getting buffer here?"
-				);
-
-				panic(
-					"BufferManager : hit buffer but buffer is occupied by "
-					"disk\n" ">> it should sleep here but sleep not imlement" );
+		while ( true )
+		{
+			node = _buffer_pool[blk].search_buffer( dev, blk, tag );
+			while ( node != nullptr && _buf_is_disk_own( blk, node->_buf_index ) &&
+					!_buf_is_valid( blk, node->_buf_index ) )
+			{ // 命中的 buffer 正在从硬盘读入，等读完后重新查找；
+			  // 正在回写的 buffer 数据是有效的，可以直接使用
+				proc::k_pm.sleep( &_buffer_pool[blk]._nodes[node->_buf_index], &_lock );
+				node = _buffer_pool[blk].search_buffer( dev, blk, tag );
 			}
 
-			_buffer_pool[blk]._ref_cnt[node->_buf_index]++;
-		}
-		else // 没有命中 buffer，需要分配新的buffer
-		{
+			if ( node != nullptr )
+			{ // 命中 buffer
+				_buffer_pool[blk]._ref_cnt[node->_buf_index]++;
+				break;
+			}
+
+			// 没有命中 buffer，需要分配新的buffer
 			node = _buffer_pool[blk].alloc_buffer( dev, blk, tag );
 			assert( node != nullptr,
 				"BufferManager : try to get buffer fail\n"
@@ -219,40 +375,45 @@ namespace fs
 				"  but sleep not implement"
 			);
 
-			if ( _buf_is_dirty( blk, node->_buf_index ) )
-			{ // 这个buffer有脏数据，需要回写
-
-				uint dev_num = (uint) _buffer_pool[blk]._device[node->_buf_index];
-				_check_block_device( dev_num );
-				dev::BlockDevice* bd = (dev::BlockDevice*) dev::k_devm.get_device( dev_num );
-
-				buf_base = (uint64) _buffer_pool[blk]._buffer_base[node->_buf_index];
-				dev::BufferDescriptor buf_des		= { .buf_addr = buf_base,
-														.buf_size = default_buffer_size };
-				u64					   lba_to_write = _lba_from_tag_blk_off(
-					   _buffer_pool[blk]._tag_number[node->_buf_index], blk, 0 );
-
-				_buf_set_disk_own( blk, node->_buf_index );
-				if ( need_sleep_lock )
-					panic( "BufferManager : sleep not implement" );
-				else
-				{
-					_lock.release();
-					bd->write_blocks_sync( lba_to_write, default_buffer_size / bd->get_block_size(),
-										   &buf_des, 1 );
-					_lock.acquire();
-				}
+			uint idx = node->_buf_index;
+			if ( !_buf_is_dirty( blk, idx ) )
+			{ // 把 buffer 交给新的块，读入完成前其他查找者会在上面等待
+				_buffer_pool[blk]._device[idx]		= dev;
+				_buffer_pool[blk]._tag_number[idx] = tag;
+				_buffer_pool[blk]._ref_cnt[idx]	= 1;
+				_buf_reset_valid( blk, idx );
+				break;
+			}
 
-				_buf_reset_dirty( blk, node->_buf_index );
-				_buf_reset_disk_own( blk, node->_buf_index );
-			} // buffer is dirty
+			// 没有干净 buffer 可用，只能在这里同步写回旧数据。
+			// 写回期间保留旧标签并置硬盘持有，和 _writeback 的状态一样：
+			// 查旧块的人照常命中有效数据，_sync 也能看到这次写并等它落盘
+			uint old_dev = (uint) _buffer_pool[blk]._device[idx];
+			u64	 old_lba = _buf_lba( blk, idx );
+			_check_block_device( old_dev );
+			dev::BlockDevice* bd = (dev::BlockDevice*) dev::k_devm.get_device( old_dev );
 
-			_buffer_pool[blk]._device[node->_buf_index]		= dev;
-			_buffer_pool[blk]._tag_number[node->_buf_index] = tag;
-			_buffer_pool[blk]._ref_cnt[node->_buf_index]	= 1;
-			_buf_reset_valid( blk, node->_buf_index );
+			buf_base = (uint64) _buffer_pool[blk]._buffer_base[idx];
+			dev::BufferDescriptor buf_des = { .buf_addr = buf_base,
+											   .buf_size = default_buffer_size };
 
-		} // >> end if ( node == nullptr )
+			_buf_reset_dirty( blk, idx );
+			_dirty_count--;
+			_buf_set_disk_own( blk, idx );
+			_lock.release();
+			int rc = bd->write_blocks_sync( old_lba, default_buffer_size / bd->get_block_size(),
+											&buf_des, 1 );
+			_lock.acquire();
+			_buf_reset_disk_own( blk, idx );
+			if ( rc < 0 && !_buf_is_dirty( blk, idx ) )
+			{
+				printfRed( "BufferManager : write back LBA %p failed\n", old_lba );
+				_buf_set_dirty( blk, idx );
+				_dirty_count++;
+			}
+			proc::k_pm.wakeup( &_buffer_pool[blk]._nodes[idx] );
+			// 放锁期间新块可能已被别人读入，旧块也可能又被用上或写脏，从头再查一次
+		}
 
 		if ( !_buf_is_valid( blk, node->_buf_index ) )
 		{ // 这个块没有有效的数据，需要从硬盘读入
@@ -264,18 +425,13 @@ namespace fs
 											   .buf_size = default_buffer_size };
 
 			_buf_set_disk_own( blk, node->_buf_index );
-			if ( need_sleep_lock )
-				panic( "BufferManager : sleep not implement" );
-			else
-			{
-				_lock.release();
-				bd->read_blocks_sync( lba, default_buffer_size / bd->get_block_size(), &buf_des,
-									  1 );
-				_lock.acquire();
-			}
+			_lock.release();
+			bd->read_blocks_sync( lba, default_buffer_size / bd->get_block_size(), &buf_des, 1 );
+			_lock.acquire();
 
 			_buf_reset_disk_own( blk, node->_buf_index );
 			_buf_set_valid( blk, node->_buf_index );
+			proc::k_pm.wakeup( &_buffer_pool[blk]._nodes[node->_buf_index] );
 		}
 
 		_lock.release();
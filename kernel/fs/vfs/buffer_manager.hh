@@ -33,12 +33,16 @@ namespace fs
 	_build_lba_divide_( tag_num, lba_blk_num_shift + block_per_pool_shift, 48 - lba_blk_num_shift - lba_offset_shift );
 #undef _build_lba_divide_
 
+	constexpr uint bufm_wb_max_segs		= 32;		// 一个设备请求最多合并的相邻buffer数
+
 	class BufferManager
 	{
 	private:
 		SpinLock _lock;
 		BufferBlock _buffer_pool[ block_per_pool ];
 
+		uint _dirty_count = 0;					// 当前脏buffer总数，由 _lock 保护
+
 	public:
 		BufferManager() {};
 		void init( const char *lock_name );
@@ -59,6 +63,16 @@ namespace fs
 		/// @return 刷新失败返回负数
 		int flush_buffer( Buffer &buf );
 
+		/// @brief 回写所有设备的脏buffer，并等待在途的写入全部完成
+		/// @return 有写入失败时返回负数
+		int sync_all() { return _sync( -1, 0, ~0UL ); }
+
+		/// @brief 只回写并等待某个设备的脏buffer
+		int sync_dev( int dev ) { return _sync( dev, 0, ~0UL ); }
+
+		/// @brief 只回写并等待与扇区区间 [lba, lba+count) 重叠的buffer，供 fsync 使用
+		int sync_range( int dev, uint64 lba, uint64 count ) { return _sync( dev, lba, lba + count ); }
+
 		/// @brief 同步方法，比较费时，应当在调度开始前供内核使用
 		void release_buffer_sync( Buffer &buf )
 		{
@@ -108,6 +122,28 @@ namespace fs
 		/// @brief 检查该设备是否是块设备
 		int _check_block_device( uint dev_num );
 
+		/// @brief 收集满足条件的脏buffer，按 (设备, LBA) 排序后把相邻的合并成一个设备请求写回，
+		///        写入期间buffer处于硬盘持有状态
+		/// @param dev 只写该设备，负数表示所有设备
+		/// @param lba_lo/lba_hi 只写与扇区区间 [lba_lo, lba_hi) 重叠的buffer
+		/// @return 写回的buffer数，有写入失败时返回负数
+		long _writeback( int dev, uint64 lba_lo, uint64 lba_hi );
+
+		/// @brief 写回并等待区间内所有在途写入结束
+		int _sync( int dev, uint64 lba_lo, uint64 lba_hi );
+
+		// buffer 所覆盖的首个扇区
+		uint64 _buf_lba( uint blk, uint idx )
+		{
+			return _lba_from_tag_blk_off( _buffer_pool[ blk ]._tag_number[ idx ], blk, 0 );
+		}
+		bool _buf_in_range( uint blk, uint idx, int dev, uint64 lba_lo, uint64 lba_hi )
+		{
+			if ( dev >= 0 && _buffer_pool[ blk ]._device[ idx ] != dev ) return false;
+			uint64 lba = _buf_lba( blk, idx );
+			return lba < lba_hi && lba + sector_per_buffer > lba_lo;
+		}
+
 
 		/// @brief 同步方法，比较费时，应当在调度开始前供内核使用
 		Buffer _get_buffer_sync( int dev, uint64 lba )
@@ -1,5 +1,6 @@
 #include "fs/vfs/dentrycache.hh"
 #include "fs/vfs/inode.hh"
+#include "fs/vfs/path.hh"
 #include "fs/vfs/dstat.hh"
 
 #include "fs/fat/fat32inode.hh"
@@ -20,45 +21,58 @@ namespace fs
 
 	fs::dentry *dentry::EntrySearch( const eastl::string name )
     {
-        // printfBlue("dentry::EntrySearch: name = %s", name.c_str());
-        auto it = children.find(name);
-        if (it != children.end())
-            return it->second;
-        if ( [[maybe_unused]] auto subnod = (_node->lookup(name)))
+        return EntrySearch( name.c_str(), name.size(), dentrycache::dentryCache::hashName( name ) );
+    }
+
+    fs::dentry *dentry::EntrySearch( const char *name, size_t len, uint32 hash )
+    {
+        using dentrycache::k_dentryCache;
+        if ( len == 0 )
         {
-            dentry *subdentry = fs::dentrycache::k_dentryCache.alloDentry();
-            if(name.empty())
-            {
-                printfRed("dentry::EntrySearch: name is empty");
-                return nullptr;
-            }
-            if (subdentry == nullptr) {
-                printfRed("dentry::EntrySearch: Failed to create dentry");
-                return nullptr;
-            }
-            if(subnod == nullptr)
-            {
-                printfRed("dentry::EntrySearch: subnod is nullptr");
-                return nullptr;
-            }
-            new ( subdentry ) dentry(name, (Inode *)subnod, this);
-            //dentry *subdentry = new dentry(name , subnod, this);
-            children[name] = subdentry;
-            return subdentry;
+            printfRed("dentry::EntrySearch: name is empty");
+            return nullptr;
         }
-        return nullptr;
+        dentry *subdentry = k_dentryCache.lookup( this, name, len, hash );
+        if ( subdentry == nullptr )
+        {
+            // 未命中才去问文件系统，查不到时缓存一个负目录项
+            eastl::string sname( name, len );
+            Inode *subnod = _node->lookup( sname );
+            subdentry = k_dentryCache.alloDentry();
+            new ( subdentry ) dentry( sname, subnod, this );
+            subdentry = k_dentryCache.insert( subdentry, hash, false );
+        }
+        if ( subdentry->isNegative() )
+        {
+            subdentry->dput();
+            return nullptr;
+        }
+        while ( subdentry->isMounted() )
+        {
+            dentry *root = mount_lookup( subdentry );
+            if ( root == nullptr )
+                break;
+            root->dget();
+            subdentry->dput();
+            subdentry = root;
+        }
+        return subdentry;
     }
 
     fs::dentry *dentry::EntryCreate( eastl::string name, FileAttrs attrs, eastl::string dev_name )
     {
+        using dentrycache::k_dentryCache;
         if (name.empty()) {
             printfRed("dentry::EntryCreate: name is empty");
             return nullptr;
         }
 
-            // check if the name already exists
-        if (children.find(name) != children.end()) {
+        // check if the name already exists
+        uint32 hash = k_dentryCache.hashName( name );
+        dentry *neg = k_dentryCache.lookup( this, name.c_str(), name.size(), hash );
+        if ( neg != nullptr && !neg->isNegative() ) {
             printfRed("dentry::EntryCreate: name already exists");
+            neg->dput();
             return nullptr;
         }
             
@@ -68,23 +82,47 @@ namespace fs
         if (node_ == nullptr) 
         {
             printfRed("dentry::EntryCreate: nodefs is not RamFS");
+            if ( neg != nullptr )
+                neg->dput();
             return nullptr;
         }
+
+        // 之前查找失败留下的负目录项直接变成新文件
+        if ( neg != nullptr )
+        {
+            k_dentryCache.instantiate( neg, node_ );
+            return neg;
+        }
+
         //dentry *newden = new dentry( name, node_, this );
-        dentry *newden = fs::dentrycache::k_dentryCache.alloDentry();
+        dentry *newden = k_dentryCache.alloDentry();
         new ( newden ) dentry( name, node_, this );
-        if ( newden == nullptr ) {
-            printfRed("dentry::EntryCreate: Failed to create RamFSDen");
-            delete node_; // 避免内存泄漏
+        dentry *ret = k_dentryCache.insert( newden, hash, true );
+        if ( ret != newden )
+        {
+            // 别人抢先插入了同名项，newden 已连同 node_ 一起释放
+            bool negative = ret->isNegative();
+            ret->dput();
+            if ( negative )
+                return EntryCreate( name, attrs, dev_name );
+            printfRed("dentry::EntryCreate: name already exists");
             return nullptr;
         }
 
-        children [ name ] = newden;
-
         // Info("RamFSDen::EntryCreate: created %s, parent %s", name.c_str(), this->name.c_str());
         return newden;
     }
 
+    void dentry::dget()
+    {
+        dentrycache::k_dentryCache.dget( this );
+    }
+
+    void dentry::dput()
+    {
+        dentrycache::k_dentryCache.dput( this );
+    }
+
     void dentry::reset( eastl::vector<int> &bitmap )
     {
         bitmap[ Did ] = 0;
@@ -167,6 +205,12 @@ namespace fs
     void dentry::unlink()
     {
         /// @todo node->unlink(); linkcnt--;
+        dentrycache::k_dentryCache.unlink( this );
+    }
+
+    void dentry::move( dentry *new_parent, const eastl::string &new_name )
+    {
+        dentrycache::k_dentryCache.move( this, new_parent, new_name );
     }
 
     int dentry::readDir( Dstat *dst, size_t off, size_t len )
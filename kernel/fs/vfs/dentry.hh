@@ -51,19 +51,43 @@ namespace fs
 		dentry *parent;
 		uint Did; // dentry id
 		bool isroot;
+		bool _mounted = false; // 上面挂着文件系统，查找时经挂载点哈希换成被挂载文件系统的根
+
+		// 以下由 dentryCache 维护，构造时清零
+		dentry	*_hnext	   = nullptr; // 哈希链
+		dentry **_hpprev   = nullptr; // 指向前驱的 _hnext，nullptr 表示不在哈希表中
+		dentry	*_lru_prev = nullptr;
+		dentry	*_lru_next = nullptr;
+		uint32	 _hash	   = 0;		  // 名字的哈希
+		uint32	 _ref	   = 0;		  // 打开的文件、工作目录和挂载点持有的引用
+		uint32	 _nsub	   = 0;		  // 哈希表中以它为父的目录项数（含负目录项）
+		bool	 _pinned   = false;	  // 不能经 lookup 重建，不会被淘汰
+		bool	 _on_lru   = false;
+		bool	 _unlinked = false;	  // 已被删除，最后一个引用放掉时释放
 
 	public:
 		dentry() = default; //{ name.clear(); children.clear(); node = nullptr;  parent = nullptr; isroot = false; };
-		dentry( const dentry& ) = default;
-		dentry & operator=( const dentry& ) = default;
+		dentry( const dentry& ) = delete;	// 哈希和 LRU 链挂在对象本身上，不能复制
+		dentry & operator=( const dentry& ) = delete;
 		dentry( eastl::string name, Inode* node, dentry* parent , bool isroot = false ) : name( name ), _node( node ), parent( parent ), isroot(isroot) {}
 		dentry( uint did ) : Did( did ) {} // only for dentrycache
 		~dentry();
 
+		/// @brief 在本目录下查找 name，不存在时返回 nullptr（同时缓存为负目录项）。
+		/// 返回的目录项带一个引用，调用者用完后 dput
 		dentry *EntrySearch( eastl::string name );
+		/// @brief 同上，name 不必以 0 结尾，hash 由调用者用 dentryCache::hashName 算好。
+		/// 命中缓存时不分配内存；结果是挂载点时返回挂在上面的文件系统的根
+		dentry *EntrySearch( const char *name, size_t len, uint32 hash );
+		/// @brief 在本目录下新建 name，返回的目录项同样带一个引用
 		dentry *EntryCreate( eastl::string name, FileAttrs attrs, eastl::string dev_name = "" );
 		Inode *getNode();
 		bool isRoot();
+		/// @brief 负目录项：缓存"该名字不存在"这一结果
+		bool isNegative() { return _node == nullptr; }
+		/// @brief 持有目录项指针的地方（查找结果、打开的文件、工作目录、挂载点）都要有引用，防止被淘汰或删除后释放
+		void dget();
+		void dput();
 		dentry *getParent() { return parent == nullptr ? nullptr : parent; };
 		eastl::string rName() { return name; };
 		uint getDid() { return Did; };
@@ -71,9 +95,14 @@ namespace fs
 		eastl::unordered_map<eastl::string, dentry*> &getChildren() { return children; };
 		//bool is_root();
 		bool isMntPoint();
+		bool isMounted() { return _mounted; }
+		void setMounted( bool mounted ) { _mounted = mounted; }
 		void delete_child( eastl::string name ) { children.erase( name ); };
 		void setParent( dentry *parent ) { this->parent = parent; };
+		/// @brief 名字对应的文件已被删除，原处留下负目录项
 		void unlink();
+		/// @brief 改名，把本目录项移到 new_parent 下的 new_name
+		void move( dentry *new_parent, const eastl::string &new_name );
 		void setNode( Inode * node_ ) { _node = node_; };
 		int readDir( Dstat *dst, size_t off, size_t len );
 
@@ -1,9 +1,8 @@
 #include "fs/vfs/dentrycache.hh"
-#include "common.hh"
-
-#include <EASTL/string.h>
-#include <EASTL/list.h>
-#include <EASTL/iterator.h>
+#include "fs/vfs/inode.hh"
+#include "physical_memory_manager.hh"
+#include "printer.hh"
+#include "klib.hh"
 
 namespace fs
 {
@@ -11,118 +10,311 @@ namespace fs
     namespace dentrycache
     {
         dentryCache k_dentryCache;
-        
+
         void dentryCache::init()
         {
             _lock.init( "dentryCache" );
-            
-            uint _index = 0;
-            for( ; _index < MAX_DENTRY_NUM ; ++_index )
+
+            uint64 cap = ( ( mem::k_pmm.free_pages() * PGSIZE ) >> DENTRY_MEM_SHIFT ) / sizeof( dentry );
+            if ( cap < MIN_DENTRY_NUM )
+                cap = MIN_DENTRY_NUM;
+            _capacity = (uint) cap;
+
+            // 桶数取不小于容量的 2 的幂，平均每条链不到一项
+            _nbucket = 1;
+            while ( _nbucket < _capacity )
+                _nbucket <<= 1;
+            _buckets = new dentry *[_nbucket];
+            for ( uint i = 0; i < _nbucket; ++i )
+                _buckets[i] = nullptr;
+
+            _count = 0;
+            _free = nullptr;
+            _lru_head = _lru_tail = nullptr;
+            printfGreen( "[dcache] capacity %d dentries, %d buckets\n", _capacity, _nbucket );
+        }
+
+        uint32 dentryCache::hashName( const char *name, size_t len )
+        {
+            // FNV-1a
+            uint32 h = 2166136261U;
+            for ( size_t i = 0; i < len; ++i )
             {
-                dentryCacheElementPool_[ _index ].is_active_ = false;
-                dentryCacheElementPool_[ _index ].pin_ = false;
-                freeList_.push_back( &dentryCacheElementPool_[ _index ] );
+                h ^= (uint8) name[i];
+                h *= 16777619U;
             }
-            leafList_.clear();
-            intenalList_.clear();
+            return h;
+        }
+
+        dentry *dentryCache::alloDentry()
+        {
+            _lock.acquire();
+            if ( _count >= _capacity )
+                _evict();   // 没有可淘汰的项时照样分配，容量只是软上限
+            dentry *d = _free;
+            if ( d != nullptr )
+                _free = d->_hnext;
+            _count++;
+            _lock.release();
+
+            if ( d == nullptr )
+                d = (dentry *) ::operator new( sizeof( dentry ) );
+            return d;
+        }
+
+        void dentryCache::freeDentry( dentry *d )
+        {
+            _lock.acquire();
+            _destroy( d );
+            _lock.release();
         }
 
-        dentry* dentryCache::alloDentry( ) 
+        dentry *dentryCache::lookup( dentry *parent, const char *name, size_t len, uint32 hash )
         {
             _lock.acquire();
-            dentry *dentry = nullptr;
- 
-            if( freeList_.empty() )
+            dentry *d = _find( parent, name, len, hash );
+            if ( d != nullptr )
             {
-                dentry = releaseInactiveDentry( );
+                // 在锁内拿引用，放锁后别的核的 unlink/淘汰不会释放它
+                d->_ref++;
+                _lru_update( d );
             }
-            else
+            _lock.release();
+            return d;
+        }
+
+        dentry *dentryCache::insert( dentry *d, uint32 hash, bool pinned )
+        {
+            d->_hash = hash;
+            d->_pinned = pinned;
+            _lock.acquire();
+            // 查找到插入之间放过锁（lookup 可能读磁盘），别人可能已经插入了同名项
+            dentry *old = _find( d->parent, d->name.c_str(), d->name.size(), hash );
+            if ( old != nullptr )
             {
-                dentryCacheElement *element = freeList_.front();
-                freeList_.pop_front();
-                dentry = &( element->dentry );
-                leafListPushBack( dentry );
+                _destroy( d );
+                old->_ref++;
+                _lru_update( old );
+                _lock.release();
+                return old;
             }
+            d->_ref++;
+            _hash( d );
+            _lock.release();
+            return d;
+        }
+
+        void dentryCache::instantiate( dentry *d, Inode *node )
+        {
+            _lock.acquire();
+            d->_node = node;
+            d->_pinned = true;
+            if ( d->_hpprev != nullptr && d->parent != nullptr )
+                d->parent->children[d->name] = d;
+            _lru_update( d );
             _lock.release();
-            return dentry;
         }
 
-        void dentryCache::touchDentry(dentry *den)
+        void dentryCache::unlink( dentry *d )
         {
-            for( auto &it : leafList_ )
+            if ( d->parent == nullptr || d->isNegative() )
+                return;
+            // 先在锁外准备好负目录项
+            dentry *neg = alloDentry();
+            new ( neg ) dentry( d->name, nullptr, d->parent );
+            neg->_hash = d->_hash;
+
+            _lock.acquire();
+            if ( d->_hpprev == nullptr || d->_unlinked )
             {
-                if( &( it->dentry ) == den )
-                {
-                    it->pin_ = true;
-                    leafList_.remove( it );
-                    intenalList_.push_back( it );
-                }
+                _destroy( neg );
+                _lock.release();
+                return;
             }
+            // 从磁盘查到的项被删掉后，lookup 仍会在磁盘上找到它（ext4 是只读的），
+            // 这时负目录项就是唯一的删除记录，不能淘汰
+            neg->_pinned = !d->_pinned;
+            _unhash( d );
+            d->_unlinked = true;
+            _hash( neg );
+            if ( d->_ref == 0 && d->_nsub == 0 )
+                _destroy( d );
+            _lock.release();
         }
-        
-        dentry* dentryCache::releaseInactiveDentry( ) 
+
+        void dentryCache::move( dentry *d, dentry *new_parent, const eastl::string &new_name )
         {
-            for( auto &it : leafList_ )
+            if ( d->parent == nullptr || d->isNegative() )
+                return;
+            if ( d->parent == new_parent && d->name == new_name )
+                return;
+            uint32 new_hash = hashName( new_name );
+            dentry *neg = alloDentry();
+            new ( neg ) dentry( d->name, nullptr, d->parent );
+            neg->_hash = d->_hash;
+
+            _lock.acquire();
+            if ( d->_hpprev == nullptr || d->_unlinked )
             {
-                if( it->pin_ == false ) // leaf的pin恒为 false
-                {
-                    // 处理 其 父节点
-                    dentry *parent = it->dentry.getParent();
-                    if( parent )
-                    {
-                        parent->children.erase( it->dentry.rName() );
-                        if( parent->children.empty() )
-                        {
-                            intenalListRemove( parent );
-                            leafListPushBack( parent );
-                        }    
-                    }
-                    it->is_active_ = false;
-                    leafList_.remove( it );
-                    return &( it->dentry );
-                }
+                _destroy( neg );
+                _lock.release();
+                return;
+            }
+            // 目标名字上已有的项被覆盖：负目录项直接丢掉，正目录项按删除处理
+            dentry *old = _find( new_parent, new_name.c_str(), new_name.size(), new_hash );
+            if ( old != nullptr && old != d )
+            {
+                _unhash( old );
+                old->_unlinked = true;
+                if ( old->_ref == 0 && old->_nsub == 0 )
+                    _destroy( old );
             }
-            return nullptr; // 如果没有找到匹配的dentry，返回nullptr
+            neg->_pinned = !d->_pinned;
+            _unhash( d );
+            d->name = new_name;
+            d->parent = new_parent;
+            d->_hash = new_hash;
+            // 改名只发生在内存里，新名字无法再经 lookup 找回
+            d->_pinned = true;
+            _hash( d );
+            _hash( neg );
+            _lock.release();
+        }
+
+        void dentryCache::dget( dentry *d )
+        {
+            _lock.acquire();
+            d->_ref++;
+            _lru_update( d );
+            _lock.release();
         }
 
-        void dentryCache::intenalListRemove( dentry * d ) 
+        void dentryCache::dput( dentry *d )
         {
-            for(auto &it : intenalList_)
+            _lock.acquire();
+            if ( d->_ref == 0 )
+                panic( "dput: dentry %s ref underflow", d->name.c_str() );
+            d->_ref--;
+            if ( d->_unlinked )
             {
-                if( &( it->dentry ) == d )
-                {
-                    intenalList_.remove( it );
-                    return;
-                }
+                if ( d->_ref == 0 && d->_nsub == 0 )
+                    _destroy( d );
             }
+            else
+                _lru_update( d );
+            _lock.release();
         }
 
-        void dentryCache::intenalListPushBack( dentry * d )
+        dentry *dentryCache::_find( dentry *parent, const char *name, size_t len, uint32 hash )
         {
-            dentryCacheElement element = dentryCacheElement( *d, true, true );
-            intenalList_.push_back( &element );
-            return;
+            for ( dentry *d = _buckets[_bucket_of( parent, hash )]; d != nullptr; d = d->_hnext )
+            {
+                if ( d->_hash == hash && d->parent == parent && d->name.size() == len &&
+                     memcmp( d->name.c_str(), name, len ) == 0 )
+                    return d;
+            }
+            return nullptr;
         }
 
-        void dentryCache::leafListRemove( dentry * d )
+        void dentryCache::_hash( dentry *d )
         {
-            for(auto &it : leafList_)
+            dentry **head = &_buckets[_bucket_of( d->parent, d->_hash )];
+            d->_hnext = *head;
+            if ( *head ) ( *head )->_hpprev = &d->_hnext;
+            *head = d;
+            d->_hpprev = head;
+
+            dentry *p = d->parent;
+            if ( p != nullptr )
             {
-                if( &( it->dentry ) == d )
+                p->_nsub++;
+                if ( !d->isNegative() )
+                    p->children[d->name] = d;
+                _lru_update( p );
+            }
+            _lru_update( d );
+        }
+
+        void dentryCache::_unhash( dentry *d )
+        {
+            *d->_hpprev = d->_hnext;
+            if ( d->_hnext ) d->_hnext->_hpprev = d->_hpprev;
+            d->_hnext = nullptr;
+            d->_hpprev = nullptr;
+            if ( d->_on_lru )
+                _lru_del( d );
+
+            dentry *p = d->parent;
+            if ( p != nullptr )
+            {
+                p->_nsub--;
+                if ( !d->isNegative() )
+                {
+                    auto it = p->children.find( d->name );
+                    if ( it != p->children.end() && it->second == d )
+                        p->children.erase( it );
+                }
+                // 已删除的目录等最后一个子项离开后释放
+                if ( p->_unlinked )
                 {
-                    leafList_.remove( it );
-                    return;
+                    if ( p->_ref == 0 && p->_nsub == 0 )
+                        _destroy( p );
                 }
+                else
+                    _lru_update( p );
             }
         }
 
-        void dentryCache::leafListPushBack( dentry * d )
+        bool dentryCache::_evictable( dentry *d ) const
+        {
+            return d->_hpprev != nullptr && !d->_pinned && d->_ref == 0 && d->_nsub == 0;
+        }
+
+        void dentryCache::_lru_update( dentry *d )
+        {
+            bool want = _evictable( d );
+            if ( want && !d->_on_lru )
+            {
+                d->_lru_prev = _lru_tail;
+                d->_lru_next = nullptr;
+                if ( _lru_tail ) _lru_tail->_lru_next = d;
+                else _lru_head = d;
+                _lru_tail = d;
+                d->_on_lru = true;
+            }
+            else if ( !want && d->_on_lru )
+                _lru_del( d );
+        }
+
+        void dentryCache::_lru_del( dentry *d )
+        {
+            if ( d->_lru_prev ) d->_lru_prev->_lru_next = d->_lru_next;
+            else _lru_head = d->_lru_next;
+            if ( d->_lru_next ) d->_lru_next->_lru_prev = d->_lru_prev;
+            else _lru_tail = d->_lru_prev;
+            d->_lru_prev = d->_lru_next = nullptr;
+            d->_on_lru = false;
+        }
+
+        bool dentryCache::_evict()
+        {
+            // LRU 链上只有没人引用、可以淘汰的叶子，链头就是最久未用的那个
+            dentry *d = _lru_head;
+            if ( d == nullptr )
+                return false;
+            _unhash( d );
+            _destroy( d );
+            return true;
+        }
+
+        void dentryCache::_destroy( dentry *d )
         {
-            dentryCacheElement *element = new dentryCacheElement( *d, false, false );
-            leafList_.push_back( element );
-            return;
+            d->~dentry();   // 连同 inode 一起释放
+            d->_hnext = _free;
+            _free = d;
+            _count--;
         }
 
     } //  namespace dentrycache
 
-} // namespace fs
\ No newline at end of file
+} // namespace fs
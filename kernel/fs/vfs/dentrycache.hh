@@ -1,66 +1,86 @@
+#pragma once
+
 #include "types.hh"
 #include "fs/vfs/dentry.hh"
 
-#include <EASTL/string.h>
-#include <EASTL/list.h>
-#include <EASTL/vector.h>
-#include <EASTL/unique_ptr.h>
-#include <EASTL/tuple.h>
-
 #include "spinlock.hh"
 
-using eastl::tuple;
-using eastl::vector;
-using eastl::unique_ptr;
-using eastl::list;
-using eastl::string;
-
 namespace fs
 {
     class dentry;
     namespace dentrycache
     {
+        constexpr uint MIN_DENTRY_NUM = 256;      // 内存再小也至少缓存这么多项
+        constexpr uint DENTRY_MEM_SHIFT = 6;      // 缓存容量按初始化时空闲内存的 1/64 计算
 
-        
-
-        constexpr uint MAX_DENTRY_NUM = 200;
         /**
-         * @brief Dentry cache
-         * @test dentryCacheTest
+         * @brief 目录项缓存
+         * 以 (父目录项, 名字) 为键的哈希表，链表指针直接放在 dentry 里，查找和插入都不分配内存。
+         * 查找失败的名字也缓存为负目录项（_node 为 nullptr），busybox/sh 沿 $PATH 逐个试探时不必每次都去读磁盘目录。
+         * 能经 Inode::lookup 重建、又没有人引用的叶子目录项挂在一条 LRU 链上，
+         * 目录项数达到容量后从链头淘汰，淘汰和访问都是 O(1)。
+         * 文件系统根、EntryCreate 新建的项（ramfs 和 ext4 上新建的文件都只在内存里）不会被淘汰。
          */
-
-        struct dentryCacheElement
-        {
-            fs::dentry dentry;
-            bool is_active_;
-            bool pin_;
-            dentryCacheElement() { is_active_ = false; pin_ = false;};
-            dentryCacheElement( fs::dentry den , bool active_, bool pin_ ) : dentry( den ), is_active_( active_ ), pin_( pin_ ) {}
-        };
-
         class dentryCache
         {
             SpinLock _lock;
-            list<dentryCacheElement *> leafList_;  // leaf list
-            list<dentryCacheElement *> intenalList_; // interal list
-            list<dentryCacheElement *> freeList_; // free list
-            dentryCacheElement *freeListHead_; // free list head
-            dentryCacheElement dentryCacheElementPool_[MAX_DENTRY_NUM];
-            
+            dentry **_buckets = nullptr;
+            uint _nbucket = 0;
+            uint _capacity = 0;   // 达到这么多项后先淘汰再分配
+            uint _count = 0;      // 已经分配出去的目录项数
+            dentry *_free = nullptr;        // 淘汰下来的空闲目录项，借用 _hnext 串起来
+            dentry *_lru_head = nullptr;    // 最久未使用的一端
+            dentry *_lru_tail = nullptr;
+
         public:
             dentryCache() = default;
             ~dentryCache() = default;
 
             void init();
+
+            /// @brief 分配一个未初始化的目录项，调用者用 placement new 构造。
+            /// 只有用 insert 挂进哈希表的目录项才可能被淘汰
             dentry *alloDentry();
-            void touchDentry(dentry *dentry);
-            dentry *releaseInactiveDentry();
-            void intenalListRemove( dentry *dentry );
-            void intenalListPushBack( dentry *dentry );
-            void leafListPushBack( dentry *dentry );
-            void leafListRemove( dentry *dentry );
+            /// @brief 释放 alloDentry 得到、已经构造但没有挂进哈希表的目录项
+            void freeDentry( dentry *d );
+
+            static uint32 hashName( const char *name, size_t len );
+            static uint32 hashName( const eastl::string &name ) { return hashName( name.c_str(), name.size() ); }
+
+            /// @brief 在 parent 下查找名字为 name 的目录项（可能是负目录项）。
+            /// 命中时已经持有一个引用，调用者用完后 dput
+            dentry *lookup( dentry *parent, const char *name, size_t len, uint32 hash );
+            /// @brief 把构造好的目录项挂进哈希表，正目录项同时加入父目录的 children。
+            /// 如果别人已经插入了同名项，释放 d 并返回已有的那一项；返回的目录项同样带一个引用
+            dentry *insert( dentry *d, uint32 hash, bool pinned );
+
+            /// @brief 把负目录项变成指向 node 的正目录项，由 EntryCreate 调用
+            void instantiate( dentry *d, Inode *node );
+            /// @brief 目录项对应的文件被删除：在原处留下一个负目录项，
+            /// d 本身从哈希表摘下，没有引用时立即释放，否则等最后一个 dput
+            void unlink( dentry *d );
+            /// @brief 把 d 移到 new_parent 下的 new_name，原名字和新名字上的负目录项一并处理
+            void move( dentry *d, dentry *new_parent, const eastl::string &new_name );
+
+            void dget( dentry *d );
+            void dput( dentry *d );
+
+        private:
+            uint32 _bucket_of( dentry *parent, uint32 hash ) const
+            {
+                uint64 h = hash ^ ( (uint64) parent >> 4 ) ^ ( (uint64) parent >> 16 );
+                return (uint32) h & ( _nbucket - 1 );
+            }
+            dentry *_find( dentry *parent, const char *name, size_t len, uint32 hash );
+            void _hash( dentry *d );
+            void _unhash( dentry *d );
+            bool _evictable( dentry *d ) const;
+            void _lru_update( dentry *d );
+            void _lru_del( dentry *d );
+            bool _evict();
+            void _destroy( dentry *d );
         };
 
         extern dentryCache k_dentryCache;
     }
-}
\ No newline at end of file
+}
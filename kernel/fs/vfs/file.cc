@@ -281,16 +281,4 @@ namespace fs
 		return nullptr;
 	}
 
-	int file_pool::unlink( eastl::string path )
-	{
-		_lock.acquire();
-		_unlink_list.push_back( path );
-		_lock.release();
-		return 0;
-	}
-	void file_pool::remove( eastl::string path )
-	{
-		_unlink_list.erase_first(path);
-	}
-
 } // namespace fs
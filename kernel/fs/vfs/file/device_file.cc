@@ -11,7 +11,7 @@ namespace fs
 
 	long device_file::read( uint64 buf, size_t len, long off, bool upgrade )
 	{
-		printfMagenta("[file] it is a device file\n");
+		log_trace("[file] it is a device file\n");
 		int ret;
 
 		if ( _attrs.u_read != 1 )
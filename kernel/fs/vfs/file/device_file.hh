@@ -1,4 +1,5 @@
 #include "fs/vfs/file/file.hh"
+#include "fs/vfs/dentry.hh"
 
 struct termios;
 
@@ -10,7 +11,6 @@ namespace dev
 
 namespace fs
 {
-	class dentry;
 	class device_file : public file
 	{
 	private:
@@ -24,12 +24,12 @@ namespace fs
 		/// @param attrs 文件属性，用于初始化基类 file。
 		/// @param dev 设备号（当前参数已废弃，实际设备号应从 node 中获取）。
 		/// @param den 指向目录项（dentry）的指针，用于标识该设备文件在文件系统中的位置。
-		device_file( FileAttrs attrs, uint dev, dentry *den ) : file( attrs), _dentry( den ) { dup(); };  // 这里 device 的 dev已经没有用了，应该去node里面找
+		device_file( FileAttrs attrs, uint dev, dentry *den ) : file( attrs), _dentry( den ) { dup(); if ( den != nullptr ) den->dget(); };  // 这里 device 的 dev已经没有用了，应该去node里面找
 		/// @brief 设备文件构造函数，初始化设备文件对象并增加引用计数。
 		/// @param dev 设备编号，用于标识具体的设备。
 		/// @param den 指向目录项（dentry）的指针，表示该设备文件在文件系统中的位置。
 		device_file( uint dev, dentry *den ) : device_file( FileAttrs( FileTypes::FT_DEVICE, 0777 ), dev, den ) { dup();};
-		~device_file() = default;
+		~device_file() { if ( _dentry != nullptr ) _dentry->dput(); }
 
 		/// @brief 从设备文件中读取数据到指定缓冲区。
 		/// @param buf 目标缓冲区的地址，用于存放读取到的数据。
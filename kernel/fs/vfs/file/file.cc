@@ -1,4 +1,5 @@
 #include "fs/vfs/file/file.hh"
+#include "fs/vfs/io_iter.hh"
 
 #include "proc.hh"
 #include "proc_manager.hh"
@@ -31,4 +32,39 @@ namespace fs
         return ret;
     }
     
+
+    long file::read_iter( IoIter &it, long off, bool upgrade_off )
+    {
+        size_t n;
+        u8 *p = it.chunk( it.count(), n );
+        if ( p == nullptr )
+            return it.faulted() ? -EFAULT : 0;
+        long r = read( (uint64) p, n, off, upgrade_off );
+        if ( r > 0 )
+            it.advance( r );
+        return r;
+    }
+
+    long file::write_iter( IoIter &it, long off, bool upgrade_off )
+    {
+        long done = 0;
+        size_t n;
+        while ( u8 *p = it.chunk( it.count(), n ) )
+        {
+            long r = write( (uint64) p, n, off < 0 ? -1 : off + done, upgrade_off );
+            if ( r <= 0 )
+            {
+                if ( done == 0 && r < 0 )
+                    return r;
+                break;
+            }
+            it.advance( r );
+            done += r;
+            if ( (size_t) r < n )
+                break;
+        }
+        if ( done == 0 && it.faulted() )
+            return -EFAULT;
+        return done;
+    }
 }
\ No newline at end of file
@@ -24,6 +24,7 @@ namespace fs
 {
 	class dentry;
 	class file_pool;
+	class IoIter;
 	class File
 	{
 		friend file_pool;
@@ -116,16 +117,12 @@ namespace fs
 	private:
 		SpinLock _lock;
 		File _files[ file_pool_max_size ];
-		eastl::vector <eastl::string> _unlink_list;
 	public:
 		void init();
 		File * alloc_file();
 		void free_file( File * f );
 		void dup( File * f );
 		File * find_file( eastl::string path );
-		int unlink( eastl::string path );
-		void remove( eastl::string path );
-		bool has_unlinked( eastl::string path ) { return eastl::find( _unlink_list.begin(), _unlink_list.end(), path ) != _unlink_list.end(); };
 	};
 
 	extern file_pool k_file_table;
@@ -144,6 +141,12 @@ namespace fs
 		virtual void free_file() { refcnt--; if ( refcnt == 0 ) delete this; };
 		virtual long read( uint64 buf, size_t len, long off, bool upgrade_off ) = 0;
 		virtual long write( uint64 buf, size_t len, long off, bool upgrade_off ) = 0;
+		/// @brief 读到 it 描述的缓冲区（可以是用户缓冲区），不经内核中转缓冲区。
+		/// 默认把第一段可访问的地址交给 read 原地填充，读到数据就返回：
+		/// 设备这类流式文件不应为了凑满缓冲区再次阻塞
+		virtual long read_iter( IoIter &it, long off, bool upgrade_off );
+		/// @brief 把 it 描述的缓冲区写入文件，默认逐段交给 write，遇到短写停止
+		virtual long write_iter( IoIter &it, long off, bool upgrade_off );
 		virtual void dup() { refcnt++; };   //增加引用计数
 		virtual bool read_ready() = 0;
 		virtual bool write_ready() = 0;
@@ -1,5 +1,6 @@
 #include "fs/vfs/file/normal_file.hh"
 
+#include "fs/vfs/io_iter.hh"
 #include "mem/userspace_stream.hh"
 namespace fs
 {
@@ -20,12 +21,41 @@ namespace fs
 		}
 		if (off < 0)
 			off = _file_ptr;
+		_readahead(node, off, len);
 		ret = node->nodeRead(buf, off, len);
 		if (ret >= 0 && upgrade)
 			_file_ptr += ret;
+		_ra_prev_end = off + (ret > 0 ? ret : 0);
 		return ret;
 	}
 
+	void normal_file::_readahead(Inode *node, size_t off, size_t len)
+	{
+		if (len == 0)
+			return;
+		if (off != _ra_prev_end)
+		{
+			// 发生跳转：窗口清零，只把本次要读的部分一次性发出去
+			_ra_window = 0;
+			_ra_next = off;
+		}
+		else if (_ra_window == 0)
+			_ra_window = file_ra_min_window;
+		else if (_ra_window < file_ra_max_window)
+			_ra_window *= 2;
+
+		if (_ra_next < off)
+			_ra_next = off;
+		size_t want_end = off + len + _ra_window;
+		// 已预读的部分还够半个窗口时不再发，避免每次小读都产生一个小请求
+		if (_ra_window != 0 && _ra_next >= off + len + _ra_window / 2)
+			return;
+		if (_ra_next >= want_end)
+			return;
+		node->readahead(_ra_next, want_end - _ra_next);
+		_ra_next = want_end;
+	}
+
 	long normal_file::write(uint64 buf, size_t len, long off, bool upgrade)
 	{
 		long ret;
@@ -54,6 +84,53 @@ namespace fs
 		return ret;
 	}
 
+	long normal_file::read_iter(IoIter &it, long off, bool upgrade)
+	{
+		if (_attrs.u_read != 1)
+		{
+			printfRed("normal_file:: not allowed to read! ");
+			return -1;
+		}
+		Inode *node = _den->getNode();
+		if (node == nullptr)
+		{
+			printfRed("normal_file:: null inode for dentry %s",
+					  _den->rName().c_str());
+			return -1;
+		}
+		if (off < 0)
+			off = _file_ptr;
+		_readahead(node, off, it.count());
+		long ret = node->nodeReadIter(it, off);
+		if (ret >= 0 && upgrade)
+			_file_ptr += ret;
+		_ra_prev_end = off + (ret > 0 ? ret : 0);
+		return ret;
+	}
+
+	long normal_file::write_iter(IoIter &it, long off, bool upgrade)
+	{
+		if (_attrs.u_write != 1)
+		{
+			printfRed("normal_file:: not allowed to write! ");
+			return -1;
+		}
+		Inode *node = _den->getNode();
+		if (node == nullptr)
+		{
+			printfRed("normal_file:: null inode for dentry %s",
+					  _den->rName().c_str());
+			return -1;
+		}
+		if (off < 0)
+			off = _file_ptr;
+		long ret = node->nodeWriteIter(it, off);
+		if (ret >= 0 && upgrade)
+			_file_ptr += ret;
+		this->_stat.size = node->rFileSize();
+		return ret;
+	}
+
 	bool normal_file::read_ready()
 	{
 		if (_attrs.filetype == FileTypes::FT_DIRECT)
@@ -116,4 +193,18 @@ namespace fs
 	{
 		_file_ptr = this->_stat.size;
 	}
+
+	int normal_file::truncate(size_t len)
+	{
+		if (_attrs.u_write != 1)
+			return -EBADF;
+		Inode *node = _den->getNode();
+		if (node == nullptr)
+			return -EINVAL;
+		int ret = node->truncate(len);
+		if (ret < 0)
+			return -EINVAL;
+		this->_stat.size = node->rFileSize();
+		return 0;
+	}
 } // namespace fs
@@ -8,15 +8,25 @@ namespace mem
 
 namespace fs
 {
+	constexpr size_t file_ra_min_window = 16 * 1024;	// 顺序读开始时的预读窗口
+	constexpr size_t file_ra_max_window = 512 * 1024;	// 预读窗口上限
+
 	class normal_file : public file
 	{
 	protected:
-		dentry *_den;
+		dentry *_den = nullptr;	// 持有一份引用，防止被目录项缓存淘汰
+
+		// 顺序预读状态（均为字节偏移）：连续读时窗口翻倍增长，发生跳转则清零
+		size_t _ra_prev_end = 0;	// 上一次读结束的位置，下一次从这里读即视为顺序读
+		size_t _ra_next = 0;		// 已发出预读的终点
+		size_t _ra_window = 0;		// 当前预读窗口，0 表示未处于顺序读
+
+		void _readahead( Inode *node, size_t off, size_t len );
 	public:
 		normal_file() = default;
-		normal_file( FileAttrs attrs, dentry *den ) : file( attrs ), _den( den ) { dup(); new ( &_stat ) Kstat( den ); }
-		normal_file( dentry *den ) : file( den->getNode()->rMode() ), _den( den ) { dup(); new ( &_stat ) Kstat( den ); }
-		~normal_file() = default;
+		normal_file( FileAttrs attrs, dentry *den ) : file( attrs ), _den( den ) { dup(); new ( &_stat ) Kstat( den ); den->dget(); }
+		normal_file( dentry *den ) : file( den->getNode()->rMode() ), _den( den ) { dup(); new ( &_stat ) Kstat( den ); den->dget(); }
+		~normal_file() { if ( _den != nullptr ) _den->dput(); }
 
 		/// @brief 从文件中读取数据到指定缓冲区。
 		/// @param buf 目标缓冲区的地址，用于存放读取到的数据。
@@ -33,6 +43,11 @@ namespace fs
 		/// @param upgrade 如果 upgrade 为 true，写完后文件指针自动后移。
 		/// @return 实际写入的字节数，若发生错误则返回负值表示错误码。
 		virtual long write( uint64 buf, size_t len, long off = -1, bool upgrade = true ) override;
+
+		/// @brief 与 read 相同，但经 Inode::nodeReadIter 直接填充 it 描述的缓冲区，预读按整次请求计算
+		virtual long read_iter( IoIter &it, long off = -1, bool upgrade = true ) override;
+		/// @brief 与 write 相同，但经 Inode::nodeWriteIter 直接从 it 描述的缓冲区取数据
+		virtual long write_iter( IoIter &it, long off = -1, bool upgrade = true ) override;
 		virtual bool read_ready() override;
 		virtual bool write_ready() override;
 		virtual off_t lseek( off_t offset, int whence ) override;
@@ -40,6 +55,8 @@ namespace fs
 		using ubuf = mem::UserspaceStream;
 		size_t read_sub_dir( ubuf &dst );
 		void setAppend();
+		/// @brief 把文件截断或扩展到 len 字节，需要写权限
+		int truncate( size_t len );
 		dentry *getDentry() { return _den; }
 	};
 }
\ No newline at end of file
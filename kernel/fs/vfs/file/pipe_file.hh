@@ -35,6 +35,8 @@ namespace fs
 
 		int write_in_kernel(uint64 buf, size_t len) { return _pipe->write_in_kernel(buf, len); }
 
+		proc::ipc::Pipe *get_pipe() { return _pipe; }
+
 		virtual bool read_ready() override { return _pipe->read_is_open(); }
 		virtual bool write_ready() override { return _pipe->write_is_open(); }
 		virtual off_t lseek(off_t offset, int whence) override { return -ESPIPE; }
@@ -0,0 +1,48 @@
+#include "fs/vfs/inode.hh"
+#include "fs/vfs/io_iter.hh"
+
+#include <asm-generic/errno-base.h>
+
+namespace fs
+{
+	long Inode::nodeReadIter( IoIter &it, size_t off )
+	{
+		long   done = 0;
+		size_t n;
+		while ( u8 *p = it.chunk( it.count(), n ) )
+		{
+			long r = (long) nodeRead( (uint64) p, off + done, n );
+			if ( r <= 0 )
+			{
+				if ( done == 0 && r < 0 ) return r;
+				break;
+			}
+			it.advance( r );
+			done += r;
+			if ( (size_t) r < n ) break; // 文件到尾
+		}
+		if ( done == 0 && it.faulted() ) return -EFAULT;
+		return done;
+	}
+
+	long Inode::nodeWriteIter( IoIter &it, size_t off )
+	{
+		long   done = 0;
+		size_t n;
+		while ( u8 *p = it.chunk( it.count(), n ) )
+		{
+			long r = (long) nodeWrite( (uint64) p, off + done, n );
+			if ( r <= 0 )
+			{
+				if ( done == 0 && r < 0 ) return r;
+				break;
+			}
+			it.advance( r );
+			done += r;
+			if ( (size_t) r < n ) break;
+		}
+		if ( done == 0 && it.faulted() ) return -EFAULT;
+		return done;
+	}
+
+} // namespace fs
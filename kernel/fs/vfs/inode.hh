@@ -23,6 +23,8 @@ namespace fs
 	class DStat;
 	class SuperBlock;
 	class FileSystem;
+	class PageCache;
+	class IoIter;
 
 	class Inode
 	{
@@ -48,6 +50,33 @@ namespace fs
 		virtual size_t nodeRead( uint64 dst_, size_t off_, size_t len_ )  = 0;
 		virtual size_t nodeWrite( uint64 src_, size_t off_, size_t len_ ) = 0;
 
+		/// @brief 把文件截断或扩展到 size_ 字节，扩展出来的部分读出为 0
+		/// @return 成功为 0；不支持改变大小的文件系统返回 -1
+		virtual int truncate( size_t size_ ) { return -1; }
+
+		/// @brief 从 off_ 起把文件读进 it 描述的缓冲区，直到填满或到达文件末尾。
+		/// 默认逐段取出可直接访问的地址交给 nodeRead，用户缓冲区被原地填充，不经中转缓冲区
+		/// @return 读到的字节数；一个字节都没读到时返回 nodeRead 的错误或 -EFAULT
+		virtual long nodeReadIter( IoIter& it, size_t off_ );
+		/// @brief 从 off_ 起把 it 描述的缓冲区写进文件，默认逐段交给 nodeWrite
+		virtual long nodeWriteIter( IoIter& it, size_t off_ );
+
+		/// @brief 提示文件系统 [off_, off_+len_) 即将被读取，可以异步地把数据提前读入缓存。
+		/// 只是提示：不等待 I/O 完成，也不保证一定预读；默认什么都不做。
+		virtual void readahead( size_t off_, size_t len_ ) {}
+
+		/// @brief 该 inode 的页缓存；不使用页缓存的文件系统返回 nullptr，mmap/exec 退回逐页拷贝
+		virtual PageCache* pageCache() { return nullptr; }
+
+		/// @brief 绕过页缓存把文件第 index 页读入 pa（文件末尾之后的部分保持为 0），供页缓存填充
+		/// @return 读到的字节数，整页都在文件末尾之后时为 0，出错为负
+		virtual long readPage( void* pa, uint64 index ) { return -1; }
+
+		/// @brief 把该文件的脏数据写回存储并等待完成，只等待属于这个文件的缓冲区
+		/// @param datasync_ 为 true 时只保证数据及读取数据所需的元数据落盘（fdatasync）
+		/// @return 成功为 0，写回失败为负；没有写回路径的文件系统无事可做
+		virtual int sync( bool datasync_ ) { return 0; }
+
 		using ubuf = mem::UserspaceStream;
 		struct linux_dirent64
 		{
@@ -0,0 +1,149 @@
+#include "fs/vfs/io_iter.hh"
+#include "virtual_memory_manager.hh"
+#include "physical_memory_manager.hh"
+#ifdef RISCV
+#include "mem/riscv/pagetable.hh"
+#elif defined( LOONGARCH )
+#include "mem/loongarch/pagetable.hh"
+#endif
+#include "platform.hh"
+#include "klib.hh"
+
+namespace fs
+{
+	IoIter::IoIter( void *buf, size_t len, bool dest )
+		: _pt( nullptr ), _iov( &_single ), _nr_seg( 1 ), _count( len ), _dest( dest )
+	{
+		_single = { (uint64) buf, len };
+	}
+
+	IoIter::IoIter( mem::PageTable *pt, uint64 buf, size_t len, bool dest )
+		: _pt( pt ), _iov( &_single ), _nr_seg( 1 ), _count( len ), _dest( dest )
+	{
+		_single = { buf, len };
+	}
+
+	IoIter::IoIter( mem::PageTable *pt, const IoVec *iov, int nr_seg, bool dest )
+		: _pt( pt ), _iov( iov ), _nr_seg( nr_seg ), _count( 0 ), _dest( dest )
+	{
+		for ( int i = 0; i < nr_seg; ++i )
+			_count += iov[i].len;
+	}
+
+	void IoIter::_unpin()
+	{
+		if ( _pinned != nullptr )
+		{
+			mem::k_pmm.free_page( _pinned );
+			_pinned = nullptr;
+		}
+	}
+
+	u8 *IoIter::chunk( size_t max, size_t &n )
+	{
+		n = 0;
+		_unpin();
+		// 跳过已用完的段和空段
+		while ( _seg < _nr_seg && _seg_off >= _iov[_seg].len )
+		{
+			_seg++;
+			_seg_off = 0;
+		}
+		if ( _seg >= _nr_seg || _fault || max == 0 )
+			return nullptr;
+
+		uint64 addr = _iov[_seg].base + _seg_off;
+		size_t len	= _iov[_seg].len - _seg_off;
+		if ( len > max ) len = max;
+
+		if ( _pt == nullptr )
+		{
+			n = len;
+			return (u8 *) addr;
+		}
+
+		size_t in_page = PGSIZE - addr % PGSIZE;
+		if ( len > in_page ) len = in_page;
+		for ( ;; )
+		{
+			u8 *k = mem::k_vmm.user_ptr( *_pt, addr, _dest );
+			if ( k == nullptr )
+			{
+				_fault = true;
+				return nullptr;
+			}
+			void *page = (void *) PGROUNDDOWN( (uint64) k );
+			int pin = mem::k_pmm.pin_page( page );
+			if ( pin == 0 )
+			{
+				n = len;
+				return k;
+			}
+			// 翻译和 pin 之间这一页可能被撤销映射、释放后又分给了别人，
+			// pin 住以后再查一次页表，确认 addr 仍然映射在这一页上
+			if ( pin > 0 )
+			{
+				if ( _still_mapped( addr, page ) )
+				{
+					_pinned = page;
+					n = len;
+					return k;
+				}
+				mem::k_pmm.free_page( page );
+			}
+			// 缓存的翻译已经过时，重新查页表
+			mem::k_vmm.user_ptr_invalidate();
+		}
+	}
+
+	bool IoIter::_still_mapped( uint64 addr, void *page )
+	{
+		mem::Pte pte = _pt->walk( PGROUNDDOWN( addr ), 0 );
+		if ( pte.is_null() || !pte.is_valid() )
+			return false;
+		if ( _dest && ( pte.get_data() & PTE_W ) == 0 )
+			return false;
+		uint64 pa = (uint64) pte.pa();
+#ifdef LOONGARCH
+		pa = to_vir( pa );
+#endif
+		return pa == (uint64) page;
+	}
+
+	void IoIter::advance( size_t n )
+	{
+		_seg_off += n;
+		_count	 -= n;
+	}
+
+	size_t IoIter::copy_to( const void *src, size_t n )
+	{
+		size_t done = 0;
+		while ( done < n )
+		{
+			size_t l;
+			u8	  *dst = chunk( n - done, l );
+			if ( dst == nullptr ) break;
+			memcpy( dst, (const u8 *) src + done, l );
+			advance( l );
+			done += l;
+		}
+		return done;
+	}
+
+	size_t IoIter::copy_from( void *dst, size_t n )
+	{
+		size_t done = 0;
+		while ( done < n )
+		{
+			size_t l;
+			u8	  *src = chunk( n - done, l );
+			if ( src == nullptr ) break;
+			memcpy( (u8 *) dst + done, src, l );
+			advance( l );
+			done += l;
+		}
+		return done;
+	}
+
+} // namespace fs
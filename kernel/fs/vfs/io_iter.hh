@@ -0,0 +1,72 @@
+#pragma once
+
+#include "types.hh"
+
+namespace mem
+{
+	class PageTable;
+}
+
+namespace fs
+{
+	/// @brief 与用户态 struct iovec 布局相同
+	struct IoVec
+	{
+		uint64 base;
+		uint64 len;
+	};
+
+	/// @brief iov_iter 风格的 I/O 缓冲区描述：一段内核缓冲区，或一组用户缓冲区。
+	/// 读写路径不再先把数据整块搬进内核堆再拷一遍，而是逐段取出“当前位置起可直接访问的
+	/// 内核地址”交给 nodeRead/nodeWrite 原地填充或取走。用户段每次最多给出一页，
+	/// 翻译经 k_vmm.user_ptr，惰性页、写时复制页和非法地址都在那里处理。
+	/// 用户页在取得 chunk 到下一次 chunk（或析构）之间被钉住，别的线程此时 munmap
+	/// 也不会让这页被释放重用。
+	class IoIter
+	{
+	private:
+		mem::PageTable *_pt;		// 用户缓冲区所在页表，内核缓冲区时为 nullptr
+		const IoVec	   *_iov;
+		int				_nr_seg;
+		int				_seg = 0;		// 当前段
+		uint64			_seg_off = 0;	// 当前段内已消耗的字节数
+		size_t			_count;			// 剩余总字节数
+		bool			_dest;			// 数据写入该缓冲区 (read) 为 true，从中取出 (write) 为 false
+		bool			_fault = false;
+		void		   *_pinned = nullptr; // 当前 chunk 所在的用户页，持有一份引用
+		IoVec			_single;
+
+		void _unpin();
+		/// @brief pin 住 page 之后确认 addr 仍映射在它上面（写方向还要求可写）
+		bool _still_mapped( uint64 addr, void *page );
+
+	public:
+		/// @brief 内核缓冲区
+		IoIter( void *buf, size_t len, bool dest );
+		/// @brief 单个用户缓冲区
+		IoIter( mem::PageTable *pt, uint64 buf, size_t len, bool dest );
+		/// @brief 用户 iovec 数组，iov 须已拷入内核并在使用期间有效
+		IoIter( mem::PageTable *pt, const IoVec *iov, int nr_seg, bool dest );
+		~IoIter() { _unpin(); }
+		IoIter( const IoIter & ) = delete;
+		IoIter &operator=( const IoIter & ) = delete;
+
+		size_t count() const { return _count; }
+		bool   is_user() const { return _pt != nullptr; }
+		/// @brief 遇到了非法的用户地址；此时已传输的部分仍然有效
+		bool faulted() const { return _fault; }
+
+		/// @brief 当前位置起一段连续可访问的内核地址，长度不超过 max，用户段不跨页
+		/// @param n 返回该段长度
+		/// @return 内核地址；已经用尽或用户地址非法时返回 nullptr
+		u8 *chunk( size_t max, size_t &n );
+		/// @brief 消耗 n 字节，n 不超过刚取得的 chunk 长度
+		void advance( size_t n );
+
+		/// @brief 把 src 的 n 字节填入缓冲区当前位置，返回实际填入的字节数
+		size_t copy_to( const void *src, size_t n );
+		/// @brief 从缓冲区当前位置取出 n 字节到 dst，返回实际取出的字节数
+		size_t copy_from( void *dst, size_t n );
+	};
+
+} // namespace fs
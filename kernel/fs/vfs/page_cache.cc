@@ -0,0 +1,314 @@
+#include "fs/vfs/page_cache.hh"
+#include "fs/vfs/inode.hh"
+#include "physical_memory_manager.hh"
+#include "proc/proc_manager.hh"
+#include "printer.hh"
+#include "klib.hh"
+
+namespace fs
+{
+	static SpinLock _all_lock;
+	static bool _all_lock_inited = false;
+	static PageCache *_all_head = nullptr;
+	static PageCache *_shrink_cursor = nullptr;	// 下一次从哪个缓存开始回收，避免总盯着同一个
+
+	void PageCache::init( Inode *owner, bool backing )
+	{
+		_lock.init( "page cache" );
+		_owner = owner;
+		_backing = backing;
+
+		// 第一个页缓存在挂载根文件系统时创建，此时还是单核启动阶段
+		if ( !_all_lock_inited )
+		{
+			_all_lock.init( "page cache list" );
+			_all_lock_inited = true;
+		}
+		_all_lock.acquire();
+		_all_prev = nullptr;
+		_all_next = _all_head;
+		if ( _all_head ) _all_head->_all_prev = this;
+		_all_head = this;
+		_all_lock.release();
+	}
+
+	PageCache::~PageCache()
+	{
+		if ( _owner == nullptr ) return;
+
+		_all_lock.acquire();
+		if ( _shrink_cursor == this ) _shrink_cursor = _all_next;
+		if ( _all_prev )
+			_all_prev->_all_next = _all_next;
+		else
+			_all_head = _all_next;
+		if ( _all_next ) _all_next->_all_prev = _all_prev;
+		_all_lock.release();
+
+		// 仍被映射的页由页表继续持有，这里只放掉缓存自己那份引用
+		for ( uint32 b = 0; b < _nbucket; ++b )
+		{
+			CachePage *cp = _buckets[b];
+			while ( cp )
+			{
+				CachePage *next = cp->hash_next;
+				mem::k_pmm.free_page( cp->pa );
+				delete cp;
+				cp = next;
+			}
+		}
+		delete[] _buckets;
+	}
+
+	void *PageCache::get_page( uint64 index )
+	{
+		bool shrunk = false;
+		_lock.acquire();
+		while ( true )
+		{
+			CachePage *cp = _lookup( index );
+			if ( cp != nullptr && !cp->valid )
+			{
+				// 别人正在读这一页；读失败时它会被摘掉，醒来后重新查找
+				proc::k_pm.sleep( cp, &_lock );
+				continue;
+			}
+			if ( cp != nullptr )
+			{
+				mem::k_pmm.ref_page( cp->pa );
+				_lock.release();
+				return cp->pa;
+			}
+
+			// 未命中：放锁去分配物理页，内存紧张时先回收一批干净页
+			_lock.release();
+			if ( !shrunk && mem::k_pmm.free_pages() < page_cache_low_pages )
+			{
+				shrink_all( page_cache_shrink_batch );
+				shrunk = true;
+			}
+			void *pa = mem::k_pmm.alloc_page();
+			CachePage *ncp = new CachePage;
+			ncp->index = index;
+			ncp->pa = pa;
+			ncp->hash_next = nullptr;
+			ncp->valid = false;
+			ncp->dirty = false;
+
+			_lock.acquire();
+			if ( _lookup( index ) != nullptr )
+			{
+				// 放锁期间别人已经插入了这一页
+				_lock.release();
+				mem::k_pmm.free_page( pa );
+				delete ncp;
+				_lock.acquire();
+				continue;
+			}
+			_insert( ncp );
+			_lock.release();
+
+			long rc = _owner->readPage( pa, index );
+
+			_lock.acquire();
+			if ( rc <= 0 )
+			{
+				_remove( ncp );
+				proc::k_pm.wakeup( ncp );
+				_lock.release();
+				mem::k_pmm.free_page( pa );
+				delete ncp;
+				if ( rc < 0 ) printfRed( "page cache: read page %d failed\n", index );
+				return nullptr;
+			}
+			ncp->valid = true;
+			mem::k_pmm.ref_page( pa );
+			proc::k_pm.wakeup( ncp );
+			_lock.release();
+			return pa;
+		}
+	}
+
+	size_t PageCache::read( uint64 dst, size_t off, size_t len )
+	{
+		size_t done = 0;
+		while ( done < len )
+		{
+			uint64 index = ( off + done ) / PGSIZE;
+			size_t p_off = ( off + done ) % PGSIZE;
+			size_t span = PGSIZE - p_off;
+			if ( span > len - done ) span = len - done;
+
+			void *pa = get_page( index );
+			if ( pa == nullptr ) break;
+			memcpy( (void *) ( dst + done ), (u8 *) pa + p_off, span );
+			mem::k_pmm.free_page( pa );
+			done += span;
+		}
+		return done;
+	}
+
+	bool PageCache::cached( uint64 index )
+	{
+		_lock.acquire();
+		bool hit = _lookup( index ) != nullptr;
+		_lock.release();
+		return hit;
+	}
+
+	void *PageCache::find_page( uint64 index )
+	{
+		_lock.acquire();
+		while ( true )
+		{
+			CachePage *cp = _lookup( index );
+			if ( cp == nullptr )
+			{
+				_lock.release();
+				return nullptr;
+			}
+			if ( !cp->valid )
+			{
+				proc::k_pm.sleep( cp, &_lock );
+				continue;
+			}
+			mem::k_pmm.ref_page( cp->pa );
+			_lock.release();
+			return cp->pa;
+		}
+	}
+
+	void PageCache::truncate( uint64 index )
+	{
+		_lock.acquire();
+		for ( uint32 b = 0; b < _nbucket; ++b )
+		{
+			CachePage **pp = &_buckets[b];
+			while ( *pp != nullptr )
+			{
+				CachePage *cp = *pp;
+				// 正在读入的页由读入方负责，读完后它会看到文件已经变短
+				if ( cp->index >= index && cp->valid )
+				{
+					*pp = cp->hash_next;
+					_count--;
+					mem::k_pmm.free_page( cp->pa );
+					delete cp;
+				}
+				else
+					pp = &cp->hash_next;
+			}
+		}
+		_lock.release();
+	}
+
+	void PageCache::mark_dirty( uint64 index )
+	{
+		_lock.acquire();
+		CachePage *cp = _lookup( index );
+		if ( cp ) cp->dirty = true;
+		_lock.release();
+	}
+
+	long PageCache::shrink( long nr )
+	{
+		long freed = 0;
+		if ( _backing )
+			return 0;
+		_lock.acquire();
+		for ( uint32 b = 0; b < _nbucket && freed < nr; ++b )
+		{
+			CachePage **pp = &_buckets[b];
+			while ( *pp != nullptr && freed < nr )
+			{
+				CachePage *cp = *pp;
+				// 只有缓存自己引用的页才没人映射；新的映射只能经 get_page 在本锁下产生
+				if ( cp->valid && !cp->dirty && mem::k_pmm.page_ref( cp->pa ) == 1 )
+				{
+					*pp = cp->hash_next;
+					_count--;
+					mem::k_pmm.free_page_cold( cp->pa );
+					delete cp;
+					freed++;
+				}
+				else
+					pp = &cp->hash_next;
+			}
+		}
+		_lock.release();
+		return freed;
+	}
+
+	long PageCache::shrink_all( long nr )
+	{
+		long freed = 0;
+		_all_lock.acquire();
+		PageCache *start = _shrink_cursor ? _shrink_cursor : _all_head;
+		PageCache *pc = start;
+		while ( pc != nullptr && freed < nr )
+		{
+			freed += pc->shrink( nr - freed );
+			pc = pc->_all_next ? pc->_all_next : _all_head;
+			if ( pc == start ) break;
+		}
+		_shrink_cursor = pc;
+		_all_lock.release();
+		return freed;
+	}
+
+	CachePage *PageCache::_lookup( uint64 index )
+	{
+		if ( _nbucket == 0 ) return nullptr;
+		for ( CachePage *cp = _buckets[_hash_of( index )]; cp != nullptr; cp = cp->hash_next )
+			if ( cp->index == index ) return cp;
+		return nullptr;
+	}
+
+	void PageCache::_insert( CachePage *cp )
+	{
+		if ( _count >= _nbucket * 2 ) _grow();
+		uint32 h = _hash_of( cp->index );
+		cp->hash_next = _buckets[h];
+		_buckets[h] = cp;
+		_count++;
+	}
+
+	void PageCache::_remove( CachePage *cp )
+	{
+		for ( CachePage **pp = &_buckets[_hash_of( cp->index )]; *pp != nullptr; pp = &( *pp )->hash_next )
+		{
+			if ( *pp == cp )
+			{
+				*pp = cp->hash_next;
+				_count--;
+				return;
+			}
+		}
+	}
+
+	void PageCache::_grow()
+	{
+		uint32 nb = _nbucket ? _nbucket * 2 : page_cache_init_buckets;
+		CachePage **nbuckets = new CachePage *[nb];
+		for ( uint32 i = 0; i < nb; ++i ) nbuckets[i] = nullptr;
+
+		CachePage **old = _buckets;
+		uint32 old_n = _nbucket;
+		_buckets = nbuckets;
+		_nbucket = nb;
+		for ( uint32 b = 0; b < old_n; ++b )
+		{
+			CachePage *cp = old[b];
+			while ( cp )
+			{
+				CachePage *next = cp->hash_next;
+				uint32 h = _hash_of( cp->index );
+				cp->hash_next = _buckets[h];
+				_buckets[h] = cp;
+				cp = next;
+			}
+		}
+		delete[] old;
+	}
+
+} // namespace fs
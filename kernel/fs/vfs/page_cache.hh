@@ -0,0 +1,87 @@
+#pragma once
+
+#include "types.hh"
+#include "spinlock.hh"
+
+namespace fs
+{
+	class Inode;
+
+	constexpr uint32 page_cache_init_buckets = 16;	// 首次插入时的哈希桶数，之后按页数翻倍
+	constexpr uint64 page_cache_low_pages = 4096;	// 物理空闲页低于此值时先回收页缓存再分配 (16MiB)
+	constexpr long page_cache_shrink_batch = 64;	// 每次回收的页数
+
+	/// @brief 页缓存中的一页：文件第 index 页在内存中的副本
+	struct CachePage
+	{
+		uint64 index;
+		void *pa;				// 物理页，页缓存自己持有一份引用
+		CachePage *hash_next;
+		bool valid;				// 正在从存储读入时为 false，其他人等待
+		bool dirty;				// 被共享可写映射修改过，尚未写回
+	};
+
+	/// @brief 每个 inode 一个的页缓存：文件页号 -> 引用计数的物理页。
+	/// read、mmap 缺页和 exec 都从这里取页；只读页直接映射进各个地址空间，
+	/// 私有可写映射以写时复制方式映射，所以同一份程序正文在所有进程间只存一份。
+	/// 引用计数就是物理页的 k_pmm 引用计数：只剩缓存自己引用的干净页可以回收。
+	class PageCache
+	{
+	private:
+		SpinLock _lock;
+		Inode *_owner = nullptr;
+		CachePage **_buckets = nullptr;
+		uint32 _nbucket = 0;
+		uint32 _count = 0;
+		bool _backing = false;	// 页缓存本身就是文件内容（tmpfs），没有别的副本，不能回收
+
+		// 所有页缓存串成一条全局链表，内存紧张时轮流回收
+		PageCache *_all_prev = nullptr;
+		PageCache *_all_next = nullptr;
+
+	public:
+		PageCache() = default;
+		PageCache( const PageCache & ) = delete;
+		PageCache &operator=( const PageCache & ) = delete;
+		~PageCache();
+
+		/// @param backing 为 true 时缓存的页就是文件内容本身，shrink 不回收它们
+		void init( Inode *owner, bool backing = false );
+
+		/// @brief 取得文件第 index 页，未缓存时经 Inode::readPage 从存储读入
+		/// @return 物理页地址，调用者持有一份引用（用完 free_page，或交给页表）；
+		/// 读失败或整页都在文件末尾之后时返回 nullptr
+		void *get_page( uint64 index );
+
+		/// @brief 经页缓存把文件 [off, off+len) 拷贝到内核缓冲区 dst，调用者负责把 len 截断到文件大小
+		/// @return 实际拷贝的字节数
+		size_t read( uint64 dst, size_t off, size_t len );
+
+		/// @brief 该页当前是否已在缓存中（含正在读入的页）
+		bool cached( uint64 index );
+
+		/// @brief 与 get_page 相同，但只取已经缓存的页，不在缓存中时返回 nullptr 而不去读入
+		void *find_page( uint64 index );
+
+		/// @brief 丢弃文件第 index 页及之后的所有页，仍被映射的页由页表继续持有
+		void truncate( uint64 index );
+
+		/// @brief 记录某页经共享可写映射被修改
+		void mark_dirty( uint64 index );
+
+		/// @brief 丢弃不再被任何页表引用的干净页
+		/// @return 释放的页数
+		long shrink( long nr );
+
+		/// @brief 依次回收所有页缓存，直到释放 nr 页或没有可回收的页
+		static long shrink_all( long nr );
+
+	private:
+		uint32 _hash_of( uint64 index ) const { return (uint32) ( index ^ ( index >> 10 ) ) & ( _nbucket - 1 ); }
+		CachePage *_lookup( uint64 index );
+		void _insert( CachePage *cp );
+		void _remove( CachePage *cp );
+		void _grow();
+	};
+
+} // namespace fs
@@ -12,6 +12,7 @@
 #include "fs/vfs/file/file.hh"
 #include "fs/vfs/file/normal_file.hh"
 #include "fs/vfs/dentry.hh"
+#include "fs/vfs/dentrycache.hh"
 #include "fs/vfs/fs_defs.hh"
 #include "fs/fat/fat32fs.hh"
 #include "printer.hh"
@@ -68,15 +69,13 @@ namespace fs
 	}
 
 	/**
-	 * @brief 将 pathname 字符串解析为路径段（dirname 向量），并确定路径基准（base）。
+	 * @brief 确定路径查找的起点（base）。
 	 *
-	 * @note 会自动处理绝对路径（以 '/' 开头）和相对路径。若 base 为 nullptr，则默认使用进程当前工作目录。
-	 *       结果保存在成员变量 base 与 dirname 中。
+	 * @note 绝对路径（以 '/' 开头）从根目录开始；相对路径在 base 为 nullptr 时使用进程当前工作目录。
+	 *       这里不再切分 pathname，查找时由 path_walk 在原字符串上逐级切分。
 	 */
 	void Path::pathbuild()
 	{
-		//[[maybe_unused]]Dentry *root = mnt_table[ "/" ]->getRoot();
-		printfBlue("pathbuild: pathname = %s\n", pathname.c_str());
 		if (pathname.size() < 1)
 		{
 			base = proc::k_pm.get_cur_pcb()->get_cwd();
@@ -84,60 +83,36 @@ namespace fs
 		}
 		else if (pathname[0] == '/')
 		{
-			printfBlue("pathbuild: absolute path\n");
-			if(mnt_table.find("/") == mnt_table.end())
+			auto root = mnt_table.find("/");
+			if (root == mnt_table.end())
 			{
 
 				panic("Path: mnt_table does not contain root");
 			}
-			base = mnt_table["/"]->getRoot();
+			base = root->second->getRoot();
 		}
 		else if (base == nullptr)
 		{
 			base = proc::k_pm.get_cur_pcb()->get_cwd();
 		}
+	}
 
-		Info("base name is %s ", base->rName());
-		size_t len = pathname.size();
-		if (len > 0)
-		{ // 保证数组长度不为0
-			auto ind = new size_t[len][2]{{0, 0}};
-			bool rep = true;
-			int dirnum = 0;
-			for (size_t i = 0; i < len; ++i)
-			{ // 识别以'/'结尾的目录
-				if (pathname[i] == '/')
-				{
-					if (!rep)
-					{
-						rep = true;
-						++dirnum;
-					}
-				}
-				else
-				{
-					++(ind[dirnum][1]);
-					if (rep)
-					{
-						rep = false;
-						ind[dirnum][0] = i;
-					}
-				}
-			}
-			if (!rep)
-			{
-				++dirnum;
-			} // 补齐末尾'/'
-			dirname = eastl::vector<eastl::string>(dirnum);
-			for (size_t i = 0; i < (size_t)dirnum; ++i)
-			{
-				dirname[i] = pathname.substr(ind[i][0], ind[i][1]);
-			}
-
-			delete[] ind;
+	/// @brief 把路径切分成各级目录名，连续的 '/' 视为一个
+	static void split_path(const eastl::string &path, eastl::vector<eastl::string> &out)
+	{
+		size_t len = path.size();
+		for (size_t i = 0; i < len;)
+		{
+			while (i < len && path[i] == '/')
+				i++;
+			size_t start = i;
+			while (i < len && path[i] != '/')
+				i++;
+			if (i > start)
+				out.push_back(path.substr(start, i - start));
 		}
-		return;
 	}
+
 	/**
 	 * @brief 获取当前路径对象对应的绝对路径字符串。
 	 *
@@ -147,7 +122,8 @@ namespace fs
 	 */
 	eastl::string Path::AbsolutePath() const
 	{
-		eastl::vector<eastl::string> absname = dirname;
+		eastl::vector<eastl::string> absname;
+		split_path(pathname, absname);
 		for (dentry *entry = base;
 			 !(entry->isRoot() && entry->getNode()->getSb()->getFileSystem()->isRootFS());
 			 entry = entry->getParent())
@@ -201,9 +177,7 @@ namespace fs
 			dentry *root = mnt_table[longest_prefix]->getSuperBlock()->getRoot();
 			base = root;
 			pathname = path_abs.substr(longest);
-			if (pathname.empty())
-				dirname.clear();
-			else
+			if (!pathname.empty())
 				pathbuild();
 			return root;
 		}
@@ -213,82 +187,189 @@ namespace fs
 
 	dentry *Path::pathSearch(bool parent)
 	{
-		/// @todo 1: 通过路径名查找文件
-
-		if (pathname == "/")
-			return mnt_table["/"]->getSuperBlock()->getRoot();
-		dentry *entry, *next;
 		if (base == nullptr)
 		{
 			return nullptr;
 		} // 无效路径
-		// else if( ( entry = pathHitTable()) != nullptr) { }// 查询挂载表，找到对应根目录
-		// else { entry = base; }	// 未找到对应根目录，使用当前目录
+		return path_walk(base, eastl::string_view(pathname.data(), pathname.size()), parent);
+	}
 
-		entry = base;
-		int dirsize = dirname.size();
-		// printfBlue( "path search %d level", dirsize );
-		for (int i = 0; i < dirsize; i++)
+	eastl::string Path::rFileName()
+	{
+		size_t end = pathname.size();
+		while (end > 0 && pathname[end - 1] == '/')
+			end--;
+		size_t start = end;
+		while (start > 0 && pathname[start - 1] != '/')
+			start--;
+		return pathname.substr(start, end - start);
+	}
+
+	dentry *path_walk(dentry *base, eastl::string_view path, bool parent)
+	{
+		// 手里始终持有当前目录项的一个引用，换到下一级之前放掉
+		dentry *entry = base;
+		entry->dget();
+		const char *p = path.data();
+		const char *end = p + path.size();
+		while (true)
 		{
-			while (entry->isMntPoint())
-				panic("pathSearch: entry is a mount point");
+			while (p < end && *p == '/')
+				p++;
+			if (p == end)
+				return entry;
+			const char *name = p;
+			while (p < end && *p != '/')
+				p++;
+			size_t len = p - name;
+
+			if (parent)
+			{
+				// 最后一级留给调用者
+				const char *q = p;
+				while (q < end && *q == '/')
+					q++;
+				if (q == end)
+					return entry;
+			}
 			/// @todo 这里随后检查 是否是目录，文件的结构不完善
-			// if( !( entry->getNode()->rMode() & (fs::File_dir << fs::FileAttrs::File_dir_s ) ) )
-			// 	return nullptr; // 不是目录
-			if (parent && i == dirsize - 1)
-				return entry; // 返回父目录
-			if (dirname[i] == ".")
-				next = entry;
-			else if (dirname[i] == "..")
-				next = entry->getParent();
-			else
+			if (len == 1 && name[0] == '.')
+				continue;
+			if (len == 2 && name[0] == '.' && name[1] == '.')
 			{
-				// printfBlue("dentry %s search sub-dir\n", entry->rName().c_str());
-				if (auto it = entry->EntrySearch(dirname[i]); it != nullptr)
+				// 被挂载文件系统的根的父目录就是挂载点的父目录；根目录的 .. 是它自己。
+				// 子项在哈希表里时父目录不会被释放
+				dentry *up = entry->getParent();
+				if (up != nullptr)
 				{
-					next = it;
+					up->dget();
+					entry->dput();
+					entry = up;
 				}
-				else
-					return nullptr;
+				continue;
 			}
+			dentry *next = entry->EntrySearch(name, len, dentrycache::dentryCache::hashName(name, len));
+			entry->dput();
 			entry = next;
+			if (entry == nullptr)
+				return nullptr;
 		}
-		return entry;
 	}
 
-	int Path::mount(Path &dev, eastl::string fstype, uint64 flags, uint64 data)
+	struct MountEntry
 	{
-		fs::dentry *mntEnt = pathSearch();
-		fs::dentry *devEnt = dev.pathSearch();
-		if (mntEnt == nullptr || devEnt == nullptr)//TODO: 无效路径，无法挂载，返回0？，抄自学长
+		dentry *mnt;
+		dentry *root;
+		MountEntry *next;
+	};
+
+	static constexpr uint mount_hash_size = 32;
+	static MountEntry *mount_hash[mount_hash_size];
+	static SpinLock mount_lock;
+	static bool mount_lock_inited = false;
+
+	static uint mount_hash_of(dentry *mnt)
+	{
+		return ((uint64)mnt >> 4) & (mount_hash_size - 1);
+	}
+
+	void mount_add(dentry *mnt, dentry *root)
+	{
+		if (!mount_lock_inited)
 		{
-			return 0;
+			mount_lock.init("mount hash");
+			mount_lock_inited = true;
 		}
-		if (mntEnt->getNode()->getFS()->mount(devEnt, mntEnt, fstype) == 0)
+		MountEntry *me = new MountEntry{mnt, root, nullptr};
+		mnt->dget(); // 挂载点不能被目录项缓存淘汰
+		mount_lock.acquire();
+		uint h = mount_hash_of(mnt);
+		me->next = mount_hash[h];
+		mount_hash[h] = me;
+		mnt->setMounted(true);
+		mount_lock.release();
+	}
+
+	dentry *mount_del(dentry *root)
+	{
+		if (!mount_lock_inited)
+			return nullptr;
+		// 卸载很少发生，直接扫一遍所有桶
+		MountEntry *me = nullptr;
+		mount_lock.acquire();
+		for (uint h = 0; h < mount_hash_size && me == nullptr; h++)
+		{
+			for (MountEntry **pp = &mount_hash[h]; *pp != nullptr; pp = &(*pp)->next)
+			{
+				if ((*pp)->root == root)
+				{
+					me = *pp;
+					*pp = me->next;
+					me->mnt->setMounted(false);
+					break;
+				}
+			}
+		}
+		mount_lock.release();
+		if (me == nullptr)
+			return nullptr;
+		dentry *mnt = me->mnt;
+		delete me;
+		mnt->dput();
+		return mnt;
+	}
+
+	dentry *mount_lookup(dentry *mnt)
+	{
+		if (!mount_lock_inited)
+			return nullptr;
+		dentry *root = nullptr;
+		mount_lock.acquire();
+		for (MountEntry *me = mount_hash[mount_hash_of(mnt)]; me != nullptr; me = me->next)
 		{
-			return 0;
+			if (me->mnt == mnt)
+			{
+				root = me->root;
+				break;
+			}
 		}
-		return -1;
+		mount_lock.release();
+		return root;
+	}
+
+	int Path::mount(Path &dev, eastl::string fstype, uint64 flags, uint64 data)
+	{
+		fs::dentry *mntEnt = pathSearch();
+		fs::dentry *devEnt = dev.pathSearch();
+		int rc = 0;
+		// 挂载成功时 mount_add 为挂载点另拿一份引用，这里查到的引用用完即放
+		if (mntEnt != nullptr && (devEnt != nullptr || fstype == "tmpfs"))//TODO: 无效路径，无法挂载，返回0？，抄自学长
+			rc = mntEnt->getNode()->getFS()->mount(devEnt, mntEnt, fstype) == 0 ? 0 : -1;
+		if (mntEnt != nullptr)
+			mntEnt->dput();
+		if (devEnt != nullptr)
+			devEnt->dput();
+		return rc;
 	}
 
 	int Path::umount(uint64 flags)
 	{
-		fs::dentry *mnt = pathSearch();
+		fs::dentry *mnt = pathSearch(); // 跨过挂载点，得到的是被挂载文件系统的根
+		if (mnt == nullptr)
+			return -1;
 		if (mnt->getParent()->getNode()->getFS()->umount(mnt) == 0)
-		{
 			mnt_table.erase(pathname);
-			return 0;
-		}
-		// return -1; @ TODO：2025/06/03
+		// 卸载失败时 return -1; @ TODO：2025/06/03
+		mnt->dput();
 		return 0;
 	}
 
 	int Path::open(FileAttrs attrs_, int flags)
 	{
-		printf("flags is %d\n", flags);
+		log_trace("flags is %d\n", flags);
 		dentry *den = pathSearch();
 
-		if (!den && flags & O_CREAT) // @todo 创建文件
+		if (!den) // @todo O_CREAT 时创建文件
 			return -1;
 		FileAttrs attrs = den->getNode()->rMode();
 
@@ -300,9 +381,13 @@ namespace fs
 		if (attrs_.o_write > attrs.o_write &&
 			attrs_.o_read > attrs.o_read &&
 			attrs_.o_exec > attrs.o_exec)
+		{
+			den->dput();
 			return -1; // 权限校验失败
+		}
 
 		fs::normal_file *f = new fs::normal_file(attrs_, den);
+		den->dput(); // 打开的文件自己持有一份引用
 		if (flags & O_APPEND)
 			f->setAppend();
 		proc::Pcb *cur_proc = proc::k_pm.get_cur_pcb();
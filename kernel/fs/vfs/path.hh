@@ -11,7 +11,7 @@
 #include "types.hh"
 
 #include <EASTL/string.h>
-#include <EASTL/vector.h>
+#include <EASTL/string_view.h>
 #include <EASTL/unordered_map.h>
 // 文件系统命名空间 fs，包含 Path 类用于路径字符串的解析与转换。
 // Path 是 VFS 层的路径表示类，负责将用户输入的路径字符串解析为一系列目录组件，
@@ -29,8 +29,7 @@ namespace fs
 	{
 	private:
 		dentry *base;  // 路径的起始目录节点（即解析路径的起点，可能是工作目录或根目录）
-		eastl::string pathname;  // 原始路径字符串
-		eastl::vector<eastl::string> dirname;  // 解析后路径的各级目录名组成的向量
+		eastl::string pathname;  // 原始路径字符串，查找时直接在上面切分各级目录名
 
 	public:
 		Path() = default;
@@ -89,7 +88,7 @@ namespace fs
 		// 赋值操作
 		Path& operator=( const Path& path ) = default;
 
-		// 将 pathname 解析成 dirname（目录名列表）
+		// 根据 pathname 确定查找的起点 base
 		void pathbuild();
 
 		// 返回解析后的**绝对路径**字符串
@@ -98,7 +97,7 @@ namespace fs
 		// 从 base 出发解析 pathname 并返回命中路径的 dentry（可以带缓存加速）
 		dentry *pathHitTable();
 
-		// 进行路径查找，可选是否查找父目录（parent = true 表示获取倒数第二级）
+		// 进行路径查找，可选是否查找父目录（parent = true 表示获取倒数第二级）；结果带一个引用，用完后 dput
 		dentry *pathSearch( bool parent = false );
 
 		// 创建路径中对应的文件或目录，并返回其 dentry，mode 为权限与类型标志
@@ -119,9 +118,22 @@ namespace fs
 		eastl::string rPathName() { return pathname; }
 
 		// 返回路径最后一级文件名（例如 /a/b/c.txt 则为 c.txt）
-		eastl::string rFileName() { return dirname[ dirname.size() - 1 ]; }
+		eastl::string rFileName();
 	};
 
+	/// @brief 路径查找引擎：从 base 出发在 path 上原地切分各级目录名，每个名字只算一次哈希，
+	/// 命中目录项缓存时整个过程不分配内存；遇到挂载点经挂载点哈希换成被挂载文件系统的根。
+	/// @param parent 为 true 时不查最后一级，返回它所在的目录
+	/// @return 找不到时返回 nullptr；找到的目录项带一个引用，调用者用完后 dput
+	dentry *path_walk( dentry *base, eastl::string_view path, bool parent = false );
+
+	/// @brief 挂载点哈希：被挂载的目录项 -> 挂在它上面的文件系统的根。
+	/// 挂载点打上 mounted 标记并持有一份引用，只有带标记的目录项才需要查这张表
+	void mount_add( dentry *mnt, dentry *root );
+	/// @brief 摘下根为 root 的挂载，返回原来的挂载点，没有这个挂载时返回 nullptr
+	dentry *mount_del( dentry *root );
+	dentry *mount_lookup( dentry *mnt );
+
 	// 全局挂载表：路径字符串 -> 文件系统对象的映射
 	extern eastl::unordered_map<eastl::string, FileSystem *> mnt_table;
 } // namespace fs
@@ -72,6 +72,7 @@
 #define LOONGARCH_CSR_DMWIN3		0x183	/* 64 direct map win3: MEM */
 
 #define LOONGARCH_CSR_TLBEHI		0x11	/* TLB EntryHi */
+#define LOONGARCH_CSR_ASID          0x18
 #define LOONGARCH_CSR_PGDL          0x19
 #define LOONGARCH_CSR_PGDH          0x1a
 #define LOONGARCH_CSR_PGD           0x1b
@@ -0,0 +1,171 @@
+#include "smp.hh"
+#include "param.h"
+#include "platform.hh"
+#include "printer.hh"
+#include "trap.hh"
+#ifdef RISCV
+#include "riscv/sbi.hh"
+#endif
+
+SmpManager k_smp;
+
+extern "C" void _entry();
+
+void SmpManager::start_secondaries()
+{
+	uint64 me = Cpu::read_tp();
+	for ( uint64 cpu = 0; cpu < SMP_NCPU && cpu < NUMCPU; cpu++ )
+	{
+		if ( cpu == me )
+			continue;
+#ifdef RISCV
+		// HSM 扩展：从核以 a0 = hartid、satp = 0 的状态从 _entry 开始执行
+		int err = sbi_hart_start( cpu, (uint64) _entry, 0 );
+		if ( err != 0 )
+			printfRed( "[smp] hart %d start failed: %d\n", cpu, err );
+#elif defined( LOONGARCH )
+		// 从核停在固件里等核间中断，醒来后跳到邮箱 0 中的地址。
+		// 固件以低 32 位非零作为邮件到达的标志，所以先写高半部分
+		uint64 entry = (uint64) _entry;
+		uint64 send	 = IOCSR_SEND_BLOCKING | ( cpu << IOCSR_SEND_CPU_SHIFT );
+		iocsr_write64( LOONGARCH_IOCSR_MBUF_SEND,
+					   send | ( 1UL << IOCSR_MBUF_SEND_BOX_SHIFT ) | ( entry & 0xffffffff00000000UL ) );
+		iocsr_write64( LOONGARCH_IOCSR_MBUF_SEND,
+					   send | ( entry << IOCSR_MBUF_SEND_BUF_SHIFT ) );
+		iocsr_write32( LOONGARCH_IOCSR_IPI_SEND, (uint32) send );
+#endif
+	}
+}
+
+void SmpManager::set_online()
+{
+	_online.fetch_or( 1UL << Cpu::read_tp() );
+	printfGreen( "[smp] cpu %d online\n", Cpu::read_tp() );
+}
+
+void SmpManager::set_idle( bool idle )
+{
+	uint64 me = 1UL << Cpu::read_tp();
+	if ( idle )
+		_idle.fetch_or( me );
+	else
+		_idle.fetch_and( ~me );
+}
+
+void SmpManager::kick_idle()
+{
+	uint64 me = 1UL << Cpu::read_tp();
+	uint64 m;
+	while ( ( m = _idle.load() & ~me ) != 0 )
+	{
+		// 认领一个空闲的核再发中断，避免连续入队时都去叫同一个核
+		uint64 bit = m & -m;
+		if ( _idle.fetch_and( ~bit ) & bit )
+		{
+			send_ipi( __builtin_ctzl( bit ), ipi_resched );
+			return;
+		}
+	}
+}
+
+bool SmpManager::kick_cpu( uint64 cpu )
+{
+	// 和 kick_idle 一样先认领空闲位，同时入队的两方只有一个发中断
+	uint64 bit = 1UL << cpu;
+	if ( ( _idle.fetch_and( ~bit ) & bit ) == 0 )
+		return false;
+	send_ipi( cpu, ipi_resched );
+	return true;
+}
+
+void SmpManager::send_ipi( uint64 cpu, uint32 action )
+{
+	_pending[cpu].fetch_or( action );
+#ifdef RISCV
+	unsigned long mask = 1UL << cpu;
+	sbi_send_ipi( &mask );
+#elif defined( LOONGARCH )
+	// 动作放在 _pending 里，中断向量固定用 0
+	iocsr_write32( LOONGARCH_IOCSR_IPI_SEND, IOCSR_SEND_BLOCKING | ( cpu << IOCSR_SEND_CPU_SHIFT ) );
+#endif
+}
+
+void SmpManager::handle_ipi()
+{
+	uint32 action = _pending[Cpu::read_tp()].exchange( 0 );
+	if ( action & ipi_tlb )
+		poll();
+	// 停机的核醒来后回到调度循环开头，时钟停着时在这里恢复
+	if ( action & ipi_resched )
+		trap_mgr.tick_restart();
+}
+
+#ifdef RISCV
+
+void SmpManager::tlb_shootdown( uint64 cpus, uint64 asid, uint64 va, uint64 npages )
+{
+	// 由 SBI 在 M 态完成，返回时目标核都已刷新
+	unsigned long mask	= cpus;
+	uint64		  start = npages ? PGROUNDDOWN( va ) : 0;
+	uint64		  size	= npages ? npages * PGSIZE : ~0UL;
+	if ( asid == any_asid )
+		sbi_remote_sfence_vma( &mask, start, size );
+	else
+		sbi_remote_sfence_vma_asid( &mask, start, size, asid );
+}
+
+void SmpManager::poll() {}
+
+#elif defined( LOONGARCH )
+
+static void local_flush( uint64 asid, uint64 va, uint64 npages )
+{
+	if ( asid == SmpManager::any_asid )
+	{
+		// 没有只按地址刷所有 ASID 的操作，刷掉全部非全局表项
+		asm volatile( "invtlb 0x3, $zero, $zero" ::: "memory" );
+		return;
+	}
+	if ( npages == 0 )
+	{
+		invtlb_asid( asid );
+		return;
+	}
+	for ( uint64 i = 0; i < npages; i++ )
+		invtlb_page( asid, PGROUNDDOWN( va ) + i * PGSIZE );
+}
+
+void SmpManager::tlb_shootdown( uint64 cpus, uint64 asid, uint64 va, uint64 npages )
+{
+	Cpu::push_intr_off();
+	uint64	  me = Cpu::read_tp();
+	Shootdown &sd = _shootdown[me];
+	sd.asid		  = asid;
+	sd.va		  = va;
+	sd.npages	  = npages;
+	sd.wait.store( cpus );
+	for ( uint64 m = cpus; m != 0; m &= m - 1 )
+	{
+		uint64 cpu = __builtin_ctzl( m );
+		_sd_from[cpu].fetch_or( 1UL << me );
+		send_ipi( cpu, ipi_tlb );
+	}
+	// 等待期间别的核可能也在等我们处理它的请求
+	while ( sd.wait.load() != 0 )
+		poll();
+	Cpu::pop_intr_off();
+}
+
+void SmpManager::poll()
+{
+	uint64 me	= Cpu::read_tp();
+	uint64 from = _sd_from[me].exchange( 0 );
+	for ( ; from != 0; from &= from - 1 )
+	{
+		Shootdown &sd = _shootdown[__builtin_ctzl( from )];
+		local_flush( sd.asid, sd.va, sd.npages );
+		sd.wait.fetch_and( ~( 1UL << me ) );
+	}
+}
+
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+#include "types.hh"
+#include "cpu.hh"
+#include <EASTL/atomic.h>
+
+/// @brief 多核启动与核间中断 (IPI)。
+/// 从核在 riscv 上经 SBI HSM 启动，在龙芯上经核间中断邮箱启动，初始化完自己的页表、
+/// 陷入和中断控制器后进入调度循环，各核有自己的就绪队列。
+/// 核间中断携带一组动作位：ipi_resched 让目标核恢复时钟并从停机中醒来重新调度，
+/// ipi_tlb 让目标核处理发给它的 TLB 击落请求。
+class SmpManager
+{
+public:
+	static constexpr uint32 ipi_resched = 1U << 0;
+	static constexpr uint32 ipi_tlb = 1U << 1;
+	/// @brief tlb_shootdown 的 asid 取这个值时按地址刷掉所有 ASID 的表项
+	static constexpr uint64 any_asid = ~0UL;
+
+private:
+	eastl::atomic<uint64> _online;			  // 已经进入调度循环的核
+	eastl::atomic<uint64> _idle;			  // 正停机等待中断的核
+	eastl::atomic<uint32> _pending[NUMCPU]; // 每个核待处理的动作位
+
+#ifdef LOONGARCH
+	// 龙芯没有固件代劳，击落请求放在发起方的槽里，目标核处理完清掉自己在 wait 中的位
+	struct Shootdown
+	{
+		uint64 asid;
+		uint64 va;
+		uint64 npages;
+		eastl::atomic<uint64> wait;
+	};
+	Shootdown _shootdown[NUMCPU];
+	eastl::atomic<uint64> _sd_from[NUMCPU]; // 每个核待处理的击落请求来自哪些发起方
+#endif
+
+public:
+	/// @brief 主核初始化完毕后启动其余的核（共 SMP_NCPU 个）
+	void start_secondaries();
+	/// @brief 当前核即将进入调度循环
+	void set_online();
+	bool is_online( uint64 cpu ) { return ( _online.load() >> cpu ) & 1; }
+	int online_count() { return __builtin_popcountl( _online.load() ); }
+
+	/// @brief 调度器停机前后标记当前核是否空闲，须关中断调用
+	void set_idle( bool idle );
+	/// @brief 有进程变为就绪时调用：挑一个空闲的核叫醒来运行它
+	void kick_idle();
+	/// @brief cpu 空闲时把它叫醒去运行它队列里的进程，cpu 不空闲返回 false
+	bool kick_cpu( uint64 cpu );
+
+	/// @brief 向 cpu 发送核间中断，action 为动作位
+	void send_ipi( uint64 cpu, uint32 action );
+	/// @brief 核间中断处理，在 devintr 中调用
+	void handle_ipi();
+
+	/// @brief 让 cpus 中的核刷掉 asid 下 [va, va + npages 页) 的 TLB 表项，返回时已经全部完成。
+	/// npages 为 0 表示该 ASID 的全部表项；asid 为 any_asid 时不区分 ASID
+	void tlb_shootdown( uint64 cpus, uint64 asid, uint64 va, uint64 npages );
+	/// @brief 处理发给当前核的击落请求。关中断自旋等待的地方要调用它，否则两个核互相等待会死锁
+	void poll();
+};
+
+extern SmpManager k_smp;
+
+/// @brief 从核的 C++ 入口，由各架构的启动代码调用
+extern "C" void secondary_main();
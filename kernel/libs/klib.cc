@@ -1,44 +1,173 @@
 #include "klib.hh"
-void *memset(void *s, int c, size_t n) noexcept(true)
+
+// mem* 按 8 字节字拷贝/填充，四个字一组展开，首尾不对齐的部分逐字节处理。
+// 不能让编译器把这里的循环再识别回 memset/memcpy 调用，否则会无限递归。
+#define KLIB_NO_LIBCALL __attribute__((optimize("no-tree-loop-distribute-patterns")))
+
+typedef uint64 __attribute__((__may_alias__)) klib_word;
+static constexpr size_t k_wsize = sizeof(klib_word);
+static constexpr size_t k_wmask = k_wsize - 1;
+
+static inline bool co_aligned(const void *a, const void *b)
+{
+	return (((uintptr_t)a ^ (uintptr_t)b) & k_wmask) == 0;
+}
+
+/// @brief 从低地址向高地址拷贝，dst < src 的重叠也是安全的（每个字都先读后写）
+KLIB_NO_LIBCALL static void copy_forward(uchar *d, const uchar *s, size_t n)
+{
+	if (n >= 2 * k_wsize)
+	{
+		// 先把 dst 对齐到字边界
+		while ((uintptr_t)d & k_wmask)
+		{
+			*d++ = *s++;
+			n--;
+		}
+		klib_word *wd = (klib_word *)d;
+		size_t off = (uintptr_t)s & k_wmask;
+		if (off == 0)
+		{
+			const klib_word *ws = (const klib_word *)s;
+			for (; n >= 4 * k_wsize; n -= 4 * k_wsize, wd += 4, ws += 4)
+			{
+				klib_word w0 = ws[0], w1 = ws[1], w2 = ws[2], w3 = ws[3];
+				wd[0] = w0;
+				wd[1] = w1;
+				wd[2] = w2;
+				wd[3] = w3;
+			}
+			for (; n >= k_wsize; n -= k_wsize)
+				*wd++ = *ws++;
+			s = (const uchar *)ws;
+		}
+		else
+		{
+			// src 与 dst 相对不对齐：只做对齐的字读，再移位拼接（小端）。
+			// 多读到的字节与有效字节同处一个对齐字内，不会越过页边界。
+			const klib_word *ws = (const klib_word *)(s - off);
+			const uint lsh = (k_wsize - off) * 8, rsh = off * 8;
+			klib_word w0 = *ws++;
+			for (; n >= k_wsize; n -= k_wsize, s += k_wsize)
+			{
+				klib_word w1 = *ws++;
+				*wd++ = (w0 >> rsh) | (w1 << lsh);
+				w0 = w1;
+			}
+		}
+		d = (uchar *)wd;
+	}
+	while (n--)
+		*d++ = *s++;
+}
+
+/// @brief 从高地址向低地址拷贝，用于 dst > src 的重叠情况
+KLIB_NO_LIBCALL static void copy_backward(uchar *d, const uchar *s, size_t n)
+{
+	d += n;
+	s += n;
+	if (n >= 2 * k_wsize && co_aligned(d, s))
+	{
+		while ((uintptr_t)d & k_wmask)
+		{
+			*--d = *--s;
+			n--;
+		}
+		klib_word *wd = (klib_word *)d;
+		const klib_word *ws = (const klib_word *)s;
+		for (; n >= 4 * k_wsize; n -= 4 * k_wsize)
+		{
+			wd -= 4;
+			ws -= 4;
+			klib_word w3 = ws[3], w2 = ws[2], w1 = ws[1], w0 = ws[0];
+			wd[3] = w3;
+			wd[2] = w2;
+			wd[1] = w1;
+			wd[0] = w0;
+		}
+		for (; n >= k_wsize; n -= k_wsize)
+			*--wd = *--ws;
+		d = (uchar *)wd;
+		s = (const uchar *)ws;
+	}
+	while (n--)
+		*--d = *--s;
+}
+
+KLIB_NO_LIBCALL void *memset(void *s, int c, size_t n) noexcept(true)
 {
-	for (char *b = (char *)s; (size_t)(b - (char *)s) < n; b++)
-		*b = c;
+	uchar *d = (uchar *)s;
+	uchar b = (uchar)c;
+	if (n >= 2 * k_wsize)
+	{
+		while ((uintptr_t)d & k_wmask)
+		{
+			*d++ = b;
+			n--;
+		}
+		klib_word w = (klib_word)b * 0x0101010101010101UL;
+		klib_word *wd = (klib_word *)d;
+		for (; n >= 4 * k_wsize; n -= 4 * k_wsize, wd += 4)
+		{
+			wd[0] = w;
+			wd[1] = w;
+			wd[2] = w;
+			wd[3] = w;
+		}
+		for (; n >= k_wsize; n -= k_wsize)
+			*wd++ = w;
+		d = (uchar *)wd;
+	}
+	while (n--)
+		*d++ = b;
 	return s;
 }
 
-void *memmove(void *dst, const void *src, size_t n) noexcept(true)
+KLIB_NO_LIBCALL void *memmove(void *dst, const void *src, size_t n) noexcept(true)
 {
 	// may overlap
-	if (n <= 0)
+	uchar *d = (uchar *)dst;
+	const uchar *s = (const uchar *)src;
+	if (n == 0 || d == s)
 		return dst;
-	const char *i = (const char *)src;
-	char *j = (char *)dst;
-	for (i += n - 1, j += n - 1; i >= (const char *)src; i--, j--)
-		*j = *i;
+	// 只有 dst 落在 [src, src + n) 内时才需要倒着拷
+	if (d <= s || d >= s + n)
+		copy_forward(d, s, n);
+	else
+		copy_backward(d, s, n);
 	return dst;
 }
 
-void *memcpy(void *out, const void *in, size_t n) noexcept(true)
+KLIB_NO_LIBCALL void *memcpy(void *out, const void *in, size_t n) noexcept(true)
 {
-	const char *i = (const char *)in;
-	char *j = (char *)out;
-	for (; static_cast<size_t>(j - ((char *)out)) < n; i++, j++)
-		*j = *i;
+	copy_forward((uchar *)out, (const uchar *)in, n);
 	return out;
 }
 
-int memcmp(const void *s1, const void *s2, size_t n) noexcept(true)
+KLIB_NO_LIBCALL int memcmp(const void *s1, const void *s2, size_t n) noexcept(true)
 {
-	size_t cnt = 1;
-	const unsigned char *i = (const unsigned char *)s1, *j = (const unsigned char *)s2;
-	if (n == 0)
-		return 0;
-	for (; *i == *j; i++, j++, cnt++)
+	const uchar *i = (const uchar *)s1, *j = (const uchar *)s2;
+	if (n >= 2 * k_wsize && co_aligned(i, j))
 	{
-		if (!*i || cnt >= n)
-			return 0;
+		while ((uintptr_t)i & k_wmask)
+		{
+			if (*i != *j)
+				return *i < *j ? -1 : 1;
+			i++, j++, n--;
+		}
+		// 按字比较，遇到不同的字再退回逐字节找出第一个不同的字节
+		const klib_word *wi = (const klib_word *)i, *wj = (const klib_word *)j;
+		for (; n >= k_wsize && *wi == *wj; n -= k_wsize)
+			wi++, wj++;
+		i = (const uchar *)wi;
+		j = (const uchar *)wj;
 	}
-	return *i < *j ? -1 : 1;
+	for (; n > 0; n--, i++, j++)
+	{
+		if (*i != *j)
+			return *i < *j ? -1 : 1;
+	}
+	return 0;
 }
 
 const void *
@@ -26,6 +26,10 @@ extern "C" {
 
 
 extern "C++" {
+#ifdef KLIB_BENCH
+	void klib_bench();	// libs/klib_bench.cc
+#endif
+
 #define STDIO 1
 #define STRING 0
 
@@ -1,5 +1,8 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#ifndef SMP_NCPU
+#define SMP_NCPU      1  // 实际启动的核数，由 Makefile 按 qemu 的 -smp 传入
+#endif
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
@@ -11,4 +14,7 @@
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#ifndef IOV_MAX
+#define IOV_MAX      1024  // readv/writev 单次最多的 iovec 段数，同 Linux 的 UIO_MAXIOV（libc 的 limits.h 可能已定义）
+#endif
 #define INTERVAL     (390000000 / 200) // 用于trap.cc中设定时钟响应间隔
@@ -1,4 +1,7 @@
 #include "printer.hh"
+#include "cpu.hh"
+#include "proc/proc.hh"
+#include "proc/proc_manager.hh"
 #include <stdarg.h>
 
 #ifdef RISCV
@@ -15,6 +18,8 @@ char Printer::_upper_digits[] = "0123456789ABCDEF";
 void Printer::init()
 {
 	_lock.init("printer");
+	_wake_lock.init("klogd");
+	_klogd_idle.store(false);
 	_locking = 1;
 	
 	// 初始化控制台并关联
@@ -68,33 +73,61 @@ void Printer::printptr( uint64 x )
         }
 }
 
-void Printer::print( const char *fmt, ... )
+namespace
 {
-#define DIS_PRINTF
-#ifdef DIS_PRINTF
-  // 当定义了 DIS_PRINTF 宏时，不产生任何输出
-  // 但仍需要处理可变参数以避免潜在问题
-  va_list ap1;
-  va_start(ap1, fmt);
-  va_end(ap1);
-  return;
-#endif
+	struct ConsoleSink
+	{
+		dev::Console *console;
+		void put( char c ) { console->console_putc( c ); }
+	};
 
-  va_list ap;
-  int i, c, tmp_locking;
-  const char *s;
+	// 写到 limit 为止，超出的部分丢弃并记下溢出
+	struct RingSink
+	{
+		char  *buf;
+		uint64 pos;
+		uint64 limit;
+		bool   overflow;
+		void put( char c )
+		{
+			if ( pos == limit )
+			{
+				overflow = true;
+				return;
+			}
+			buf[pos & ( klog_ring_size - 1 )] = c;
+			pos++;
+		}
+	};
 
-  tmp_locking = this->_locking;
-  if (tmp_locking)
-    _lock.acquire();
+	void klogd_entry( void *arg )
+	{
+		Printer	  *pr = (Printer *) arg;
+		proc::Pcb *p  = proc::k_pm.get_cur_pcb();
 
-  if (fmt == 0)
-    k_panic(__FILE__, __LINE__, "null fmt");
+		// 只在没有别的事可做时输出日志
+		p->_lock.acquire();
+		p->_priority = proc::lowest_proc_prio;
+		p->_lock.release();
+
+		while ( true )
+		{
+			pr->drain();
+			pr->wait_for_logs();
+		}
+	}
+} // namespace
+
+template <typename Sink>
+void Printer::_format( Sink &out, const char *fmt, va_list ap )
+{
+  int i, c;
+  const char *s;
+  char buf[32];
 
-  va_start(ap, fmt);
   for (i = 0; (c = fmt[i] & 0xff) != 0; ) {
     if (c != '%') {
-      _console->console_putc(c);
+      out.put(c);
       i++;
       continue;
     }
@@ -110,82 +143,215 @@ void Printer::print( const char *fmt, ... )
       break;
     switch (c) {
     case 'b':
-      printint(va_arg(ap, int), 2, 1);
-      break;
     case 'd':
-      printint(va_arg(ap, int), 10, 1);
-      break;
-    case 'u':
-      printint(va_arg(ap, uint), 10, 0);
-      break;
-    case 'x': {
-      // 打印无符号16进制（64位）
-      uint64 val = va_arg(ap, uint64);
-      char buf[16];
+    case 'u': {
+      int base = c == 'b' ? 2 : 10;
+      int xx = c == 'u' ? (int)va_arg(ap, uint) : va_arg(ap, int);
+      bool neg = c != 'u' && xx < 0;
+      uint x = neg ? -xx : xx;
       int j = 0;
       do {
-        buf[j++] = _lower_digits[val % 16];
-      } while ((val /= 16) != 0);
-      // Padding with '0' if width > j
-      for (int k = j; k < width; k++)
-        _console->console_putc('0');
+        buf[j++] = _lower_digits[x % base];
+      } while ((x /= base) != 0);
+      if (neg)
+        buf[j++] = '-';
       while (--j >= 0)
-        _console->console_putc(buf[j]);
+        out.put(buf[j]);
       break;
     }
+    case 'x':
     case 'X': {
-      // 打印大写无符号16进制（64位）
+      // 打印无符号16进制（64位）
+      const char *digits = c == 'x' ? _lower_digits : _upper_digits;
       uint64 val = va_arg(ap, uint64);
-      char buf[16];
       int j = 0;
       do {
-        buf[j++] = _upper_digits[val % 16];
+        buf[j++] = digits[val % 16];
       } while ((val /= 16) != 0);
+      // Padding with '0' if width > j
       for (int k = j; k < width; k++)
-        _console->console_putc('0');
+        out.put('0');
       while (--j >= 0)
-        _console->console_putc(buf[j]);
+        out.put(buf[j]);
       break;
     }
-    case 'p':
-      printptr(va_arg(ap, uint64));
+    case 'p': {
+      uint64 x = va_arg(ap, uint64);
+      out.put('0');
+      out.put('x');
+      for (uint j = 0; j < (sizeof(uint64) * 2); j++, x <<= 4)
+        out.put(_lower_digits[x >> 60]);
       break;
+    }
     case 's':
       if ((s = va_arg(ap, const char *)) == 0)
         s = "(null)";
       for (; *s; s++)
-        _console->console_putc(*s);
+        out.put(*s);
       break;
-    case 'c': {
-      int ch = va_arg(ap, int);
-      _console->console_putc(ch);
+    case 'c':
+      out.put(va_arg(ap, int));
       break;
-    }
     case '%':
-      _console->console_putc('%');
+      out.put('%');
       break;
     default:
       // Print unknown % sequence to draw attention.
-      _console->console_putc('%');
-      _console->console_putc(c);
+      out.put('%');
+      out.put(c);
       break;
     }
     i++;
   }
-  va_end(ap);
+}
 
+void Printer::_vprint_sync( const char *fmt, va_list ap )
+{
+  if (_console == nullptr)
+    return;
+  int tmp_locking = _locking;
+  if (tmp_locking)
+    _lock.acquire();
+  ConsoleSink out{_console};
+  _format(out, fmt, ap);
   if (tmp_locking)
     _lock.release();
 }
 
+void Printer::_print_sync( const char *fmt, ... )
+{
+  va_list ap;
+  va_start(ap, fmt);
+  _vprint_sync(fmt, ap);
+  va_end(ap);
+}
+
+void Printer::print( const char *fmt, ... )
+{
+  va_list ap;
+  va_start(ap, fmt);
+  vlog(LOG_INFO, fmt, ap);
+  va_end(ap);
+}
+
+void Printer::log( int level, const char *fmt, ... )
+{
+  va_list ap;
+  va_start(ap, fmt);
+  vlog(level, fmt, ap);
+  va_end(ap);
+}
+
+void Printer::vlog( int level, const char *fmt, va_list ap )
+{
+  if (level < _level)
+    return;
+  if (fmt == 0)
+    k_panic(__FILE__, __LINE__, "null fmt");
+  if (!_async)
+  {
+    _vprint_sync(fmt, ap);
+    return;
+  }
+
+  // 关中断后本核是这个环唯一的写者；整条写完才推进 head，排空方看不到写了一半的日志
+  Cpu::push_intr_off();
+  LogRing &r = _ring[Cpu::read_tp()];
+  uint64 head = r.head.load(eastl::memory_order_relaxed);
+  RingSink out{r.buf, head, r.tail.load(eastl::memory_order_acquire) + klog_ring_size, false};
+  _format(out, fmt, ap);
+  if (out.overflow)
+    r.dropped.fetch_add(1, eastl::memory_order_relaxed);
+  else
+    r.head.store(out.pos, eastl::memory_order_release);
+  Cpu::pop_intr_off();
+  _kick_klogd();
+}
+
+void Printer::_kick_klogd()
+{
+  // 持有自旋锁时不能去拿进程锁唤醒（可能正持有日志线程的锁或调度相关的锁），
+  // 这时的日志留给下一次不持锁的日志调用或调度器空闲路径去排空
+  if (!_klogd_idle.load() || Cpu::get_cpu()->get_num_off() > 0)
+    return;
+  _wake_lock.acquire();
+  if (_klogd_idle.load())
+  {
+    _klogd_idle.store(false);
+    proc::k_pm.wakeup(&_klogd_idle);
+  }
+  _wake_lock.release();
+}
+
+bool Printer::_has_pending()
+{
+  for (LogRing &r : _ring)
+    if (r.head.load(eastl::memory_order_acquire) != r.tail.load(eastl::memory_order_relaxed) ||
+        r.dropped.load(eastl::memory_order_relaxed) != 0)
+      return true;
+  return false;
+}
+
+void Printer::wait_for_logs()
+{
+  _wake_lock.acquire();
+  // 先置标志再检查缓冲区：vlog 先写缓冲区再看标志，两边总有一方看到对方
+  _klogd_idle.store(true);
+  while (_klogd_idle.load() && !_has_pending())
+    proc::k_pm.sleep(&_klogd_idle, &_wake_lock);
+  _klogd_idle.store(false);
+  _wake_lock.release();
+}
+
+void Printer::start_async()
+{
+  proc::k_pm.create_kthread("klogd", klogd_entry, this);
+  _async = true;
+}
+
+void Printer::_drain_ring( LogRing &r )
+{
+  uint64 tail = r.tail.load(eastl::memory_order_relaxed);
+  uint64 head;
+  while ((head = r.head.load(eastl::memory_order_acquire)) != tail)
+  {
+    // 分段持锁，不让一次排空长时间关着中断
+    uint64 end = head - tail > klog_drain_chunk ? tail + klog_drain_chunk : head;
+    int tmp_locking = _locking;
+    if (tmp_locking)
+      _lock.acquire();
+    for (; tail != end; tail++)
+      _console->console_putc(r.buf[tail & (klog_ring_size - 1)]);
+    if (tmp_locking)
+      _lock.release();
+    r.tail.store(tail, eastl::memory_order_release);
+  }
+  uint64 dropped = r.dropped.exchange(0, eastl::memory_order_relaxed);
+  if (dropped != 0)
+    _print_sync("[log] %d messages dropped\n", (int)dropped);
+}
+
+void Printer::drain()
+{
+  if (!_async || _draining.exchange(true))
+    return;
+  for (LogRing &r : _ring)
+    _drain_ring(r);
+  _draining.store(false);
+}
+
 void Printer::k_panic( const char *f, uint l, const char *info, ... )
 {
   va_list ap;
+  // 同步输出，并先把缓冲区里还没输出的日志倒出来，它们往往就是出错的经过
+  k_printer._locking = 0;
+  if (k_printer._async)
+    for (LogRing &r : k_printer._ring)
+      k_printer._drain_ring(r);
   va_start( ap, info );
-  printf("panic: ");
-  printf("%s:%d: ", f, l);
-  printf(info, ap);
-  printf("\n");
+  k_printer._print_sync("panic: %s:%d: ", f, l);
+  k_printer._vprint_sync(info, ap);
+  k_printer._print_sync("\n");
   va_end( ap );
   k_printer._panicked = 1; // freeze uart output from other CPUs
   
@@ -207,28 +373,26 @@ void Printer::k_panic( const char *f, uint l, const char *info, ... )
 void Printer::assrt( const char *f, uint l, const char *expr, const char *detail, ... )
 	{
 		k_printer._locking = 0;
+		if ( k_printer._async )
+			for ( LogRing &r : k_printer._ring )
+				k_printer._drain_ring( r );
 #ifdef LINUX_BUILD
-		printf( "\033[91m[ assert ]=> " );
+		k_printer._print_sync( "\033[91m[ assert ]=> " );
 #else 
-		printf( "[ assert ]=> " );
+		k_printer._print_sync( "[ assert ]=> " );
 #endif 
-		printf( f );
-		printf( " : " );
-		printf( "%d", l );
-		printf( " :\n\t     " );
+		k_printer._print_sync( "%s : %d :\n\t     ", f, l );
 		_trace_flag = 1;
-		printf( "assert fail for '" );
-		printf( expr );
-		printf( "'\n[detail] " );
+		k_printer._print_sync( "assert fail for '%s'\n[detail] ", expr );
 		va_list ap;
 		va_start( ap, detail );
-		printf( detail, ap );
+		k_printer._vprint_sync( detail, ap );
 		va_end( ap );
 		_trace_flag = 0;
 #ifdef LINUX_BUILD
-		printf( "\033[0m\n" );
+		k_printer._print_sync( "\033[0m\n" );
 #else 
-		printf( "\n" );
+		k_printer._print_sync( "\n" );
 #endif 
 		k_printer._locking = 1;
 
@@ -1,37 +1,66 @@
 #pragma once
 #include "devs/console.hh"
 #include "string.hh"
-// enum OutputLevel
-// 	{
-// 		out_trace,
-// 		out_info,
-// 		out_warn,
-// 		out_error,
-// 		out_panic,
-// 	};
+#include "param.h"
+#include <stdarg.h>
+
+// 日志级别
+#define LOG_TRACE 0
+#define LOG_DEBUG 1
+#define LOG_INFO 2
+#define LOG_WARN 3
+#define LOG_ERROR 4
+#define LOG_OFF 5
+
+// 编译期日志级别，由 Makefile 的 LOG_LEVEL 传入。低于它的日志调用连同参数求值一起被编译掉，
+// 运行期还可以用 k_printer.set_level() 再往上调
+#ifdef DIS_PRINTF
+#undef KLOG_LEVEL
+#define KLOG_LEVEL LOG_OFF
+#endif
+#ifndef KLOG_LEVEL
+#define KLOG_LEVEL LOG_WARN
+#endif
+
 #define panic(info, args...) k_printer.k_panic(__FILE__, __LINE__, info, ##args)
 
-#define printf(info, args...) k_printer.print(info, ##args)
+#define klog(level, fmt, args...)                     \
+	do                                                \
+	{                                                 \
+		if constexpr ((level) >= KLOG_LEVEL)          \
+			k_printer.log((level), fmt, ##args);      \
+	} while (0)
+#define log_trace(fmt, args...) klog(LOG_TRACE, fmt, ##args)
+#define log_debug(fmt, args...) klog(LOG_DEBUG, fmt, ##args)
+#define log_info(fmt, args...) klog(LOG_INFO, fmt, ##args)
+#define log_warn(fmt, args...) klog(LOG_WARN, fmt, ##args)
+#define log_error(fmt, args...) klog(LOG_ERROR, fmt, ##args)
+
+#define printf(info, args...) log_info(info, ##args)
 #define assert(expr, detail, args...) ((expr) ? (void)0 : k_printer.assrt(__FILE__, __LINE__, #expr, detail, ##args))
 
 #ifndef COLOR_PRINT
 #define COLOR_PRINT
 
-#define printfRed(format, ...) k_printer.print("\33[1;31m" format "\33[0m", ##__VA_ARGS__)
-#define printfGreen(format, ...) k_printer.print("\33[1;32m" format "\33[0m", ##__VA_ARGS__)
-#define printfBlue(format, ...) k_printer.print("\33[1;34m" format "\33[0m", ##__VA_ARGS__)
-#define printfCyan(format, ...) k_printer.print("\33[1;36m" format "\33[0m", ##__VA_ARGS__)
-#define printfYellow(format, ...) k_printer.print("\33[1;33m" format "\33[0m", ##__VA_ARGS__)
-#define printfWhite(format, ...) k_printer.print("\33[1;37m" format "\33[0m", ##__VA_ARGS__)
-#define printfMagenta(format, ...) k_printer.print("\33[1;35m" format "\33[0m", ##__VA_ARGS__)
+// 颜色只是习惯：红色多用于报错，青、蓝色多用于调试跟踪，其余是一般信息
+#define printfRed(format, ...) log_warn("\33[1;31m" format "\33[0m", ##__VA_ARGS__)
+#define printfGreen(format, ...) log_info("\33[1;32m" format "\33[0m", ##__VA_ARGS__)
+#define printfBlue(format, ...) log_debug("\33[1;34m" format "\33[0m", ##__VA_ARGS__)
+#define printfCyan(format, ...) log_debug("\33[1;36m" format "\33[0m", ##__VA_ARGS__)
+#define printfYellow(format, ...) log_info("\33[1;33m" format "\33[0m", ##__VA_ARGS__)
+#define printfWhite(format, ...) log_info("\33[1;37m" format "\33[0m", ##__VA_ARGS__)
+#define printfMagenta(format, ...) log_info("\33[1;35m" format "\33[0m", ##__VA_ARGS__)
 // Info print macros
-#define Info(fmt, ...) printf("[INFO] => " fmt "", ##__VA_ARGS__)
+#define Info(fmt, ...) log_info("[INFO] => " fmt "", ##__VA_ARGS__)
 #define Info_R(fmt, ...) printfRed("[INFO] => " fmt "", ##__VA_ARGS__)
 
 // TODO macro
 #define TODO(x)
 #endif
 
+constexpr uint64 klog_ring_size = 8192; // 每个核的日志环形缓冲区大小，须是 2 的幂
+constexpr uint64 klog_drain_chunk = 256; // 排空时每次持锁输出的最多字节数
+
 class Printer
 {
 private:
@@ -41,11 +70,27 @@ private:
 		file,
 		device,
 	};
+	/// @brief 每个核一个单生产者单消费者的日志环：本核关中断写入，排空方读出，互不加锁。
+	/// 一条日志放不下时整条丢弃并计数，写日志永远不会等控制台
+	struct LogRing
+	{
+		char buf[klog_ring_size];
+		eastl::atomic<uint64> head;	   // 已提交的写入位置
+		eastl::atomic<uint64> tail;	   // 已输出的读出位置
+		eastl::atomic<uint64> dropped; // 因为放不下而丢弃的条数
+	};
+
 	out_type _type;
 	dev::Console *_console;
 	SpinLock _lock;
 	int _locking = 1;
 	int _panicked = 0;
+	int _level = KLOG_LEVEL;	// 运行期日志级别，不低于编译期级别
+	bool _async = false;		// 日志线程启动前同步输出
+	eastl::atomic<bool> _draining;
+	SpinLock _wake_lock;			 // 日志线程睡眠/唤醒用
+	eastl::atomic<bool> _klogd_idle; // 日志线程已经（或正准备）睡在 _klogd_idle 上
+	LogRing _ring[NCPU];
 	static int _trace_flag;
 	static char _lower_digits[];
 	static char _upper_digits[];
@@ -57,6 +102,18 @@ public:
 	inline int is_panic() { return _panicked; }
 
 	void print(const char *fmt, ...);
+	/// @brief 记一条日志，低于运行期级别的直接忽略；异步模式下写入本核的环形缓冲区后立即返回
+	void log(int level, const char *fmt, ...);
+	void vlog(int level, const char *fmt, va_list ap);
+	void set_level(int level) { _level = level < KLOG_LEVEL ? KLOG_LEVEL : level; }
+	int get_level() { return _level; }
+
+	/// @brief 启动日志线程，此后日志改为异步输出
+	void start_async();
+	/// @brief 把各核环形缓冲区中的日志输出到控制台。已有别的核在排空时直接返回
+	void drain();
+	/// @brief 日志线程在各核缓冲区都空时睡下，直到 vlog 写入新日志把它唤醒
+	void wait_for_logs();
 	void printint(int xx, int base, int sign);
 	void printbyte(uint8 x);
 	void printptr(uint64 x);
@@ -76,6 +133,14 @@ public:
 						 va_list ap);
 
 private:
+	template <typename Sink>
+	void _format(Sink &out, const char *fmt, va_list ap);
+	void _vprint_sync(const char *fmt, va_list ap);
+	void _print_sync(const char *fmt, ...);
+	void _drain_ring(LogRing &r);
+	bool _has_pending();
+	void _kick_klogd();
+
 	int _divide(ulong &n, int base)
 	{
 		int res = (int)(n % base);
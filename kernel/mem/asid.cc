@@ -0,0 +1,98 @@
+#include "asid.hh"
+#ifdef RISCV
+#include "mem/riscv/pagetable.hh"
+#elif defined(LOONGARCH)
+#include "mem/loongarch/pagetable.hh"
+#endif
+#include "platform.hh"
+#include "hal/cpu.hh"
+#include "printer.hh"
+
+namespace mem
+{
+	AsidAllocator k_asid;
+
+	void AsidAllocator::init()
+	{
+		_lock.init( "asid" );
+#ifdef RISCV
+		// 往 satp 的 ASID 字段写全 1，读回来的就是实现了的位
+		uint64 satp = r_satp();
+		w_satp( satp | riscv::csr::satp_asid_m );
+		uint64 impl = ( r_satp() & riscv::csr::satp_asid_m ) >> riscv::csr::satp_asid_s;
+		w_satp( satp );
+		sfence_vma();
+		while ( impl & 1 )
+		{
+			_bits++;
+			impl >>= 1;
+		}
+#elif defined(LOONGARCH)
+		// CSR.ASID 的 ASIDBITS 字段 [23:16] 给出 ASID 宽度
+		_bits = ( r_csr_asid() >> 16 ) & 0xff;
+#endif
+		_gen  = _bits ? 1UL << _bits : 0;
+		_next = 1;
+		printfGreen( "[asid] %d-bit ASID%s\n", _bits, _bits ? "" : " not supported, flushing TLB on every switch" );
+	}
+
+	uint64 AsidAllocator::activate( PageTable &pt )
+	{
+		uint64 *slot = pt.asid_slot();
+		if ( slot == nullptr )
+			return 0;
+		// 先登记再换页表：击落方在改完页表项之后读这个位图
+		__atomic_fetch_or( pt.cpus_slot(), 1UL << Cpu::read_tp(), __ATOMIC_SEQ_CST );
+		if ( _bits == 0 )
+			return 0;
+
+		uint64 mask = ( 1UL << _bits ) - 1;
+		_lock.acquire();
+		if ( ( *slot & ~mask ) != _gen )
+		{
+			if ( _next > mask )
+			{
+				// 本代用完：换代，所有核都欠一次整片刷新
+				_gen += mask + 1;
+				_next = 1;
+				_flush_pending = ~0UL;
+			}
+			*slot = _gen | _next++;
+		}
+		uint64 me = 1UL << Cpu::read_tp();
+		bool flush = ( _flush_pending & me ) != 0;
+		_flush_pending &= ~me;
+		uint64 asid = *slot & mask;
+		_lock.release();
+
+		if ( flush )
+		{
+#ifdef RISCV
+			sfence_vma();
+#elif defined(LOONGARCH)
+			asm volatile( "invtlb 0x0,$zero,$zero" );
+#endif
+		}
+		return asid;
+	}
+
+	bool AsidAllocator::current( PageTable &pt, uint64 &asid )
+	{
+		uint64 *slot = pt.asid_slot();
+		if ( _bits == 0 || slot == nullptr )
+			return false;
+		uint64 mask = ( 1UL << _bits ) - 1;
+		uint64 v	= *slot;
+		if ( ( v & ~mask ) != _gen )
+			return false;
+		asid = v & mask;
+		return true;
+	}
+
+	uint64 AsidAllocator::ran_on( PageTable &pt )
+	{
+		uint64 *cpus = pt.cpus_slot();
+		return cpus ? __atomic_load_n( cpus, __ATOMIC_SEQ_CST ) : 0;
+	}
+
+} // namespace mem
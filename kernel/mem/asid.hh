@@ -0,0 +1,46 @@
+#pragma once
+
+#include "types.hh"
+#include "spinlock.hh"
+
+namespace mem
+{
+	class PageTable;
+
+	/// @brief 地址空间标识 (riscv satp.ASID / 龙芯 CSR.ASID) 分配器。
+	/// 每个用户页表分到一个 ASID，TLB 表项按 ASID 区分，所以进出内核不必再整片刷新 TLB，
+	/// 修改映射时也只需按 ASID/VA 刷掉相应表项。内核页表固定使用 ASID 0。
+	/// ASID 按代分配：页表记下“代号 | ASID”，本代的 ASID 用完后代号加一，
+	/// 各核在下次进入用户态前整片刷新一次，旧代的页表下次运行时重新分配。
+	/// 页表释放时不回收 ASID，统一等到换代时作废。
+	class AsidAllocator
+	{
+	private:
+		SpinLock _lock;
+		uint	 _bits = 0;			// 硬件实现的 ASID 位数，0 表示不支持
+		uint64	 _gen = 0;			// 当前代号，低 _bits 位恒为 0
+		uint64	 _next = 1;			// 本代下一个可分配的 ASID
+		uint64	 _flush_pending = 0;	// 换代后还没整片刷新过的核（按 hartid 的位图）
+
+	public:
+		/// @brief 探测硬件 ASID 位数，须在内核页表启用之后调用
+		void init();
+		bool enabled() const { return _bits != 0; }
+
+		/// @brief 进入用户态前取得 pt 在本代的 ASID，没有时分配；换代欠下的整片刷新也在这里完成。
+		/// 同时记下当前核运行过 pt
+		/// @return 写入 satp/CSR.ASID 的 ASID；不支持 ASID 或页表没有共享状态时为 0，此时进出内核仍整片刷新
+		uint64 activate( PageTable &pt );
+
+		/// @brief pt 在本代持有的 ASID。没有时 TLB 里不可能有它的表项，返回 false，修改映射后也不用刷
+		bool current( PageTable &pt, uint64 &asid );
+
+		/// @brief 运行过 pt 的核（按 hartid 的位图），修改映射后要击落的范围
+		uint64 ran_on( PageTable &pt );
+		/// @brief 换代后还没整片刷新的核，它们可能还留着上一代 ASID 的表项
+		uint64 stale_cpus() const { return _flush_pending; }
+	};
+
+	extern AsidAllocator k_asid;
+
+} // namespace mem
@@ -8,219 +8,159 @@
 namespace mem
 {
 
-    constexpr uint64 BuddySystem::AlignUp(uint64 addr, uint64 align)
+    int BuddySystem::SizeToOrder(uint32 size)
     {
-        return (addr + align - 1) & ~(align - 1);
+        int order = 0;
+        while ((1U << order) < size)
+            order++;
+        return order;
     }
 
-    uint32 BuddySystem::NextPowerOfTwo(uint32 x)
+    BuddyFreeBlock *BuddySystem::BlockAt(int offset) const
     {
-        if (x == 0)
-            return 1;
-        x--;
-        x |= x >> 1;
-        x |= x >> 2;
-        x |= x >> 4;
-        x |= x >> 8;
-        x |= x >> 16;
-        return x + 1;
+        return reinterpret_cast<BuddyFreeBlock *>(base_ptr + static_cast<uint64>(offset) * PGSIZE);
     }
 
-    void BuddySystem::Initialize(uint64 baseptr)
+    int BuddySystem::OffsetOf(BuddyFreeBlock *blk) const
     {
-        // 初始化buddy系统，baseptr是buddy系统的起始地址
-        // 原本的buddy是用来管理物理内存的，所以并没有初始化它管理的内存的操作
-        // 这里解耦合，buddy同时用于管理pm和hm，这里的buddy初始化时不用初始化内存
-        base_ptr = reinterpret_cast<uint8 *>(baseptr);
+        return static_cast<int>((reinterpret_cast<uint8 *>(blk) - base_ptr) / PGSIZE);
+    }
 
-        printfGreen("[mem] Buddy System Init\n");
-        // printf("[BuddySystem] base_ptr: %p\n", base_ptr);
-        tree = base_ptr - BSSIZE * PGSIZE + sizeof(BuddySystem);
-        level = 0;
-        while (!((1 << level) & PGNUM))
+    void BuddySystem::Initialize(uint64 baseptr, uint64 pages)
+    {
+        // 初始化buddy系统，baseptr是buddy系统管理的内存的起始地址，pages是实际可用的页数
+        // buddy同时用于管理pm和hm，空闲链表节点写在空闲块的首页里，
+        // 所以这里只会碰到每个初始空闲块的第一页
+        base_ptr = reinterpret_cast<uint8 *>(baseptr);
+        if (pages > PGNUM)
         {
-            level++;
+            printfRed("[BuddySystem] %d pages exceed the limit, only %d managed\n", pages, PGNUM);
+            pages = PGNUM;
         }
-        // 计算所需的树节点数量
-        int max_nodes = (1 << (level + 1)) - 1;
-        int available_bytes = BSSIZE * PGSIZE - sizeof(BuddySystem);
-
-        printf("[BuddySystem] level=%d, max_nodes=%d, available_bytes=%d\n",
-               level, max_nodes, available_bytes);
-
-        if (max_nodes > available_bytes)
+        page_num = pages;
+        used = 0;
+
+        // 元数据放在预留区里对象本身的后面：每页一个字节的阶，然后是各阶的空闲位图
+        uint8 *meta = reinterpret_cast<uint8 *>(this) + sizeof(BuddySystem);
+        uint8 *limit = reinterpret_cast<uint8 *>(this) + BSSIZE * PGSIZE;
+        orders = meta;
+        meta += page_num;
+        meta = reinterpret_cast<uint8 *>((reinterpret_cast<uint64>(meta) + 7) & ~7UL);
+        for (int k = 0; k <= BUDDY_MAX_ORDER; k++)
         {
-            panic("[BuddySystem] Tree size (%d bytes) exceeds available space (%d bytes)\n",
-                  max_nodes, available_bytes);
+            free_map[k] = reinterpret_cast<uint64 *>(meta);
+            meta += ((page_num >> k) / 64 + 1) * sizeof(uint64);
+            free_list[k] = nullptr;
         }
+        if (meta > limit)
+        {
+            panic("[BuddySystem] metadata (%d bytes) exceeds available space (%d bytes)\n",
+                  meta - reinterpret_cast<uint8 *>(this), BSSIZE * PGSIZE);
+        }
+        memset(orders, 0, meta - orders);
 
-        // 初始化树数组
-        for (int i = 0; i < max_nodes; i++)
+        // 把整段内存切成尽可能大的对齐块挂上空闲链表
+        uint64 off = 0;
+        while (off < page_num)
         {
-            tree[i] = NODE_UNUSED;
+            int k = BUDDY_MAX_ORDER;
+            while ((off & ((1UL << k) - 1)) != 0 || off + (1UL << k) > page_num)
+                k--;
+            ListAdd(k, static_cast<int>(off));
+            off += 1UL << k;
         }
 
-        printfGreen("[mem] Buddy System Init with %d pages, level=%d\n", PGNUM, level);
+        printfGreen("[mem] Buddy System Init with %d pages\n", page_num);
     }
 
-    int BuddySystem::IndexOffset(int index, int level, int max_level) const
+    void BuddySystem::ListAdd(int order, int offset)
     {
-        return ((index + 1) - (1 << level)) << (max_level - level);
+        BuddyFreeBlock *blk = BlockAt(offset);
+        blk->prev = nullptr;
+        blk->next = free_list[order];
+        if (free_list[order])
+            free_list[order]->prev = blk;
+        free_list[order] = blk;
+        uint64 idx = static_cast<uint64>(offset) >> order;
+        free_map[order][idx >> 6] |= 1UL << (idx & 63);
     }
 
-    void BuddySystem::MarkParent(int index)
+    void BuddySystem::ListDel(int order, int offset)
     {
-        while (true)
-        {
-            int buddy = index - 1 + (index & 1) * 2;
-            if (buddy > 0 && (tree[buddy] == NODE_USED || tree[buddy] == NODE_FULL))
-            {
-                index = (index + 1) / 2 - 1;
-                tree[index] = NODE_FULL;
-            }
-            else
-            {
-                return;
-            }
-        }
+        BuddyFreeBlock *blk = BlockAt(offset);
+        if (blk->prev)
+            blk->prev->next = blk->next;
+        else
+            free_list[order] = blk->next;
+        if (blk->next)
+            blk->next->prev = blk->prev;
+        uint64 idx = static_cast<uint64>(offset) >> order;
+        free_map[order][idx >> 6] &= ~(1UL << (idx & 63));
     }
 
-    int BuddySystem::Alloc(int size)
+    int BuddySystem::AllocOrder(int order)
     {
-        // buddy的单位是页，而不是页面大小，这个size的意思是页的数量
-        int actual_size = size == 0 ? 1 : NextPowerOfTwo(size);
-        int length = 1 << level; // length变量表示当前结点对应的块的大小
-
-        if (actual_size > length)
+        if (order < 0 || order > BUDDY_MAX_ORDER)
         {
             printfRed("[BuddySystem] Alloc failed, request too many pages\n");
             return -1;
         }
-        int index = 0;
-        int current_level = 0;
+        int k = order;
+        while (k <= BUDDY_MAX_ORDER && free_list[k] == nullptr)
+            k++;
+        if (k > BUDDY_MAX_ORDER)
+            return -1;
 
-        while (index >= 0)
+        int offset = OffsetOf(free_list[k]);
+        ListDel(k, offset);
+        // 大块逐级对半拆开，后一半挂回低一阶的链表
+        while (k > order)
         {
-
-            // if(current_level > - 30)
-            // printf("[BuddySystem] index: %d, level: %d, current_level: %d,length: %d\n", index, level, current_level,length);
-            if (actual_size == length)
-            {
-
-                if (tree[index] == NODE_UNUSED)
-                {
-                    tree[index] = NODE_USED;
-                    MarkParent(index);
-                    return IndexOffset(index, current_level, level);
-                }
-            }
-            else
-            {
-                // printfBlue("%d", tree[index]);
-                switch (tree[index])
-                {
-                case NODE_USED:
-                case NODE_FULL:
-                    break;
-                case NODE_UNUSED:
-                    // printfCyan("1");
-                    tree[index] = NODE_SPLIT;
-                    tree[index * 2 + 1] = NODE_UNUSED;
-                    tree[index * 2 + 2] = NODE_UNUSED;
-                    // printfCyan("2");
-                    [[fallthrough]]; // 默认行为是向下执行
-                default:
-                    index = index * 2 + 1;
-                    length /= 2;
-                    current_level++;
-
-                    continue;
-                }
-            }
-
-            // if (index % 2 == 0) {
-            //     ++index;
-            //     continue;
-            // }
-            if (index & 1) // index是左孩子，变换到右孩子
-            {
-                ++index;
-                continue;
-            }
-
-            for (;;)
-            {
-                current_level--;
-                length *= 2;
-                index = (index + 1) / 2 - 1; // 回溯到父节点
-                if (index < 0)
-                {
-                    printfRed("[BuddySystem] Alloc failed, no suitable block found\n");
-                    return -1; // 遍历完了没有找到合适的块，失败
-                }
-                if (index % 2 == 0)
-                { // 当前是左孩子，变换到右孩子开始继续寻找。
-                    ++index;
-                    break;
-                }
-            }
+            k--;
+            ListAdd(k, offset + (1 << k));
         }
-        // printfRed("[BuddySystem] Alloc failed, no suitable block found\n");
-        return -1;
+        orders[offset] = static_cast<uint8>(order + 1);
+        used += 1UL << order;
+        return offset;
     }
 
-    void BuddySystem::Combine(int index)
+    int BuddySystem::Alloc(int size)
     {
-        while (true)
-        {
-            int buddy = index - 1 + (index & 1) * 2;
-            if (buddy < 0 || tree[buddy] != NODE_UNUSED)
-            {
-                tree[index] = NODE_UNUSED;
-                while ((index = (index + 1) / 2 - 1) >= 0 && tree[index] == NODE_FULL)
-                {
-                    tree[index] = NODE_SPLIT;
-                }
-                return;
-            }
-            index = (index + 1) / 2 - 1;
-        }
+        // buddy的单位是页，而不是页面大小，这个size的意思是页的数量
+        return AllocOrder(size <= 1 ? 0 : SizeToOrder(static_cast<uint32>(size)));
+    }
+
+    int BuddySystem::BlockOrder(int offset) const
+    {
+        if (offset < 0 || static_cast<uint64>(offset) >= page_num)
+            return -1;
+        return static_cast<int>(orders[offset]) - 1;
     }
 
     void BuddySystem::Free(int offset)
     {
         // buddy的单位是页，而不是页面大小，这个offset的意思是页的数量的偏移量
         // 这里需要把offset转换为页的偏移量，也就是offset*PGSIZE+base_ptr才是实际的内存地址
-        int left = 0;
-        int length = 1 << level; // 当前 index 所表示的块的大小（从整块开始）
-        int index = 0;           // 从根节点开始遍历 buddy 树
-
-        while (true)
+        int k = BlockOrder(offset);
+        if (k < 0)
         {
+            panic("[BuddySystem] Freeing invalid page\n");
+            return;
+        }
+        orders[offset] = 0;
+        used -= 1UL << k;
 
-            // printf("[BuddySystem] Freeing page at address: %p, left: %d, length: %d,offset :%d\n", base_ptr + index * PGSIZE, left, length,offset);
-            switch (tree[index])
-            {
-            case NODE_USED:
-                Combine(index);
-                return;
-            case NODE_UNUSED:
-                panic("[BuddySystem] Freeing invalid page\n");
-                return;
-            default:
-                length /= 2;
-                if (offset < left + length)
-                {
-                    index = index * 2 + 1;
-                }
-                else
-                {
-                    left += length;
-                    index = index * 2 + 2;
-                }
+        // 伙伴空闲就摘下来合并，直到伙伴不空闲或越过管理范围
+        while (k < BUDDY_MAX_ORDER)
+        {
+            int buddy = offset ^ (1 << k);
+            if (static_cast<uint64>(buddy) + (1UL << k) > page_num || !IsFree(k, buddy))
                 break;
-            }
+            ListDel(k, buddy);
+            offset &= ~(1 << k);
+            k++;
         }
+        ListAdd(k, offset);
     }
 
     void *BuddySystem::alloc_pages(int count)
@@ -248,4 +188,4 @@ namespace mem
         }
         Free((addr - (uint64)base_ptr) / PGSIZE);
     }
-} // namespace mem
\ No newline at end of file
+} // namespace mem
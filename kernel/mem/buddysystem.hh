@@ -1,42 +1,58 @@
 #pragma once
 #include "types.hh"
 
-#define PAGE_ORDER 10
-#define PGNUM (1 << 19)
-#define BSSIZE 320 //最多支持 2^15 = 32768 页的分配粒度
+#define PGNUM (1 << 19)        // 一个 buddy 最多管理的页数
+#define BUDDY_MAX_ORDER 19     // 最大的块为 2^19 页
+#define BSSIZE 320 // 预留给 BuddySystem 对象及其元数据（阶数组和空闲位图）的页数
 
 namespace mem {
 
-enum NodeState {
-    NODE_UNUSED = 0,
-    NODE_USED = 1,
-    NODE_SPLIT = 2,
-    NODE_FULL = 3
+/// @brief 空闲块的链表节点，直接放在空闲块的首页里
+struct BuddyFreeBlock
+{
+    BuddyFreeBlock *prev;
+    BuddyFreeBlock *next;
 };
 
+/**
+ * @brief 伙伴系统页分配器
+ * 每一阶一条空闲块双向链表，外加一张位图记录某个块是否挂在该阶的空闲链表上，
+ * 释放时据此 O(1) 判断伙伴是否空闲，分配和释放都只需要 O(阶数) 步。
+ * 已分配块的阶记在首页对应的字节里，Free 只需要页号。
+ * 元数据紧跟在 BuddySystem 对象后面，放在调用者预留的 BSSIZE 页内。
+ */
 class BuddySystem {
 public:
-    void Initialize(uint64 baseptr);
-    int Alloc(int size);
+    void Initialize(uint64 baseptr, uint64 pages);
+    int Alloc(int size);          // size 为页数，向上取整到 2 的幂，返回页号，失败返回 -1
+    int AllocOrder(int order);    // 分配 2^order 页
     void Free(int offset);
+    int BlockOrder(int offset) const; // 已分配块的阶，offset 不是已分配块的首页时返回 -1
     void* alloc_pages(int count);
     void free_pages(void* ptr);
     void* get_base_ptr() const { return base_ptr; }
+    uint64 used_pages() const { return used; } // 已分配出去的页数（按 2 的幂次取整后）
 private:
 
     BuddySystem() = default;
-    int IndexOffset(int index, int level, int max_level) const;
-    void MarkParent(int index);
-    void Combine(int index);
-    uint32 NextPowerOfTwo(uint32 x);
-
-    // 内存管理相关
-    constexpr uint64 AlignUp(uint64 addr, uint64 align);
-
-
-    int level;
-    uint8* tree;
+    static int SizeToOrder(uint32 size);
+
+    BuddyFreeBlock *BlockAt(int offset) const;
+    int OffsetOf(BuddyFreeBlock *blk) const;
+    bool IsFree(int order, int offset) const
+    {
+        uint64 idx = static_cast<uint64>(offset) >> order;
+        return (free_map[order][idx >> 6] >> (idx & 63)) & 1;
+    }
+    void ListAdd(int order, int offset);
+    void ListDel(int order, int offset);
+
+    uint64 page_num;
+    uint64 used;
     uint8* base_ptr;
+    uint8* orders;                              // 每页一个字节，已分配块的首页记 阶+1，其余为 0
+    uint64* free_map[BUDDY_MAX_ORDER + 1];      // 第 k 阶第 i 块（页号 i<<k）是否在空闲链表上
+    BuddyFreeBlock* free_list[BUDDY_MAX_ORDER + 1];
 };
 
-} ;// namespace mem
\ No newline at end of file
+} ;// namespace mem
@@ -26,7 +26,8 @@ namespace mem
         heap_start += BSSIZE * PGSIZE;
         memset(_k_allocator_coarse, 0, BSSIZE * PGSIZE);
 
-        _k_allocator_coarse->Initialize(heap_start);
+        _total_pages = vm_kernel_heap_size / PGSIZE - BSSIZE;
+        _k_allocator_coarse->Initialize(heap_start, _total_pages);
 		/*在原本的hmm中初始化时，粗粒度的buddy是紧耦合在hmm上的，
 		它的初始化会把堆区域的内存全部初始化（也就是虚拟地址映射到物理地址上），
 		但是这里我们不需要这样做，我们需要把堆内存初始化的时间改到vmm中，这里就不需要初始化*/
@@ -38,32 +39,172 @@ namespace mem
 		);
 		//这里细粒度的管理是依仗着粗粒度进行的，它每一次申请内存的时候都会调用粗粒度的buddy系统，分配一个页面
 		//再从这样分配的页面中，进行更细粒度的内存分配。
+
+		// 小对象按 size class 从单页中切分；页头本身由 buddy 提供，
+		// 不能走 SlabAllocator（它的链表节点依赖 operator new，会递归回到这里）
+		for ( int i = 0; i < _class_count; i++ )
+		{
+			_classes[i].obj_size = _class_sizes[i];
+			_classes[i].obj_per_slab = ( PGSIZE - _slab_obj_offset ) / _class_sizes[i];
+			_classes[i].empty_slabs = 0;
+			_classes[i].partial = nullptr;
+		}
 		printfGreen("[hmm] Heap Memory Manager Init at %p\n", this);
 	}
 
 	void * HeapMemoryManager::allocate( uint64 size )
 	{
-        int x = _k_allocator_coarse->Alloc(0);
-
-        if(x == -1)
-        {
-            panic("[hmm] alloc_page failed");
-        }
-		void *pa = reinterpret_cast<void *>(static_cast<uint64>(x) * PGSIZE + reinterpret_cast<uint64>(_k_allocator_coarse->get_base_ptr()));
-        // printfCyan("分配物理页:  %p\n", pa);
-        memset(pa, 0, PGSIZE);
-        return pa;
+		void *p;
+		_lock.acquire();
+		if ( size <= _max_small_size )
+			p = _alloc_small( size );
+		else
+			p = _alloc_large( size );
+		_lock.release();
 
+		if ( p == nullptr )
+			panic( "[hmm] allocate %d bytes failed", size );
+		return p;
 	}
 
 	void HeapMemoryManager::free( void *p )
 	{
-		        auto addr = reinterpret_cast<uint64>(p);
-        if (addr % PGSIZE != 0)
-        {
-            panic("kfree!");
-        }
-        int x=(addr - reinterpret_cast<uint64>(_k_allocator_coarse->get_base_ptr())) / PGSIZE;
-        _k_allocator_coarse->Free(x);
+		if ( p == nullptr )
+			return;
+		_lock.acquire();
+		// 整页分配一定页对齐，小对象一定不页对齐（页首是页头）
+		if ( reinterpret_cast<uint64>( p ) % PGSIZE == 0 )
+			_free_large( p );
+		else
+			_free_small( p );
+		_lock.release();
+	}
+
+// -------- private helper function --------
+
+	int HeapMemoryManager::_size_to_class( uint64 size )
+	{
+		for ( int i = 0; i < _class_count; i++ )
+			if ( size <= _class_sizes[i] )
+				return i;
+		return -1;
+	}
+
+	void HeapMemoryManager::_slab_list_remove( HeapSizeClass &sc, HeapSlabHeader *slab )
+	{
+		if ( slab->prev )
+			slab->prev->next = slab->next;
+		else
+			sc.partial = slab->next;
+		if ( slab->next )
+			slab->next->prev = slab->prev;
+		slab->prev = slab->next = nullptr;
+	}
+
+	void HeapMemoryManager::_slab_list_push( HeapSizeClass &sc, HeapSlabHeader *slab )
+	{
+		slab->prev = nullptr;
+		slab->next = sc.partial;
+		if ( sc.partial )
+			sc.partial->prev = slab;
+		sc.partial = slab;
+	}
+
+	HeapSlabHeader * HeapMemoryManager::_new_slab( int cls )
+	{
+		int x = _k_allocator_coarse->Alloc( 1 );
+		if ( x == -1 )
+			return nullptr;
+		uint64 page = static_cast<uint64>( x ) * PGSIZE + reinterpret_cast<uint64>( _k_allocator_coarse->get_base_ptr() );
+
+		HeapSlabHeader *slab = reinterpret_cast<HeapSlabHeader *>( page );
+		HeapSizeClass &sc = _classes[cls];
+		slab->magic = _slab_magic;
+		slab->cls = cls;
+		slab->inuse = 0;
+		slab->prev = slab->next = nullptr;
+
+		// 把页内对象串成空闲链表，不需要清零整页，分配时只清零对象本身
+		uint64 obj = page + _slab_obj_offset;
+		slab->free_list = reinterpret_cast<void *>( obj );
+		for ( uint32 i = 0; i + 1 < sc.obj_per_slab; i++, obj += sc.obj_size )
+			*reinterpret_cast<uint64 *>( obj ) = obj + sc.obj_size;
+		*reinterpret_cast<uint64 *>( obj ) = 0;
+
+		return slab;
+	}
+
+	void * HeapMemoryManager::_alloc_small( uint64 size )
+	{
+		int cls = _size_to_class( size );
+		HeapSizeClass &sc = _classes[cls];
+
+		HeapSlabHeader *slab = sc.partial;
+		if ( slab == nullptr )
+		{
+			slab = _new_slab( cls );
+			if ( slab == nullptr )
+				return nullptr;
+			_slab_list_push( sc, slab );
+			sc.empty_slabs++;
+		}
+
+		void *obj = slab->free_list;
+		slab->free_list = reinterpret_cast<void *>( *reinterpret_cast<uint64 *>( obj ) );
+		if ( slab->inuse++ == 0 )
+			sc.empty_slabs--;
+		if ( slab->free_list == nullptr )
+			_slab_list_remove( sc, slab );		// 满页不挂在链表上
+
+		memset( obj, 0, sc.obj_size );
+		return obj;
+	}
+
+	void HeapMemoryManager::_free_small( void *p )
+	{
+		HeapSlabHeader *slab = reinterpret_cast<HeapSlabHeader *>( PGROUNDDOWN( reinterpret_cast<uint64>( p ) ) );
+		if ( slab->magic != _slab_magic || slab->cls >= _class_count )
+			panic( "[hmm] bad free %p", p );
+		HeapSizeClass &sc = _classes[slab->cls];
+		if ( ( reinterpret_cast<uint64>( p ) - reinterpret_cast<uint64>( slab ) - _slab_obj_offset ) % sc.obj_size != 0 )
+			panic( "[hmm] free %p is not an object start", p );
+
+		bool was_full = slab->free_list == nullptr;
+		*reinterpret_cast<uint64 *>( p ) = reinterpret_cast<uint64>( slab->free_list );
+		slab->free_list = p;
+		if ( was_full )
+			_slab_list_push( sc, slab );
+
+		if ( --slab->inuse == 0 )
+		{
+			if ( sc.empty_slabs >= _max_empty_slabs )
+			{
+				// 已经缓存了足够的空页，把这一页还给 buddy
+				_slab_list_remove( sc, slab );
+				slab->magic = 0;
+				_k_allocator_coarse->free_pages( slab );
+			}
+			else
+				sc.empty_slabs++;
+		}
+	}
+
+	void * HeapMemoryManager::_alloc_large( uint64 size )
+	{
+		int pages = static_cast<int>( ( size + PGSIZE - 1 ) / PGSIZE );
+		return _k_allocator_coarse->alloc_pages( pages );
+	}
+
+	void HeapMemoryManager::_free_large( void *p )
+	{
+		_k_allocator_coarse->free_pages( p );
+	}
+
+	uint64 HeapMemoryManager::free_pages()
+	{
+		_lock.acquire();
+		uint64 used = _k_allocator_coarse->used_pages();
+		_lock.release();
+		return used < _total_pages ? _total_pages - used : 0;
 	}
 } // namespace mem
@@ -5,6 +5,27 @@
 
 namespace mem
 {
+	/// @brief 小对象页头，位于每个小对象页的起始处。
+	/// 小对象永远不会页对齐（页头占据了页首），free 时据此区分小对象与整页分配。
+	struct HeapSlabHeader
+	{
+		uint32 magic;
+		uint16 cls;						///< 所属的 size class 下标
+		uint16 inuse;					///< 本页已分配的对象数
+		HeapSlabHeader *prev;			///< partial 链表
+		HeapSlabHeader *next;
+		void *free_list;				///< 页内空闲对象链表
+	};
+
+	/// @brief 一个 size class：所有仍有空闲对象的页串在 partial 链表上
+	struct HeapSizeClass
+	{
+		uint32 obj_size;
+		uint32 obj_per_slab;
+		uint32 empty_slabs;				///< partial 链表中完全空闲的页数
+		HeapSlabHeader *partial;
+	};
+
  	class HeapMemoryManager
 	{
 	private:
@@ -14,6 +35,28 @@ namespace mem
 
 		L_Allocator _k_allocator_fine;
 
+		constexpr static uint32 _slab_magic = 0x5a1ab0b1U;
+		constexpr static uint64 _slab_obj_offset = 64;			// 页头按 cache line 对齐，对象从这里开始
+		constexpr static uint32 _max_empty_slabs = 1;			// 每个 class 最多缓存的空页数
+		constexpr static int _class_count = 10;
+		constexpr static uint32 _class_sizes[_class_count] = {
+			16, 32, 64, 96, 128, 192, 256, 512, 1024, 2016
+		};
+		constexpr static uint64 _max_small_size = 2016;
+
+		HeapSizeClass _classes[_class_count];
+		uint64 _total_pages;			///< buddy 实际可分配的页数
+
+		int _size_to_class( uint64 size );
+		HeapSlabHeader *_new_slab( int cls );
+		void _slab_list_remove( HeapSizeClass &sc, HeapSlabHeader *slab );
+		void _slab_list_push( HeapSizeClass &sc, HeapSlabHeader *slab );
+
+		void *_alloc_small( uint64 size );
+		void _free_small( void *p );
+		void *_alloc_large( uint64 size );
+		void _free_large( void *p );
+
 	public:
 		HeapMemoryManager() {};
 		void init( const char *lock_name ,uint64_t heap_start);
@@ -21,6 +64,9 @@ namespace mem
 		void *allocate( uint64 size );
 
 		void free( void *p );
+
+		/// @brief 堆中尚未分配的页数，供缓存类模块判断内存压力
+		uint64 free_pages();
 	};
 
     extern HeapMemoryManager k_hmm;
@@ -7,11 +7,19 @@
 namespace mem
 {
 	extern bool debug_trace_walk;
+	/// @brief 共享同一份页表的所有 PageTable 副本共用的状态
+	struct PtShared
+	{
+		int cnt;		// 引用计数
+		uint64 asid;	// 分配到的 “代号 | ASID”，见 AsidAllocator
+		uint64 cpus;	// 运行过这个地址空间的核，它们的 TLB 里可能有它的表项
+	};
+
 	class PageTable
 	{
 	private:
 		uint64 _base_addr;
-		int* _ref = nullptr; // 引用计数指针，用于支持clone CLONE_VM标志位
+		PtShared* _ref = nullptr; // 共享状态（引用计数、ASID），用于支持clone CLONE_VM标志位
 		bool _is_global = false;
 
 	public:
@@ -29,6 +37,8 @@ namespace mem
 		void inc_ref(); // 增加引用计数
 		void dec_ref(); // 减少引用计数
 		int get_ref_count(); // 获取引用计数
+		uint64 *asid_slot() { return _ref ? &_ref->asid : nullptr; } // 没有共享状态的页表（内核页表）不分配 ASID
+		uint64 *cpus_slot() { return _ref ? &_ref->cpus : nullptr; }
 		void share_from(const PageTable& other); // 从另一个页表共享（浅拷贝）
 
 		/// @brief 软件遍历页表，通常，只能由全局页目录调用
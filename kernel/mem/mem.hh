@@ -11,4 +11,7 @@
 #define MAP_SHARED 0x01
 #define MAP_PRIVATE 0X02
 #define MAP_FIXED 0x10 /* Interpret addr exactly.  */
-#define MAP_ANONYMOUS 0x20 /* Don't use a file.  */
\ No newline at end of file
+#define MAP_ANONYMOUS 0x20 /* Don't use a file.  */
+
+#define MREMAP_MAYMOVE 1
+#define MREMAP_FIXED 2
@@ -73,6 +73,8 @@
 //   TRAMPOLINE (the same page as in the kernel)
 #define SIG_TRAMPOLINE   (TRAMPOLINE - PGSIZE)
 #define TRAPFRAME (SIG_TRAMPOLINE - PGSIZE)
+// 共享页表的线程在每个核上各有一个 trapframe 槽位，位于 TRAPFRAME 之下
+#define TRAPFRAME_CPU(c) (TRAPFRAME - ((c) + 1) * PGSIZE)
 #elif defined(LOONGARCH)
 // Physical memory layout
 
@@ -113,6 +115,8 @@
 // each surrounded by invalid guard pages.
 #define KSTACK(p) (TRAPFRAME - ((p)+1)* 2*PGSIZE)
 #define SIG_TRAMPOLINE   (TRAPFRAME - PGSIZE)
+// 共享页表的线程在每个核上各有一个 trapframe 槽位，位于 SIG_TRAMPOLINE 之下
+#define TRAPFRAME_CPU(c) (SIG_TRAMPOLINE - ((c) + 1) * PGSIZE)
 #define PA2VA(pa) ((pa) & (~(DMWIN_MASK)))
 
 
@@ -6,7 +6,7 @@
 #include "printer.hh"
 #include "klib.hh"
 #include "slab.hh"
-#include "platform.hh"
+#include "cpu.hh"
 extern "C" char end[]; // 来自链接脚本
 
 namespace mem
@@ -15,6 +15,10 @@ namespace mem
     uint64 PhysicalMemoryManager::pa_start;
     SpinLock PhysicalMemoryManager::memlock;
     BuddySystem* PhysicalMemoryManager::_buddy;
+    uint32 *PhysicalMemoryManager::_page_refs;
+    uint64 PhysicalMemoryManager::_page_ref_num;
+    uint64 PhysicalMemoryManager::_total_pages;
+    PerCpuPages PhysicalMemoryManager::_pcp[NCPU];
 
     uint64 PhysicalMemoryManager::pa2pgnm(void *pa)
     {
@@ -36,44 +40,262 @@ namespace mem
         return static_cast<int>(size / PGSIZE + (size % PGSIZE != 0));
     }
 
+    void *PhysicalMemoryManager::canonical(void *pa)
+    {
+#ifdef LOONGARCH
+        return reinterpret_cast<void *>(to_vir(reinterpret_cast<uint64>(pa))); // 页表里拿到的是物理地址，pa_start 是直接映射窗口地址
+#else
+        return pa;
+#endif
+    }
+
+    uint32 &PhysicalMemoryManager::page_ref_of(void *pa)
+    {
+        uint64 addr = reinterpret_cast<uint64>(canonical(pa));
+        uint64 pgnm = (addr - pa_start) / PGSIZE;
+        if (addr < pa_start || pgnm >= _page_ref_num)
+            panic("[pmm] page ref out of range: %p", pa);
+        return _page_refs[pgnm];
+    }
+
     void PhysicalMemoryManager::init()
     {
-        // 多核情况下应该加锁
         memlock.init("memlock");
         //把原本Buddy的初始化放在这里，Buddy变成pmm的一个成员
 
-        /*pa_start是buddy系统在物理内存中的起始地址,加上一个Sizeof(BuddySystem)后后面存的东西是tree,
-        然后tree存完了之后才是buddy系统管理的那块内存。加上的BSSIZE是预留来放BuddySystem的大小和tree的大小，
+        /*pa_start是buddy系统在物理内存中的起始地址,加上一个Sizeof(BuddySystem)后后面存的东西是buddy的元数据,
+        然后元数据存完了之后才是buddy系统管理的那块内存。加上的BSSIZE是预留来放BuddySystem和元数据的大小，
         在这之后才是buddy系统管理的那块内存，这时pa_start指向的就是buddy系统管理的那块内存的开始地址，
         再被初始化为buddy的基址。*/
         pa_start = reinterpret_cast<uint64_t>(end);
         pa_start = (pa_start + PGSIZE - 1) & ~(PGSIZE - 1); //将pa_start向高地址对齐到PGSIZE的整数倍
+
+        // 引用计数数组放在buddy前面，按pmm可能管理的最大页数（end到堆起点）分配
+        _page_refs = reinterpret_cast<uint32 *>(pa_start);
+        _page_ref_num = ((uint64)(HEAP_START) - pa_start) / PGSIZE;
+        uint64 ref_bytes = PGROUNDUP(_page_ref_num * sizeof(uint32));
+        memset(_page_refs, 0, ref_bytes);
+        pa_start += ref_bytes;
+
         _buddy = reinterpret_cast<BuddySystem*>(pa_start);
         pa_start += BSSIZE * PGSIZE;
         memset(_buddy, 0, BSSIZE * PGSIZE);
-        _buddy->Initialize(pa_start);
+        _total_pages = ((uint64)(HEAP_START) - pa_start) / PGSIZE;
+        _buddy->Initialize(pa_start, _total_pages);
+        for (PerCpuPages &pcp : _pcp)
+        {
+            pcp.lock.init("pcp");
+            pcp.hot = pcp.cold = nullptr;
+            pcp.hot_count = pcp.cold_count = 0;
+        }
         printfGreen("[pmm] buddy system initialized, pa_start: %p\n", pa_start);
     }
 
+    void PhysicalMemoryManager::_pcp_refill(PerCpuPages &pcp)
+    {
+        // 新领来的页不在 cache 里，放进 cold
+        memlock.acquire();
+        for (uint i = 0; i < pcp_batch; i++)
+        {
+            int x = _buddy->AllocOrder(0);
+            if (x == -1)
+                break;
+            void *pa = pgnm2pa(x);
+            *reinterpret_cast<void **>(pa) = pcp.cold;
+            pcp.cold = pa;
+            pcp.cold_count++;
+        }
+        memlock.release();
+    }
+
+    void PhysicalMemoryManager::_pcp_drain(PerCpuPages &pcp, uint n)
+    {
+        // 先还冷页，热页留给本核下一次分配
+        memlock.acquire();
+        for (; n > 0 && (pcp.cold != nullptr || pcp.hot != nullptr); n--)
+        {
+            void *pa;
+            if (pcp.cold != nullptr)
+            {
+                pa = pcp.cold;
+                pcp.cold = *reinterpret_cast<void **>(pa);
+                pcp.cold_count--;
+            }
+            else
+            {
+                pa = pcp.hot;
+                pcp.hot = *reinterpret_cast<void **>(pa);
+                pcp.hot_count--;
+            }
+            _buddy->Free(pa2pgnm(pa));
+        }
+        memlock.release();
+    }
+
+    void PhysicalMemoryManager::_pcp_drain_all()
+    {
+        for (PerCpuPages &pcp : _pcp)
+        {
+            pcp.lock.acquire();
+            _pcp_drain(pcp, pcp.hot_count + pcp.cold_count);
+            pcp.lock.release();
+        }
+    }
+
     void *PhysicalMemoryManager::alloc_page()
     {
-        
-        int x = _buddy->Alloc(0);
+        void *pa = nullptr;
+        for (int retry = 0; pa == nullptr && retry < 2; retry++)
+        {
+            // buddy 分不出页时，空闲页可能都散落在各个核的缓存里，全部收回后再试一次
+            if (retry > 0)
+                _pcp_drain_all();
+            Cpu::push_intr_off();
+            PerCpuPages &pcp = _pcp[Cpu::read_tp()];
+            pcp.lock.acquire();
+            if (pcp.hot == nullptr && pcp.cold == nullptr)
+                _pcp_refill(pcp);
+            if (pcp.hot != nullptr)
+            {
+                pa = pcp.hot;
+                pcp.hot = *reinterpret_cast<void **>(pa);
+                pcp.hot_count--;
+            }
+            else if (pcp.cold != nullptr)
+            {
+                pa = pcp.cold;
+                pcp.cold = *reinterpret_cast<void **>(pa);
+                pcp.cold_count--;
+            }
+            pcp.lock.release();
+            Cpu::pop_intr_off();
+        }
 
-        if(x == -1)
+        if (pa == nullptr)
         {
             panic("[pmm] alloc_page failed");
         }
-        void *pa = pgnm2pa(x);
+        page_ref_of(pa) = 1; // 页还没交出去，不会有人同时访问
         // printfCyan("分配物理页:  %p\n", pa);
         memset(pa, 0, PGSIZE);
         return pa;
     }
 
-    void PhysicalMemoryManager::free_page(void *pa)
+    void *PhysicalMemoryManager::alloc_pages(int order)
+    {
+        if (order == 0)
+            return alloc_page();
+        memlock.acquire();
+        int x = _buddy->AllocOrder(order);
+        memlock.release();
+        if (x == -1)
+        {
+            // 各核缓存里的零散单页可能正好拆散了需要的伙伴，还回去再试一次
+            _pcp_drain_all();
+            memlock.acquire();
+            x = _buddy->AllocOrder(order);
+            memlock.release();
+            if (x == -1)
+                return nullptr;
+        }
+        void *pa = pgnm2pa(x);
+        page_ref_of(pa) = 1; // 整块以首页的引用计数为准，由 free_page 一次释放
+        memset(pa, 0, PGSIZE << order);
+        return pa;
+    }
+
+    void PhysicalMemoryManager::_free_page(void *pa, bool cold)
     {
         // printfCyan("释放物理页:  %p\n", pa);
-        _buddy->Free(pa2pgnm(pa));
+        pa = canonical(pa);
+        uint32 &ref = page_ref_of(pa);
+        uint32 old = __atomic_fetch_sub(&ref, 1, __ATOMIC_ACQ_REL);
+        if (old == 0)
+            panic("[pmm] free_page: page %p not in use", pa);
+        if (old != 1)
+            return;
+
+        int pgnm = static_cast<int>(pa2pgnm(pa));
+        if (_buddy->BlockOrder(pgnm) != 0)
+        {
+            // alloc_pages 分配的整块直接还给 buddy
+            memlock.acquire();
+            _buddy->Free(pgnm);
+            memlock.release();
+            return;
+        }
+
+        Cpu::push_intr_off();
+        PerCpuPages &pcp = _pcp[Cpu::read_tp()];
+        pcp.lock.acquire();
+        if (cold)
+        {
+            *reinterpret_cast<void **>(pa) = pcp.cold;
+            pcp.cold = pa;
+            pcp.cold_count++;
+        }
+        else
+        {
+            *reinterpret_cast<void **>(pa) = pcp.hot;
+            pcp.hot = pa;
+            pcp.hot_count++;
+        }
+        if (pcp.hot_count + pcp.cold_count > pcp_high)
+            _pcp_drain(pcp, pcp_batch);
+        pcp.lock.release();
+        Cpu::pop_intr_off();
+    }
+
+    void PhysicalMemoryManager::free_page(void *pa)
+    {
+        _free_page(pa, false);
+    }
+
+    void PhysicalMemoryManager::free_page_cold(void *pa)
+    {
+        _free_page(pa, true);
+    }
+
+    void PhysicalMemoryManager::ref_page(void *pa)
+    {
+        uint32 old = __atomic_fetch_add(&page_ref_of(pa), 1, __ATOMIC_RELAXED);
+        if (old == 0)
+            panic("[pmm] ref_page: page %p not in use", pa);
+    }
+
+    int PhysicalMemoryManager::pin_page(void *pa)
+    {
+        uint64 addr = reinterpret_cast<uint64>(canonical(pa));
+        uint64 pgnm = (addr - pa_start) / PGSIZE;
+        if (addr < pa_start || pgnm >= _page_ref_num)
+            return 0;
+        // 引用计数已经归零的页可能正被释放，不能再加回去
+        uint32 &ref = _page_refs[pgnm];
+        uint32 old = __atomic_load_n(&ref, __ATOMIC_RELAXED);
+        do
+        {
+            if (old == 0)
+                return -1;
+        } while (!__atomic_compare_exchange_n(&ref, &old, old + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+        return 1;
+    }
+
+    uint32 PhysicalMemoryManager::page_ref(void *pa)
+    {
+        return __atomic_load_n(&page_ref_of(pa), __ATOMIC_ACQUIRE);
+    }
+
+    uint64 PhysicalMemoryManager::free_pages()
+    {
+        // 各核缓存里的页对 buddy 来说是已分配的，但随时可以分出去，算作空闲
+        uint64 cached = 0;
+        for (uint i = 0; i < NCPU; i++)
+            cached += _pcp[i].hot_count + _pcp[i].cold_count;
+        memlock.acquire();
+        uint64 used = _buddy->used_pages();
+        memlock.release();
+        used = used > cached ? used - cached : 0;
+        return used < _total_pages ? _total_pages - used : 0;
     }
 
     void PhysicalMemoryManager::clear_page(void *pa)
@@ -88,21 +310,19 @@ namespace mem
     {
         if(size >= PGSIZE)
         {
-            int x = _buddy->Alloc(size_to_page_num(size));
-            void *pa = pgnm2pa(x);
-            memset(pa, 0, PGSIZE);
+            int order = 0;
+            while ((1 << order) < size_to_page_num(size))
+                order++;
+            void *pa = alloc_pages(order);
+            if (pa == nullptr)
+                panic("kmalloc: out of memory for %d bytes", size);
             return pa;
         }
-        else if(size < PGSIZE)
+        else
         {
             //there maybe some bugs to be fixed
             return SlabAllocator::alloc(size);
         }
-        else
-        {
-            panic("kmalloc: size is too large");
-            return nullptr; // 永远不会执行到这里，但必须有返回值
-        }
     }
 
     void *PhysicalMemoryManager::kcalloc(uint n, size_t size)
@@ -3,15 +3,41 @@
 #include "devs/spinlock.hh"
 #include "buddysystem.hh"
 #include "platform.hh"
+#include "param.h"
 namespace mem
 {
 
+    /// @brief 每个核自己的单页缓存，页通过首 8 字节串成单链表。
+    /// hot 里是刚释放、多半还在 cache 中的页，优先分出去；cold 里是从 buddy 批量领来的页
+    /// 和回收下来的冷页，超过上限时先还这一部分。
+    /// 平时只有本核访问，锁几乎没有竞争；buddy 耗尽时别的核要拿这把锁把缓存收回去
+    struct PerCpuPages
+    {
+        SpinLock lock;
+        void *hot;
+        void *cold;
+        uint hot_count;
+        uint cold_count;
+    };
+
     class PhysicalMemoryManager
     {
     public:
+        static constexpr uint pcp_high = 64;  // 每核缓存超过这么多页就还回 buddy 一批
+        static constexpr uint pcp_batch = 16; // 每核缓存向 buddy 批量领取、归还的页数
+
         static void init();
-        static void *alloc_page(); // 分配单个物理页
-        static void free_page(void *pa);
+        static void *alloc_page(); // 分配单个物理页，先从本核的页缓存里拿
+        static void *alloc_pages(int order); // 分配 2^order 个连续物理页并全部清零，失败返回 nullptr，由 free_page 整块释放
+        static void free_page(void *pa); // 引用计数减一，归零时才真正释放
+        static void free_page_cold(void *pa); // 同 free_page，用于近期没人碰过的页（如页缓存回收）
+        static void ref_page(void *pa);  // 共享物理页（COW）时引用计数加一
+        /// @brief 临时钉住一个经页表查到的页，防止使用期间被别的线程解除映射后释放。
+        /// @return 1 已加一份引用，用完 free_page；0 不归 pmm 管（如内核镜像里的页），不用钉；
+        ///         -1 页已经被释放，查到的翻译过时了
+        static int pin_page(void *pa);
+        static uint32 page_ref(void *pa);
+        static uint64 free_pages(); // 尚未分配的物理页数，供页缓存等判断内存压力
         static void *kmalloc(size_t size); // 分配任意大小的内存块
         static void *kcalloc(uint n, size_t size);
         void clear_page(void *pa);
@@ -19,11 +45,21 @@ namespace mem
     private:
         static BuddySystem *_buddy;
         static uint64 pa_start;
-        static class SpinLock memlock;
+        static uint32 *_page_refs;     // 按页号索引的物理页引用计数，紧挨着 buddy 元数据存放，原子地增减
+        static uint64 _page_ref_num;
+        static uint64 _total_pages;    // buddy 管理的页数
+        static class SpinLock memlock; // 保护 buddy；加锁顺序为先每核缓存的锁、后 memlock
+        static PerCpuPages _pcp[NCPU];
 
         static uint64 pa2pgnm(void *pa);
         static void *pgnm2pa(int pgnm);
         static int size_to_page_num(uint64 size);
+        static uint32 &page_ref_of(void *pa);
+        static void *canonical(void *pa);
+        static void _free_page(void *pa, bool cold);
+        static void _pcp_refill(PerCpuPages &pcp);
+        static void _pcp_drain(PerCpuPages &pcp, uint n);
+        static void _pcp_drain_all(); // 把所有核缓存的页都还给 buddy，buddy 分不出页时调用
     };
 extern PhysicalMemoryManager k_pmm;
 }
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include "klib.hh"
 #include "printer.hh"
 #include "physical_memory_manager.hh"
+#include "virtual_memory_manager.hh"
 namespace mem
 {
     PageTable k_pagetable;
@@ -15,10 +16,10 @@ namespace mem
     // 引用计数管理实现
     void PageTable::init_ref() {
         if (_ref == nullptr && _base_addr != 0) {
-            _ref = new int(1); // 初始引用计数为1
+            _ref = new PtShared{1, 0, 0}; // 初始引用计数为1
             printfCyan("init_ref: initialized page table %p with ref count: 1\n", _base_addr);
         } else if (_ref != nullptr) {
-            printfYellow("init_ref: page table %p already has ref count: %d\n", _base_addr, *_ref);
+            printfYellow("init_ref: page table %p already has ref count: %d\n", _base_addr, _ref->cnt);
         } else {
             panic("init_ref: warning - page table has null base address\n");
         }
@@ -26,8 +27,8 @@ namespace mem
 
     void PageTable::inc_ref() {
         if (_ref != nullptr) {
-            (*_ref)++;
-            printfCyan("inc_ref: page table %p, new ref count: %d\n", _base_addr, *_ref);
+            _ref->cnt++;
+            printfCyan("inc_ref: page table %p, new ref count: %d\n", _base_addr, _ref->cnt);
         } else {
             panic("inc_ref: warning - trying to increase ref count on page table %p with null ref pointer\n", _base_addr);
         }
@@ -35,9 +36,9 @@ namespace mem
 
     void PageTable::dec_ref() {
         if (_ref != nullptr) {
-            (*_ref)--;
-            printfCyan("dec_ref: page table %p, ref count: %d\n", _base_addr, *_ref);
-            if (*_ref <= 0) {
+            _ref->cnt--;
+            printfCyan("dec_ref: page table %p, ref count: %d\n", _base_addr, _ref->cnt);
+            if (_ref->cnt <= 0) {
                 printfYellow("dec_ref: releasing page table %p (ref count reached 0)\n", _base_addr);
                 // 引用计数为0，释放页表和引用计数
                 if (_base_addr != 0 && !_is_global) {
@@ -53,7 +54,7 @@ namespace mem
     }
 
     int PageTable::get_ref_count() {
-        return _ref ? *_ref : 0;
+        return _ref ? _ref->cnt : 0;
     }
 
     void PageTable::share_from(const PageTable& other) {
@@ -67,8 +68,8 @@ namespace mem
         
         // 增加共享页表的引用计数
         if (_ref != nullptr) {
-            (*_ref)++;
-            printfCyan("share_from: sharing page table %p, new ref count: %d\n", _base_addr, *_ref);
+            _ref->cnt++;
+            printfCyan("share_from: sharing page table %p, new ref count: %d\n", _base_addr, _ref->cnt);
         } else {
             panic("share_from: warning - sharing page table %p with null ref pointer\n", _base_addr);
         }
@@ -193,10 +194,15 @@ namespace mem
         // 	return 0;
 
         Pte pte = walk(va, false /* alloc */);
-        if (pte._data_addr == nullptr)
-            return nullptr;
-        if (!pte.is_valid())
-            return nullptr;
+        if (pte._data_addr == nullptr || !pte.is_valid())
+        {
+            // 惰性映射的用户页还没建立：由缺页处理补上后再查一次
+            if (k_vmm.fault_in(*this, va) < 0)
+                return nullptr;
+            pte = walk(va, false);
+            if (pte._data_addr == nullptr || !pte.is_valid())
+                return nullptr;
+        }
         if (pte.is_user() == 0)
         {
             printfCyan("try to walk-addr( k-pt, %p ). nullptr will be return.\n", va);
@@ -210,8 +216,8 @@ namespace mem
     void PageTable::freewalk()
     {
         // 检查引用计数，只有引用计数为0或1时才真正释放
-        if (_ref != nullptr && *_ref > 1) {
-            panic("freewalk: page table %p still has %d references, not freeing\n", _base_addr, *_ref);
+        if (_ref != nullptr && _ref->cnt > 1) {
+            panic("freewalk: page table %p still has %d references, not freeing\n", _base_addr, _ref->cnt);
             return;
         }
 
@@ -46,6 +46,7 @@ namespace mem
 
 		u8 *_cache_ptr = nullptr; // 缓存的页内部指针
 		u8 *_cache_end = nullptr; // 缓存的页结束地址
+		bool _cache_writable = false; // 缓存的页是否已按写访问翻译（写时复制页已拆开）
 
 		RetCode _errno = rc_ok;
 
@@ -125,38 +126,18 @@ namespace mem
 		}
 
 	private:
-	//"此处有风险，参考了rv版本的学长代码，to_vir()函数因为返回本身，故删除，la版本的代码未实现"
-		int _update_cache(void *va)
+		/// @brief 把流指针所在的用户页翻译成内核地址，缓存到页尾；地址非法时返回 -1
+		int _update_cache( void *va, bool write )
 		{
-			// printfCyan("[UserspaceStream::_update_cache] va: %p\n", va);
-			u64 a = (u64)va;
-			if (is_page_align(a))
+			u64 a = (u64) va;
+			_cache_ptr = k_vmm.user_ptr( *_pt, a, write );
+			if ( _cache_ptr == nullptr )
 			{
-#ifdef RISCV
-				_cache_ptr = (u8 *)_pt->walk_addr(a);
-				_cache_end = _cache_ptr + PGSIZE;
-#elif defined(LOONGARCH)
-				_cache_ptr = (u8 *)to_vir((ulong)_pt->walk_addr(a));
-				_cache_end = _cache_ptr + PGSIZE;
-#endif
-				// printfGreen("[_update_cache] page aligned: _cache_ptr=%p, _cache_end=%p\n", _cache_ptr, _cache_end);
-			}
-			else
-			{
-#ifdef RISCV
-				u64 page_start = PGROUNDDOWN(a);
-				u64 offset = a - page_start;
-				_cache_ptr = (u8 *)_pt->walk_addr(page_start) + offset;
-				_cache_end = (u8 *)_pt->walk_addr(page_start) + PGSIZE;
-#elif defined(LOONGARCH)
-				u64 page_start = PGROUNDDOWN(a);
-				u64 offset = a - page_start;
-				_cache_ptr = (u8 *)to_vir((ulong)_pt->walk_addr(page_start)) + offset;
-				_cache_end = (u8 *)to_vir((ulong)_pt->walk_addr(page_start)) + PGSIZE;
-#endif
-				// printfYellow("[_update_cache] not page aligned: page_start=%p, offset=%lu, _cache_ptr=%p, _cache_end=%p\n", 
-				// 	(void*)page_start, offset, _cache_ptr, _cache_end);
+				_cache_end = nullptr;
+				return -1;
 			}
+			_cache_end = _cache_ptr + ( PGSIZE - a % PGSIZE );
+			_cache_writable = write;
 			return 0;
 		}
 	};
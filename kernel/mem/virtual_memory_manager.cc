@@ -11,9 +11,17 @@
 #include "printer.hh"
 #include "proc/proc.hh"
 #include "proc_manager.hh"
+#include "asid.hh"
+#include "smp.hh"
+#include "cpu.hh"
+#include "mem.hh"
+#include "fs/vfs/file/normal_file.hh"
+#include "fs/vfs/page_cache.hh"
+#include <asm-generic/errno.h>
 extern char etext[]; // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
+int mmap_handler(uint64 va, int cause); // trap.cc
 #ifdef LOONGARCH
 void tlbinit(void)
 {
@@ -50,6 +58,13 @@ namespace mem
         {
             pcb.map_kstack(k_pagetable);
         }
+        inithart();
+        k_asid.init();
+        printfGreen("[vmm] Virtual Memory Manager Init\n");
+    }
+
+    void VirtualMemoryManager::inithart()
+    {
 #ifdef RISCV
         // 设置satp，对应龙芯应该设置pgdl，pgdh，stlbps，asid，tlbrehi，pwcl，pwch,
         // 并且invtlb 0x0,$zero,$zero;
@@ -69,11 +84,7 @@ namespace mem
 
         w_csr_pwcl((PTEWIDTH << 30) | (DIR2WIDTH << 25) | (DIR2BASE << 20) | (DIR1WIDTH << 15) | (DIR1BASE << 10) | (PTWIDTH << 5) | (PTBASE << 0));
         w_csr_pwch((DIR4WIDTH << 18) | (DIR3WIDTH << 6) | (DIR3BASE << 0) | (PWCH_HPTW_EN << 24));
-
-        [[maybe_unused]] uint64 crmd = r_csr_crmd();
-
 #endif
-        printfGreen("[vmm] Virtual Memory Manager Init\n");
     }
 
     // 根据传入的 flags 标志，生成对应的页表权限（perm）值
@@ -216,26 +227,25 @@ namespace mem
     /// @return 成功返回0，失败返回-1（如页表无法转换用户虚拟地址）。
     int VirtualMemoryManager::copy_in(PageTable &pt, void *dst, uint64 src_va, uint64 len)
     {
-        uint64 n, va, pa;
+        uint64 n;
         char *p_dst = (char *)dst;
 
         while (len > 0)
         {
-            va = PGROUNDDOWN(src_va);
-            pa = (uint64)pt.walk_addr(va);
-            if (pa == 0)
+            u8 *src = user_ptr(pt, src_va, false);
+            if (src == nullptr)
             {
-                printfRed("[copyin] pa ==0! walk failed");
+                printfRed("[copyin] bad user address %p\n", src_va);
                 return -1;
             }
-            n = PGSIZE - (src_va - va);
+            n = PGSIZE - (src_va % PGSIZE);
             if (n > len)
                 n = len;
-            memmove((void *)p_dst, (const void *)(pa + (src_va - va)), n);
+            memmove((void *)p_dst, (const void *)src, n);
 
             len -= n;
             p_dst += n;
-            src_va = va + PGSIZE;
+            src_va += n;
         }
         return 0;
     }
@@ -243,98 +253,52 @@ namespace mem
     int VirtualMemoryManager::copy_str_in(PageTable &pt, void *dst,
                                           uint64 src_va, uint64 max)
     {
-        uint64 n, va, pa;
-        int got_null = 0;
         char *p_dst = (char *)dst;
 
-        while (got_null == 0 && max > 0)
+        while (max > 0)
         {
-            va = PGROUNDDOWN(src_va);
-            pa = (uint64)pt.walk_addr(va);
-            if (pa == 0)
+            char *p = (char *)user_ptr(pt, src_va, false);
+            if (p == nullptr)
                 return -1;
-            n = PGSIZE - (src_va - va);
+            uint64 n = PGSIZE - (src_va % PGSIZE);
             if (n > max)
                 n = max;
 
-            char *p = (char *)(pa + (src_va - va));
-            while (n > 0)
+            for (uint64 i = 0; i < n; i++)
             {
-                if (*p == '\0')
-                {
-                    *p_dst = '\0';
-                    got_null = 1;
-                    break;
-                }
-                else
-                {
-                    *p_dst = *p;
-                }
-                --n;
-                --max;
-                p++;
-                p_dst++;
+                p_dst[i] = p[i];
+                if (p[i] == '\0')
+                    return 0;
             }
-
-            src_va = va + PGSIZE;
-        }
-        if (got_null)
-        {
-            return 0;
-        }
-        else
-        {
-            return -1;
+            p_dst += n;
+            max -= n;
+            src_va += n;
         }
+        return -1;
     }
     int VirtualMemoryManager::copy_str_in(PageTable &pt, eastl::string &dst,
                                           uint64 src_va, uint64 max)
     {
-        uint64 n, va, pa;
-        int got_null = 0;
-
-        while (got_null == 0 && max > 0)
+        while (max > 0)
         {
-            va = PGROUNDDOWN(src_va);
-            pa = (uint64)pt.walk_addr(va);
-            if (pa == 0)
+            const char *p = (const char *)user_ptr(pt, src_va, false);
+            if (p == nullptr)
                 return -1;
-#ifdef RISCV
-
-#elif defined(LOONGARCH)
-            pa = to_phy(pa);
-#endif
-            n = PGSIZE - (src_va - va);
+            uint64 n = PGSIZE - (src_va % PGSIZE);
             if (n > max)
                 n = max;
 
-            char *p = (char *)(pa + (src_va - va));
-            while (n > 0)
-            {
-                if (*p == '\0')
-                {
-                    got_null = 1;
-                    break;
-                }
-                else
-                {
-                    dst.push_back(*p);
-                }
-                --n;
-                --max;
-                p++;
-            }
-
-            src_va = va + PGSIZE;
-        }
-        if (got_null)
-        {
-            return 0;
-        }
-        else
-        {
-            return -1;
+            // 整段追加，找到结尾的 0 就停
+            uint64 len = 0;
+            while (len < n && p[len] != '\0')
+                len++;
+            dst.append(p, p + len);
+            if (len < n)
+                return 0;
+            max -= n;
+            src_va += n;
         }
+        return -1;
     }
     // TODO
     // uint64 VirtualMemoryManager::allocshm(PageTable &pt, uint64 oldshm, uint64 newshm, uint64 sz, void *phyaddr[pm::MAX_SHM_PGNUM])
@@ -407,123 +371,79 @@ namespace mem
     /// @return 成功返回 0；若任意一页无效或未映射，返回 -1。
     int VirtualMemoryManager::copy_out(PageTable &pt, uint64 va, const void *p, uint64 len)
     {
-#ifdef RISCV
-        uint64 n, a, pa;
-        // printf("[copy_out] va: %p, len: %d\n", va, len);
-        // // 打印拷贝的所有字节
-        // const uint8_t* p_bytes = reinterpret_cast<const uint8_t*>(p);
-        // printf("[copy_out] bytes: ");
-        // for (uint64 i = 0; i < len; ++i) {
-        //     printf("%02x ", p_bytes[i]);
-        // }
-        // printf("\n");
-
+        uint64 n;
         while (len > 0)
         {
-            a = PGROUNDDOWN(va);
-            bool alloc = false;
-            proc::Pcb *proc = proc::k_pm.get_cur_pcb();
-            for (int i = 0; i < proc::NVMA; ++i)
-            {
-                if (proc->_vma->_vm[i].used)
-                {
-
-                    // 检查是否在当前VMA范围内
-                    if (va >= proc->_vma->_vm[i].addr && va < proc->_vma->_vm[i].addr + proc->_vma->_vm[i].len)
-                    {
-                        alloc = true;
-                        // printfCyan("[copy_out] va: %p is in VMA[%d]: %p-%p\n", va, i, proc->_vma->_vm[i].addr, proc->_vma->_vm[i].addr + proc->_vma->_vm[i].len);
-                        break; // 在当前VMA范围内
-                    }
-                }
-            }
-            Pte pte = pt.walk(a, 0);
-            if (pte.get_data() == 0 && alloc)
-            {
-                // 如果页表项无效且当前VMA范围内，则分配物理页
-                void *mem = k_pmm.alloc_page();
-                if (mem == 0)
-                {
-                    printfRed("[copy_out] alloc page failed for va: %p\n", va);
-                    return -1; // 分配失败
-                }
-                k_pmm.clear_page(mem);
-                map_pages(pt, a, PGSIZE, (uint64)mem,
-                          riscv::PteEnum::pte_readable_m | riscv::PteEnum::pte_writable_m | riscv::PteEnum::pte_user_m);
-            }
-            pa = reinterpret_cast<uint64>(pte.pa());
-            if (pa == 0)
+            // 惰性映射的页由 user_ptr 代替用户缺页，写时复制页先拆开
+            u8 *dst = user_ptr(pt, va, true);
+            if (dst == nullptr)
                 return -1;
-            n = PGSIZE - (va - a);
+            n = PGSIZE - (va % PGSIZE);
             if (n > len)
                 n = len;
-            memmove((void *)(pa + (va - a)), p, n);
+            memmove((void *)dst, p, n);
 
             len -= n;
             p = (char *)p + n;
-            va = a + PGSIZE;
+            va += n;
         }
         return 0;
-#elif defined(LOONGARCH)
-        uint64 n, a, pa;
-        // printf("[copy_out] va: %p, len: %d\n", va, len);
-        // // 打印拷贝的所有字节
-        // const uint8_t* p_bytes = reinterpret_cast<const uint8_t*>(p);
-        // printf("[copy_out] bytes: ");
-        // for (uint64 i = 0; i < len; ++i) {
-        //     printf("%02x ", p_bytes[i]);
-        // }
-        // printf("\n");
+    }
 
-        while (len > 0)
+    u8 *VirtualMemoryManager::user_ptr(PageTable &pt, uint64 va, bool write)
+    {
+        if (va >= MAXVA)
+            return nullptr;
+        uint64 a = PGROUNDDOWN(va);
+
+        proc::Pcb *cur = proc::k_pm.get_cur_pcb();
+        proc::Pcb::UaCache *c = cur != nullptr ? &cur->_ua_cache : nullptr;
+        // 代数在查页表之前读：查的过程中有人撤销映射的话，缓存下来的翻译已经是旧一代的
+        uint64 gen = _pte_gen.load();
+        if (c != nullptr && c->gen == gen && c->va == a && c->pt_base == (uint64)pt.get_base() &&
+            (c->writable || !write))
+            return c->kva + (va - a);
+
+        Pte pte = pt.walk(a, 0);
+        if (pte.is_null() || !pte.is_valid())
         {
-            a = PGROUNDDOWN(va);
-            bool alloc = false;
-            proc::Pcb *proc = proc::k_pm.get_cur_pcb();
-            for (int i = 0; i < proc::NVMA; ++i)
-            {
-                if (proc->_vma->_vm[i].used)
-                {
-
-                    // 检查是否在当前VMA范围内
-                    if (va >= proc->_vma->_vm[i].addr && va < proc->_vma->_vm[i].addr + proc->_vma->_vm[i].len)
-                    {
-                        alloc = true;
-                        // printfCyan("[copy_out] va: %p is in VMA[%d]: %p-%p\n", va, i, proc->_vma->_vm[i].addr, proc->_vma->_vm[i].addr + proc->_vma->_vm[i].len);
-                        break; // 在当前VMA范围内
-                    }
-                }
-            }
-            Pte pte = pt.walk(a, 0);
-            if (pte.get_data() == 0 && alloc)
-            {
-                // 如果页表项无效且当前VMA范围内，则分配物理页
-                void *mem = k_pmm.alloc_page();
-                if (mem == 0)
-                {
-                    printfRed("[copy_out] alloc page failed for va: %p\n", va);
-                    return -1; // 分配失败
-                }
-                k_pmm.clear_page(mem);
-                map_pages(pt, a, PGSIZE, (uint64)mem,
-                          PTE_U | PTE_W | PTE_MAT | PTE_D);
-            }
-            pa = reinterpret_cast<uint64>(pte.pa());
-            if (pa == 0)
-                return -1;
-            n = PGSIZE - (va - a);
-            if (n > len)
-                n = len;
-            pa = to_vir(pa);
-            // printfMagenta("copy_out: va: %p, pa: %p, n: %p\n", va, pa, n);
-            memmove((void *)((pa + (va - a))), p, n);
-
-            len -= n;
-            p = (char *)p + n;
-            va = a + PGSIZE;
+            // 惰性映射（mmap、按需加载的 ELF 段）的页还没有建立，代替用户缺页一次
+            if (fault_in(pt, a) < 0)
+                return nullptr;
+            pte = pt.walk(a, 0);
+            if (pte.is_null() || !pte.is_valid())
+                return nullptr;
         }
-        return 0;
+#ifdef RISCV
+        if (!pte.is_user())
+            return nullptr;
+#elif defined(LOONGARCH)
+        if (pte.is_super_plv())
+            return nullptr;
 #endif
+        if (write && (pte.get_data() & PTE_COW))
+        {
+            if (cow_fault(pt, a) < 0)
+                return nullptr;
+            pte = pt.walk(a, 0);
+        }
+        bool writable = (pte.get_data() & PTE_W) != 0;
+        if (write && !writable)
+            return nullptr; // 只读映射（例如直接映射的页缓存页）不能被内核代写
+
+        uint64 pa = (uint64)pte.pa();
+#ifdef LOONGARCH
+        pa = to_vir(pa);
+#endif
+        if (c != nullptr)
+        {
+            c->pt_base = (uint64)pt.get_base();
+            c->va = a;
+            c->kva = (u8 *)pa;
+            c->gen = gen;
+            c->writable = writable;
+        }
+        return (u8 *)pa + (va - a);
     }
 
     void VirtualMemoryManager::vmunmap(PageTable &pt, uint64 va, uint64 npages, int do_free)
@@ -555,6 +475,64 @@ namespace mem
             // printfMagenta("vmunmap: unmap va: %p, pa: %p\n", a, pte.pa());
             pte.clear_data();
         }
+        tlb_flush(pt, va, npages);
+        user_ptr_invalidate();
+    }
+
+    void VirtualMemoryManager::tlb_flush(PageTable &pt, uint64 va, uint64 npages)
+    {
+        uint64 asid;
+        if (npages > tlb_flush_page_limit)
+        {
+            tlb_flush_all(pt);
+            return;
+        }
+        // 关中断，“本核”在击落完成之前不会变
+        Cpu::push_intr_off();
+        if (k_asid.current(pt, asid))
+        {
+            for (uint64 i = 0; i < npages; i++)
+            {
+#ifdef RISCV
+                sfence_vma_page(PGROUNDDOWN(va) + i * PGSIZE, asid);
+#elif defined(LOONGARCH)
+                invtlb_page(asid, PGROUNDDOWN(va) + i * PGSIZE);
+#endif
+            }
+        }
+        tlb_shootdown(pt, va, npages);
+        Cpu::pop_intr_off();
+    }
+
+    void VirtualMemoryManager::tlb_flush_all(PageTable &pt)
+    {
+        uint64 asid;
+        Cpu::push_intr_off();
+        if (k_asid.current(pt, asid))
+        {
+#ifdef RISCV
+            sfence_vma_asid(asid);
+#elif defined(LOONGARCH)
+            invtlb_asid(asid);
+#endif
+        }
+        tlb_shootdown(pt, 0, 0);
+        Cpu::pop_intr_off();
+    }
+
+    void VirtualMemoryManager::tlb_shootdown(PageTable &pt, uint64 va, uint64 npages)
+    {
+        uint64 cpus = k_asid.ran_on(pt) & ~(1UL << Cpu::read_tp());
+        if (cpus == 0)
+            return;
+        // 换代后还没整片刷新过的核可能还拿着旧代的 ASID 运行 pt，不支持 ASID 时所有表项都记在 ASID 0 下，
+        // 这两种情况只能按地址刷掉所有 ASID 的表项；其余的核按 pt 在本代的 ASID 刷，没有就不用刷
+        uint64 stale = k_asid.enabled() ? cpus & k_asid.stale_cpus() : cpus;
+        uint64 asid;
+        if ((cpus & ~stale) != 0 && k_asid.current(pt, asid))
+            k_smp.tlb_shootdown(cpus & ~stale, asid, va, npages);
+        if (stale != 0)
+            k_smp.tlb_shootdown(stale, SmpManager::any_asid, va, npages);
     }
 
     PageTable VirtualMemoryManager::vm_create()
@@ -572,13 +550,15 @@ namespace mem
         return pt;
     }
 
-    int VirtualMemoryManager::vm_copy(PageTable &old_pt, PageTable &new_pt, uint64 start, uint64 size)
+    /// @brief fork 时复制用户地址空间：不再拷贝页面内容，而是让父子进程共享物理页。
+    /// 可写页在父子两边都改为只读并打上 PTE_COW，真正写入时由 cow_fault 拆分；
+    /// 只读页直接共享。每共享一次物理页引用计数加一。
+    int VirtualMemoryManager::vm_copy(PageTable &old_pt, PageTable &new_pt, uint64 start, uint64 size, proc::VmaTree *vt)
     {
         Pte pte;
         uint64 pa, va;
         uint64 va_end;
         uint64 flags;
-        void *mem;
 
         if (!is_page_align(start) || !is_page_align(size))
         {
@@ -601,19 +581,208 @@ namespace mem
             /// TODO: 为了mmap的懒分配，所以确实可能出现了惰性页面调用
             // panic("uvmcopy: page not valid");
             pa = (uint64)pte.pa();
-            flags = pte.get_flags();
-            if ((mem = mem::PhysicalMemoryManager::alloc_page()) == nullptr)
+            flags = pte.get_flags() | (pte.get_data() & PTE_COW); // 已经是 COW 的页继续保持 COW
+            proc::vma *v = vt != nullptr ? vt->find(va) : nullptr;
+            bool shared = v != nullptr && (v->flags & MAP_SHARED);
+#ifdef RISCV
+            if ((flags & PTE_W) && !shared)
+            {
+                flags = (flags & ~PTE_W) | PTE_COW;
+                pte.clear_data();
+                pte.set_data(PA2PTE(pa) | flags);
+            }
+#elif defined(LOONGARCH)
+            // 龙芯由硬件 D 位决定能否写入，清掉 D 后写入会触发 PME 例外
+            if ((flags & (PTE_D | PTE_W)) && !shared)
+            {
+                flags = (flags & ~(PTE_D | PTE_W)) | PTE_COW;
+                pte.clear_data();
+                pte.set_data(PA2PTE(pa) | flags);
+            }
+            pa = to_vir(pa);
+#endif
+            if (map_pages(new_pt, va, PGSIZE, pa, flags) == false)
             {
-                vmunmap(new_pt, 0, va / PGSIZE, 1);
+                vmunmap(new_pt, start, (va - start) / PGSIZE, 1);
                 return -1;
             }
-            memmove(mem, (const char *)pa, PGSIZE);
-            if (map_pages(new_pt, va, PGSIZE, (uint64)mem, flags) == false)
+            k_pmm.ref_page((void *)pa);
+        }
+
+        // 父进程的页表项被改成了只读，刷掉旧的可写 TLB 表项和缓存的可写翻译
+        tlb_flush(old_pt, start, PGROUNDUP(size) / PGSIZE);
+        user_ptr_invalidate();
+        return 0;
+    }
+
+    int VirtualMemoryManager::move_pages(PageTable &pt, uint64 old_va, uint64 new_va, uint64 npages)
+    {
+        // 先为所有要搬的页建好目标页表，分配失败时旧映射原封不动，不会只搬了一半
+        for (uint64 i = 0; i < npages; i++)
+        {
+            Pte pte = pt.walk(old_va + i * PGSIZE, 0);
+            if (pte.is_null() || !pte.is_valid())
+                continue;
+            if (pt.walk(new_va + i * PGSIZE, 1).is_null())
+                return -1;
+        }
+        for (uint64 i = 0; i < npages; i++)
+        {
+            Pte pte = pt.walk(old_va + i * PGSIZE, 0);
+            if (pte.is_null() || !pte.is_valid())
+                continue;
+            Pte npte = pt.walk(new_va + i * PGSIZE, 0);
+            uint64 data = pte.get_data();
+            pte.clear_data();
+            npte.clear_data();
+            npte.set_data(data);
+        }
+        tlb_flush(pt, old_va, npages);
+        user_ptr_invalidate();
+        return 0;
+    }
+
+    int VirtualMemoryManager::cow_fault(PageTable &pt, uint64 va)
+    {
+        if (va >= MAXVA)
+            return -1;
+        va = PGROUNDDOWN(va);
+
+        // 同一地址空间的线程可能同时在这一页上缺页，查表、换页都要在 mm 锁里
+        proc::Pcb *cur = proc::k_pm.get_cur_pcb();
+        SpinLock *mm = (cur != nullptr && cur->_vma != nullptr &&
+                        cur->get_pagetable()->get_base() == pt.get_base())
+                           ? &cur->_vma->_lock
+                           : nullptr;
+        if (mm)
+            mm->acquire();
+
+        Pte pte = pt.walk(va, false);
+        if (pte.is_null() || !pte.is_valid() || (pte.get_data() & PTE_COW) == 0)
+        {
+            if (mm)
+                mm->release();
+            return -1;
+        }
+
+        uint64 pa = (uint64)pte.pa();
+        uint64 flags = pte.get_flags() & ~PTE_COW;
+#ifdef RISCV
+        flags |= PTE_W;
+#elif defined(LOONGARCH)
+        flags |= PTE_W | PTE_D;
+        pa = to_vir(pa);
+#endif
+
+        if (k_pmm.page_ref((void *)pa) > 1)
+        {
+            // 仍有其他地址空间共享这一页，拷贝出私有副本。分配和拷贝时放开 mm 锁，
+            // 先多拿一份引用，免得旧页在这期间被释放挪作他用
+            k_pmm.ref_page((void *)pa);
+            if (mm)
+                mm->release();
+            void *mem = k_pmm.alloc_page();
+            if (mem == nullptr)
             {
-                k_pmm.free_page(mem);
-                vmunmap(new_pt, 0, va / PGSIZE, 1);
+                k_pmm.free_page((void *)pa);
                 return -1;
             }
+            memcpy(mem, (const void *)pa, PGSIZE);
+            if (mm)
+                mm->acquire();
+
+            // 放锁期间别的线程可能已经拆分过这一页，或者整个撤销了映射：丢掉这份拷贝，让访问重来
+            pte = pt.walk(va, false);
+            uint64 now = pte.is_null() || !pte.is_valid() ? 0 : (uint64)pte.pa();
+#ifdef LOONGARCH
+            now = now ? to_vir(now) : 0;
+#endif
+            if (now != pa || (pte.get_data() & PTE_COW) == 0)
+            {
+                if (mm)
+                    mm->release();
+                k_pmm.free_page(mem);
+                k_pmm.free_page((void *)pa);
+                return 0;
+            }
+            k_pmm.free_page((void *)pa); // 上面多拿的那份
+            k_pmm.free_page((void *)pa); // 本页表原来那份
+            pa = (uint64)mem;
+        }
+        // 否则已经是最后一个使用者，直接恢复写权限
+
+        pte.clear_data();
+        pte.set_data(PA2PTE(pa) | flags);
+        tlb_flush(pt, va, 1);
+        user_ptr_invalidate();
+        if (mm)
+            mm->release();
+        return 0;
+    }
+
+    int VirtualMemoryManager::map_shared_page(PageTable &pt, uint64 va, void *pa, uint64 flags, bool cow)
+    {
+#ifdef RISCV
+        if (cow && (flags & PTE_W))
+            flags = (flags & ~PTE_W) | PTE_COW;
+#elif defined(LOONGARCH)
+        // 龙芯由 D 位决定能否写入，只读的共享页也必须清掉 D
+        if (cow && (flags & (PTE_D | PTE_W)))
+            flags = (flags & ~(PTE_D | PTE_W)) | PTE_COW;
+        else if (!(flags & PTE_W))
+            flags &= ~PTE_D;
+#endif
+        return map_pages(pt, PGROUNDDOWN(va), PGSIZE, (uint64)pa, flags) ? 0 : -1;
+    }
+
+    int VirtualMemoryManager::fault_in(PageTable &pt, uint64 va)
+    {
+        // 缺页处理可能读页缓存并睡眠，持锁时睡下去会撞上调度器的检查
+        if (Cpu::get_cpu()->get_num_off() > 0)
+            return -EFAULT;
+        proc::Pcb *p = proc::k_pm.get_cur_pcb();
+        if (p == nullptr || p->_vma == nullptr || pt.get_base() != p->get_pagetable()->get_base())
+            return -1;
+
+        // 先确认地址落在某个 VMA 里，不在的话就是真正的非法地址，不必打扰缺页处理
+        p->_vma->_lock.acquire();
+        bool mapped = p->_vma->_vm.find(va) != nullptr;
+        p->_vma->_lock.release();
+        if (!mapped)
+            return -1;
+        return mmap_handler(va, 0);
+    }
+
+    uint64 VirtualMemoryManager::fault_in_range(PageTable &pt, uint64 va, uint64 len, bool write)
+    {
+        uint64 done = 0;
+        while (done < len)
+        {
+            if (user_ptr(pt, va + done, write) == nullptr)
+                break;
+            done += PGSIZE - ((va + done) % PGSIZE);
+        }
+        return done < len ? done : len;
+    }
+
+    int VirtualMemoryManager::cow_prepare_write(PageTable &pt, uint64 va, uint64 len)
+    {
+        if (len == 0)
+            return 0;
+        for (uint64 a = PGROUNDDOWN(va); a < va + len; a += PGSIZE)
+        {
+            Pte pte = pt.walk(a, false);
+            if (pte.is_null() || !pte.is_valid())
+            {
+                // 还没建立的惰性页：先缺页进来，按需加载的私有文件页会以写时复制方式映射
+                if (fault_in(pt, a) < 0)
+                    continue;
+                pte = pt.walk(a, false);
+                if (pte.is_null() || !pte.is_valid())
+                    continue;
+            }
+            if ((pte.get_data() & PTE_COW) && cow_fault(pt, a) < 0)
+                return -1;
         }
         return 0;
     }
@@ -627,6 +796,7 @@ namespace mem
         // 使用引用计数机制安全释放页表
         // 注意：这里不直接设置pt的_base_addr为0，让dec_ref来处理
         pt.dec_ref();
+        user_ptr_invalidate(); // 页表页可能被别的地址空间重用
     }
 
     void VirtualMemoryManager::uvmclear(PageTable &pt, uint64 va)
@@ -639,6 +809,8 @@ namespace mem
         if (pte.is_valid())
             pte.set_data(pte.get_data() & ~loongarch::PteEnum::pte_plv_m); // PTE_U
 #endif
+        tlb_flush(pt, va, 1);
+        user_ptr_invalidate();
     }
 
     uint64 VirtualMemoryManager::uvmalloc(PageTable &pt, uint64 oldsz, uint64 newsz, uint64 flags)
@@ -906,27 +1078,93 @@ namespace mem
 #endif
     }
 
-    int VirtualMemoryManager::protectpages(PageTable &pt, uint64 va, uint64 size, int perm)
+    void VirtualMemoryManager::_mark_shared_dirty(proc::vma *v, uint64 va)
+    {
+        fs::normal_file *vf = v->vfile;
+        uint64 pg_off = PGROUNDDOWN(va - v->addr);
+        if (vf == nullptr || vf->getDentry() == nullptr || vf->getDentry()->getNode() == nullptr ||
+            pg_off + PGSIZE > v->file_sz)
+            return;
+        fs::PageCache *pcache = vf->getDentry()->getNode()->pageCache();
+        uint64 foff = v->offset + pg_off;
+        if (pcache != nullptr && foff % PGSIZE == 0)
+            pcache->mark_dirty(foff / PGSIZE);
+    }
+
+    int VirtualMemoryManager::protectpages(PageTable &pt, uint64 va, uint64 size, int prot, proc::VmaTree *vt)
     {
         uint64 a, last;
         Pte pte;
 
-        // printf("[protectpages] va: %p, size: %p, perm: %p\n", va, size, perm);
+        // printf("[protectpages] va: %p, size: %p, prot: %p\n", va, size, prot);
+
+        // 先按 prot 算出整套用户权限位，再替换表项里原有的，mprotect 才能去掉权限
+#ifdef RISCV
+        const uint64 mask = PTE_R | PTE_W | PTE_X | PTE_U | PTE_COW;
+        // PROT_NONE 保留一个不带 U 的只读叶子表项：用户访问缺页，user_ptr 也拒绝访问；
+        // R/W/X 全为 0 会被硬件当成下一级页表
+        uint64 perm = PTE_R;
+        if (prot != PROT_NONE)
+        {
+            perm |= PTE_U;
+            if (prot & PROT_WRITE)
+                perm |= PTE_W; // 只写不读是保留编码，可写的页同时可读
+            if (prot & PROT_EXEC)
+                perm |= PTE_X;
+            if (!(prot & (PROT_READ | PROT_WRITE)))
+                perm &= ~PTE_R;
+        }
+        const uint64 wbits = PTE_W;
+#elif defined(LOONGARCH)
+        const uint64 mask = PTE_PLV | PTE_W | PTE_D | PTE_NR | PTE_NX | PTE_COW;
+        // PROT_NONE 把特权级降到 0，用户访问触发特权异常，user_ptr 也拒绝访问
+        uint64 perm = PTE_NX;
+        if (prot != PROT_NONE)
+        {
+            perm = PTE_U;
+            if (!(prot & (PROT_READ | PROT_WRITE)))
+                perm |= PTE_NR;
+            if (prot & PROT_WRITE)
+                perm |= PTE_W | PTE_D;
+            if (!(prot & PROT_EXEC))
+                perm |= PTE_NX;
+        }
+        const uint64 wbits = PTE_W | PTE_D;
+#endif
 
         last = PGROUNDDOWN(va + size - 1);
 
         for (a = PGROUNDDOWN(va); a != last + PGSIZE; a += PGSIZE)
         {
-            pte = pt.walk(a, 1);
-            if (pte.is_null())
-                return -1;
-            if (pte.get_data() == 0)
-                break;
-            if (pte.get_data() & PTE_V)
-                pte.set_data(pte.get_data() | perm);
-            else
-                pte.set_data(pte.get_data() | PTE_U);
+            pte = pt.walk(a, 0);
+            if (pte.is_null() || pte.get_data() == 0)
+                continue; // 按需分页区域中尚未访问的页，缺页时按 VMA 的权限建立映射
+            if (!(pte.get_data() & PTE_V))
+                continue;
+            uint64 add = perm;
+            if (add & PTE_W)
+            {
+                uint64 pa = (uint64)pte.pa();
+#ifdef LOONGARCH
+                pa = to_vir(pa);
+#endif
+                proc::vma *v = vt != nullptr ? vt->find(a) : nullptr;
+                bool shared = v != nullptr && (v->flags & MAP_SHARED);
+                if (shared)
+                {
+                    // 共享映射的写入要让其他映射者看到，直接给写权限；页缓存页从此可能被写脏
+                    if (!(pte.get_data() & PTE_W))
+                        _mark_shared_dirty(v, a);
+                }
+                else if ((pte.get_data() & PTE_COW) || k_pmm.page_ref((void *)pa) > 1)
+                    // 私有映射的共享物理页（写时复制页、页缓存页）改成写时复制，第一次写入时再拆分
+                    add = (add & ~wbits) | PTE_COW;
+            }
+            // 去掉写权限时写时复制位也要去掉，否则写错误会被当成写时复制拆开
+            pte.set_data((pte.get_data() & ~mask) | add);
         }
+        // 减权限必须刷掉旧表项；加权限也要刷：旧的只读表项会让写入白白多一次缺页
+        tlb_flush(pt, va, (last + PGSIZE - PGROUNDDOWN(va)) / PGSIZE);
         return 0;
     }
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "spinlock.hh"
 #include <EASTL/string.h>
+#include <EASTL/atomic.h>
 // 根据不同架构包含不同的页表实现
 #ifdef RISCV
 #include "riscv/pagetable.hh"
@@ -10,12 +11,23 @@
 
 #endif
 
+namespace proc
+{
+	class VmaTree;
+	struct vma;
+}
+
 namespace mem
 {
+	constexpr uint64 tlb_flush_page_limit = 32; // 一次要刷的页数超过这个数时直接刷掉整个 ASID
+
 	class VirtualMemoryManager
 	{
 	private:
 		SpinLock _virt_mem_lock;
+		// 用户页表项每被撤销或降权一次加一，进程里缓存的用户页翻译随之作废。
+		// 各核并发地撤销映射和翻译，必须原子；撤销方在清掉表项并刷完 TLB 之后才加
+		eastl::atomic<uint64> _pte_gen{1};
 
 	public:
 		static uint64 kstack_vm_from_gid( uint gid );
@@ -23,6 +35,8 @@ namespace mem
 	public:
 		VirtualMemoryManager() {};
 		void init( const char *lock_name );
+		/// @brief 在当前核上启用内核页表，主核在 init 中调用，从核启动时各自调用
+		void inithart();
 		/// @brief map va to pa through pt 
 		/// @param pt pagetable to use 
 		/// @param va virtual address 
@@ -46,9 +60,44 @@ namespace mem
 		/// @param do_free free physical pages?
 		void vmunmap( PageTable &pt, uint64 va, uint64 npages, int do_free );
 
+		/// @brief 把 [old_va, old_va + npages 页) 上已建立的映射原样挪到 new_va，物理页和引用计数不变
+		/// @return 0 if success, -1 if a page table page could not be allocated (nothing has been moved)
+		int move_pages( PageTable &pt, uint64 old_va, uint64 new_va, uint64 npages );
+
 		PageTable vm_create();
 
-		int vm_copy( PageTable &old_pt, PageTable &new_pt, uint64 start, uint64 size );
+		/// @brief fork 时复制 [start, start + size) 上已建立的映射。私有页两边都改成写时复制；
+		/// vt 中 MAP_SHARED 区域里的页原样共享，父子双方写的是同一页
+		/// @param vt 旧地址空间的区域表，调用者持有它所属的 mm 锁；为 nullptr 时全部按私有页处理
+		int vm_copy( PageTable &old_pt, PageTable &new_pt, uint64 start, uint64 size, proc::VmaTree *vt = nullptr );
+
+		/// @brief 处理写时复制页的写错误
+		/// @param pt pagetable to use
+		/// @param va faulting virtual address
+		/// @return 0 if va was a COW page and is now writable, -1 otherwise
+		int cow_fault( PageTable &pt, uint64 va );
+
+		/// @brief 把一个共享的物理页（例如页缓存页）映射到 va
+		/// @param pa 物理页，调用者已为这次映射持有它的一份引用
+		/// @param flags 页表项标志；不可写时去掉硬件写权限，保证共享页不会被改写
+		/// @param cow 为 true 时以写时复制方式映射，第一次写入由 cow_fault 拷出私有副本
+		/// @return 0 if success, -1 otherwise
+		int map_shared_page( PageTable &pt, uint64 va, void *pa, uint64 flags, bool cow );
+
+		/// @brief 内核代替当前进程访问一个还没建立映射的用户地址时调用：
+		///        地址落在某个 VMA 里就走一次缺页处理（mmap 惰性页、按需加载的 ELF 段）。
+		///        缺页处理可能读盘睡眠，持有自旋锁（关中断层数非零）时一律不做，返回 -EFAULT
+		/// @return 0 if the page is now mapped, <0 otherwise
+		int fault_in( PageTable &pt, uint64 va );
+
+		/// @brief 拿自旋锁之前把用户区间 [va, va + len) 逐页缺页进来，write 为真时同时拆开写时复制页，
+		///        之后在锁内的 copy_in/copy_out 不再需要缺页
+		/// @return 从 va 开始连续可访问的字节数（不超过 len）
+		uint64 fault_in_range( PageTable &pt, uint64 va, uint64 len, bool write );
+
+		/// @brief 内核要经由物理地址写用户内存前，先拆分区间内的写时复制页
+		/// @return 0 if success, -1 if out of memory
+		int cow_prepare_write( PageTable &pt, uint64 va, uint64 len );
 
 		/// @brief allocate shm
 		/// @param pt pagetable to use
@@ -64,6 +113,23 @@ namespace mem
 		/// @param sz 
 		void vmfree( PageTable &pt, uint64 sz,uint64 base = 0 );
 
+		/// @brief 取得用户地址 va 在内核中可以直接读写的地址（所在物理页的直接映射）。
+		/// 内核与用户不共用页表，内核访问用户内存都经这里翻译：还没建立的惰性页代替用户缺页一次，
+		/// 写访问先拆开写时复制页并要求页可写；地址非法时返回 nullptr，调用者据此返回 -EFAULT。
+		/// 最近一次的翻译缓存在当前进程里，连续的小拷贝落在同一页时不必再查页表。
+		/// @return 指向 va 的内核指针，[va, 页尾) 可以直接访问；失败返回 nullptr
+		u8 *user_ptr( PageTable &pt, uint64 va, bool write );
+
+		/// @brief 用户页表项被撤销、降权或换了物理页，并且 TLB 已经刷过之后调用，作废所有缓存的用户页翻译
+		void user_ptr_invalidate() { _pte_gen.fetch_add(1); }
+
+		/// @brief 用户页表项被撤销、降权或改指向之后刷掉 TLB 中 [va, va + npages 页) 的旧表项。
+		/// 本核只按 pt 的 ASID 刷，pt 在本代还没有 ASID 时本核 TLB 里没有它的表项；
+		/// 运行过 pt 的其他核经核间中断一并刷掉
+		void tlb_flush( PageTable &pt, uint64 va, uint64 npages );
+		/// @brief 刷掉 pt 整个地址空间在 TLB 中的表项
+		void tlb_flush_all( PageTable &pt );
+
 		int copy_in( PageTable &pt, void *dst, uint64 src_va, uint64 len );
 
 		int copy_str_in( PageTable &pt, void *dst, uint64 src_va, uint64 max );
@@ -116,9 +182,17 @@ namespace mem
 
 		void uvmfirst(PageTable &pt, uint64 src, uint64 sz);
 
-		int protectpages(PageTable &pt, uint64 va, uint64 size, int perm);
+		/// @brief 把已映射的页的用户权限整体换成 prot (PROT_*)，可以加也可以减；
+		/// vt 给出时按 VMA 区分共享映射（直接可写）和私有映射（写时复制）
+		int protectpages(PageTable &pt, uint64 va, uint64 size, int prot, proc::VmaTree *vt = nullptr);
 
 	private:
+		/// @brief 共享文件映射的页变为可写时，把对应的页缓存页标脏
+		void _mark_shared_dirty( proc::vma *v, uint64 va );
+
+
+		/// @brief 让运行过 pt 的其他核刷掉相应表项，npages 为 0 表示整个地址空间。须关中断调用
+		void tlb_shootdown( PageTable &pt, uint64 va, uint64 npages );
 	};
 
 	extern VirtualMemoryManager k_vmm;
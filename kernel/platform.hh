@@ -287,6 +287,13 @@ intr_off()
   w_sstatus(r_sstatus() & ~SSTATUS_SIE);
 }
 
+// 停机直到有中断挂起；关中断时调用也会醒来，醒来后开中断即进入处理
+static inline void
+wait_for_interrupt()
+{
+  asm volatile("wfi" ::: "memory");
+}
+
 // are device interrupts enabled?
 static inline int
 intr_get()
@@ -350,6 +357,20 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// 只刷掉一个 ASID 的全部表项
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r"(asid) : "memory");
+}
+
+// 只刷掉一个 ASID 下 va 所在页的表项
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r"(va), "r"(asid) : "memory");
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
@@ -368,6 +389,7 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_COW (1L << 8) // RSW 软件位：写时复制页
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -495,6 +517,7 @@ r_csr_estat()
 #define CSR_ECFG_LIE_TI_SHIFT 11
 #define HWI_VEC 0x3fcU
 #define TI_VEC (0x1 << CSR_ECFG_LIE_TI_SHIFT)
+#define IPI_VEC (0x1 << 12)
 
 static inline uint32
 r_csr_ecfg()
@@ -580,6 +603,28 @@ w_csr_asid(uint32 x)
   asm volatile("csrwr %0, 0x18" : : "r"(x));
 }
 
+static inline uint32
+r_csr_asid()
+{
+  uint32 x;
+  asm volatile("csrrd %0, 0x18" : "=r"(x));
+  return x;
+}
+
+// 清除一个 ASID 的全部非全局 TLB 表项
+static inline void
+invtlb_asid(uint64 asid)
+{
+  asm volatile("invtlb 0x4, %0, $zero" : : "r"(asid) : "memory");
+}
+
+// 清除一个 ASID 下 va 所在页的非全局 TLB 表项
+static inline void
+invtlb_page(uint64 asid, uint64 va)
+{
+  asm volatile("invtlb 0x5, %0, %1" : : "r"(asid), "r"(va) : "memory");
+}
+
 #define CSR_TCFG_EN (1U << 0)
 #define CSR_TCFG_PER (1U << 1)
 
@@ -740,6 +785,34 @@ inline u8 read_itr_cfg_8b(uint64 itr_reg)
 {
   return *((volatile u8 *)itr_reg);
 }
+
+// 每个核私有的 IOCSR 只能用 iocsr 指令访问（核间中断、邮箱）
+inline uint32 iocsr_read32(uint64 reg)
+{
+  uint32 x;
+  asm volatile("iocsrrd.w %0, %1" : "=r"(x) : "r"(reg));
+  return x;
+}
+inline void iocsr_write32(uint64 reg, uint32 x)
+{
+  asm volatile("iocsrwr.w %0, %1" : : "r"(x), "r"(reg));
+}
+inline void iocsr_write64(uint64 reg, uint64 x)
+{
+  asm volatile("iocsrwr.d %0, %1" : : "r"(x), "r"(reg));
+}
+
+/* 核间中断 (IPI) */
+constexpr uint64 LOONGARCH_IOCSR_IPI_STATUS = 0x1000;
+constexpr uint64 LOONGARCH_IOCSR_IPI_EN = 0x1004;
+constexpr uint64 LOONGARCH_IOCSR_IPI_CLEAR = 0x100c;
+constexpr uint64 LOONGARCH_IOCSR_MBUF0 = 0x1020;
+constexpr uint64 LOONGARCH_IOCSR_IPI_SEND = 0x1040;
+constexpr uint64 LOONGARCH_IOCSR_MBUF_SEND = 0x1048;
+constexpr uint64 IOCSR_SEND_BLOCKING = 1UL << 31;
+constexpr int IOCSR_SEND_CPU_SHIFT = 16;
+constexpr int IOCSR_MBUF_SEND_BOX_SHIFT = 2;
+constexpr int IOCSR_MBUF_SEND_BUF_SHIFT = 32;
 static inline int
 intr_get()
 {
@@ -769,6 +842,13 @@ intr_off()
   w_csr_crmd(r_csr_crmd() & ~CSR_CRMD_IE);
 }
 
+// 停机直到有中断挂起（只看 ECFG 中使能的中断，与 CRMD.IE 无关）
+static inline void
+wait_for_interrupt()
+{
+  asm volatile("idle 0" ::: "memory");
+}
+
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
 
@@ -785,6 +865,7 @@ intr_off()
 #define PTE_NX (1UL << 62)   // non executable
 #define PTE_NR (1L << 61)    // non readable
 #define PTE_RPLV (1UL << 63) // restricted privilege level enable
+#define PTE_COW (1L << 9)    // 软件位：写时复制页
 #define PTE_R 0
 #define PTE_X 0
 
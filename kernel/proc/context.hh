@@ -60,5 +60,6 @@ namespace proc
         int offset;             // 文件偏移
         uint64 max_len;         // 新增：最大可扩展长度
         bool is_expandable;     // 新增：是否可扩展
+        uint64 file_sz;         // 从 addr 起由文件提供内容的字节数，之后到 len 为止填零（ELF 段的 .bss）
     };
 }
\ No newline at end of file
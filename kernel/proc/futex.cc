@@ -1,11 +1,13 @@
 #include "proc/futex.hh"
 #include "time.hh"
 #include "timer_manager.hh"
+#include "tm/timer_wheel.hh"
 #include "proc/scheduler.hh"
 #include "proc/proc_manager.hh"
 #include "proc/proc.hh"
 #include "virtual_memory_manager.hh"
 #include "platform.hh"
+#include <asm-generic/errno.h>
 namespace proc
 {
 
@@ -18,12 +20,16 @@ namespace proc
         {
             p->_futex_addr = futex_addr;
         }
-        p->_state = SLEEPING;
+        k_sleep_wq.insert(&p->_sleep_node, chan);
+        k_futex_wq.insert(&p->_futex_node, p->_futex_addr);
+        k_pm.change_state(p, SLEEPING);
 
         k_scheduler.call_sched();
 
         // printf("%d\n", p->state);
         p->_chan = 0;
+        k_sleep_wq.remove(&p->_sleep_node);
+        k_futex_wq.remove(&p->_futex_node);
     }
 
     int futex_wait(uint64 uaddr, int val, tmm::timespec *ts)
@@ -31,6 +37,10 @@ namespace proc
         Pcb *p = k_pm.get_cur_pcb();
         int current_val;
 
+        // 持有 p->_lock 时不能缺页，先在锁外读一次把页缺页进来，锁内再读一次做比较
+        if (mem::k_vmm.copy_in(p->_pt, (char *)&current_val, uaddr, sizeof(int)))
+            return -1;
+
         p->_lock.acquire();
         if (mem::k_vmm.copy_in(p->_pt, (char *)&current_val, uaddr, sizeof(int)))
         {
@@ -49,27 +59,23 @@ namespace proc
 
         if (ts)
         {
-            uint64 n;
-            n = (ts->tv_sec + 3) * tmm::qemu_fre+ (ts->tv_nsec * tmm::qemu_fre) / 1000000000;
-            uint64 timestamp;
-            timestamp = rdtime();
-            while (rdtime() - timestamp < n)
+            // 超时由时间轮上的一个定时器负责叫醒，不再每个 tick 醒来看一次时间
+            uint64 expires = tmm::k_twheel.jiffies() + tmm::k_tm.timespec_to_ticks(*ts);
+            tmm::Timer t;
+            t.init(ProcessManager::wake_on_timer, p);
+            tmm::k_twheel.add(&t, expires);
+
+            bool timed_out = true;
+            if (tmm::k_twheel.jiffies() < expires)
             {
-                if (p->_signal == 9)
-                {
-                    p->_lock.release();
-                    return -1;
-                }
-                futex_sleep((void*)tmm::k_tm.get_ticks(), (void *)uaddr);
-                if (p->_futex_addr == 0)
-                {
-                    p->_lock.release();
-                    return 0;
-                }
+                futex_sleep((void *)uaddr, (void *)uaddr);
+                // 被 futex_wakeup 唤醒时 _futex_addr 已被清零
+                timed_out = p->_futex_addr != 0;
+                p->_futex_addr = 0;
             }
-            p->_futex_addr = 0;
             p->_lock.release();
-            return 0;
+            tmm::k_twheel.del_sync(&t);
+            return timed_out ? -ETIMEDOUT : 0;
         }
         futex_sleep((void *)uaddr, (void *)uaddr);
         p->_lock.release();
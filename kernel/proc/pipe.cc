@@ -10,6 +10,7 @@
 #include "proc_manager.hh"
 
 #include "virtual_memory_manager.hh"
+#include "physical_memory_manager.hh"
 
 #include "fs/vfs/file/file.hh"
 #include "fs/vfs/file/pipe_file.hh"
@@ -18,175 +19,353 @@ namespace proc
 {
 	namespace ipc
 	{
-		int Pipe::write(uint64 addr, int n)
+		int Pipe::_wait_data(Pcb *pr)
+		{
+			// 缓冲区为空且写端未关闭，或者有 splice 正在锁外取数据时，读者必须等待
+			while (_rd_busy || (_count == 0 && _write_is_open))
+			{ // DOC: pipe-empty
+				if (pr->is_killed())
+					return -1;
+				k_pm.sleep(&_read_sleep, &_lock); // DOC: piperead-sleep
+			}
+			return _count > 0 ? 1 : 0;
+		}
+
+		int Pipe::_wait_space(Pcb *pr)
+		{
+			while (_wr_busy || (is_full() && _read_is_open))
+			{
+				if (pr->is_killed())
+					return -1;
+				// 唤醒等待读取的进程，让其读走数据，自己睡眠等待空间释放
+				k_pm.wakeup(&_read_sleep);
+				k_pm.sleep(&_write_sleep, &_lock);
+			}
+			if (!_read_is_open || pr->is_killed())
+				return -1;
+			return 0;
+		}
+
+		int Pipe::_write(uint64 src, int n, bool user)
 		{
-			// printfRed("write pipe file\n");
 			int i = 0;
-			Pcb *pr = k_pm.get_cur_pcb(); // 获取当前进程的 PCB 指针
+			Pcb *pr = k_pm.get_cur_pcb();
+			mem::PageTable *pt = user ? pr->get_pagetable() : nullptr;
+
+			// 锁内的 copy_in 不能缺页（可能读盘睡眠），先把用户缓冲区缺页进来
+			if (user && n > 0)
+			{
+				n = (int)mem::k_vmm.fault_in_range(*pt, src, n, false);
+				if (n == 0)
+					return -EFAULT;
+			}
 
-			_lock.acquire(); // 加锁以保护共享资源 _data
+			_lock.acquire();
 
-			while (i < n) // 尝试写入 n 个字节
+			while (i < n)
 			{
-				if (!_read_is_open || pr->is_killed())
+				if (_wait_space(pr) < 0)
 				{
-					// 如果读端已关闭，或者当前进程已被标记为 killed，则写失败
+					// 读端已关闭，或者当前进程已被标记为 killed，则写失败
 					_lock.release();
 					return -1;
 				}
 
-				if (_count >= pipe_size)
+				// 每次搬运环内一段连续空间，绕回时下一轮再搬剩下的部分
+				uint32 len = contig_space();
+				if (len > (uint32)(n - i))
+					len = n - i;
+				uint8 *dst = _buffer + _tail;
+				if (user)
 				{
-					// 如果管道缓冲区满了，不能继续写入
-					// 唤醒等待读取的进程，让其读走数据
-					k_pm.wakeup(&_read_sleep);
-
-					// 当前进程进入睡眠，等待空间释放
-					k_pm.sleep(&_write_sleep, &_lock);
+					if (mem::k_vmm.copy_in(*pt, dst, src + i, len) < 0)
+					{
+						// 用户地址非法：已写入部分数据则返回字节数，否则返回 -EFAULT
+						if (i == 0)
+							i = -EFAULT;
+						break;
+					}
 				}
 				else
-				{
-					char ch;
-
-					mem::PageTable *pt = pr->get_pagetable(); // 获取页表对象的地址（风险点）
-
-					// 从用户空间地址 addr + i 拷贝一个字节到内核空间的 ch 中
-					if (mem::k_vmm.copy_in(*pt, &ch, addr + i, 1) == -1)
-						break; // 如果拷贝失败（例如地址非法），退出循环
-					// // printfYellow("Pipe write char: %c\n", ch); // 调试输出写入的字符
-					push((uint8)ch); // 将字符写入管道缓冲区
-					i++;			// 写入计数加一
-				}
+					memmove(dst, (void *)(src + i), len);
+				advance_tail(len);
+				i += len;
 			}
 
-			// // printf("Pipe buffer: ");
-			// for (auto q = _data; !q.empty(); q.pop())
-			// {
-			// 	// printf("%c", q.front());
-			// }
-			// // printf("\n");
-
 			// 写完后唤醒读者进程
 			k_pm.wakeup(&_read_sleep);
-			_lock.release(); // 释放锁
+			_lock.release();
 
 			return i; // 返回实际写入的字节数
 		}
+
+		int Pipe::write(uint64 addr, int n)
+		{
+			return _write(addr, n, true);
+		}
+
 		int Pipe::write_in_kernel(uint64 addr, int n)
+		{
+			return _write(addr, n, false);
+		}
+
+		int Pipe::read(uint64 addr, int n)
+		{
+			return _read(addr, n, false);
+		}
+
+		int Pipe::read_user(uint64 addr, int n)
+		{
+			return _read(addr, n, true);
+		}
+
+		int Pipe::_read(uint64 dst, int n, bool user)
 		{
 			int i = 0;
-			Pcb *pr = k_pm.get_cur_pcb(); // 获取当前运行的进程控制块（虽然这函数是内核态用的，但可能用于判死等）
+			Pcb *pr = k_pm.get_cur_pcb();
+			mem::PageTable *pt = user ? pr->get_pagetable() : nullptr;
+
+			// 同 _write：锁外先缺页并拆开写时复制页
+			if (user && n > 0)
+			{
+				n = (int)mem::k_vmm.fault_in_range(*pt, dst, n, true);
+				if (n == 0)
+					return -EFAULT;
+			}
 
-			_lock.acquire(); // 获取锁，防止多进程并发写入管道缓冲区
+			_lock.acquire();
 
-			// printfBlue("write_in_kernel buf: %s\n", (char *)addr);
-			// printfYellow("write_in_kernel n: %d\n", n);
-			while (i < n) // 写入 n 个字节
+			if (_wait_data(pr) < 0)
 			{
-				if (!_read_is_open || pr->is_killed())
-				{
-					// printfRed("Pipe write failed: read end closed or process killed\n");
-					// 如果读端已关闭，或者当前进程被终止，提前退出
-					_lock.release();
-					return -1;
-				}
+				// 如果进程被杀死，则放弃等待，直接返回 -1
+				_lock.release();
+				return -1;
+			}
 
-				if (_count >= pipe_size)
+			// 按环内连续段整块拷贝
+			while (i < n && _count > 0)
+			{ // DOC: piperead-copy
+				uint32 len = contig_data();
+				if (len > (uint32)(n - i))
+					len = n - i;
+				if (user)
 				{
-					// printfRed("Pipe buffer full, cannot write more data\n");
-					// 如果缓冲区已满，则不能继续写入
-					// 唤醒读端（可能已阻塞）
-					k_pm.wakeup(&_read_sleep);
-
-					// 当前写入进程挂起，等待读端消费数据后唤醒
-					k_pm.sleep(&_write_sleep, &_lock);
+					if (mem::k_vmm.copy_out(*pt, dst + i, _buffer + _head, len) < 0)
+					{
+						if (i == 0)
+							i = -EFAULT;
+						break;
+					}
 				}
 				else
-				{
-					char ch;
-
-					// 内核态地址直接解引用：从addr+i的位置取一个字节
-					ch = *(char *)(addr + i);
-
-					// 将该字节推入管道缓冲区
-					// printf("Pipe write char: %c\n", ch); // 调试输出写入的字符
-
-					// for (auto q = _data; !q.empty(); q.pop())
-					// {
-					// 	// printf("%c", q.front());
-					// }
-					// printf("current queue\n"); // 调试输出写入的字符
-					// printf("pipe size:%d,pipe buffer size: %d\n",pipe_size, _count);
-					push((uint8)ch);
-					// printf("pipe size:%d,pipe buffer size: %d\n",pipe_size, _count);
-					i++;
-				}
-				// Info(" i: %d\n", i);
-				// Info("Pipe buffer size: %d\n", _count);
-				// Info("Pipe buffer: ");
-				// for (auto q = _data; !q.empty(); q.pop())
-				// {
-				// 	// printf("%c", q.front());
-				// }
-				// // printf("\n");
+					memmove((char *)dst + i, _buffer + _head, len);
+				advance_head(len);
+				i += len;
 			}
 
-			// 写完后唤醒读者，防止其继续阻塞
-			k_pm.wakeup(&_read_sleep);
-			_lock.release(); // 释放写锁
+			// 唤醒阻塞在写端的进程，提示缓冲区已有空间
+			k_pm.wakeup(&_write_sleep); // DOC: piperead-wakeup
+
+			_lock.release();
 
-			return i; // 返回成功写入的字节数
+			return i; // 返回成功读取的字节数
 		}
 
-		int Pipe::read(uint64 addr, int n)
+		uint32 Pipe::_peek(uint8 *dst, uint32 off, uint32 n)
 		{
-			// // printf("Pipe buffer: ");
-			// for (auto q = _data; !q.empty(); q.pop())
-			// {
-			// 	// printf("%c", q.front());
-			// }
-			// // printf("\n");
-			// // printfMagenta("it is a pipe file\n");
-			int i;
-			Pcb *pr = k_pm.get_cur_pcb(); // 获取当前运行进程的 PCB
-			char ch;
-
-			_lock.acquire(); // 加锁保护 _data 缓冲区
-
-			// 如果缓冲区为空，且写端还未关闭，当前读者进程必须等待
-			while (_count == 0 && _write_is_open)
-			{ // DOC: pipe-empty
-				if (pr->is_killed())
+			if (off >= _count)
+				return 0;
+			if (n > _count - off)
+				n = _count - off;
+			uint32 pos = (_head + off) & (_capacity - 1);
+			uint32 first = _capacity - pos;
+			if (first > n)
+				first = n;
+			memmove(dst, _buffer + pos, first);
+			memmove(dst + first, _buffer, n - first);
+			return n;
+		}
+
+		long Pipe::set_size(uint size, bool privileged)
+		{
+			// 与 Linux 的 round_pipe_size 一致：超过 2^31 无法取整，视为非法参数
+			if (size > (1U << 31))
+				return -EINVAL;
+			// 向上取整到 2 的幂次个页，环下标可以用掩码回绕
+			uint32 cap = pipe_min_size;
+			while (cap < size)
+				cap <<= 1;
+			// 只有扩容超过 pipe-max-size 才需要特权 (CAP_SYS_RESOURCE)，缩小总是允许
+			if (cap > _capacity && cap > pipe_max_size && !privileged)
+				return -EPERM;
+			// 分配失败会 panic，特权进程的超大请求在这里先拒绝
+			if (cap > pipe_max_size && cap / PGSIZE >= mem::k_pmm.free_pages())
+				return -ENOMEM;
+
+			uint8 *nbuf = new uint8[cap];
+			_lock.acquire();
+			if (_rd_busy || _wr_busy || _count > cap)
+			{
+				_lock.release();
+				delete[] nbuf;
+				return -EBUSY;
+			}
+			// 把现有数据线性化到新缓冲区头部
+			_peek(nbuf, 0, _count);
+			uint8 *obuf = _buffer;
+			_buffer = nbuf;
+			_capacity = cap;
+			_head = 0;
+			_tail = _count & (cap - 1);
+			k_pm.wakeup(&_write_sleep);
+			_lock.release();
+			delete[] obuf;
+			return cap;
+		}
+
+		long Pipe::splice_to(fs::file *f, long off, ulong len)
+		{
+			Pcb *pr = k_pm.get_cur_pcb();
+			long total = 0;
+
+			_lock.acquire();
+			int r = _wait_data(pr);
+			if (r <= 0)
+			{
+				_lock.release();
+				return r;
+			}
+
+			// 文件写可能睡眠，不能持有自旋锁：标记 _rd_busy 占住读端，
+			// 直接把环内的连续段交给文件写，写完再推进读位置
+			_rd_busy = true;
+			while ((ulong)total < len && _count > 0)
+			{
+				uint32 n = contig_data();
+				if (n > len - total)
+					n = len - total;
+				uint8 *src = _buffer + _head;
+				_lock.release();
+				long w = f->write((uint64)src, n, off < 0 ? -1 : off + total, off < 0);
+				_lock.acquire();
+				if (w <= 0)
 				{
-					// 如果进程被杀死，则放弃等待，直接返回 -1
-					_lock.release();
-					return -1;
+					if (total == 0)
+						total = w;
+					break;
 				}
-				// 让当前进程进入休眠状态，等待写端唤醒
-				k_pm.sleep(&_read_sleep, &_lock); // DOC: piperead-sleep
+				advance_head(w);
+				total += w;
+				if ((uint32)w < n)
+					break;
 			}
+			_rd_busy = false;
+			k_pm.wakeup(&_write_sleep);
+			k_pm.wakeup(&_read_sleep);
+			_lock.release();
+			return total;
+		}
 
-			// 退出等待状态后，开始实际读取数据
-			for (i = 0; i < n; i++)
-			{ // DOC: piperead-copy
-				if (_count == 0)
-					break; // 如果缓冲区已经没有数据，则提前结束读取
+		long Pipe::splice_from(fs::file *f, long off, ulong len)
+		{
+			Pcb *pr = k_pm.get_cur_pcb();
+			long total = 0;
 
-				ch = pop(); // 读取并弹出字符
+			_lock.acquire();
+			if (_wait_space(pr) < 0)
+			{
+				_lock.release();
+				return -EPIPE;
+			}
 
-				// printfYellow("Pipe read char: %c\n", ch); // 调试输出读取的字符
-				*(((char *)addr) + i) = ch;				  // 将读取的字符写入用户态缓冲区
-														  // ⚠️注意：这里是直接解引用写入，如果addr是用户态地址，
-														  // 需要确保这个函数运行在内核地址空间能访问用户地址。
-														  // 否则应使用 copy_out 函数，这里可能有安全隐患
+			// 与 splice_to 对称：占住写端，文件直接读进环内的空闲段
+			_wr_busy = true;
+			while ((ulong)total < len && space() > 0)
+			{
+				uint32 n = contig_space();
+				if (n > len - total)
+					n = len - total;
+				uint8 *dst = _buffer + _tail;
+				_lock.release();
+				long rd = f->read((uint64)dst, n, off < 0 ? -1 : off + total, off < 0);
+				_lock.acquire();
+				if (rd <= 0)
+				{
+					if (total == 0)
+						total = rd;
+					break;
+				}
+				advance_tail(rd);
+				total += rd;
+				if ((uint32)rd < n)
+					break; // 文件到尾
 			}
+			_wr_busy = false;
+			k_pm.wakeup(&_read_sleep);
+			k_pm.wakeup(&_write_sleep);
+			_lock.release();
+			return total;
+		}
 
-			// 唤醒阻塞在写端的进程，提示缓冲区已有空间
-			k_pm.wakeup(&_write_sleep); // DOC: piperead-wakeup
+		long Pipe::tee(Pipe *out, ulong len, bool consume)
+		{
+			Pcb *pr = k_pm.get_cur_pcb();
+			if (out == this)
+				return -EINVAL;
+			// 两把管道锁按地址顺序获取，避免两个方向的 tee 互相死锁
+			Pipe *first = this < out ? this : out;
+			Pipe *second = this < out ? out : this;
+
+			for (;;)
+			{
+				_lock.acquire();
+				if (_wait_data(pr) <= 0)
+				{
+					_lock.release();
+					return pr->is_killed() ? -1 : 0;
+				}
+				_lock.release();
 
-			_lock.release(); // 释放互斥锁
+				out->_lock.acquire();
+				if (out->_wait_space(pr) < 0)
+				{
+					out->_lock.release();
+					return -EPIPE;
+				}
+				out->_lock.release();
 
-			return i; // 返回成功读取的字节数
+				first->_lock.acquire();
+				second->_lock.acquire();
+				// 两次等待之间状态可能改变，同时持有两把锁后再确认
+				if (_count == 0 || _rd_busy || out->is_full() || out->_wr_busy)
+				{
+					second->_lock.release();
+					first->_lock.release();
+					continue;
+				}
+				uint32 n = _count < out->space() ? _count : out->space();
+				if (n > len)
+					n = len;
+				uint32 done = 0;
+				while (done < n)
+				{
+					uint32 c = out->contig_space();
+					if (c > n - done)
+						c = n - done;
+					_peek(out->_buffer + out->_tail, done, c);
+					out->advance_tail(c);
+					done += c;
+				}
+				if (consume)
+				{
+					advance_head(n);
+					k_pm.wakeup(&_write_sleep);
+				}
+				k_pm.wakeup(&out->_read_sleep);
+				second->_lock.release();
+				first->_lock.release();
+				return n;
+			}
 		}
 
 		int Pipe::alloc(fs::pipe_file *&f0, fs::pipe_file *&f1)
@@ -199,6 +378,11 @@ namespace proc
 			// init pipe
 			_read_is_open = true;
 			_write_is_open = true;
+			if (_buffer == nullptr)
+			{
+				_buffer = new uint8[pipe_size];
+				_capacity = pipe_size;
+			}
 			_head = 0;
 			_tail = 0;
 			_count = 0;
@@ -13,42 +13,56 @@
 namespace fs{
 
 	class File;
+	class file;
 	class pipe_file;
 	
 }
 namespace proc
 {
 	class ProcessManager;
+	class Pcb;
 
 	namespace ipc
 	{
-		constexpr uint pipe_size = 1024;
+		constexpr uint pipe_size = 64 * 1024;			// 默认容量，与 Linux 一致
+		constexpr uint pipe_min_size = 4096;			// F_SETPIPE_SZ 的下限 (一页)
+		constexpr uint pipe_max_size = 1024 * 1024;		// F_SETPIPE_SZ 的上限 (/proc/sys/fs/pipe-max-size)
 
+		/// @brief 环形缓冲区由整页构成（大于一页的 new 直接走伙伴系统），
+		/// 读写按环内连续段整块搬运，一次最多两段。
+		/// splice/tee 直接在环与文件/另一个管道之间搬运，不经过中间缓冲区。
 		class Pipe
 		{
 			friend ProcessManager;
 		private:
 			SpinLock _lock;
-			// 使用循环缓冲区替代 queue，避免 EASTL 分配器问题
-			uint8 _buffer[pipe_size];
+			uint8 *_buffer;
+			uint32 _capacity; // 缓冲区容量，2 的幂次个页
 			uint32 _head;  // 读取位置
 			uint32 _tail;  // 写入位置
 			uint32 _count; // 当前数据量
 			bool _read_is_open;
 			bool _write_is_open;
+			bool _rd_busy;	// splice 正在锁外从环中取数据
+			bool _wr_busy;	// splice 正在锁外向环中填数据
 			uint8 _read_sleep;
 			uint8 _write_sleep;
 
 		public:
 			Pipe()
-				: _head(0)
+				: _buffer( nullptr )
+				, _capacity( 0 )
+				, _head(0)
 				, _tail(0)
 				, _count(0)
 				, _read_is_open( false )
 				, _write_is_open( false )
+				, _rd_busy( false )
+				, _wr_busy( false )
 			{
 				_lock.init( "pipe" );
 			};
+			~Pipe() { delete[] _buffer; }
 			bool read_is_open() { return _read_is_open; }
 			bool write_is_open() { return _write_is_open; }
 
@@ -56,35 +70,52 @@ namespace proc
 			int write_in_kernel( uint64 addr, int n );
 
 			int read( uint64 addr, int n );
+			int read_user( uint64 addr, int n );	// addr 为当前进程的用户地址
 
 			int alloc( fs::pipe_file * &f0, fs::pipe_file * &f1);
 
 			void close( bool is_write );
 
+			/// @brief F_GETPIPE_SZ / F_SETPIPE_SZ；privileged 表示调用者可以超过 pipe_max_size
+			long get_size() { return _capacity; }
+			long set_size( uint size, bool privileged );
+
+			/// @brief 从文件 f 的 off 处读入最多 len 字节到管道；off < 0 表示使用并推进文件自身偏移
+			long splice_from( fs::file *f, long off, ulong len );
+			/// @brief 从管道取出最多 len 字节写到文件 f 的 off 处；off 含义同上
+			long splice_to( fs::file *f, long off, ulong len );
+			/// @brief 复制最多 len 字节到另一个管道；consume 为真时同时从本管道取走 (管道间 splice)
+			long tee( Pipe *out, ulong len, bool consume = false );
+
 		private:
-			// 循环缓冲区辅助方法
-			bool is_full() const { return _count >= pipe_size; }
+			bool is_full() const { return _count >= _capacity; }
 			bool is_empty() const { return _count == 0; }
 			uint32 size() const { return _count; }
-			
-			void push(uint8 data) {
-				if (!is_full()) {
-					_buffer[_tail] = data;
-					_tail = (_tail + 1) % pipe_size;
-					_count++;
-				}
+			uint32 space() const { return _capacity - _count; }
+
+			// 环内从读位置开始的连续数据长度 / 从写位置开始的连续空闲长度
+			uint32 contig_data() const
+			{
+				uint32 n = _capacity - _head;
+				return n < _count ? n : _count;
 			}
-			
-			uint8 pop() {
-				if (!is_empty()) {
-					uint8 data = _buffer[_head];
-					_head = (_head + 1) % pipe_size;
-					_count--;
-					return data;
-				}
-				return 0;
+			uint32 contig_space() const
+			{
+				uint32 n = _capacity - _tail;
+				return n < space() ? n : space();
 			}
+			void advance_head( uint32 n ) { _head = ( _head + n ) & ( _capacity - 1 ); _count -= n; }
+			void advance_tail( uint32 n ) { _tail = ( _tail + n ) & ( _capacity - 1 ); _count += n; }
 
+			/// @brief 写入 n 字节；user 为真时 src 是当前进程的用户地址
+			int _write( uint64 src, int n, bool user );
+			int _read( uint64 dst, int n, bool user );
+			/// @brief 从 off 字节处窥视（不消耗）最多 n 字节到 dst，返回实际字节数
+			uint32 _peek( uint8 *dst, uint32 off, uint32 n );
+			/// @brief 等待缓冲区有数据；返回 0 表示写端已关闭且无数据，<0 表示被杀死
+			int _wait_data( Pcb *pr );
+			/// @brief 等待缓冲区有空间；返回 <0 表示读端关闭或被杀死
+			int _wait_space( Pcb *pr );
 		};
 
 	} // namespace ipc
@@ -30,6 +30,8 @@ namespace proc
     {
         _lock.init(lock_name);
         _state = ProcState::UNUSED;
+        _sleep_node.proc = this;
+        _futex_node.proc = this;
         _gid = gid;
         _kstack = mem::VirtualMemoryManager::kstack_vm_from_gid(_gid);
                
@@ -38,6 +40,8 @@ namespace proc
         _rlim_vec[ResourceLimitId::RLIMIT_STACK].rlim_max = 0;
         _sigmask = 0;
         _signal = 0;
+        _itimer.init(nullptr, this);
+        _itimer_interval = 0;
     }
 
     void Pcb::cleanup_sighand()
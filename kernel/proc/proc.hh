@@ -7,11 +7,14 @@
 #endif
 #include "trapframe.hh"
 #include "context.hh"
+#include "vma.hh"
 #include "spinlock.hh"
 #include <EASTL/string.h>
 #include "signal.hh"
 #include "prlimit.hh"
 #include "futex.hh"
+#include "wait_queue.hh"
+#include "tm/timer_wheel.hh"
 #include "fs/vfs/file/file.hh"
 #include "signal.hh"
 namespace fs
@@ -21,7 +24,6 @@ namespace fs
 } // namespace fs
 namespace proc
 {
-    constexpr int NVMA = 30; // 每个进程最多的虚拟内存区域数量
     enum ProcState
     {
         UNUSED,
@@ -77,6 +79,7 @@ namespace proc
         // 进程状态信息
         enum ProcState _state; // 进程当前状态 (unused, used, sleeping, runnable, running, zombie)
         void *_chan;           // 进程睡眠时等待的通道 (例如：某个锁或事件)
+        WaitNode _sleep_node;  // 挂在 k_sleep_wq 上，键为 _chan
         int _killed;           // 进程是否被标记为kill (非零表示被kill)
         int _xstate;           // 进程退出状态，用于父进程wait()获取
         int _pid;              // 进程ID (Process ID)
@@ -96,10 +99,18 @@ namespace proc
 
         // 上下文切换
         Context _context; // 保存进程的上下文信息 (寄存器等)，用于进程切换
+        void (*_kthread_fn)(void *) = nullptr; // 内核线程入口，普通进程为空
+        void *_kthread_arg = nullptr;
 
         // 调度相关
         int _slot;     // 分配给进程的时间片剩余量
         int _priority; // 进程优先级 (0最高，19最低)
+        Pcb *_rq_prev = nullptr; // 就绪队列链表，由 Scheduler 维护
+        Pcb *_rq_next = nullptr;
+        bool _on_rq = false;     // 是否挂在就绪队列上
+        int _rq_prio = 0;        // 入队时所在的优先级队列，优先级变化后仍能正确摘除
+        int _rq_cpu = 0;         // 入队时所在的核，挂在队列上期间不变
+        int _last_cpu = -1;      // 上次运行在哪个核，再次就绪时优先回到那里
 
         // TODO:共享内存相关
         // uint _shm;             // 共享内存的起始虚拟地址
@@ -116,17 +127,34 @@ namespace proc
 
         uint64 _hp; // 临时堆指针 (注释说明后续会删除)
 
+        /// @brief 一个地址空间的区域表，CLONE_VM 的线程之间共享。
+        /// _lock 保护 _vm 的一切访问（查找也会改写命中缓存）；它是自旋锁，持锁期间不能睡眠，
+        /// 缺页处理读文件之前要先放锁，回来后重新确认区域没变
         struct VMA
         {
-            vma     _vm[NVMA]; // 虚拟内存区域数组
+            VmaTree _vm;  // 虚拟内存区域，按起始地址排序
             int  _ref_cnt; // 虚拟内存区域的引用计数
+            SpinLock _lock;
+
+            VMA() { _lock.init("mm"); }
         };
         VMA* _vma; // 虚拟内存区域管理 (VMA) - 用于管理进程的虚拟内存区域
+
+        // 内核访问用户内存时最近一次的页翻译，见 VirtualMemoryManager::user_ptr
+        struct UaCache
+        {
+            uint64 pt_base = 0;
+            uint64 va = 0;     // 用户页地址
+            u8 *kva = nullptr; // 该页在内核中的地址
+            uint64 gen = 0;    // 翻译时的页表项代数
+            bool writable = false;
+        } _ua_cache;
         // 虚拟内存区域 (VMA) - 注释中提出了疑问，这里保留但需要进一步理解其用途
 
 
         // 线程/futex 相关
         void *_futex_addr; // Used for futex
+        WaitNode _futex_node; // 挂在 k_futex_wq 上，键为 _futex_addr
         int _tid = 0;
         int *_set_child_tid = nullptr;
         int *_clear_child_tid = nullptr;
@@ -145,6 +173,10 @@ namespace proc
         uint64 _signal = 0;                             // 信号标志位，表示接收到的信号
         ipc::signal::signal_frame *sig_frame = nullptr; // 信号处理帧，用于保存信号处理的上下文
 
+        // setitimer(ITIMER_REAL)：到期时投递 SIGALRM，间隔非零时按间隔重新挂上
+        tmm::Timer _itimer;
+        uint64 _itimer_interval = 0; // 单位为 tick
+
         // 程序段相关
         TODO("TBF")
         program_section_desc _prog_sections[max_program_section_num];
@@ -23,6 +23,7 @@
 #include "timer_manager.hh"
 #include "fs/vfs/elf.hh"
 #include "fs/vfs/file/normal_file.hh"
+#include "fs/vfs/page_cache.hh"
 #include "mem.hh"
 #include "fs/vfs/file/pipe_file.hh"
 #include "syscall_defs.hh"
@@ -38,6 +39,10 @@ extern "C"
         // printf("into _wrapped_fork_ret\n");
         proc::k_pm.fork_ret();
     }
+    void _wrp_kthread_entry(void)
+    {
+        proc::k_pm.kthread_entry();
+    }
     extern char sig_trampoline[]; // sig_trampoline.S
 }
 
@@ -51,6 +56,8 @@ namespace proc
         _pid_lock.init(pid_lock_name);
         _tid_lock.init(tid_lock_name);
         _wait_lock.init(wait_lock_name);
+        k_sleep_wq.init("sleep wait queue");
+        k_futex_wq.init("futex wait queue");
         for (uint i = 0; i < num_process; ++i)
         {
             Pcb &p = k_proc_pool[i];
@@ -93,6 +100,17 @@ namespace proc
         _tid_lock.release();
     }
 
+    /// @brief 修改进程状态并同步就绪队列，调用者需持有 p->_lock
+    bool ProcessManager::change_state(Pcb *p, ProcState state)
+    {
+        p->_state = state;
+        if (state == ProcState::RUNNABLE)
+            k_scheduler.enqueue(p);
+        else
+            k_scheduler.dequeue(p);
+        return true;
+    }
+
     Pcb *ProcessManager::alloc_proc()
     {
         Pcb *p;
@@ -221,22 +239,33 @@ namespace proc
             fs::Path mnt("/mnt");
             fs::Path dev("/dev/hda");
             mnt.mount(dev, "ext4", 0, 0);
+            // /tmp 挂内存文件系统，测试程序的临时文件不落到磁盘上
+            fs::Path tmp("/tmp");
+            fs::dentry *tmp_de = tmp.pathSearch();
+            fs::ramfs::k_ramfs.mount(nullptr, tmp_de, "tmpfs");
+            tmp_de->dput();
 
             fs::Path path("/dev/stdin");
             fs::FileAttrs fAttrsin = fs::FileAttrs(fs::FileTypes::FT_DEVICE, 0444); // only read
-            fs::device_file *f_in = new fs::device_file(fAttrsin, DEV_STDIN_NUM, path.pathSearch());
+            fs::dentry *std_de = path.pathSearch();
+            fs::device_file *f_in = new fs::device_file(fAttrsin, DEV_STDIN_NUM, std_de);
+            std_de->dput();
             assert(f_in != nullptr, "proc: alloc stdin file fail while user init.");
 
             fs::Path pathout("/dev/stdout");
             fs::FileAttrs fAttrsout = fs::FileAttrs(fs::FileTypes::FT_DEVICE, 0222); // only write
+            std_de = pathout.pathSearch();
             fs::device_file *f_out =
-                new fs::device_file(fAttrsout, DEV_STDOUT_NUM, pathout.pathSearch());
+                new fs::device_file(fAttrsout, DEV_STDOUT_NUM, std_de);
+            std_de->dput();
             assert(f_out != nullptr, "proc: alloc stdout file fail while user init.");
 
             fs::Path patherr("/dev/stderr");
             fs::FileAttrs fAttrserr = fs::FileAttrs(fs::FileTypes::FT_DEVICE, 0222); // only write
+            std_de = patherr.pathSearch();
             fs::device_file *f_err =
-                new fs::device_file(fAttrserr, DEV_STDERR_NUM, patherr.pathSearch());
+                new fs::device_file(fAttrserr, DEV_STDERR_NUM, std_de);
+            std_de->dput();
             assert(f_err != nullptr, "proc: alloc stderr file fail while user init.");
 
             fs::ramfs::k_ramfs.getRoot()->printAllChildrenInfo();
@@ -248,7 +277,7 @@ namespace proc
             proc->_ofile->_ofile_ptr[2] = f_err;
             proc->_ofile->_ofile_ptr[2]->refcnt++;
             /// @todo 这里暂时修改进程的工作目录为fat的挂载点
-            proc->_cwd = fs::ramfs::k_ramfs.getRoot()->EntrySearch("mnt");
+            proc->_cwd = fs::ramfs::k_ramfs.getRoot()->EntrySearch("mnt"); // 查找结果自带引用，直接作为 cwd 的引用
             proc->_cwd_name = "/mnt/";
             /// 你好
             /// 这是重定向uart的代码
@@ -266,63 +295,66 @@ namespace proc
         p->_pt = proc_pagetable(p);
     }
 
+    void ProcessManager::_free_vma_entries(Pcb::VMA *vt, mem::PageTable &pt)
+    {
+        for (VmaTree::iterator it = vt->_vm.begin(); it != vt->_vm.end(); ++it)
+        {
+            vma &v = it->second;
+
+            // 只对文件映射进行写回操作
+            if (v.vfile != nullptr && v.flags == MAP_SHARED && (v.prot & PROT_WRITE) != 0)
+            {
+                v.vfile->write(v.addr, v.len);
+            }
+
+            // 只对文件映射释放文件引用
+            if (v.vfile != nullptr)
+            {
+                v.vfile->free_file();
+                v.vfile = nullptr;
+            }
+
+            // 逐页检查并取消映射，按需分页的区域里可能只有一部分页被访问过
+            _unmap_present(pt, PGROUNDDOWN(v.addr), PGROUNDUP(v.addr + v.len));
+        }
+        vt->_vm.clear();
+    }
+
+    void ProcessManager::_unmap_present(mem::PageTable &pt, uint64 va_start, uint64 va_end)
+    {
+        for (uint64 va = va_start; va < va_end; va += PGSIZE)
+        {
+            mem::Pte pte = pt.walk(va, 0);
+            if (!pte.is_null() && pte.is_valid())
+            {
+                mem::k_vmm.vmunmap(pt, va, 1, 1);
+            }
+        }
+    }
+
     void ProcessManager::freeproc(Pcb *p)
     {
         // 处理VMA的引用计数
         bool should_free_vma = false;
         if (p->_vma != nullptr)
         {
-            if (--p->_vma->_ref_cnt <= 0)
+            p->_vma->_lock.acquire();
+            int ref = --p->_vma->_ref_cnt;
+            p->_vma->_lock.release();
+            if (ref <= 0)
             {
                 should_free_vma = true;
             }
             else
             {
-                printfYellow("freeproc: vma ref count not zero, ref_cnt: %d\n", p->_vma->_ref_cnt);
+                printfYellow("freeproc: vma ref count not zero, ref_cnt: %d\n", ref);
             }
         }
 
         // 如果应该释放VMA，则处理所有VMA条目
         if (should_free_vma && p->_vma != nullptr)
         {
-            for (int i = 0; i < NVMA; ++i)
-            {
-                // printfBlue("freeproc: checking vma %d, addr: %p, len: %d,used:%d\n", i, p->_vm[i].addr, p->_vm[i].len,p->_vm[i].used);
-                if (p->_vma->_vm[i].used)
-                {
-
-                    // 只对文件映射进行写回操作
-                    if (p->_vma->_vm[i].vfile != nullptr && p->_vma->_vm[i].flags == MAP_SHARED && (p->_vma->_vm[i].prot & PROT_WRITE) != 0)
-                    {
-                        p->_vma->_vm[i].vfile->write(p->_vma->_vm[i].addr, p->_vma->_vm[i].len);
-                    }
-
-                    // 只对文件映射释放文件引用
-                    if (p->_vma->_vm[i].vfile != nullptr)
-                    {
-                        p->_vma->_vm[i].vfile->free_file();
-                    }
-                    // 修复vmunmap调用：逐页检查并取消映射
-
-                    uint64 va_start = PGROUNDDOWN(p->_vma->_vm[i].addr);
-                    uint64 va_end = PGROUNDUP(p->_vma->_vm[i].addr + p->_vma->_vm[i].len);
-                    // printfMagenta("freeproc: unmapping vma %d, addr: %p, len: %d\n", i, p->_vm[i].addr, p->_vm[i].len);
-                    // uint64 npages = (va_end - va_start) / PGSIZE;
-
-                    // 逐页检查并取消映射，避免对未映射的页面进行操作
-                    for (uint64 va = va_start; va < va_end; va += PGSIZE)
-                    {
-                        mem::Pte pte = p->_pt.walk(va, 0);
-                        // printfCyan("freeproc: checking pte for va %p, pte: %p\n", va, pte.get_data());
-                        if (!pte.is_null() && pte.is_valid())
-                        {
-                            // 只对实际映射的页面进行取消映射
-                            mem::k_vmm.vmunmap(*p->get_pagetable(), va, 1, 1);
-                        }
-                    }
-                    p->_vma->_vm[i].used = 0;
-                }
-            }
+            _free_vma_entries(p->_vma, p->_pt);
             // 只有当VMA引用计数为0时才删除VMA
             delete p->_vma;
         }
@@ -345,10 +377,18 @@ namespace proc
         p->_pid = 0;
         p->_parent = 0;
         p->_name[0] = 0;
+        if (p->_cwd != nullptr)
+            p->_cwd->dput();
+        p->_cwd = nullptr;
         p->_chan = 0;
+        k_sleep_wq.remove(&p->_sleep_node);
+        k_futex_wq.remove(&p->_futex_node);
+        // 调用者可能持有 p->_lock，不能等回调；回调会看到进程已不在运行而放弃
+        tmm::k_twheel.del(&p->_itimer);
+        p->_itimer_interval = 0;
         p->_killed = 0;
         p->_xstate = 0;
-        p->_state = ProcState::UNUSED;
+        change_state(p, ProcState::UNUSED);
 
         // 线程相关
         p->_tid = 0;
@@ -438,6 +478,13 @@ namespace proc
 #endif
         mem::k_vmm.vmunmap(pt, TRAPFRAME, 1, 0);
         mem::k_vmm.vmunmap(pt, SIG_TRAMPOLINE, 1, 0);
+        // 共享页表的线程用过的各核 trapframe 槽位，别的线程还在用这张页表时留给它们
+        for (int c = 0; c < NCPU && pt.get_ref_count() <= 1; c++)
+        {
+            mem::Pte pte = pt.walk(TRAPFRAME_CPU(c), 0);
+            if (!pte.is_null() && pte.is_valid())
+                mem::k_vmm.vmunmap(pt, TRAPFRAME_CPU(c), 1, 0);
+        }
 #ifdef RISCV
         mem::k_vmm.vmfree(pt, sz);
 #elif LOONGARCH
@@ -486,7 +533,7 @@ namespace proc
         // safestrcpy(p->_cwd_name, "/", sizeof(p->_cwd_name));
         p->_cwd_name = "/";
 
-        p->_state = ProcState::RUNNABLE;
+        change_state(p, ProcState::RUNNABLE);
 
         p->_lock.release();
 
@@ -527,12 +574,45 @@ namespace proc
         // safestrcpy(p->_cwd_name, "/", sizeof(p->_cwd_name));
         p->_cwd_name = "/";
 
-        p->_state = ProcState::RUNNABLE;
+        change_state(p, ProcState::RUNNABLE);
 
         p->_lock.release();
 #endif
     }
 
+    Pcb *ProcessManager::create_kthread(const char *name, void (*fn)(void *), void *arg)
+    {
+        Pcb *p = alloc_proc();
+        if (p == nullptr)
+        {
+            panic("create_kthread: alloc_proc failed");
+            return nullptr;
+        }
+
+        // 内核线程不回到用户态，页表和 trapframe 只是 alloc_proc 顺带分配的
+        p->_context.ra = (uint64)_wrp_kthread_entry;
+        p->_kthread_fn = fn;
+        p->_kthread_arg = arg;
+        safestrcpy(p->_name, name, sizeof(p->_name));
+        p->_parent = nullptr; // 不挂在任何进程下面，也就不会被 wait 回收
+        p->_cwd_name = "/";
+
+        change_state(p, ProcState::RUNNABLE);
+
+        p->_lock.release();
+        return p;
+    }
+
+    void ProcessManager::kthread_entry()
+    {
+        Pcb *p = get_cur_pcb();
+        // 调度器切换过来时持有该进程的锁，与 fork_ret 一致
+        p->_lock.release();
+
+        p->_kthread_fn(p->_kthread_arg);
+        panic("kthread %s returned", p->_name);
+    }
+
     // Atomically release lock and sleep on chan.
     // Reacquires lock when awakened.
 
@@ -567,7 +647,7 @@ namespace proc
                 {
                     // 提前唤醒等待中的进程，
                     // 避免它永远睡着不被调度，也就永远无法响应 kill。
-                    p->_state = ProcState::RUNNABLE;
+                    change_state(p, ProcState::RUNNABLE);
                 }
 
                 p->_lock.release();
@@ -772,7 +852,6 @@ namespace proc
     // 这个函数主要用提供clone的底层支持
     Pcb *ProcessManager::fork(Pcb *p, uint64 flags, uint64 stack_ptr, uint64 ctid, bool is_clone3)
     {
-        TODO("copy on write fork");
         uint64 i;
         Pcb *np; // new proc
 
@@ -793,6 +872,8 @@ namespace proc
         _wait_lock.release();
 
         np->_cwd = p->_cwd;           // 继承当前工作目录
+        if (np->_cwd != nullptr)
+            np->_cwd->dget();
         np->_cwd_name = p->_cwd_name; // 继承当前工作目录名称
 
         // 为子进程设置名称，添加子进程标识
@@ -846,8 +927,10 @@ namespace proc
             // 共享虚拟内存：新进程共享父进程的页表
             np->_pt.share_from(p->_pt); // 共享父进程的页表
 
-            np->_vma = p->_vma;  // 继承父进程的虚拟内存区域映射
+            np->_vma = p->_vma; // 继承父进程的虚拟内存区域映射
+            p->_vma->_lock.acquire();
             p->_vma->_ref_cnt++; // 增加父进程的虚拟内存区域映射引用计数
+            p->_vma->_lock.release();
 
             // 在共享页表的情况下，需要标记为共享虚拟内存
             // 因为子进程有自己的trapframe，但共享父进程的页表
@@ -859,33 +942,30 @@ namespace proc
         }
         else
         {
+            // 复制页表和区域表期间，共享地址空间的其他线程不能改动区域或拆掉映射
+            p->_vma->_lock.acquire();
 #ifdef RISCV
-            if (mem::k_vmm.vm_copy(*curpt, *newpt, 0, p->_sz) < 0)
-            {
-                freeproc(np);
-                np->_lock.release();
-                return nullptr;
-            }
+            int rc = mem::k_vmm.vm_copy(*curpt, *newpt, 0, p->_sz, &p->_vma->_vm);
 #elif LOONGARCH
-            if (mem::k_vmm.vm_copy(*curpt, *newpt, p->elf_base, p->_sz - p->elf_base) < 0)
+            int rc = mem::k_vmm.vm_copy(*curpt, *newpt, p->elf_base, p->_sz - p->elf_base, &p->_vma->_vm);
+#endif
+            if (rc < 0)
             {
+                p->_vma->_lock.release();
                 freeproc(np);
                 np->_lock.release();
                 return nullptr;
             }
-#endif
-            for (i = 0; i < NVMA; ++i)
+            for (VmaTree::iterator it = p->_vma->_vm.begin(); it != p->_vma->_vm.end(); ++it)
             {
-                if (p->_vma->_vm[i].used)
+                np->_vma->_vm.insert(it->second);
+                // 只对文件映射增加引用计数
+                if (it->second.vfile != nullptr)
                 {
-                    memmove(&np->_vma->_vm[i], &p->_vma->_vm[i], sizeof(p->_vma->_vm[i]));
-                    // 只对文件映射增加引用计数
-                    if (p->_vma->_vm[i].vfile != nullptr)
-                    {
-                        p->_vma->_vm[i].vfile->dup(); // 增加引用计数
-                    }
+                    it->second.vfile->dup(); // 增加引用计数
                 }
             }
+            p->_vma->_lock.release();
         }
         
         // 处理信号处理共享
@@ -960,7 +1040,7 @@ namespace proc
                     np->_lock.release();
                     return nullptr;
                 }
-                printf("fork: stack_ptr: %p, entry_point: %p arg: %p\n", stack_ptr, entry_point, arg);
+                log_trace("fork: stack_ptr: %p, entry_point: %p arg: %p\n", stack_ptr, entry_point, arg);
 #ifdef RISCV
                 np->_trapframe->epc = entry_point; // 设置程序计数器为栈顶地址
 #elif LOONGARCH
@@ -993,7 +1073,7 @@ namespace proc
             np->_ctid = ctid;
         }
 
-        np->_state = ProcState::RUNNABLE;
+        change_state(np, ProcState::RUNNABLE);
 
         return np;
     }
@@ -1123,6 +1203,88 @@ namespace proc
             sleep(p, &_wait_lock);
         }
     }
+    /// @brief 预扫描 PT_LOAD 段，判断映像能否按需分页。
+    /// 缺页时按页从页缓存取内容，要求每个段的文件偏移与虚拟地址模页同余，
+    /// 且不同段不落在同一页里（否则一页的内容来自两个段）。
+    bool ProcessManager::_elf_demand_pageable(fs::dentry *de, uint64 phoff, int phnum)
+    {
+        if (de == nullptr || de->getNode() == nullptr || de->getNode()->pageCache() == nullptr)
+            return false;
+
+        elf::proghdr ph;
+        uint64 prev_end = 0;
+        int nload = 0;
+        for (int i = 0; i < phnum; i++, phoff += sizeof(ph))
+        {
+            de->getNode()->nodeRead(reinterpret_cast<uint64>(&ph), phoff, sizeof(ph));
+            if (ph.type != elf::elfEnum::ELF_PROG_LOAD)
+                continue;
+            if (ph.memsz < ph.filesz || ph.vaddr + ph.memsz < ph.vaddr)
+                return false; // 交给原来的加载路径报错
+            if ((ph.vaddr - ph.off) % PGSIZE != 0)
+                return false;
+            if (nload > 0 && PGROUNDDOWN(ph.vaddr) < prev_end)
+                return false;
+            prev_end = PGROUNDUP(ph.vaddr + ph.memsz);
+            nload++;
+        }
+        return nload > 0;
+    }
+
+    void ProcessManager::_elf_readahead(fs::dentry *de, uint64 phoff, int phnum)
+    {
+        // 只读各 PT_LOAD 段在文件里的部分，调试信息、符号表等不读；
+        // 特别大的映像只预读前 exec_readahead_max，其余随加载或缺页读入
+        elf::proghdr ph;
+        uint64 budget = exec_readahead_max;
+        for (int i = 0; i < phnum && budget > 0; i++, phoff += sizeof(ph))
+        {
+            de->getNode()->nodeRead(reinterpret_cast<uint64>(&ph), phoff, sizeof(ph));
+            if (ph.type != elf::elfEnum::ELF_PROG_LOAD || ph.filesz == 0)
+                continue;
+            uint64 len = MIN(ph.filesz, budget);
+            de->getNode()->readahead(ph.off, len);
+            budget -= len;
+        }
+    }
+
+    /// @brief 把一个 PT_LOAD 段登记为私有文件映射。[addr, addr+file_sz) 的内容来自文件，
+    /// 之后到段尾的部分（.bss）在缺页时填零；可写段的页缓存页以写时复制方式映射。
+    int ProcessManager::_add_elf_vma(Pcb::VMA *vt, fs::dentry *de, uint64 va, uint64 off, uint64 filesz, uint64 memsz, uint32 pflags)
+    {
+        vma v = {};
+        v.addr = PGROUNDDOWN(va);
+        v.len = PGROUNDUP(va + memsz) - v.addr;
+        if (pflags & elf::elfEnum::ELF_PROG_FLAG_READ)
+            v.prot |= PROT_READ;
+        if (pflags & elf::elfEnum::ELF_PROG_FLAG_WRITE)
+            v.prot |= PROT_WRITE;
+        if (pflags & elf::elfEnum::ELF_PROG_FLAG_EXEC)
+            v.prot |= PROT_EXEC;
+        if (v.prot == 0)
+            v.prot = PROT_READ; // 没有任何权限的段按 PROT_NONE 处理就无法访问了，段至少可读
+        v.flags = MAP_PRIVATE;
+        v.vfd = -1;
+        v.vfile = new fs::normal_file(de);
+        v.offset = off - (va - v.addr);
+        v.file_sz = (va - v.addr) + filesz;
+        v.max_len = v.len;
+        v.is_expandable = 0;
+        if (vt->_vm.insert(v) == nullptr)
+        {
+            v.vfile->free_file();
+            return -1;
+        }
+        return 0;
+    }
+
+    void ProcessManager::_abort_exec(mem::PageTable &pt, uint64 sz, Pcb::VMA *vma)
+    {
+        _free_vma_entries(vma, pt);
+        delete vma;
+        proc_freepagetable(pt, sz);
+    }
+
     /// @brief 将指定文件中的一段内容加载到页表映射的虚拟内存中。
     ///
     /// 此函数用于将文件 `de` 中从 `offset` 开始的 `size` 字节数据，
@@ -1135,7 +1297,10 @@ namespace proc
     /// @param de  指向文件的目录项，用于读取文件数据。
     /// @param offset 文件中读取的起始偏移。
     /// @param size 要读取的总字节数。
-    /// @return 总是返回 0，失败情况下内部直接 panic。
+    /// @return 成功返回 0，读取失败返回 -1。
+    ///
+    /// 文件支持页缓存时，段内完整且与文件页对齐的页不再拷贝，而是把 vmalloc 分配的页换成
+    /// 页缓存页：只读段直接共享，可写段以写时复制方式映射。首尾不完整的页仍然拷贝。
     int ProcessManager::load_seg(mem::PageTable &pt, uint64 va, fs::dentry *de, uint offset, uint size)
     { // 好像没有机会返回 -1, pa失败的话会panic，de的read也没有返回值
         uint i, n;
@@ -1158,8 +1323,25 @@ namespace proc
         // printfRed("[load_seg] load va: %p, size: %d\n", va, size);
         // printfRed("[load_seg] i: %d, offset: %d\n", i, offset);
 
+        fs::PageCache *pcache = de->getNode()->pageCache();
         for (; i < size; i += PGSIZE) // 此时 va + i 地址是页对齐的
         {
+            if (pcache != nullptr && size - i >= PGSIZE && (offset + i) % PGSIZE == 0)
+            {
+                void *cpa = pcache->get_page((offset + i) / PGSIZE);
+                if (cpa != nullptr)
+                {
+                    uint64 flags = pt.walk(va + i, 0).get_flags();
+                    mem::k_vmm.vmunmap(pt, va + i, 1, 1);
+                    if (mem::k_vmm.map_shared_page(pt, va + i, cpa, flags, (flags & PTE_W) != 0) < 0)
+                    {
+                        mem::k_pmm.free_page(cpa);
+                        return -1;
+                    }
+                    continue;
+                }
+            }
+
             // printf("[load_seg] va + i: %p\n", va + i);
             pa = PTE2PA((uint64)pt.walk(va + i, 0).get_data()); // pte.to_pa() 得到的地址是页对齐的
             // printf("[load_seg] pa: %p\n", pa);
@@ -1188,6 +1370,10 @@ namespace proc
 
         if (p == _init_proc)
             panic("init exiting"); // 保护机制：init 进程不能退出
+
+        // 此时还未持有任何锁，可以等待正在执行的 SIGALRM 回调结束
+        tmm::k_twheel.del_sync(&p->_itimer);
+        p->_itimer_interval = 0;
         // log_info( "exit proc %d", p->_pid );
 
         _wait_lock.acquire();
@@ -1206,7 +1392,7 @@ namespace proc
 
         p->_lock.acquire();
         p->_xstate = state << 8;       // 存储退出状态（通常高字节存状态）
-        p->_state = ProcState::ZOMBIE; // 标记为 zombie，等待父进程回收
+        change_state(p, ProcState::ZOMBIE); // 标记为 zombie，等待父进程回收
 
         _wait_lock.release();
         //    printf("[exit_proc] proc %s pid %d exiting with state %d\n", p->_name, p->_pid, state);
@@ -1237,7 +1423,7 @@ namespace proc
     void ProcessManager::exit(int state)
     {
         Pcb *p = get_cur_pcb();
-        printf("[exit] proc %s pid %d exiting with state %d\n", p->_name, p->_pid, state);
+        log_trace("[exit] proc %s pid %d exiting with state %d\n", p->_name, p->_pid, state);
         exit_proc(p, state);
     }
 
@@ -1291,7 +1477,11 @@ namespace proc
                 stk_ptr--;
                 if (need_chp)
                 {
-                    freeproc(tp);
+                    // 正在别的核上运行的进程不能就地回收，让它在下一次陷入时自己退出
+                    if (tp->_state == ProcState::RUNNING)
+                        tp->kill();
+                    else
+                        freeproc(tp);
                 }
             }
         }
@@ -1312,60 +1502,115 @@ namespace proc
         // so it's okay to release lk.
         // printfCyan("[sleep]proc %s : sleep on chan: %p\n", p->_name, chan);
         p->_lock.acquire();
+        // 先入队再放开 lk：唤醒方在 lk 下修改条件后一定能在队列中找到本进程，
+        // 随后阻塞在 p->_lock 上直到本进程真正切换出去
+        p->_chan = chan;
+        k_sleep_wq.insert(&p->_sleep_node, chan);
         lock->release();
         // go to sleep
-        p->_chan = chan;
-        p->_state = ProcState::SLEEPING;
+        change_state(p, ProcState::SLEEPING);
         k_scheduler.call_sched();
         p->_chan = 0;
+        k_sleep_wq.remove(&p->_sleep_node);
 
         p->_lock.release();
         lock->acquire();
     }
+    /// @brief 定时器回调：唤醒 t->data 指向的进程。只在对应的 sleep_until 期间挂在时间轮上，
+    /// 所以此时进程若在睡眠，睡的就是那一次
+    void ProcessManager::wake_on_timer(tmm::Timer *t)
+    {
+        Pcb *p = (Pcb *)t->data;
+        p->_lock.acquire();
+        if (p->_state == ProcState::SLEEPING)
+            k_pm.change_state(p, ProcState::RUNNABLE);
+        p->_lock.release();
+    }
+    /// @brief 与 sleep 相同，但最迟在 tick 数到达 expires 时被唤醒
+    /// @param chan 为 nullptr 时只等超时（仍可能被信号以外的原因提前唤醒，调用者需循环检查条件）
+    /// @return 醒来时是否已经超时
+    bool ProcessManager::sleep_until(void *chan, SpinLock *lock, uint64 expires)
+    {
+        Pcb *p = get_cur_pcb();
+        tmm::Timer t;
+        t.init(wake_on_timer, p);
+        if (chan == nullptr)
+            chan = &t;
+        tmm::k_twheel.add(&t, expires);
+
+        p->_lock.acquire();
+        // 回调要拿 p->_lock，在这里检查就不会错过它：要么已经到期不必睡，要么回调一定看到 SLEEPING
+        if (tmm::k_twheel.jiffies() < expires)
+        {
+            p->_chan = chan;
+            k_sleep_wq.insert(&p->_sleep_node, chan);
+            lock->release();
+            change_state(p, ProcState::SLEEPING);
+            k_scheduler.call_sched();
+            p->_chan = 0;
+            k_sleep_wq.remove(&p->_sleep_node);
+            p->_lock.release();
+        }
+        else
+        {
+            p->_lock.release();
+            lock->release();
+        }
+
+        // 回调要拿 p->_lock，必须在放掉它之后再等回调结束
+        tmm::k_twheel.del_sync(&t);
+        lock->acquire();
+        return tmm::k_twheel.jiffies() >= expires;
+    }
     void ProcessManager::wakeup(void *chan)
     {
-        Pcb *p;
+        Pcb *waiters[num_process];
+        Pcb *cur = get_cur_pcb();
+        int n = k_sleep_wq.collect(chan, waiters, num_process);
 
-        for (p = k_proc_pool; p < &k_proc_pool[num_process]; p++)
+        for (int i = 0; i < n; i++)
         {
-            if (p != k_pm.get_cur_pcb() && p->_state != ProcState::UNUSED)
+            Pcb *p = waiters[i];
+            if (p == cur)
+                continue;
+            p->_lock.acquire();
+            // 收集之后可能已被别处唤醒，需在 p->_lock 下复核
+            if (p->_state == ProcState::SLEEPING && p->_chan == chan)
             {
-                p->_lock.acquire();
-                if (p->_state == ProcState::SLEEPING && p->_chan == chan)
-                {
-                    p->_state = ProcState::RUNNABLE;
-                }
-                p->_lock.release();
+                change_state(p, ProcState::RUNNABLE);
             }
+            p->_lock.release();
         }
     }
     int ProcessManager::wakeup2(uint64 uaddr, int val, void *uaddr2, int val2)
     {
-        Pcb *p;
+        Pcb *waiters[num_process];
         int count1 = 0, count2 = 0;
-        for (p = k_proc_pool; p < &k_proc_pool[num_process]; p++)
+        int n = k_futex_wq.collect((void *)uaddr, waiters, num_process);
+
+        for (int i = 0; i < n; i++)
         {
+            if (count1 >= val && count2 >= val2)
+                break;
+            Pcb *p = waiters[i];
             p->_lock.acquire();
             if (p->_state == SLEEPING && (uint64)p->_futex_addr == uaddr)
             {
                 if (count1 < val)
                 {
                     // printf("[wakeup2] proc %s pid %d waking up on uaddr: %p\n", p->_name, p->_pid, uaddr);
-                    p->_state = RUNNABLE;
+                    change_state(p, RUNNABLE);
                     p->_futex_addr = 0;
+                    k_futex_wq.remove(&p->_futex_node);
                     count1++;
                 }
                 else if (uaddr2 && count2 < val2)
                 {
+                    // FUTEX_REQUEUE：换到 uaddr2 的桶上继续等待
                     p->_futex_addr = uaddr2;
+                    k_futex_wq.insert(&p->_futex_node, uaddr2);
                     count2++;
                 }
-
-                if (count1 >= val && count2 >= val2)
-                {
-                    p->_lock.release();
-                    break;
-                }
             }
             p->_lock.release();
         }
@@ -1393,7 +1638,9 @@ namespace proc
             fs::FileAttrs attrs;
             attrs.filetype = fs::FileTypes::FT_DIRECT;
             attrs._value = 0777;
-            if ((dentry = par_->EntryCreate(path_.rFileName(), attrs)) == nullptr)
+            dentry = par_->EntryCreate(path_.rFileName(), attrs);
+            par_->dput();
+            if (dentry == nullptr)
             {
                 printf("Error creating new dentry %s failed\n", path_.rFileName());
                 return -1;
@@ -1401,6 +1648,7 @@ namespace proc
         }
         if (dentry == nullptr)
             return -1;
+        dentry->dput();
         return 0;
     }
     /// @brief
@@ -1435,22 +1683,12 @@ namespace proc
         dentry = path_.pathSearch(); // 查找路径对应的 dentry（目录项）
         // printfBlue("[open] path: %s, dentry: %p, flags: %x\n", path_.AbsolutePath().c_str(), dentry, flags);
         if (path == "") // empty path
-            return -1;
-
-        if (path[0] == '.' && path[1] == '/')
-            path = path.substr(2); // 处理./xxxx的情况
-        // 如果 dentry 存在但处于“已删除但未关闭”状态
-        if (dentry != nullptr && fs::k_file_table.has_unlinked(path))
         {
-            if (flags & O_CREAT)
-            {
-                fs::k_file_table.remove(path);
-            }
-            else
-            {
-                return -1;
-            }
+            if (dentry != nullptr)
+                dentry->dput();
+            return -1;
         }
+
         // dentry 不存在但设置了 O_CREAT，尝试创建文件
         if (dentry == nullptr && flags & O_CREAT)
         {
@@ -1464,8 +1702,10 @@ namespace proc
                 attrs.filetype = fs::FileTypes::FT_DIRECT;
             else
                 attrs.filetype = fs::FileTypes::FT_NORMAL;
-            attrs._value = 0777;                                                   // 默认权限
-            if ((dentry = par_->EntryCreate(path_.rFileName(), attrs)) == nullptr) // 创建文件
+            attrs._value = 0777;                                   // 默认权限
+            dentry = par_->EntryCreate(path_.rFileName(), attrs); // 创建文件
+            par_->dput();
+            if (dentry == nullptr)
             {
                 printf("Error creating new dentry %s failed\n", path_.rFileName());
                 return -1;
@@ -1480,12 +1720,14 @@ namespace proc
         if (dev >= 0) // dentry is a device
         {
             fs::device_file *f = new fs::device_file(attrs, dev, dentry);
+            dentry->dput(); // 文件对象自己持有一份引用
             return alloc_fd(p, f);
         } // else if( attrs.filetype == fs::FileTypes::FT_DIRECT)
         // 	fs::directory *f = new fs::directory( attrs, dentry );
         else // 否则为普通文件，创建 normal_file 对象
         {
             fs::normal_file *f = new fs::normal_file(attrs, dentry);
+            dentry->dput(); // 文件对象自己持有一份引用
             // log_info( "test normal file read" );
             // {
             // 	fs::file *ff = ( fs::file * ) f;
@@ -1494,6 +1736,8 @@ namespace proc
             // 	buf[ 8 ] = 0;
             // 	printf( "%s\n", buf );
             // }
+            if ((flags & O_TRUNC) && attrs.filetype == fs::FileTypes::FT_NORMAL)
+                f->truncate(0);
             if (flags & O_APPEND)
                 f->setAppend();
             return alloc_fd(p, f);
@@ -1552,6 +1796,9 @@ namespace proc
         // dentry = p->_cwd->EntrySearch( path );
         if (dentry == nullptr)
             return -1;
+        // 查找结果自带的引用直接转给 cwd
+        if (p->_cwd != nullptr)
+            p->_cwd->dput();
         p->_cwd = dentry;
         p->_cwd_name = pt.AbsolutePath();
         if (p->_cwd_name.back() != '/')
@@ -1581,7 +1828,7 @@ namespace proc
     /// @return
     void *ProcessManager::mmap(void *addr, int length, int prot, int flags, int fd, int offset)
     {
-        printfYellow("[mmap] addr: %p, length: %d, prot: %d, flags: %d, fd: %d, offset: %d\n",
+        log_debug("[mmap] addr: %p, length: %d, prot: %d, flags: %d, fd: %d, offset: %d\n",
                      addr, length, prot, flags, fd, offset);
         uint64 err = 0xffffffffffffffff;
         fs::normal_file *vfile = nullptr;
@@ -1620,152 +1867,209 @@ namespace proc
         //     length = 10 * PGSIZE; // 默认映射10页
         // }
 
-        // MAP_FIXED 的处理应该在 VMA 分配中进行，而不是直接返回地址
+        bool fixed = (flags & MAP_FIXED) && addr != nullptr;
 
-        for (int i = 0; i < NVMA; ++i)
+        vma v = {};
+        v.flags = flags;
+        v.prot = prot;
+        v.vfile = vfile; // 对于匿名映射，这里是nullptr
+        v.vfd = fd;      // 对于匿名映射，这里是-1
+        v.offset = offset;
+        v.file_sz = 0;
+        v.is_expandable = 0;
+        if (fd == -1) // 匿名映射
         {
-            if (p->_vma->_vm[i].used == 0) // 找到一个空闲的虚拟内存区域
-            {
-                p->_vma->_vm[i].used = 1;
+            // MAP_FIXED 只能使用指定区域，其余至少映射10页
+            v.len = fixed ? length : MAX(length, 10 * PGSIZE);
+        }
+        else
+        {
+            v.len = length; // 文件映射保持原样
+            v.file_sz = PGROUNDUP(length);
+        }
 
-                // 处理 MAP_FIXED 标志
-                if (flags & MAP_FIXED && addr != nullptr)
-                {
-                    // MAP_FIXED 要求在指定地址进行映射
-                    p->_vma->_vm[i].addr = (uint64)addr;
-                    printfCyan("[mmap] MAP_FIXED mapping at specified address %p\n", addr);
-                }
-                else
-                {
-                    // 正常情况下，在进程当前大小之后分配
-                    p->_vma->_vm[i].addr = p->_sz;
-                }
+        if (fixed && (uint64)addr % PGSIZE != 0)
+            return (void *)err;
 
-                p->_vma->_vm[i].flags = flags;
-                p->_vma->_vm[i].prot = prot;
-                p->_vma->_vm[i].vfile = vfile; // 对于匿名映射，这里是nullptr
-                p->_vma->_vm[i].vfd = fd;      // 对于匿名映射，这里是-1
-                p->_vma->_vm[i].offset = offset;
+        // 选地址到插入区域要在同一把锁里，免得两个线程选中同一段空洞
+        p->_vma->_lock.acquire();
+        if (fixed)
+        {
+            // MAP_FIXED 要求在指定地址进行映射，覆盖这段地址上原有的映射
+            v.addr = (uint64)addr;
+            _unmap_range(p, v.addr, PGROUNDUP(v.addr + v.len));
+            printfCyan("[mmap] MAP_FIXED mapping at specified address %p\n", addr);
+        }
+        else
+        {
+            // 正常情况下，在进程当前大小之后找第一段空闲的地址
+            v.addr = p->_vma->_vm.find_free(p->_sz, PGROUNDUP(v.len), MAXVA - PGSIZE);
+            if (v.addr == 0)
+            {
+                p->_vma->_lock.release();
+                return (void *)err;
+            }
+        }
+        v.max_len = v.len;
+        if (fd == -1 && !fixed)
+            v.max_len = MAXVA - v.addr; // 设置最大可扩展大小
 
-                if (fd == -1) // 匿名映射
-                {
-                    // 设置初始大小为请求大小
-                    printfCyan("[mmap] anonymous mapping at %p, length: %d, prot: %d, flags: %d\n",
-                               (void *)p->_vma->_vm[i].addr, length, prot, flags);
-                    p->_vma->_vm[i].is_expandable = 0;              // 可扩展
-                    p->_vma->_vm[i].len = MAX(length, 10 * PGSIZE); // 至少10页
+        if (fd == -1)
+            printfCyan("[mmap] anonymous mapping at %p, length: %d, prot: %d, flags: %d\n",
+                       (void *)v.addr, length, prot, flags);
 
-                    if (flags & MAP_FIXED)
-                    {
-                        // MAP_FIXED 不扩展最大长度，只能使用指定区域
-                        p->_vma->_vm[i].len = length; // 使用指定长度
-                        p->_vma->_vm[i].addr = (uint64)addr;
-                        p->_vma->_vm[i].max_len = p->_vma->_vm[i].len;
-                        p->_vma->_vm[i].is_expandable = 0; // MAP_FIXED 通常不可扩展
-                    }
-                    else
-                    {
-                        p->_vma->_vm[i].max_len = MAXVA - p->_sz; // 设置最大可扩展大小
-                    }
-                }
-                else
-                {
-                    p->_vma->_vm[i].len = length; // 文件映射保持原样
-                    p->_vma->_vm[i].max_len = length;
-                    // printfCyan("[mmap] file mapping at %p, length: %d, prot: %d, flags: %d, fd: %d\n",
-                    //            (void *)p->_vma->_vm[i].addr, length, prot, flags, fd);
-                    vfile->dup(); // 只对文件映射增加引用计数
-                }
+        if (p->_vma->_vm.insert(v) == nullptr)
+        {
+            p->_vma->_lock.release();
+            return (void *)err;
+        }
+        if (vfile != nullptr)
+            vfile->dup(); // 只对文件映射增加引用计数
 
-                // 只有非 MAP_FIXED 的映射才更新 p->_sz
-                if (!(flags & MAP_FIXED))
-                {
-                    p->_sz += p->_vma->_vm[i].len; // 扩展进程的虚拟内存空间
-                }
-                else
-                {
-                    // MAP_FIXED 可能需要更新 p->_sz 为更大的值
-                    uint64 end_addr = p->_vma->_vm[i].addr + p->_vma->_vm[i].len;
-                    if (end_addr > p->_sz)
-                    {
-                        p->_sz = end_addr;
-                    }
-                }
+        // 进程大小要覆盖所有映射，fork 按它复制页表
+        if (v.addr + v.len > p->_sz)
+            p->_sz = v.addr + v.len;
+        p->_vma->_lock.release();
+
+        return (void *)v.addr; // 返回映射的虚拟地址
+    }
 
-                return (void *)p->_vma->_vm[i].addr; // 返回映射的虚拟地址
+    void ProcessManager::_unmap_range(Pcb *p, uint64 start, uint64 end)
+    {
+        VmaTree &t = p->_vma->_vm;
+        vma *v;
+        while ((v = t.find_intersect(start, end)) != nullptr)
+        {
+            // 只去掉落在 [start, end) 里的部分，两头露在外面的切下来保留
+            if (v->addr < start)
+            {
+                v = t.split(v, start);
+                continue;
             }
+            if (v->addr + v->len > end)
+                t.split(v, end);
+
+            // 共享文件映射直接映射页缓存页，解除映射不必写回：ramfs 的页缓存就是文件内容本身，
+            // ext4 驱动只读没有写回路径，脏页留在缓存里不被回收。没有页缓存的文件退回私有拷贝，写入不会回到文件
+            _unmap_present(p->_pt, PGROUNDDOWN(v->addr), PGROUNDUP(v->addr + v->len));
+            if (v->vfile != nullptr)
+                v->vfile->free_file();
+            t.erase(v);
         }
-        return (void *)err;
     }
+
     int ProcessManager::munmap(void *addr, int length)
     {
-
-        int i;
         Pcb *p = get_cur_pcb();
+        uint64 start = (uint64)addr;
+        if (start % PGSIZE != 0 || length <= 0)
+            return -1;
 
-        for (i = 0; i < NVMA; ++i)
-        {
-            if (p->_vma->_vm[i].used && p->_vma->_vm[i].len >= length)
+        // 可以是某个区域的开头、结尾、中间，也可以横跨多个区域
+        p->_vma->_lock.acquire();
+        _unmap_range(p, start, PGROUNDUP(start + length));
+        p->_vma->_lock.release();
+        return 0;
+    }
+
+    void ProcessManager::mprotect_vma(uint64 addr, uint64 len, int prot)
+    {
+        Pcb *p = get_cur_pcb();
+        VmaTree &t = p->_vma->_vm;
+        uint64 a = PGROUNDDOWN(addr);
+        uint64 end = PGROUNDUP(addr + len);
+        vma *v;
+        p->_vma->_lock.acquire();
+        while ((v = t.find_intersect(a, end)) != nullptr)
+        {
+            // 权限不变的区域不用切
+            if (v->prot == prot)
             {
-                // 根据提示，munmap的地址范围只能是
-                // 1. 起始位置
-                if (p->_vma->_vm[i].addr == (uint64)addr)
-                {
-                    p->_vma->_vm[i].addr += length;
-                    p->_vma->_vm[i].len -= length;
-                    break;
-                }
-                // 2. 结束位置
-                if ((uint64)(addr) + length == p->_vma->_vm[i].addr + p->_vma->_vm[i].len)
-                {
-                    p->_vma->_vm[i].len -= length;
-                    break;
-                }
+                a = v->addr + v->len;
+                continue;
             }
-        }
-        if (i == NVMA)
-            return -1;
+            if (v->addr < a)
+                v = t.split(v, a);
+            if (v->addr + v->len > end)
+                t.split(v, end);
+            v->prot = prot;
+            a = v->addr + v->len;
+            t.try_merge(v);
+        }
+        p->_vma->_lock.release();
+    }
 
-        ///@TODO: 此处注释了就能过，但是supposed to 写回的，暂时处理不了那个write
-        ///@details 所以其实不用管，munmap和mmap两个点都能过。
-        // // 将MAP_SHARED页面写回文件系统
-        // if (p->_vma->_vm[i].flags == MAP_SHARED && (p->_vma->_vm[i].prot & PROT_WRITE) != 0)
-        // {
-        //     // printfRed("[munmap?]: walkaddr :%p\n",(p->_pt.walk_addr((uint64)addr)));
-        //     p->_vma->_vm[i].vfile->write((uint64)addr, length);
-        // }
-        uint64 va_start = PGROUNDDOWN((uint64)addr);
-        uint64 va_end = PGROUNDUP((uint64)addr + length);
-        // 逐页检查并取消映射，避免对未映射的页面进行操作
-        for (uint64 va = va_start; va < va_end; va += PGSIZE)
+    void *ProcessManager::mremap(void *old_addr, uint64 old_size, uint64 new_size, int flags)
+    {
+        Pcb *p = get_cur_pcb();
+        p->_vma->_lock.acquire();
+        void *ret = _mremap(p, old_addr, old_size, new_size, flags);
+        p->_vma->_lock.release();
+        return ret;
+    }
+
+    void *ProcessManager::_mremap(Pcb *p, void *old_addr, uint64 old_size, uint64 new_size, int flags)
+    {
+        uint64 err = 0xffffffffffffffff;
+        VmaTree &t = p->_vma->_vm;
+        uint64 start = (uint64)old_addr;
+
+        old_size = PGROUNDUP(old_size);
+        new_size = PGROUNDUP(new_size);
+        if (start % PGSIZE != 0 || new_size == 0 || new_size > 0x7fffffff || (flags & MREMAP_FIXED))
+            return (void *)err;
+
+        vma *v = t.find(start);
+        if (v == nullptr || start + old_size > PGROUNDUP(v->addr + v->len))
+            return (void *)err;
+        uint64 old_end = start + old_size;
+
+        // 缩小：直接去掉尾部
+        if (new_size <= old_size)
         {
-            mem::Pte pte = p->_pt.walk(va, 0);
-            // printfCyan("freeproc: checking pte for va %p, pte: %p\n", va, pte.get_data());
-            if (!pte.is_null() && pte.is_valid())
-            {
-                // 只对实际映射的页面进行取消映射
-                mem::k_vmm.vmunmap(*p->get_pagetable(), va, 1, 1);
-            }
+            _unmap_range(p, start + new_size, old_end);
+            return old_addr;
         }
-        p->_vma->_vm[i].used = 0;
-        // 判断此页面是否存在映射
 
-        // 当前VMA中全部映射都被取消
-        if (p->_vma->_vm[i].len == 0)
+        // 原地扩展：这段正好是区域的结尾，后面的地址又没人用
+        bool whole_file = v->vfile != nullptr && v->file_sz >= PGROUNDUP(v->addr + v->len) - v->addr;
+        if (old_end == PGROUNDUP(v->addr + v->len) && start + new_size <= MAXVA - PGSIZE &&
+            t.find_intersect(old_end, start + new_size) == nullptr)
         {
-            /// TODO:此处我没找到对应xv6的fileclose，找了个最类似的函数用上
-            /// 也许这个free_file()是对的
-            /// commented by @gkq
-            // 只对文件映射释放文件引用
-            if (p->_vma->_vm[i].vfile != nullptr)
-            {
-                p->_vma->_vm[i].vfile->free_file();
-            }
-            p->_vma->_vm[i].used = 0;
+            v->len = start + new_size - v->addr;
+            if (v->max_len < (uint64)v->len)
+                v->max_len = v->len;
+            if (whole_file)
+                v->file_sz = v->len;
+            if (start + new_size > p->_sz)
+                p->_sz = start + new_size;
+            return old_addr;
         }
 
-        return 0;
+        if (!(flags & MREMAP_MAYMOVE))
+            return (void *)err;
+
+        uint64 na = t.find_free(p->_sz, new_size, MAXVA - PGSIZE);
+        if (na == 0)
+            return (void *)err;
+
+        // 先把 [start, old_end) 切成独立的区域，连同已经建立的页一起挪到新地址
+        if (v->addr < start)
+            v = t.split(v, start);
+        if (v->addr + v->len > old_end)
+            t.split(v, old_end);
+        if (mem::k_vmm.move_pages(p->_pt, start, na, old_size / PGSIZE) < 0)
+            return (void *)err;
+        v = t.move(v, na);
+        v->len = new_size;
+        v->max_len = new_size;
+        if (whole_file)
+            v->file_sz = new_size;
+        if (na + new_size > p->_sz)
+            p->_sz = na + new_size;
+        return (void *)na;
     }
+
     /// @brief 从当前工作目录中删除指定路径的文件或目录项。
     /// @param fd 基准目录的文件描述符，若为 -100 表示以当前工作目录为基准（AT_FDCWD）。其他值暂不支持。
     /// @param path 要删除的文件或目录的相对路径，不能为空字符串，支持"./"开头的路径格式。
@@ -1782,7 +2086,14 @@ namespace proc
             if (path[0] == '.' && path[1] == '/')
                 path = path.substr(2);
 
-            return fs::k_file_table.unlink(path);
+            // 目录项换成负目录项，之后的查找直接失败；已经打开的文件仍持有原目录项
+            fs::Path pt(path);
+            fs::dentry *den = pt.pathSearch();
+            if (den == nullptr)
+                return -1;
+            den->unlink();
+            den->dput();
+            return 0;
         }
         else
         {
@@ -1867,6 +2178,17 @@ namespace proc
     }
 
     int ProcessManager::execve(eastl::string path, eastl::vector<eastl::string> argv, eastl::vector<eastl::string> envs)
+    {
+        // 路径查找得到的目录项都带着引用，_execve 无论从哪个分支返回，都在这里统一放掉
+        fs::dentry *held[2] = {nullptr, nullptr};
+        int ret = _execve(path, argv, envs, held);
+        for (fs::dentry *d : held)
+            if (d != nullptr)
+                d->dput();
+        return ret;
+    }
+
+    int ProcessManager::_execve(eastl::string path, eastl::vector<eastl::string> argv, eastl::vector<eastl::string> envs, fs::dentry *held[2])
     {
         // printfRed("execve: %s\n", path.c_str());
         // 获取当前进程控制块
@@ -1900,7 +2222,7 @@ namespace proc
         else
             ab_path = proc->_cwd_name + path; // 相对路径，添加当前工作目录前缀
 
-        printfRed("execve file : %s\n", ab_path.c_str());
+        log_debug("execve file : %s\n", ab_path.c_str());
 
         // 解析路径并查找文件
         fs::Path path_resolver(ab_path);
@@ -1909,6 +2231,7 @@ namespace proc
             printfRed("execve: cannot find file");
             return -1;
         }
+        held[0] = de;
 
         // 读取ELF文件头，验证文件格式
         de->getNode()->nodeRead(reinterpret_cast<uint64>(&elf), 0, sizeof(elf));
@@ -1939,6 +2262,10 @@ namespace proc
         // int new_sec_cnt = 0;                         // 新程序段计数
         // psd_t new_sec_desc[max_program_section_num]; // 新程序段描述符数组
 
+        // 新映像的 VMA 表，按需分页的 ELF 段登记在这里，替换进程映像时才装上
+        Pcb::VMA *new_vma = new Pcb::VMA();
+        new_vma->_ref_cnt = 1;
+
         // ========== 第三阶段：加载ELF程序段 ==========
         uint64 phdr = 0;
         {
@@ -1973,9 +2300,11 @@ namespace proc
                         printfBlue("execve: using riscv64 dynamic linker\n");
                         fs::Path path_resolver_interp("/mnt/glibc/lib/ld-linux-riscv64-lp64d.so.1");
                         interp_de = path_resolver_interp.pathSearch();
+                        held[1] = interp_de;
                         if (interp_de == nullptr)
                         {
                             printfRed("execve: failed to find riscv64 dynamic linker\n");
+                            _abort_exec(new_pt, new_sz, new_vma);
                             return -1;
                         }
                     }
@@ -1984,9 +2313,11 @@ namespace proc
                         printfBlue("execve: using loongarch64 dynamic linker\n");
                         fs::Path path_resolver_interp("/mnt/glibc/lib/ld-linux-loongarch-lp64d.so.1");
                         interp_de = path_resolver_interp.pathSearch();
+                        held[1] = interp_de;
                         if (interp_de == nullptr)
                         {
                             printfRed("execve: failed to find loongarch64 dynamic linker\n");
+                            _abort_exec(new_pt, new_sz, new_vma);
                             return -1;
                         }
                     }
@@ -1995,9 +2326,11 @@ namespace proc
                         printfBlue("execve: using loongarch dynamic linker\n");
                         fs::Path path_resolver_interp("/mnt/musl/lib/libc.so");
                         interp_de = path_resolver_interp.pathSearch();
+                        held[1] = interp_de;
                         if (interp_de == nullptr)
                         {
                             printfRed("execve: failed to find loongarch musl linker\n");
+                            _abort_exec(new_pt, new_sz, new_vma);
                             return -1;
                         }
                     }
@@ -2006,15 +2339,23 @@ namespace proc
                         printfBlue("execve: using riscv64 sf dynamic linker\n");
                         fs::Path path_resolver_interp("/mnt/musl/lib/libc.so");
                         interp_de = path_resolver_interp.pathSearch();
+                        held[1] = interp_de;
                         if (interp_de == nullptr)
                         {
                             printfRed("execve: failed to find riscv64 musl linker\n");
+                            _abort_exec(new_pt, new_sz, new_vma);
                             return -1;
                         }
                     }
                     break;
                 }
             }
+            // 段布局允许时按需分页：只登记 VMA，页面在第一次访问时从页缓存映射进来
+            bool lazy = _elf_demand_pageable(de, elf.phoff, elf.phnum);
+            // 先对各段发出异步预读：立即加载时逐段读大多命中缓存，按需分页时缺页也大多命中缓存。
+            // 预读只填页缓存，不建立任何映射
+            _elf_readahead(de, elf.phoff, elf.phnum);
+
             // 遍历所有程序头，加载LOAD类型的段
             for (i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph))
             {
@@ -2054,10 +2395,23 @@ namespace proc
                     }
                     elf_start = ph.vaddr; // 记录第一个LOAD段的起始地址
                     new_sz = elf_start;
-                    printfGreen("execve: start_vaddr set to %p\n", (void *)elf_start);
+                    log_trace("execve: start_vaddr set to %p\n", (void *)elf_start);
                 }
 #endif
 
+                if (lazy)
+                {
+                    if (_add_elf_vma(new_vma, de, ph.vaddr, ph.off, ph.filesz, ph.memsz, ph.flags) < 0)
+                    {
+                        printfRed("execve: segment overlaps another mapping\n");
+                        load_bad = true;
+                        break;
+                    }
+                    if (ph.vaddr + ph.memsz > new_sz)
+                        new_sz = ph.vaddr + ph.memsz;
+                    continue;
+                }
+
                 // 分配虚拟内存空间
                 uint64 sz1;
                 uint64 seg_flag = PTE_U; // User可访问标志
@@ -2080,7 +2434,7 @@ namespace proc
 #endif
                 // printfRed("execve: loading segment %d, type: %d, startva: %p, endva: %p, memsz: %p, filesz: %p, flags: %d\n", i, ph.type, (void *)ph.vaddr, (void *)(ph.vaddr + ph.memsz), (void *)ph.memsz, (void *)ph.filesz, ph.flags);
 #ifdef RISCV
-                printf("[exec] map from %p to %p new_pt base %p\n", (void *)(new_sz), (void *)(ph.vaddr + ph.memsz), new_pt.get_base());
+                log_trace("[exec] map from %p to %p new_pt base %p\n", (void *)(new_sz), (void *)(ph.vaddr + ph.memsz), new_pt.get_base());
                 if ((sz1 = mem::k_vmm.vmalloc(new_pt, new_sz, ph.vaddr + ph.memsz, seg_flag)) == 0)
                 {
                     printfRed("execve: uvmalloc\n");
@@ -2110,7 +2464,7 @@ namespace proc
                 // 从文件加载段内容到内存
                 if (load_seg(new_pt, ph.vaddr, de, ph.off, ph.filesz) < 0)
                 {
-                    printf("execve: load_icode\n");
+                    log_trace("execve: load_icode\n");
                     load_bad = true;
                     break;
                 }
@@ -2119,7 +2473,7 @@ namespace proc
             if (load_bad)
             {
                 // printfRed("execve: load segment failed\n");
-                k_pm.proc_freepagetable(new_pt, new_sz);
+                _abort_exec(new_pt, new_sz, new_vma);
                 return -1;
             }
 
@@ -2128,7 +2482,7 @@ namespace proc
                 if (interp_de == nullptr)
                 {
                     printfRed("execve: cannot find dynamic linker: %s\n", interpreter_path.c_str());
-                    k_pm.proc_freepagetable(new_pt, new_sz);
+                    _abort_exec(new_pt, new_sz, new_vma);
                     return -1;
                 }
 
@@ -2138,13 +2492,17 @@ namespace proc
                 if (interp_elf.magic != elf::elfEnum::ELF_MAGIC)
                 {
                     printfRed("execve: invalid dynamic linker ELF\n");
-                    k_pm.proc_freepagetable(new_pt, new_sz);
+                    _abort_exec(new_pt, new_sz, new_vma);
                     return -1;
                 }
                 printfCyan("execve: dynamic linker ELF magic: %x\n", interp_elf.magic);
                 // 选择动态链接器的加载基址（通常在高地址）
                 interp_base = PGROUNDUP(new_sz); // 在新进程映像的末尾分配空间
 
+                bool interp_lazy = _elf_demand_pageable(interp_de, interp_elf.phoff, interp_elf.phnum);
+                if (interp_de != de)
+                    _elf_readahead(interp_de, interp_elf.phoff, interp_elf.phnum);
+
                 // 加载动态链接器的程序段
                 elf::proghdr interp_ph;
                 for (int j = 0, interp_off = interp_elf.phoff; j < interp_elf.phnum; j++, interp_off += sizeof(interp_ph))
@@ -2155,6 +2513,18 @@ namespace proc
                         continue;
 
                     uint64 load_addr = interp_base + interp_ph.vaddr;
+                    if (interp_lazy)
+                    {
+                        if (_add_elf_vma(new_vma, interp_de, load_addr, interp_ph.off, interp_ph.filesz, interp_ph.memsz, interp_ph.flags) < 0)
+                        {
+                            printfRed("execve: dynamic linker segment overlaps another mapping\n");
+                            _abort_exec(new_pt, new_sz, new_vma);
+                            return -1;
+                        }
+                        if (load_addr + interp_ph.memsz > new_sz)
+                            new_sz = load_addr + interp_ph.memsz;
+                        continue;
+                    }
                     uint64 seg_flag = PTE_U;
 
 #ifdef RISCV
@@ -2179,7 +2549,7 @@ namespace proc
                     if ((sz1 = mem::k_vmm.uvmalloc(new_pt, PGROUNDUP(new_sz), load_addr + interp_ph.memsz, seg_flag)) == 0)
                     {
                         printfRed("execve: load dynamic linker failed\n");
-                        k_pm.proc_freepagetable(new_pt, new_sz);
+                        _abort_exec(new_pt, new_sz, new_vma);
                         return -1;
                     }
                     new_sz = sz1;
@@ -2190,7 +2560,7 @@ namespace proc
                     if (load_seg(new_pt, load_addr, interp_de, interp_ph.off, interp_ph.filesz) < 0)
                     {
                         printfRed("execve: load dynamic linker segment failed\n");
-                        k_pm.proc_freepagetable(new_pt, new_sz);
+                        _abort_exec(new_pt, new_sz, new_vma);
                         return -1;
                     }
                 }
@@ -2211,14 +2581,14 @@ namespace proc
             if ((sz1 = mem::k_vmm.uvmalloc(new_pt, new_sz, new_sz + stack_pgnum * PGSIZE, PTE_W | PTE_X | PTE_R | PTE_U)) == 0)
             {
                 printfRed("execve: load user stack failed\n");
-                k_pm.proc_freepagetable(new_pt, new_sz);
+                _abort_exec(new_pt, new_sz, new_vma);
                 return -1;
             }
 #elif defined(LOONGARCH)
             if ((sz1 = mem::k_vmm.uvmalloc(new_pt, new_sz, new_sz + stack_pgnum * PGSIZE, PTE_P | PTE_W | PTE_PLV | PTE_MAT | PTE_D)) == 0)
             {
                 printfRed("execve: load user stack failed\n");
-                k_pm.proc_freepagetable(new_pt, new_sz);
+                _abort_exec(new_pt, new_sz, new_vma);
                 return -1;
             }
 #endif
@@ -2239,7 +2609,7 @@ namespace proc
         if (sp < stackbase || mem::k_vmm.copy_out(new_pt, sp, (char *)random, 32) < 0)
         {
             printfRed("execve: copy random data failed\n");
-            k_pm.proc_freepagetable(new_pt, new_sz);
+            _abort_exec(new_pt, new_sz, new_vma);
             return -1;
         }
 
@@ -2254,7 +2624,7 @@ namespace proc
             if (envc >= MAXARG)
             { // 检查环境变量数量限制
                 printfRed("execve: too many envs\n");
-                k_pm.proc_freepagetable(new_pt, new_sz);
+                _abort_exec(new_pt, new_sz, new_vma);
                 return -1;
             }
             sp -= envs[envc].size() + 1; // 为环境变量字符串预留空间(包括null)
@@ -2262,13 +2632,13 @@ namespace proc
             if (sp < stackbase + PGSIZE)
             {
                 printfRed("execve: stack overflow\n");
-                k_pm.proc_freepagetable(new_pt, new_sz);
+                _abort_exec(new_pt, new_sz, new_vma);
                 return -1;
             }
             if (mem::k_vmm.copy_out(new_pt, sp, envs[envc].c_str(), envs[envc].size() + 1) < 0)
             {
                 printfRed("execve: copy envs failed\n");
-                k_pm.proc_freepagetable(new_pt, new_sz);
+                _abort_exec(new_pt, new_sz, new_vma);
                 return -1;
             }
             uenvp[envc] = sp; // 记录字符串地址
@@ -2283,7 +2653,7 @@ namespace proc
             if (argc >= MAXARG)
             { // 检查参数数量限制
                 printfRed("execve: too many args\n");
-                k_pm.proc_freepagetable(new_pt, new_sz);
+                _abort_exec(new_pt, new_sz, new_vma);
                 return -1;
             }
             sp -= argv[argc].size() + 1; // 为参数字符串预留空间(包括null)
@@ -2291,13 +2661,13 @@ namespace proc
             if (sp < stackbase + PGSIZE)
             {
                 printfRed("execve: stack overflow\n");
-                k_pm.proc_freepagetable(new_pt, new_sz);
+                _abort_exec(new_pt, new_sz, new_vma);
                 return -1;
             }
             if (mem::k_vmm.copy_out(new_pt, sp, argv[argc].c_str(), argv[argc].size() + 1) < 0)
             {
                 printfRed("execve: copy args failed\n");
-                k_pm.proc_freepagetable(new_pt, new_sz);
+                _abort_exec(new_pt, new_sz, new_vma);
                 return -1;
             }
             uargv[argc] = sp; // 记录字符串地址
@@ -2333,14 +2703,14 @@ namespace proc
             ADD_AUXV(AT_NULL, 0); // 结束标记
 
             // printf("index: %d\n", index);
-            printfRed("[execve] base: %p, phdr: %p\n", (void *)interp_base, (void *)phdr);
+            log_trace("[execve] base: %p, phdr: %p\n", (void *)interp_base, (void *)phdr);
 
             // 将辅助向量复制到栈上
             sp -= sizeof(aux);
             if (mem::k_vmm.copy_out(new_pt, sp, (char *)aux, sizeof(aux)) < 0)
             {
                 printfRed("execve: copy auxv failed\n");
-                k_pm.proc_freepagetable(new_pt, new_sz);
+                _abort_exec(new_pt, new_sz, new_vma);
                 return -1;
             }
         }
@@ -2352,13 +2722,13 @@ namespace proc
             if (sp < stackbase + PGSIZE)
             {
                 printfRed("execve: stack overflow\n");
-                k_pm.proc_freepagetable(new_pt, new_sz);
+                _abort_exec(new_pt, new_sz, new_vma);
                 return -1;
             }
             if (mem::k_vmm.copy_out(new_pt, sp, uenvp, (envc + 1) * sizeof(uint64)) < 0)
             {
                 printfRed("execve: copy envp failed\n");
-                k_pm.proc_freepagetable(new_pt, new_sz);
+                _abort_exec(new_pt, new_sz, new_vma);
                 return -1;
             }
         }
@@ -2372,13 +2742,13 @@ namespace proc
             if (sp < stackbase + PGSIZE)
             {
                 printfRed("execve: stack overflow\n");
-                k_pm.proc_freepagetable(new_pt, new_sz);
+                _abort_exec(new_pt, new_sz, new_vma);
                 return -1;
             }
             if (mem::k_vmm.copy_out(new_pt, sp, uargv, (argc + 1) * sizeof(uint64)) < 0)
             {
                 printfRed("execve: copy argv failed\n");
-                k_pm.proc_freepagetable(new_pt, new_sz);
+                _abort_exec(new_pt, new_sz, new_vma);
                 return -1;
             }
             // // 新增：打印压入的 argv 指针及其内容
@@ -2396,7 +2766,7 @@ namespace proc
         if (mem::k_vmm.copy_out(new_pt, sp, (char *)&argc, sizeof(uint64)) < 0)
         {
             printfRed("execve: copy argc failed\n");
-            k_pm.proc_freepagetable(new_pt, new_sz);
+            _abort_exec(new_pt, new_sz, new_vma);
             return -1;
         }
 
@@ -2455,13 +2825,26 @@ namespace proc
         proc->_trapframe->era = entry_point;
         proc->elf_base = elf_start; // 保存ELF文件的起始地址
 #endif
+        // 旧映像的 VMA（包括旧 ELF 段）对新映像没有意义，趁旧页表还在时释放
+        if (proc->_vma != nullptr)
+        {
+            proc->_vma->_lock.acquire();
+            int ref = --proc->_vma->_ref_cnt;
+            proc->_vma->_lock.release();
+            if (ref <= 0)
+            {
+                _free_vma_entries(proc->_vma, old_pt);
+                delete proc->_vma;
+            }
+        }
+        proc->_vma = new_vma;
         proc->_pt = new_pt;        // 替换为新的页表
         proc->_trapframe->sp = sp; // 设置栈指针
 
         // printf("execve: new process size: %p, new pagetable: %p\n", proc->_sz, proc->_pt);
         k_pm.proc_freepagetable(old_pt, old_sz);
 
-        printf("execve succeed, new process size: %p\n", proc->_sz);
+        log_trace("execve succeed, new process size: %p\n", proc->_sz);
 
         // 写成0为了适配glibc的rtld_fini需求
         return 0; // 返回参数个数，表示成功执行
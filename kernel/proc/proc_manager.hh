@@ -10,6 +10,7 @@ namespace tmm
 namespace proc
 {
     constexpr int default_proc_slot = 1; // 默认进程槽位 TODO:TBD
+    constexpr uint64 exec_readahead_max = 4 * 1024 * 1024; // exec 一次预读映像的上限，更大的部分加载时按需读
 
 #define MAXARG 32
 
@@ -68,6 +69,8 @@ namespace proc
         int load_seg(mem::PageTable &pt, uint64 va, fs::dentry *de, uint offset, uint size);
 
         void sleep(void *chan, SpinLock *lock);
+        bool sleep_until(void *chan, SpinLock *lock, uint64 expires);
+        static void wake_on_timer(tmm::Timer *t);
         void wakeup(void *chan);
         int wakeup2(uint64 uaddr, int val, void *uaddr2, int val2);
         void exit_proc(Pcb *p, int state);
@@ -84,6 +87,10 @@ namespace proc
         int getcwd(char *out_buf);
         void *mmap(void *addr, int length, int prot, int flags, int fd, int offset);
         int munmap(void *addr, int length);
+        /// @brief 把 prot 加到覆盖 [addr, addr+len) 的 VMA 上，必要时切分区域，之后与相邻区域合并
+        void mprotect_vma(uint64 addr, uint64 len, int prot);
+        /// @brief 调整以 old_addr 开始的映射的大小，能原地扩展时原地扩展，否则在 MREMAP_MAYMOVE 时整体搬走
+        void *mremap(void *old_addr, uint64 old_size, uint64 new_size, int flags);
         int unlink(int fd, eastl::string path, int flags);
         int pipe(int *fd, int);
         int set_tid_address(int *tidptr);
@@ -94,6 +101,10 @@ namespace proc
 
         void user_init();
 
+        /// @brief 创建只在内核态运行的线程，调度到它时直接执行 fn(arg)，fn 不应返回
+        Pcb *create_kthread(const char *name, void (*fn)(void *), void *arg);
+        void kthread_entry();
+
         int alloc_fd(Pcb *p, fs::file *f);
         int alloc_fd(Pcb *p, fs::file *f, int fd);
 
@@ -112,6 +123,34 @@ namespace proc
         void _proc_create_vm(Pcb *p, mem::PageTable &pt);
         void _proc_create_vm(Pcb *p);
 
+        /// @brief 释放一张 VMA 表的所有条目：写回可写的共享映射，放掉文件引用，解除已建立的页映射
+        void _free_vma_entries(Pcb::VMA *vt, mem::PageTable &pt);
+
+        /// @brief 去掉 [start, end) 上的所有映射，部分重叠的区域切开后只去掉重叠的部分。调用者持有 p->_vma->_lock
+        void _unmap_range(Pcb *p, uint64 start, uint64 end);
+        /// @brief mremap 的主体，调用者持有 p->_vma->_lock
+        void *_mremap(Pcb *p, void *old_addr, uint64 old_size, uint64 new_size, int flags);
+
+        /// @brief 解除 [va_start, va_end) 中已建立映射的页，跳过尚未缺页的空洞
+        void _unmap_present(mem::PageTable &pt, uint64 va_start, uint64 va_end);
+
+        /// @brief ELF 映像的 PT_LOAD 段能否按需分页：文件偏移与虚拟地址模页同余、段之间不共享页
+        bool _elf_demand_pageable(fs::dentry *de, uint64 phoff, int phnum);
+
+        /// @brief 为 ELF 映像的各 PT_LOAD 段发出异步预读（只填页缓存，不建映射），合计最多 exec_readahead_max
+        void _elf_readahead(fs::dentry *de, uint64 phoff, int phnum);
+
+        /// @brief 把一个 PT_LOAD 段登记为私有文件映射 VMA，页面在第一次访问时由缺页处理填充
+        /// @param va 段在新地址空间中的起始地址（已加上加载基址）
+        /// @param pflags ELF 段标志 (PF_R/PF_W/PF_X)
+        int _add_elf_vma(Pcb::VMA *vt, fs::dentry *de, uint64 va, uint64 off, uint64 filesz, uint64 memsz, uint32 pflags);
+
+        /// @brief execve 的主体，held 收集路径查找得到的目录项（程序本身和动态链接器），由 execve 统一 dput
+        int _execve(eastl::string path, eastl::vector<eastl::string> argv, eastl::vector<eastl::string> envs, fs::dentry *held[2]);
+
+        /// @brief execve 失败时释放尚未生效的新页表和新 VMA 表
+        void _abort_exec(mem::PageTable &pt, uint64 sz, Pcb::VMA *vma);
+
     public: // ================ 测试函数 ================
         void vectortest();
         void stringtest();
@@ -3,6 +3,8 @@
 #include "scheduler.hh"
 #include "proc_manager.hh"
 #include "printer.hh"
+#include "trap.hh"
+#include "smp.hh"
 #ifdef RISCV
 #include "mem/riscv/pagetable.hh"
 #elif defined(LOONGARCH)
@@ -23,21 +25,162 @@ namespace proc
 
     void Scheduler::init(const char *name)
     {
-        _sche_lock.init(name);
+        for (RunQueue &rq : _rq)
+        {
+            rq.lock.init(name);
+            for (int i = 0; i < num_proc_prio; i++)
+                rq.head[i] = rq.tail[i] = nullptr;
+            rq.bitmap = 0;
+        }
     }
 
-    int Scheduler::get_highest_proirity()
+    int Scheduler::prio_index(Pcb *p)
     {
-        _sche_lock.acquire();
-        int prio = lowest_proc_prio;
-        for (Pcb &p : k_proc_pool)
+        int prio = p->_priority;
+        if (prio < highest_proc_prio)
+            prio = highest_proc_prio;
+        if (prio > lowest_proc_prio)
+            prio = lowest_proc_prio;
+        return prio - highest_proc_prio;
+    }
+
+    void Scheduler::enqueue(Pcb *p)
+    {
+        int me = (int)Cpu::read_tp();
+        int cpu = p->_last_cpu;
+        if (cpu < 0 || !k_smp.is_online(cpu))
+            cpu = me;
+
+        RunQueue &rq = _rq[cpu];
+        bool was_empty;
+        rq.lock.acquire();
+        was_empty = rq.bitmap == 0;
+        if (!p->_on_rq)
         {
-            if (p._priority < prio && p._state == ProcState::RUNNABLE)
-            {
-                prio = p._priority;
-            }
+            int i = prio_index(p);
+            p->_rq_next = nullptr;
+            p->_rq_prev = rq.tail[i];
+            if (rq.tail[i])
+                rq.tail[i]->_rq_next = p;
+            else
+                rq.head[i] = p;
+            rq.tail[i] = p;
+            rq.bitmap |= 1U << i;
+            p->_rq_prio = i;
+            p->_rq_cpu = cpu;
+            p->_on_rq = true;
+        }
+        rq.lock.release();
+
+        Pcb *cur = Cpu::get_cpu()->get_cur_proc();
+        if (cpu == me)
+        {
+            // 只有一个进程可运行时时钟可能停着，现在要恢复时间片轮转
+            if (was_empty)
+                trap_mgr.tick_restart();
+            // 本核正忙着别的进程，叫一个空闲的核来偷；
+            // 让出 CPU 的进程自己入队时本核马上就会重新调度，不用叫
+            if (cur != nullptr && cur != p)
+                k_smp.kick_idle();
+        }
+        else if (!k_smp.kick_cpu(cpu))
+        {
+            // 目标核正在运行别的进程：它的时钟可能停着，要它恢复时间片；
+            // 同时叫一个空闲的核，免得新进程干等目标核的时间片
+            if (was_empty)
+                k_smp.send_ipi(cpu, SmpManager::ipi_resched);
+            k_smp.kick_idle();
+        }
+    }
+
+    void Scheduler::dequeue(Pcb *p)
+    {
+        // 调用者持有 p->_lock，_rq_cpu 只在入队时改变，不会与这里并发
+        RunQueue &rq = _rq[p->_rq_cpu];
+        rq.lock.acquire();
+        if (p->_on_rq)
+        {
+            int i = p->_rq_prio;
+            if (p->_rq_prev)
+                p->_rq_prev->_rq_next = p->_rq_next;
+            else
+                rq.head[i] = p->_rq_next;
+            if (p->_rq_next)
+                p->_rq_next->_rq_prev = p->_rq_prev;
+            else
+                rq.tail[i] = p->_rq_prev;
+            if (rq.head[i] == nullptr)
+                rq.bitmap &= ~(1U << i);
+            p->_rq_prev = p->_rq_next = nullptr;
+            p->_on_rq = false;
+        }
+        rq.lock.release();
+    }
+
+    Pcb *Scheduler::_take(RunQueue &rq)
+    {
+        if (rq.bitmap == 0)
+            return nullptr;
+        int i = __builtin_ctz(rq.bitmap);
+        Pcb *p = rq.head[i];
+        rq.head[i] = p->_rq_next;
+        if (rq.head[i])
+            rq.head[i]->_rq_prev = nullptr;
+        else
+        {
+            rq.tail[i] = nullptr;
+            rq.bitmap &= ~(1U << i);
         }
-        _sche_lock.release();
+        p->_rq_prev = p->_rq_next = nullptr;
+        p->_on_rq = false;
+        return p;
+    }
+
+    Pcb *Scheduler::_steal(int me)
+    {
+        // 从下一个核开始轮一圈，先不加锁看位图，免得空队列的锁也去抢
+        for (int k = 1; k < NUMCPU; k++)
+        {
+            RunQueue &rq = _rq[(me + k) % NUMCPU];
+            if (rq.bitmap == 0)
+                continue;
+            rq.lock.acquire();
+            Pcb *p = _take(rq);
+            rq.lock.release();
+            if (p)
+                return p;
+        }
+        return nullptr;
+    }
+
+    Pcb *Scheduler::pick_next()
+    {
+        int me = (int)Cpu::read_tp();
+        RunQueue &rq = _rq[me];
+        rq.lock.acquire();
+        Pcb *p = _take(rq);
+        rq.lock.release();
+        if (p == nullptr)
+            p = _steal(me);
+        return p;
+    }
+
+    bool Scheduler::any_runnable()
+    {
+        for (RunQueue &rq : _rq)
+            if (rq.bitmap != 0)
+                return true;
+        return false;
+    }
+
+    int Scheduler::get_highest_proirity()
+    {
+        RunQueue &rq = _rq[Cpu::read_tp()];
+        rq.lock.acquire();
+        int prio = lowest_proc_prio;
+        if (rq.bitmap != 0)
+            prio = __builtin_ctz(rq.bitmap) + highest_proc_prio;
+        rq.lock.release();
         return prio;
     }
 
@@ -45,7 +188,6 @@ namespace proc
     {
         Pcb *p;
         Cpu *cpu = Cpu::get_cpu();
-        int priority;
 
         cpu->set_cur_proc(nullptr);
 
@@ -54,50 +196,39 @@ namespace proc
 
             cpu->interrupt_on();
 
-            priority = get_highest_proirity();
+            // 同优先级内按入队顺序轮转：yield 会把当前进程重新挂到队尾
+            if ((p = pick_next()) == nullptr)
+            {
+                // 关中断后再确认一次，否则唤醒可能恰好发生在检查和停机之间。
+                // 停机期间挂起的中断会让 CPU 醒来，回到循环开头开中断后得到处理
+                // 空闲时顺便把积压的日志输出
+                k_printer.drain();
+                // 先标记空闲再检查，入队方看到标记就会用核间中断把这里叫醒；
+                // 别的核队列里还有在等的进程就不停机，回去偷
+                cpu->interrupt_off();
+                k_smp.set_idle(true);
+                if (!any_runnable())
+                    trap_mgr.idle();
+                k_smp.set_idle(false);
+                continue;
+            }
 
-            for (p = k_proc_pool; p < &k_proc_pool[num_process]; p++)
+            p->_lock.acquire();
+            // 出队之后、拿到锁之前状态可能已被改变（例如被 freeproc 回收）
+            if (p->get_state() == ProcState::RUNNABLE)
             {
-                // printfBlue("[sche]  start_schedule here,p->addr:%p \n", p);
-                if (p->_state != ProcState::RUNNABLE || p->_priority > priority)
-                {
-                    // printf("p.gid: %d, p.state: %d, p.name:%s not runnable or priority too high \n", p->_gid, p->_state, p->_name);
-                    continue;
-                }
-                // printf("p.gid: %d, p.state: %d, p.name:%s \n", p->_gid, p->_state, p->_name);
-                p->_lock.acquire();
-                // p->print_context();
-                if (p->get_state() == ProcState::RUNNABLE)
-                {
-                    p->_state = ProcState::RUNNING;
-                    cpu->set_cur_proc(p);
-                    proc::Context *cur_context = cpu->get_context();
-                    // print_context1( cur_context );
-
-                    // Debug
-                    //  uint64 sp = p->get_context()->sp; // 0x0000001ffffbf000;
-                    //  uint64 pa = (uint64)PTE2PA(mem::k_pagetable.kwalkaddr(sp).get_data());
-                    //  printf("sp: %p, kstack: %p,pa:%p\n", sp, p->_kstack,pa);
-                    //  printfCyan("[sche]  start_schedule here,p->addr:%x \n",Cpu::get_cpu()->get_cur_proc());
-                    printfRed("[sche] -> proc gid: %d pid: %d tid: %d, name: %s\n", p->_gid, p->_pid, p->_tid, p->_name);
-                    swtch(cur_context, &p->_context);
-                    // printf( "return from %d, name: %s\n", p->_gid, p->_name );
-                    bool flag = false;
-                    for (Pcb *np = k_proc_pool; np < &k_proc_pool[num_process]; np++)
-                    {
-                        if(np->_state == ProcState::UNUSED){
-                            flag = true;
-                            // break;
-                        }
-                        printf("[sche]  proc gid: [%d], pid: [%d], parent: [%d], state: %d, name: %s\n", np->_gid, np->_pid,  np->get_ppid(), (int)np->_state, np->_name);
-                    }
-                    if(flag == false){
-                        // panic("no unused proc in pool, please check your code");
-                    }
-                    cpu->set_cur_proc(nullptr);
-                }
-                p->_lock.release();
+                k_pm.change_state(p, ProcState::RUNNING);
+                p->_last_cpu = (int)Cpu::read_tp();
+                cpu->set_cur_proc(p);
+                proc::Context *cur_context = cpu->get_context();
+
+                // printfCyan("[sche]  start_schedule here,p->addr:%x \n",Cpu::get_cpu()->get_cur_proc());
+                log_trace("[sche] -> proc gid: %d pid: %d tid: %d, name: %s\n", p->_gid, p->_pid, p->_tid, p->_name);
+                swtch(cur_context, &p->_context);
+                // printf( "return from %d, name: %s\n", p->_gid, p->_name );
+                cpu->set_cur_proc(nullptr);
             }
+            p->_lock.release();
         }
     }
 
@@ -110,7 +241,7 @@ namespace proc
         // printfCyan("[sche]  yield here,p->addr:%x \n",Cpu::get_cpu()->get_cur_proc());
         p->_lock.acquire();
         // printfCyan("[sche]  yield here \n");
-        p->_state = ProcState::RUNNABLE;
+        k_pm.change_state(p, ProcState::RUNNABLE);
         call_sched(); // 注意swtch的逻辑是函数调用, 所以重新调用就是视为从这个函数返回
         p->_lock.release();
     }
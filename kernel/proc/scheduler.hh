@@ -1,17 +1,39 @@
 #pragma once
 #include "spinlock.hh"
 #include "proc.hh"
+#include "hal/cpu.hh"
 
 namespace proc
 {
 
+	constexpr int num_proc_prio = lowest_proc_prio - highest_proc_prio + 1;
+
+	/// @brief 每个核一组就绪队列：每个优先级一条，外加一个非空队列位图；
+	/// 队列成员资格与 RUNNABLE 状态一致，由 ProcessManager::change_state 维护。
+	/// 进程就绪时回到上次运行的核，本核没有就绪进程时从别的核偷一个来运行。
 	class Scheduler
 	{
 	private:
-		SpinLock _sche_lock;
+		struct RunQueue
+		{
+			SpinLock lock;
+			Pcb *head[num_proc_prio];
+			Pcb *tail[num_proc_prio];
+			uint32 bitmap;			// 第 i 位置 1 表示优先级 i 的队列非空
+		};
+		RunQueue _rq[NUMCPU];
+
+		static int prio_index( Pcb *p );
+		static Pcb *_take( RunQueue &rq );	// 取出 rq 最高优先级队列的队首，调用者持有 rq.lock
+		Pcb *_steal( int me );
 	public:
 		Scheduler() = default;
 		void init( const char *name );
+		void enqueue( Pcb *p );		// 加入对应核、对应优先级的队尾，已在队列中则忽略
+		void dequeue( Pcb *p );		// 从队列中摘除，不在队列中则忽略
+		Pcb *pick_next();			// 先取本核队列，空则从别的核偷；没有就绪进程返回 nullptr
+		bool has_runnable() { return _rq[Cpu::read_tp()].bitmap != 0; } // 本核是否有进程在等 CPU（不含正在运行的）
+		bool any_runnable();		// 任何一个核是否有进程在等 CPU
 		void add_thread();
 		void remove_thread();
 		void switch_to_proc(Pcb *p);
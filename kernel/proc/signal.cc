@@ -51,7 +51,7 @@ namespace proc
                         if (cur_proc->_sigactions->actions[flag] == nullptr)
                             return -1; // 内存分配失败
                     }
-                    printf("[sigAction] Setting handler for signal %d: enter %p flags: %p mask: %p\n", flag, newact->sa_handler, newact->sa_flags, newact->sa_mask.sig[0]);
+                    log_trace("[sigAction] Setting handler for signal %d: enter %p flags: %p mask: %p\n", flag, newact->sa_handler, newact->sa_flags, newact->sa_mask.sig[0]);
                     *(cur_proc->_sigactions->actions[flag]) = *newact;
                 }
 
@@ -144,10 +144,10 @@ namespace proc
                         continue; // 该信号未被设置
                     }
                     int signum = i;
-                    printf("[handle_signal] Handling signal %d\n", signum);
+                    log_trace("[handle_signal] Handling signal %d\n", signum);
                     if (is_ignored(p, signum))
                     {
-                        printf("[handle_signal] Signal %d is ignored, sigmask=0x%x\n", signum, p->_sigmask);
+                        log_trace("[handle_signal] Signal %d is ignored, sigmask=0x%x\n", signum, p->_sigmask);
                         return;
                     }
 
@@ -155,7 +155,7 @@ namespace proc
                     if (p->_sigactions != nullptr && p->_sigactions->actions[signum] != nullptr)
                     {
                         act = p->_sigactions->actions[signum];
-                        printf("[handle_signal] Found handler for signal %d: %p\n", signum, act->sa_handler);
+                        log_trace("[handle_signal] Found handler for signal %d: %p\n", signum, act->sa_handler);
                     }
                     else
                     {
@@ -169,21 +169,21 @@ namespace proc
                     }
                     else
                     {
-                        printf("[handle_signal] Calling do_handle for signal %d\n", signum);
+                        log_trace("[handle_signal] Calling do_handle for signal %d\n", signum);
                         do_handle(p, signum, act);
                         
                         // 处理 SA_RESETHAND 标志：执行后重置为默认处理
                         if (act->sa_flags & (uint64)SigActionFlags::RESETHAND)
                         {
-                            printf("[handle_signal] SA_RESETHAND set, resetting handler for signal %d\n", signum);
+                            log_trace("[handle_signal] SA_RESETHAND set, resetting handler for signal %d\n", signum);
                             delete p->_sigactions->actions[signum];
                             p->_sigactions->actions[signum] = nullptr;
                         }
                     }
                     clear_signal(p, signum);
-                    printf("[handle_signal] Cleared signal %d, _signal now 0x%x\n", signum, p->_signal);
+                    log_trace("[handle_signal] Cleared signal %d, _signal now 0x%x\n", signum, p->_signal);
                 }
-                printf("[handle_signal] Finished handling signals\n");
+                log_trace("[handle_signal] Finished handling signals\n");
             }
 
             void add_signal(proc::Pcb *p, int sig)
@@ -214,7 +214,7 @@ namespace proc
                     panic("[do_handle] Signal %d is ignored", signum);
                     return;
                 }
-                printf("[do_handle] Handling signal %d with handler %p\n", signum, act->sa_handler);
+                log_trace("[do_handle] Handling signal %d with handler %p\n", signum, act->sa_handler);
 
                 signal_frame *frame;
                 frame = (signal_frame *)mem::k_pmm.alloc_page();
@@ -238,7 +238,7 @@ namespace proc
                 // 永远不能屏蔽 SIGKILL 和 SIGSTOP
                 p->_sigmask &= ~((1UL << (signal::SIGKILL - 1)) | (1UL << (signal::SIGSTOP - 1)));
                 
-                printf("[do_handle] Signal mask updated: old=0x%x, new=0x%x, sa_mask=0x%x\n", 
+                log_trace("[do_handle] Signal mask updated: old=0x%x, new=0x%x, sa_mask=0x%x\n", 
                        old_sigmask, p->_sigmask, act->sa_mask.sig[0]);
 
                 if (frame == nullptr)
@@ -251,19 +251,19 @@ namespace proc
                 p->_trapframe->ra = (uint64)(SIG_TRAMPOLINE + ((uint64)sig_handler - (uint64)sig_trampoline));
 #elif LOONGARCH
                 p->_trapframe->ra = (uint64)SIG_TRAMPOLINE;
-                printf("sig: %p\n", SIG_TRAMPOLINE);
+                log_trace("sig: %p\n", SIG_TRAMPOLINE);
 #endif
 
                 // 检查是否需要三参数信号处理 (SA_SIGINFO)
                 if (act->sa_flags & (uint64)SigActionFlags::SIGINFO)
                 {
-                    printf("[do_handle] Using SA_SIGINFO for signal %d\n", signum);
+                    log_trace("[do_handle] Using SA_SIGINFO for signal %d\n", signum);
                     uint64 va, a, pa;
                     va = p->_trapframe->sp;
                     a = PGROUNDDOWN(va);
                     mem::Pte pte = p->_pt.walk(a, 0);
                     pa = reinterpret_cast<uint64>(pte.pa());
-                    printf("[copy_out] va: %p, pte: %p, pa: %p\n", va, pte.get_data(), pa);
+                    log_trace("[copy_out] va: %p, pte: %p, pa: %p\n", va, pte.get_data(), pa);
 
                     // 计算用户栈上的地址
                     uint64 usercontext_sp = p->_trapframe->sp - PGSIZE - sizeof(usercontext);
@@ -301,7 +301,7 @@ namespace proc
                         .si_code = 0,
                         ._pad = {0},
                         ._align = 0};
-                    printf("[do_handle] LinuxSigInfo constructed: sp: %p usercontext_sp=%p, linuxinfo_sp=%p\n",
+                    log_trace("[do_handle] LinuxSigInfo constructed: sp: %p usercontext_sp=%p, linuxinfo_sp=%p\n",
                            p->_trapframe->sp, usercontext_sp, linuxinfo_sp);
                     // 将结构写入用户空间
                     if (mem::k_vmm.copy_out(p->_pt, usercontext_sp, &uctx, sizeof(usercontext)) < 0)
@@ -333,7 +333,7 @@ namespace proc
                         return;
                     }
 
-                    printf("[do_handle] SA_SIGINFO setup complete: sp=%p, a1=%p, a2=%p\n",
+                    log_trace("[do_handle] SA_SIGINFO setup complete: sp=%p, a1=%p, a2=%p\n",
                            p->_trapframe->sp, linuxinfo_sp, usercontext_sp);
                 }
                 else
@@ -0,0 +1,179 @@
+#include "proc/vma.hh"
+#include "fs/vfs/file/normal_file.hh"
+#include "platform.hh"
+
+namespace proc
+{
+	vma *VmaTree::find( uint64 va )
+	{
+		if ( _last_hit != nullptr && va >= _last_hit->addr && va < _last_hit->addr + _last_hit->len )
+			return _last_hit;
+
+		vma *v = find_prev( va );
+		if ( v == nullptr || va >= v->addr + v->len )
+			return nullptr;
+		_last_hit = v;
+		return v;
+	}
+
+	bool VmaTree::same_region( uint64 va, const vma &snap )
+	{
+		vma *v = find( va );
+		return v != nullptr && v->addr == snap.addr && v->vfile == snap.vfile && v->offset == snap.offset &&
+			   v->prot == snap.prot && v->flags == snap.flags && v->file_sz == snap.file_sz;
+	}
+
+	vma *VmaTree::find_prev( uint64 va )
+	{
+		Map::iterator it = _map.upper_bound( va );
+		if ( it == _map.begin() )
+			return nullptr;
+		--it;
+		return &it->second;
+	}
+
+	vma *VmaTree::next( vma *v )
+	{
+		Map::iterator it = _map.upper_bound( v->addr );
+		return it == _map.end() ? nullptr : &it->second;
+	}
+
+	vma *VmaTree::find_intersect( uint64 start, uint64 end )
+	{
+		if ( start >= end )
+			return nullptr;
+		vma *v = find_prev( start );
+		if ( v != nullptr && start < v->addr + v->len )
+			return v;
+		// 起始地址落在 (start, end) 内的第一个区域
+		Map::iterator it = _map.upper_bound( start );
+		if ( it != _map.end() && it->first < end )
+			return &it->second;
+		return nullptr;
+	}
+
+	uint64 VmaTree::find_free( uint64 from, uint64 len, uint64 limit )
+	{
+		uint64 a = PGROUNDUP( from );
+		while ( a + len > a && a + len <= limit )
+		{
+			vma *v = find_intersect( a, a + len );
+			if ( v == nullptr )
+				return a;
+			a = PGROUNDUP( v->addr + v->len );
+		}
+		return 0;
+	}
+
+	vma *VmaTree::insert( const vma &v )
+	{
+		if ( v.len <= 0 || find_intersect( v.addr, v.addr + v.len ) != nullptr )
+			return nullptr;
+		Map::iterator it = _map.insert( Map::value_type( v.addr, v ) ).first;
+		it->second.used = 1;
+		return &it->second;
+	}
+
+	void VmaTree::erase( vma *v )
+	{
+		if ( _last_hit == v )
+			_last_hit = nullptr;
+		_map.erase( v->addr );
+	}
+
+	vma *VmaTree::split( vma *v, uint64 at )
+	{
+		if ( at <= v->addr || at >= v->addr + v->len )
+			return nullptr;
+
+		uint64 head = at - v->addr;
+		vma tail = *v;
+		tail.addr = at;
+		tail.len = v->len - (int) head;
+		tail.offset = v->offset + (int) head;
+		tail.file_sz = v->file_sz > head ? v->file_sz - head : 0;
+		tail.max_len = v->max_len > head + tail.len ? v->max_len - head : tail.len;
+		if ( tail.vfile != nullptr )
+			tail.vfile->dup();
+
+		// 前半段不再能向后扩展，否则会长进后半段
+		v->len = (int) head;
+		if ( v->file_sz > head )
+			v->file_sz = head;
+		v->max_len = head;
+		v->is_expandable = 0;
+
+		Map::iterator it = _map.insert( Map::value_type( at, tail ) ).first;
+		return &it->second;
+	}
+
+	vma *VmaTree::move( vma *v, uint64 new_addr )
+	{
+		if ( new_addr == v->addr )
+			return v;
+
+		// 目标范围只允许与 v 自己重叠
+		uint64 new_end = new_addr + v->len;
+		vma *o = find_intersect( new_addr, new_end );
+		if ( o == v )
+		{
+			if ( find_intersect( new_addr, v->addr ) != nullptr || find_intersect( v->addr + v->len, new_end ) != nullptr )
+				return nullptr;
+		}
+		else if ( o != nullptr )
+			return nullptr;
+
+		vma moved = *v;
+		erase( v );
+		moved.addr = new_addr;
+		return insert( moved );
+	}
+
+	bool VmaTree::_mergeable( vma *a, vma *b )
+	{
+		if ( a->addr + a->len != b->addr )
+			return false;
+		if ( a->prot != b->prot || a->flags != b->flags || a->vfile != b->vfile )
+			return false;
+		if ( a->is_expandable || b->is_expandable )
+			return false;
+		if ( (uint64) a->len + b->len > 0x7fffffff )
+			return false;
+		if ( a->vfile != nullptr )
+		{
+			// 文件映射要求文件偏移连续，并且前一段一直由文件提供内容到结尾
+			if ( a->len % PGSIZE != 0 || a->file_sz != (uint64) a->len )
+				return false;
+			if ( (uint64) a->offset + a->len != (uint64) b->offset )
+				return false;
+		}
+		return true;
+	}
+
+	vma *VmaTree::try_merge( vma *v )
+	{
+		vma *p = v->addr > 0 ? find_prev( v->addr - 1 ) : nullptr;
+		if ( p != nullptr && _mergeable( p, v ) )
+		{
+			p->len += v->len;
+			p->file_sz = p->vfile != nullptr ? p->file_sz + v->file_sz : 0;
+			p->max_len = p->len;
+			if ( v->vfile != nullptr )
+				v->vfile->free_file();
+			erase( v );
+			v = p;
+		}
+
+		vma *n = next( v );
+		if ( n != nullptr && _mergeable( v, n ) )
+		{
+			v->len += n->len;
+			v->file_sz = v->vfile != nullptr ? v->file_sz + n->file_sz : 0;
+			v->max_len = v->len;
+			if ( n->vfile != nullptr )
+				n->vfile->free_file();
+			erase( n );
+		}
+		return v;
+	}
+} // namespace proc
@@ -0,0 +1,62 @@
+#pragma once
+#include "types.hh"
+#include "context.hh"
+#include <EASTL/map.h>
+
+namespace proc
+{
+	/// @brief 一个地址空间的虚拟内存区域集合。
+	/// 区域之间互不重叠，按起始地址存进红黑树 (eastl::map)：包含某地址的区域
+	/// 就是起始地址不大于它的最后一个区域，查找、插入、删除都是 O(log n)。
+	/// 另外缓存上一次命中的区域——缺页和 copy_out 往往连续落在同一个区域里，不必每次都下树。
+	/// 树中区域的 addr 就是键，不能直接改写；要挪动起始地址用 move()，切分用 split()。
+	/// 本身不加锁，由所属 Pcb::VMA 的 _lock 保护。
+	class VmaTree
+	{
+	private:
+		using Map = eastl::map<uint64, vma>;
+		Map _map;
+		vma *_last_hit = nullptr;
+
+	public:
+		using iterator = Map::iterator;
+
+		VmaTree() = default;
+		VmaTree( const VmaTree & ) = delete;
+		VmaTree &operator=( const VmaTree & ) = delete;
+
+		/// @brief 查找包含 va 的区域，没有时返回 nullptr
+		vma *find( uint64 va );
+		/// @brief 起始地址不大于 va 的最后一个区域（不一定包含 va）
+		vma *find_prev( uint64 va );
+		/// @brief 地址上紧随 v 之后的区域
+		vma *next( vma *v );
+		/// @brief 与 [start, end) 相交的第一个区域
+		vma *find_intersect( uint64 start, uint64 end );
+		/// @brief 从 from 起找第一段长度为 len、不与任何区域相交且不超过 limit 的空洞
+		/// @return 空洞起始地址，找不到时返回 0
+		uint64 find_free( uint64 from, uint64 len, uint64 limit );
+
+		/// @brief 插入一个区域（拷贝一份），与已有区域重叠或长度为 0 时返回 nullptr
+		vma *insert( const vma &v );
+		/// @brief 从树中删除区域，不处理文件引用和页表
+		void erase( vma *v );
+		/// @brief 在页对齐的地址 at 处把 v 一分为二，返回后半段；文件映射的后半段另持一份文件引用
+		vma *split( vma *v, uint64 at );
+		/// @brief 把区域挪到 new_addr 开始，返回新位置上的区域；目标与其他区域重叠时返回 nullptr 且不做改动
+		vma *move( vma *v, uint64 new_addr );
+		/// @brief 与地址相邻、属性相同的前后区域合并，返回合并后的区域
+		vma *try_merge( vma *v );
+		/// @brief va 是否仍落在与快照 snap 映射内容相同的区域里（起点、文件、偏移、权限都没变），
+		/// 缺页处理放锁读文件回来后据此判断能不能装上读到的页
+		bool same_region( uint64 va, const vma &snap );
+
+		void clear() { _map.clear(); _last_hit = nullptr; }
+		uint64 size() const { return _map.size(); }
+		iterator begin() { return _map.begin(); }
+		iterator end() { return _map.end(); }
+
+	private:
+		bool _mergeable( vma *a, vma *b );
+	};
+} // namespace proc
@@ -0,0 +1,83 @@
+#include "wait_queue.hh"
+
+namespace proc
+{
+    WaitQueue k_sleep_wq;
+    WaitQueue k_futex_wq;
+
+    void WaitQueue::init(const char *name)
+    {
+        for (int i = 0; i < _bucket_count; i++)
+        {
+            _buckets[i].lock.init(name);
+            _buckets[i].head = nullptr;
+        }
+    }
+
+    int WaitQueue::hash(void *key)
+    {
+        // 通道多为按 8 字节对齐的内核地址，低位无信息；乘法散列取高 6 位
+        uint64 k = (uint64)key >> 3;
+        return (int)((k * 0x9E3779B97F4A7C15UL) >> 58);
+    }
+
+    void WaitQueue::_unlink(Bucket &b, WaitNode *node)
+    {
+        if (node->prev)
+            node->prev->next = node->next;
+        else
+            b.head = node->next;
+        if (node->next)
+            node->next->prev = node->prev;
+        node->prev = node->next = nullptr;
+        node->bucket = -1;
+    }
+
+    void WaitQueue::insert(WaitNode *node, void *key)
+    {
+        remove(node);
+
+        int i = hash(key);
+        Bucket &b = _buckets[i];
+        b.lock.acquire();
+        // 挂到队尾，保证唤醒顺序与入睡顺序一致
+        WaitNode *tail = b.head;
+        while (tail && tail->next)
+            tail = tail->next;
+        node->key = key;
+        node->bucket = i;
+        node->next = nullptr;
+        node->prev = tail;
+        if (tail)
+            tail->next = node;
+        else
+            b.head = node;
+        b.lock.release();
+    }
+
+    void WaitQueue::remove(WaitNode *node)
+    {
+        int i = node->bucket;
+        if (i < 0)
+            return;
+        Bucket &b = _buckets[i];
+        b.lock.acquire();
+        if (node->bucket == i)
+            _unlink(b, node);
+        b.lock.release();
+    }
+
+    int WaitQueue::collect(void *key, Pcb **out, int max)
+    {
+        Bucket &b = _buckets[hash(key)];
+        int n = 0;
+        b.lock.acquire();
+        for (WaitNode *w = b.head; w && n < max; w = w->next)
+        {
+            if (w->key == key)
+                out[n++] = w->proc;
+        }
+        b.lock.release();
+        return n;
+    }
+} // namespace proc
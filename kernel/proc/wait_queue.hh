@@ -0,0 +1,51 @@
+#pragma once
+#include "types.hh"
+#include "spinlock.hh"
+
+namespace proc
+{
+	class Pcb;
+
+	/// @brief 嵌入在 Pcb 中的等待节点，一个节点同一时刻只挂在一个桶上
+	struct WaitNode
+	{
+		Pcb *proc = nullptr;
+		void *key = nullptr;
+		int bucket = -1;				///< 所在桶的下标，-1 表示未入队
+		WaitNode *prev = nullptr;
+		WaitNode *next = nullptr;
+	};
+
+	/// @brief 以等待通道地址为键的哈希等待队列。
+	/// 这里只负责"谁在等这个键"，进程状态仍由 p->_lock 保护：
+	/// 唤醒方先在桶锁下收集候选进程，释放桶锁后再逐个拿 p->_lock 复核，
+	/// 因此锁顺序始终是 p->_lock -> 桶锁，不会与 sleep 形成环。
+	class WaitQueue
+	{
+	private:
+		constexpr static int _bucket_count = 64;
+		struct Bucket
+		{
+			SpinLock lock;
+			WaitNode *head;
+		};
+		Bucket _buckets[_bucket_count];
+
+		static int hash( void *key );
+		void _unlink( Bucket &b, WaitNode *node );
+
+	public:
+		WaitQueue() = default;
+		void init( const char *name );
+
+		/// @brief 以 key 挂入节点；若已挂在别的键上则先摘除
+		void insert( WaitNode *node, void *key );
+		/// @brief 摘除节点，未入队时什么都不做
+		void remove( WaitNode *node );
+		/// @brief 收集等待 key 的进程（按入队顺序），返回个数
+		int collect( void *key, Pcb **out, int max );
+	};
+
+	extern WaitQueue k_sleep_wq;	// sleep/wakeup，以 _chan 为键
+	extern WaitQueue k_futex_wq;	// futex，以 _futex_addr 为键
+} // namespace proc
@@ -40,11 +40,14 @@ namespace syscall
         SYS_sendfile = 71,
         SYS_pselect6 = 72, // todo
         SYS_ppoll = 73,
+        SYS_splice = 76,
+        SYS_tee = 77,
         SYS_readlinkat = 78,
         SYS_fstatat = 79,
         SYS_fstat = 80,
-        SYS_sync = 81,  // todo
-        SYS_fsync = 82, // todo
+        SYS_sync = 81,
+        SYS_fsync = 82,
+        SYS_fdatasync = 83,
         SYS_utimensat = 88,
         SYS_exit = 93,
         SYS_exit_group = 94,
@@ -18,6 +18,7 @@
 #endif
 #include "hal/cpu.hh"
 #include "timer_manager.hh"
+#include "tm/timer_wheel.hh"
 #include "fs/vfs/path.hh"
 #include "fs/vfs/file/device_file.hh"
 // #include <asm-generic/ioctls.h>
@@ -25,6 +26,8 @@
 #include <asm-generic/poll.h>
 #include <linux/sysinfo.h>
 #include "fs/vfs/file/normal_file.hh"
+#include "fs/vfs/buffer_manager.hh"
+#include "fs/vfs/io_iter.hh"
 #include "fs/vfs/file/pipe_file.hh"
 #include "proc/pipe.hh"
 #include "proc/signal.hh"
@@ -96,13 +99,16 @@ namespace syscall
         BIND_SYSCALL(pread64);  // todo
         BIND_SYSCALL(pwrite64); // todo
         BIND_SYSCALL(sendfile);
+        BIND_SYSCALL(splice);
+        BIND_SYSCALL(tee);
         BIND_SYSCALL(pselect6); // todo
         BIND_SYSCALL(ppoll);
         BIND_SYSCALL(readlinkat);
         BIND_SYSCALL(fstatat);
         BIND_SYSCALL(fstat);
-        BIND_SYSCALL(sync);  // todo
-        BIND_SYSCALL(fsync); // todo
+        BIND_SYSCALL(sync);
+        BIND_SYSCALL(fsync);
+        BIND_SYSCALL(fdatasync);
         BIND_SYSCALL(utimensat);
         BIND_SYSCALL(exit);
         BIND_SYSCALL(exit_group);
@@ -192,7 +198,7 @@ namespace syscall
         {
             // printf("---------- start ------------\n");
             // printfMagenta("[Pcb::get_open_file] pid: %d\n", p->_pid);
-            printfGreen("[invoke_syscaller]sys_num: %d sys_name: %s\n", sys_num, _syscall_name[sys_num]);
+            log_trace("[invoke_syscaller]sys_num: %d sys_name: %s\n", sys_num, _syscall_name[sys_num]);
         }
 
         if (sys_num >= max_syscall_funcs_num || sys_num < 0 || _syscall_funcs[sys_num] == nullptr)
@@ -355,7 +361,7 @@ namespace syscall
     {
         panic("未实现该系统调用");
         TODO("sys_exec");
-        printfYellow("sys_exec\n");
+        log_trace("sys_exec\n");
         return 0;
     }
     uint64 SyscallHandler::sys_fork()
@@ -368,7 +374,7 @@ namespace syscall
              } return proc::k_pm.fork(usp); // 调用进程管理器的 fork 函数
         )
         TODO("sys_fork");
-        printfYellow("sys_fork\n");
+        log_trace("sys_fork\n");
         return 0;
     }
     uint64 SyscallHandler::sys_exit()
@@ -392,7 +398,7 @@ namespace syscall
             return -1;
         }
         int waitret = proc::k_pm.wait4(pid, wstatus_addr, 0);
-        printf("[SyscallHandler::sys_wait] waitret: %d",
+        log_trace("[SyscallHandler::sys_wait] waitret: %d",
                waitret);
         return waitret;
     }
@@ -482,26 +488,14 @@ namespace syscall
         if (n <= 0)
             return -5;
         // printfCyan("[sys_read] Try read,f:%x,buf:%x", f, f);
-        proc::Pcb *p = proc::k_pm.get_cur_pcb();
-        mem::PageTable *pt = p->get_pagetable();
-
-        char *k_buf = new char[n + 1];
-        int ret = f->read((uint64)k_buf, n, f->get_file_offset(), true);
-        if (ret < 0)
-            return -6;
-
-        static int string_length = 0;
-        string_length += strlen(k_buf);
-        // printf("[sys_read] read %d characters in total\n", string_length);
-        // 添加调试打印，显示读取到的内容
-        k_buf[ret] = '\0'; // 确保字符串以null结尾
-        // printfCyan("[sys_read] fd=%d, read %d bytes: \"%s\"\n", fd, ret, k_buf);
+        // 管道直接在用户页与环之间搬运，不经过内核中转缓冲区
+        if (f->_attrs.filetype == fs::FileTypes::FT_PIPE)
+            return static_cast<fs::pipe_file *>(f)->get_pipe()->read_user(buf, n);
 
-        if (mem::k_vmm.copy_out(*pt, buf, k_buf, ret) < 0)
-            return -7;
-
-        delete[] k_buf;
-        return ret;
+        // 文件内容直接读进用户页
+        mem::PageTable *pt = proc::k_pm.get_cur_pcb()->get_pagetable();
+        fs::IoIter it(pt, buf, n, true);
+        return f->read_iter(it, f->get_file_offset(), true);
     }
     uint64 SyscallHandler::sys_kill()
     {
@@ -791,19 +785,14 @@ namespace syscall
         // if (fd > 2)
         //     printfRed("invoke sys_write\n");
         // printf("syscall_write: fd: %d, p: %p, n: %d\n", fd, (void *)p, n);
-        proc::Pcb *proc = proc::k_pm.get_cur_pcb();
-        mem::PageTable *pt = proc->get_pagetable();
-        char *buf = new char[n + 10];
-        {
-            mem::UserspaceStream uspace((void *)p, n + 1, pt);
-            uspace.open();
-            mem::UsRangeDesc urd = std::make_tuple((u8 *)buf, (ulong)n + 1);
-            uspace >> urd;
-            uspace.close();
-        }
-        long rc = f->write((ulong)buf, n, f->get_file_offset(), true);
-        delete[] buf;
-        return rc;
+        if (f->_attrs.filetype == fs::FileTypes::FT_PIPE)
+            return static_cast<fs::pipe_file *>(f)->get_pipe()->write(p, n);
+
+        if (n <= 0)
+            return 0;
+        mem::PageTable *pt = proc::k_pm.get_cur_pcb()->get_pagetable();
+        fs::IoIter it(pt, p, n, false);
+        return f->write_iter(it, f->get_file_offset(), true);
     }
 
     uint64 SyscallHandler::sys_unlinkat()
@@ -831,7 +820,7 @@ namespace syscall
     {
         panic("未实现该系统调用");
         TODO("sys_linkat");
-        printfYellow("sys_linkat\n");
+        log_trace("sys_linkat\n");
         return 0;
     }
     uint64 SyscallHandler::sys_mkdirat()
@@ -869,7 +858,7 @@ namespace syscall
     {
         panic("未实现该系统调用");
         TODO("sys_mkn");
-        printfYellow("sys_mkn\n");
+        log_trace("sys_mkn\n");
         return 0;
     }
     uint64 SyscallHandler::sys_clone()
@@ -899,7 +888,7 @@ namespace syscall
         printfCyan("[SyscallHandler::sys_clone] flags: %p, stack: %p, ptid: %p, tls: %p, ctid: %p\n",
                flags, (void *)stack, (void *)ptid, (void *)tls, (void *)ctid);
         clone_pid = proc::k_pm.clone(flags, stack, ptid, tls, ctid);
-        printfRed("[SyscallHandler::sys_clone] pid: [%d] tid: [%d] name: %s clone_pid: [%d]\n", proc::k_pm.get_cur_pcb()->_pid, proc::k_pm.get_cur_pcb()->_tid, proc::k_pm.get_cur_pcb()->_name, clone_pid);
+        log_trace("[SyscallHandler::sys_clone] pid: [%d] tid: [%d] name: %s clone_pid: [%d]\n", proc::k_pm.get_cur_pcb()->_pid, proc::k_pm.get_cur_pcb()->_tid, proc::k_pm.get_cur_pcb()->_name, clone_pid);
         return clone_pid;
     }
     uint64 SyscallHandler::sys_umount2()
@@ -1101,37 +1090,31 @@ namespace syscall
     }
     uint64 SyscallHandler::sys_nanosleep()
     {
-
-        int clockid;
-        int flags;
-        timespec dur;
-        uint64 dur_addr;
-        timespec rem;
+        tmm::timespec req;
+        uint64 req_addr;
         uint64 rem_addr;
-        if (_arg_int(0, clockid) < 0 || _arg_int(1, flags) < 0 ||
-            _arg_addr(0, dur_addr) < 0 || _arg_addr(1, rem_addr) < 0)
+        if (_arg_addr(0, req_addr) < 0 || _arg_addr(1, rem_addr) < 0)
         {
             printfRed("[SyscallHandler::sys_nanosleep] Error fetching nanosleep arguments\n");
-            return -1;
+            return -EINVAL;
         }
 
         proc::Pcb *cur_proc = proc::k_pm.get_cur_pcb();
         mem::PageTable *pt = cur_proc->get_pagetable();
 
-        if (dur_addr != 0)
-            if (mem::k_vmm.copy_in(*pt, &dur, dur_addr, sizeof(dur)) < 0)
-                return -1;
-        // printfCyan("into nano sleep,dur_addr:%p.rem_addr:%p\n", dur_addr, rem_addr);
-        if (rem_addr != 0)
-            if (mem::k_vmm.copy_in(*pt, &rem, rem_addr, sizeof(rem)) < 0)
-                return -1;
-
-        tmm::timeval tm_;
-        tm_.tv_sec = dur.tv_sec;
-        tm_.tv_usec = dur.tv_nsec / 1000;
+        if (mem::k_vmm.copy_in(*pt, &req, req_addr, sizeof(req)) < 0)
+            return -EFAULT;
+        if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= (long)tmm::_1G_dec)
+            return -EINVAL;
 
-        tmm::k_tm.sleep_from_tv(tm_);
+        if (tmm::k_tm.sleep_n_ticks(tmm::k_tm.timespec_to_ticks(req)) == -2)
+            return -EINTR;
 
+        if (rem_addr != 0)
+        {
+            tmm::timespec zero_ts{0, 0};
+            mem::k_vmm.copy_out(*pt, rem_addr, &zero_ts, sizeof(zero_ts));
+        }
         return 0;
     }
     uint64 SyscallHandler::sys_getcwd()
@@ -1174,6 +1157,9 @@ namespace syscall
         fs::normal_file *normal_f = static_cast<fs::normal_file *>(f);
 
         mem::PageTable *pt = proc::k_pm.get_cur_pcb()->get_pagetable();
+        // UserspaceStream 经物理地址写入，先拆分写时复制页
+        if (mem::k_vmm.cow_prepare_write(*pt, buf_addr, buf_len) < 0)
+            return -1;
 
         mem::UserspaceStream us((void *)buf_addr, buf_len, pt);
 
@@ -1241,7 +1227,7 @@ namespace syscall
 
         if (_arg_addr(2, oldactaddr) < 0)
             return -1;
-        printf("[SyscallHandler::sys_rt_sigaction] signum: %d, newactaddr: %p, oldactaddr: %p\n",
+        log_trace("[SyscallHandler::sys_rt_sigaction] signum: %d, newactaddr: %p, oldactaddr: %p\n",
                signum, (void *)newactaddr, (void *)oldactaddr);
 
         if (newactaddr != 0)
@@ -1429,6 +1415,8 @@ namespace syscall
         }
         proc::Pcb *p = proc::k_pm.get_cur_pcb();
         mem::PageTable *pt = p->get_pagetable();
+        if (mem::k_vmm.cow_prepare_write(*pt, addr, sizeof(proc::robust_list_head)) < 0)
+            return -10;
 #ifdef RISCV
         head = (proc::robust_list_head *)pt->walk_addr(addr);
 #elif defined(LOONGARCH)
@@ -1459,46 +1447,24 @@ namespace syscall
             return -1;
         }
 
-        proc::Pcb *proc = proc::k_pm.get_cur_pcb();
-        mem::PageTable *pt = proc->get_pagetable();
-
-        uint64 writebytes = 0;
+        if (iovcnt <= 0 || iovcnt > IOV_MAX)
+            return -EINVAL;
 
-        for (int i = 0; i < iovcnt; i++)
+        mem::PageTable *pt = proc::k_pm.get_cur_pcb()->get_pagetable();
+        fs::IoVec *vec = new fs::IoVec[iovcnt];
+        if (mem::k_vmm.copy_in(*pt, vec, iov_ptr, sizeof(fs::IoVec) * iovcnt) < 0)
         {
-            struct iovec iov;
-            uint64 iov_addr = iov_ptr + i * sizeof(struct iovec);
-
-            {
-                mem::UserspaceStream uspace((void *)iov_addr, sizeof(struct iovec), pt);
-                uspace.open();
-                mem::UsRangeDesc urd = std::make_tuple((u8 *)&iov, sizeof(struct iovec));
-                uspace >> urd;
-                uspace.close();
-            }
-
-            char *buf = new char[iov.iov_len + 10];
-            {
-                mem::UserspaceStream uspace((void *)iov.iov_base, iov.iov_len + 1, pt);
-                uspace.open();
-                mem::UsRangeDesc urd = std::make_tuple((u8 *)buf, (ulong)iov.iov_len + 1);
-                uspace >> urd;
-                uspace.close();
-            }
-
-            long rc = f->write((ulong)buf, iov.iov_len, f->get_file_offset(), true);
-            delete[] buf;
-
-            if (rc < 0)
-            {
-                printfRed("[SyscallHandler::sys_writev] 写入文件失败\n");
-                return -1;
-            }
-
-            writebytes += rc;
+            delete[] vec;
+            return -EFAULT;
         }
 
-        return writebytes;
+        // 所有段描述成一个缓冲区，各段的用户页直接交给文件写入
+        fs::IoIter it(pt, vec, iovcnt, false);
+        long rc = f->write_iter(it, f->get_file_offset(), true);
+        delete[] vec;
+        if (rc < 0)
+            printfRed("[SyscallHandler::sys_writev] 写入文件失败\n");
+        return rc;
     }
     uint64 SyscallHandler::SyscallHandler::sys_prlimit64()
     {
@@ -1530,6 +1496,8 @@ namespace syscall
         proc::rlimit64 *nlim = nullptr, *olim = nullptr;
         proc::Pcb *p = proc::k_pm.get_cur_pcb();
         mem::PageTable *pt = p->get_pagetable();
+        if (old_limit != 0 && mem::k_vmm.cow_prepare_write(*pt, old_limit, sizeof(proc::rlimit64)) < 0)
+            return -4;
 #ifdef RISCV
         if (new_limit != 0)
             nlim = (proc::rlimit64 *)pt->walk_addr(new_limit);
@@ -1595,6 +1563,7 @@ namespace syscall
 
         char *buffer = new char[buf_size];
         ret = dent->getNode()->readlinkat(buffer, buf_size);
+        dent->dput();
 
         if (mem::k_vmm.copy_out(*pt, buf, (void *)buffer, ret) < 0)
         {
@@ -1664,6 +1633,8 @@ namespace syscall
         tmm::timespec *tp = nullptr;
         proc::Pcb *p = proc::k_pm.get_cur_pcb();
         mem::PageTable *pt = p->get_pagetable();
+        if (addr != 0 && mem::k_vmm.cow_prepare_write(*pt, addr, sizeof(tmm::timespec)) < 0)
+            return -2;
         if (addr != 0)
 #ifdef RISCV
             tp = (tmm::timespec *)pt->walk_addr(addr);
@@ -1707,6 +1678,8 @@ namespace syscall
         {
             fs::device_file *df = (fs::device_file *)f;
             mem::PageTable *pt = proc::k_pm.get_cur_pcb()->get_pagetable();
+            if (mem::k_vmm.cow_prepare_write(*pt, arg, 64) < 0) // termios 在这里是不完整类型，按 64 字节上界处理
+                return -3;
 #ifdef RISCV
             termios *ts = (termios *)pt->walk_addr(arg);
 #elif defined(LOONGARCH)
@@ -1719,6 +1692,8 @@ namespace syscall
         if ((cmd & 0XFFFF) == TIOCGPGRP)
         {
             mem::PageTable *pt = proc::k_pm.get_cur_pcb()->get_pagetable();
+            if (mem::k_vmm.cow_prepare_write(*pt, arg, sizeof(int)) < 0)
+                return -3;
 #ifdef RISCV
             int *p_pgrp = (int *)pt->walk_addr(arg);
 #elif defined(LOONGARCH)
@@ -1845,6 +1820,19 @@ namespace syscall
             }
             return retfd;
 
+        case F_GETPIPE_SZ:
+            if (f->_attrs.filetype != fs::FileTypes::FT_PIPE)
+                return -EBADF;
+            return static_cast<fs::pipe_file *>(f)->get_pipe()->get_size();
+
+        case F_SETPIPE_SZ:
+            if (_arg_addr(2, arg) < 0)
+                return -3;
+            if (f->_attrs.filetype != fs::FileTypes::FT_PIPE)
+                return -EBADF;
+            // fcntl 的参数按 unsigned int 解释；没有用户和能力模型，进程都以 root 身份运行
+            return static_cast<fs::pipe_file *>(f)->get_pipe()->set_size((uint)arg, true);
+
         default:
             break;
         }
@@ -1964,9 +1952,10 @@ namespace syscall
         uint64 sigmask_addr;
         pollfd *fds = nullptr;
         int nfds;
-        [[maybe_unused]] timespec tm{0, 0}; // 现在没用上
+        tmm::timespec tm{0, 0};
         [[maybe_unused]] sigset_t sigmask;  // 现在没用上
-        [[maybe_unused]] int timeout;       // 现在没用上
+        bool has_timeout = false;
+        uint64 expires = 0;
         int ret = 0;
 
         proc::Pcb *proc = proc::k_pm.get_cur_pcb();
@@ -2006,10 +1995,9 @@ namespace syscall
                 delete[] fds;
                 return -1;
             }
-            timeout = tm.tv_sec * 1000 + tm.tv_nsec / 1'000'000;
+            has_timeout = true;
+            expires = tmm::k_twheel.jiffies() + tmm::k_tm.timespec_to_ticks(tm);
         }
-        else
-            timeout = -1;
 
         if (sigmask_addr != 0)
             if (mem::k_vmm.copy_in(*pt, &sigmask, sigmask_addr,
@@ -2062,10 +2050,14 @@ namespace syscall
             }
             if (ret != 0)
                 break;
-            // else
-            // {
-            // 	/// @todo sleep
-            // }
+            if (has_timeout && tmm::k_twheel.jiffies() >= expires)
+                break;
+            // 文件还没有就绪等待队列，只能每个 tick 重新检查一次
+            if (tmm::k_tm.sleep_n_ticks(1) == -2)
+            {
+                delete[] fds;
+                return -EINTR;
+            }
         }
 
         if (mem::k_vmm.copy_out(*pt, fds_addr, fds, nfds * sizeof(pollfd)) < 0)
@@ -2087,45 +2079,145 @@ namespace syscall
         if (_arg_fd(1, &in_fd, &in_f) < 0)
             return -2;
 
-        ulong addr;
-        ulong *p_off = nullptr;
-        p_off = p_off;
-        if (_arg_addr(2, addr) < 0)
+        uint64 off_addr;
+        if (_arg_addr(2, off_addr) < 0)
             return -3;
-
-        mem::PageTable *pt = proc::k_pm.get_cur_pcb()->get_pagetable();
-        if (addr != 0)
-            p_off = (ulong *)pt->walk_addr(addr); // TODO：TBD原来这里有to_vir
-
         size_t count;
         if (_arg_addr(3, count) < 0)
             return -4;
 
-        /// @todo sendfile
-
-        ulong start_off = in_f->get_file_offset();
-        if (p_off != nullptr)
-            start_off = *p_off;
+        // 给定偏移指针时从 *offset 读并回写新偏移，输入文件自己的偏移不动
+        mem::PageTable *pt = proc::k_pm.get_cur_pcb()->get_pagetable();
+        long off = -1;
+        if (off_addr != 0)
+        {
+            if (mem::k_vmm.copy_in(*pt, &off, off_addr, sizeof(off)) < 0)
+                return -EFAULT;
+            if (off < 0)
+                return -EINVAL;
+        }
 
-        char *buf = new char[count + 1];
-        if (buf == nullptr)
+        // 经一页内核缓冲区分段搬运，不按 count 整块分配
+        void *page = mem::k_pmm.alloc_page();
+        if (page == nullptr)
             return -5;
+        bool out_pipe = out_f->_attrs.filetype == fs::FileTypes::FT_PIPE;
+        long total = 0;
+        while ((size_t)total < count)
+        {
+            size_t n = count - total < PGSIZE ? count - total : PGSIZE;
+            long rd = in_f->read((uint64)page, n, off < 0 ? -1 : off + total, off < 0);
+            if (rd <= 0)
+            {
+                if (total == 0)
+                    total = rd;
+                break;
+            }
+            long wr = out_pipe ? ((fs::pipe_file *)out_f)->write_in_kernel((uint64)page, rd)
+                               : out_f->write((uint64)page, rd, out_f->get_file_offset(), true);
+            if (wr <= 0)
+            {
+                if (total == 0)
+                    total = wr;
+                if (off < 0)
+                    in_f->lseek(-rd, SEEK_CUR);
+                break;
+            }
+            total += wr;
+            if (wr < rd)
+            {
+                // 没写出去的部分视为没读
+                if (off < 0)
+                    in_f->lseek(wr - rd, SEEK_CUR);
+                break;
+            }
+            if ((size_t)rd < n)
+                break;
+        }
+        mem::k_pmm.free_page(page);
 
-        int readcnt = in_f->read((ulong)buf, count, start_off, true);
-        int writecnt = 0;
-        if (out_f->_attrs.filetype == fs::FileTypes::FT_PIPE)
-            writecnt = ((fs::pipe_file *)out_f)
-                           ->write_in_kernel((ulong)buf, readcnt);
-        else
-            writecnt = out_f->write((ulong)buf, readcnt,
-                                    out_f->get_file_offset(), true);
+        if (off_addr != 0 && total > 0)
+        {
+            off += total;
+            if (mem::k_vmm.copy_out(*pt, off_addr, &off, sizeof(off)) < 0)
+                return -EFAULT;
+        }
+        return total;
+    }
+    uint64 SyscallHandler::sys_splice()
+    {
+        int fd_in, fd_out, flags;
+        fs::file *f_in, *f_out;
+        uint64 off_in_addr, off_out_addr, len;
+        if (_arg_fd(0, &fd_in, &f_in) < 0 || _arg_fd(2, &fd_out, &f_out) < 0)
+            return -EBADF;
+        if (_arg_addr(1, off_in_addr) < 0 || _arg_addr(3, off_out_addr) < 0 ||
+            _arg_addr(4, len) < 0 || _arg_int(5, flags) < 0)
+            return -EINVAL;
+        (void)flags; // SPLICE_F_MOVE/MORE 只是提示；SPLICE_F_NONBLOCK 暂不支持
 
-        delete[] buf;
+        bool in_pipe = f_in->_attrs.filetype == fs::FileTypes::FT_PIPE;
+        bool out_pipe = f_out->_attrs.filetype == fs::FileTypes::FT_PIPE;
+        if (!in_pipe && !out_pipe)
+            return -EINVAL;
+        if (len == 0)
+            return 0;
+
+        mem::PageTable *pt = proc::k_pm.get_cur_pcb()->get_pagetable();
+        if (in_pipe && out_pipe)
+        {
+            if (off_in_addr || off_out_addr)
+                return -ESPIPE;
+            // 管道到管道：两个环之间直接整块搬运
+            proc::ipc::Pipe *pin = static_cast<fs::pipe_file *>(f_in)->get_pipe();
+            proc::ipc::Pipe *pout = static_cast<fs::pipe_file *>(f_out)->get_pipe();
+            return pin->tee(pout, len, true);
+        }
+
+        // 恰好一端是管道；另一端的偏移可以由用户指定
+        uint64 off_addr = in_pipe ? off_out_addr : off_in_addr;
+        if ((in_pipe ? off_in_addr : off_out_addr) != 0)
+            return -ESPIPE;
+        long off = -1;
+        if (off_addr != 0)
+        {
+            if (mem::k_vmm.copy_in(*pt, &off, off_addr, sizeof(off)) < 0)
+                return -EFAULT;
+            if (off < 0)
+                return -EINVAL;
+        }
 
-        if (p_off != nullptr)
-            *p_off += writecnt;
+        long n;
+        if (in_pipe)
+            n = static_cast<fs::pipe_file *>(f_in)->get_pipe()->splice_to(f_out, off, len);
+        else
+            n = static_cast<fs::pipe_file *>(f_out)->get_pipe()->splice_from(f_in, off, len);
 
-        return writecnt;
+        if (n > 0 && off_addr != 0)
+        {
+            off += n;
+            if (mem::k_vmm.copy_out(*pt, off_addr, &off, sizeof(off)) < 0)
+                return -EFAULT;
+        }
+        return n;
+    }
+    uint64 SyscallHandler::sys_tee()
+    {
+        int fd_in, fd_out, flags;
+        fs::file *f_in, *f_out;
+        uint64 len;
+        if (_arg_fd(0, &fd_in, &f_in) < 0 || _arg_fd(1, &fd_out, &f_out) < 0)
+            return -EBADF;
+        if (_arg_addr(2, len) < 0 || _arg_int(3, flags) < 0)
+            return -EINVAL;
+        (void)flags;
+        if (f_in->_attrs.filetype != fs::FileTypes::FT_PIPE ||
+            f_out->_attrs.filetype != fs::FileTypes::FT_PIPE)
+            return -EINVAL;
+        if (len == 0)
+            return 0;
+        return static_cast<fs::pipe_file *>(f_in)->get_pipe()->tee(
+            static_cast<fs::pipe_file *>(f_out)->get_pipe(), len);
     }
     uint64 SyscallHandler::sys_readv()
     {
@@ -2144,57 +2236,22 @@ namespace syscall
 
         if (f == nullptr || iovcnt <= 0)
             return -4;
+        if (iovcnt > IOV_MAX)
+            return -EINVAL;
 
         proc::Pcb *p = proc::k_pm.get_cur_pcb();
         mem::PageTable *pt = p->get_pagetable();
 
-        // 分配内核缓冲区存放iovec数组
-        struct iovec
-        {
-            void *iov_base;
-            size_t iov_len;
-        };
-        size_t totsize = sizeof(iovec) * iovcnt;
-        iovec *vec = new iovec[iovcnt];
-        if (!vec)
-            return -5;
-
-        // 从用户空间拷贝iovec数组
-        if (mem::k_vmm.copy_in(*pt, vec, iov_ptr, totsize) < 0)
+        // 把 iovec 数组拷进内核，各段的用户页直接作为读目标
+        fs::IoVec *vec = new fs::IoVec[iovcnt];
+        if (mem::k_vmm.copy_in(*pt, vec, iov_ptr, sizeof(fs::IoVec) * iovcnt) < 0)
         {
             delete[] vec;
             return -6;
         }
 
-        int nread = 0;
-        for (int i = 0; i < iovcnt; ++i)
-        {
-            if (vec[i].iov_len == 0)
-                continue;
-            char *k_buf = new char[vec[i].iov_len];
-            if (!k_buf)
-            {
-                delete[] vec;
-                return -7;
-            }
-            int ret = f->read((uint64)k_buf, vec[i].iov_len, f->get_file_offset(), true);
-            if (ret < 0)
-            {
-                delete[] k_buf;
-                delete[] vec;
-                return -8;
-            }
-            if (mem::k_vmm.copy_out(*pt, (uint64)vec[i].iov_base, k_buf, ret) < 0)
-            {
-                delete[] k_buf;
-                delete[] vec;
-                return -9;
-            }
-            nread += ret;
-            delete[] k_buf;
-            // 文件偏移量已在f->read内部更新
-        }
-
+        fs::IoIter it(pt, vec, iovcnt, true);
+        long nread = f->read_iter(it, f->get_file_offset(), true);
         delete[] vec;
         return nread;
     }
@@ -2208,7 +2265,17 @@ namespace syscall
     }
     uint64 SyscallHandler::sys_mremap()
     {
-        panic("未实现该系统调用");
+        uint64 old_addr, old_size, new_size;
+        int flags;
+        if (_arg_addr(0, old_addr) < 0)
+            return -1;
+        if (_arg_addr(1, old_size) < 0)
+            return -1;
+        if (_arg_addr(2, new_size) < 0)
+            return -1;
+        if (_arg_int(3, flags) < 0)
+            return -1;
+        return (uint64)proc::k_pm.mremap((void *)old_addr, old_size, new_size, flags);
     }
 
     uint64 SyscallHandler::sys_lseek()
@@ -2295,6 +2362,7 @@ namespace syscall
         fs::dentry *den = path.pathSearch();
         if (den == nullptr)
             return -ENOENT;
+        den->dput();
 
         // int fd = path.open();
 
@@ -2406,41 +2474,9 @@ namespace syscall
             total_ns = requested_ns - current_ns;
         }
 
-        auto start_tv = tmm::k_tm.get_time_val();
-        uint64 start_ns = start_tv.tv_sec * 1000000000ULL + start_tv.tv_usec * 1000ULL;
-        while (true)
-        {
-            // 信号相关代码已忽略
-            // if (proc::k_pm.has_pending_signal(proc::k_pm.get_cur_pcb()))
-            // {
-            //     if (rem_addr != 0)
-            //     {
-            //         tmm::timespec rem_ts;
-            //         uint64 used = tmm::k_tm.get_time_ns() - start_ns;
-            //         if (used >= total_ns)
-            //         {
-            //             rem_ts.tv_sec = 0;
-            //             rem_ts.tv_nsec = 0;
-            //         }
-            //         else
-            //         {
-            //             uint64 left = total_ns - used;
-            //             rem_ts.tv_sec = left / 1000000000ULL;
-            //             rem_ts.tv_nsec = left % 1000000000ULL;
-            //         }
-            //         mem::k_vmm.copy_out(*proc::k_pm.get_cur_pcb()->get_pagetable(),
-            //                             rem_addr, &rem_ts, sizeof(rem_ts));
-            //     }
-            //     return -EINTR;
-            // }
-
-            auto now_tv = tmm::k_tm.get_time_val();
-            uint64 now_ns = now_tv.tv_sec * 1000000000ULL + now_tv.tv_usec * 1000ULL;
-            if (now_ns - start_ns >= total_ns)
-                break;
-            // 暂时放弃 CPU
-            proc::k_scheduler.yield();
-        }
+        // 信号不会打断睡眠，rem 总是 0
+        if (tmm::k_tm.sleep_n_ticks(tmm::k_tm.ns_to_ticks(total_ns)) == -2)
+            return -EINTR;
 
         // 正常返回
         if (rem_addr != 0)
@@ -2480,7 +2516,16 @@ namespace syscall
     }
     uint64 SyscallHandler::sys_ftruncate()
     {
-        panic("未实现该系统调用");
+        int fd;
+        fs::file *f;
+        uint64 length;
+        if (_arg_fd(0, &fd, &f) < 0)
+            return -EBADF;
+        if (_arg_addr(1, length) < 0)
+            return -EINVAL;
+        if ((long)length < 0 || f->_attrs.filetype != fs::FileTypes::FT_NORMAL)
+            return -EINVAL;
+        return static_cast<fs::normal_file *>(f)->truncate(length);
     }
     uint64 SyscallHandler::sys_pread64()
     {
@@ -2497,28 +2542,11 @@ namespace syscall
         if (!f)
             return -1;
 
-        auto old_off = f->get_file_offset();
-        f->lseek(offset, SEEK_SET);
-
-        char *kbuf = new char[count];
-        long rc = f->read((ulong)kbuf, count, f->get_file_offset(), true);
-        if (rc < 0)
-        {
-            delete[] kbuf;
-            f->lseek(old_off, SEEK_SET);
-            return rc;
-        }
-
-        if (mem::k_vmm.copy_out(*p->get_pagetable(), buf, kbuf, rc) < 0)
-        {
-            delete[] kbuf;
-            f->lseek(old_off, SEEK_SET);
-            return -1;
-        }
-
-        f->lseek(old_off, SEEK_SET);
-        delete[] kbuf;
-        return rc;
+        if (offset < 0)
+            return -EINVAL;
+        // 指定偏移读，不移动文件偏移
+        fs::IoIter it(p->get_pagetable(), buf, count, true);
+        return f->read_iter(it, offset, false);
     }
     uint64 SyscallHandler::sys_pwrite64()
     {
@@ -2535,35 +2563,123 @@ namespace syscall
         if (!f)
             return -1;
 
-        auto old_off = f->get_file_offset();
-        f->lseek(offset, SEEK_SET);
+        if (offset < 0)
+            return -EINVAL;
+        fs::IoIter it(p->get_pagetable(), buf, count, false);
+        return f->write_iter(it, offset, false);
+    }
+    constexpr int fd_set_words = 1024 / 64; // FD_SETSIZE 为 1024
+    uint64 SyscallHandler::sys_pselect6()
+    {
+        int nfds;
+        uint64 set_addr[3]; // readfds, writefds, exceptfds
+        uint64 timeout_addr;
+        if (_arg_int(0, nfds) < 0 || _arg_addr(1, set_addr[0]) < 0 ||
+            _arg_addr(2, set_addr[1]) < 0 || _arg_addr(3, set_addr[2]) < 0 ||
+            _arg_addr(4, timeout_addr) < 0)
+            return -EINVAL;
+        if (nfds < 0 || nfds > fd_set_words * 64)
+            return -EINVAL;
+
+        proc::Pcb *p = proc::k_pm.get_cur_pcb();
+        mem::PageTable *pt = p->get_pagetable();
+        uint64 set_bytes = (nfds + 63) / 64 * sizeof(uint64);
+
+        uint64 in[3][fd_set_words];
+        memset(in, 0, sizeof(in));
+        for (int i = 0; i < 3; i++)
+            if (set_addr[i] != 0 && set_bytes != 0 &&
+                mem::k_vmm.copy_in(*pt, in[i], set_addr[i], set_bytes) < 0)
+                return -EFAULT;
 
-        char *kbuf = new char[count];
-        if (mem::k_vmm.copy_in(*p->get_pagetable(), kbuf, buf, count) < 0)
+        bool has_timeout = false;
+        uint64 expires = 0;
+        if (timeout_addr != 0)
         {
-            delete[] kbuf;
-            f->lseek(old_off, SEEK_SET);
-            return -1;
+            tmm::timespec tm;
+            if (mem::k_vmm.copy_in(*pt, &tm, timeout_addr, sizeof(tm)) < 0)
+                return -EFAULT;
+            if (tm.tv_sec < 0 || tm.tv_nsec < 0 || tm.tv_nsec >= (long)tmm::_1G_dec)
+                return -EINVAL;
+            has_timeout = true;
+            expires = tmm::k_twheel.jiffies() + tmm::k_tm.timespec_to_ticks(tm);
+        }
+
+        uint64 out[3][fd_set_words];
+        int ret;
+        while (1)
+        {
+            memset(out, 0, sizeof(out));
+            ret = 0;
+            for (int fd = 0; fd < nfds; fd++)
+            {
+                int w = fd / 64;
+                uint64 bit = 1UL << (fd % 64);
+                if (((in[0][w] | in[1][w] | in[2][w]) & bit) == 0)
+                    continue;
+                fs::file *f = p->get_open_file(fd);
+                if (f == nullptr)
+                    return -EBADF;
+                if ((in[0][w] & bit) && f->read_ready())
+                {
+                    out[0][w] |= bit;
+                    ret++;
+                }
+                if ((in[1][w] & bit) && f->write_ready())
+                {
+                    out[1][w] |= bit;
+                    ret++;
+                }
+                // 没有带外数据，异常集合总为空
+            }
+            if (ret != 0)
+                break;
+            if (has_timeout && tmm::k_twheel.jiffies() >= expires)
+                break;
+            // 与 ppoll 相同，按 tick 重新检查
+            if (tmm::k_tm.sleep_n_ticks(1) == -2)
+                return -EINTR;
         }
 
-        long rc = f->write((ulong)kbuf, count, f->get_file_offset(), true);
-        delete[] kbuf;
-        f->lseek(old_off, SEEK_SET);
-        return rc < 0 ? rc : rc;
+        for (int i = 0; i < 3; i++)
+            if (set_addr[i] != 0 && set_bytes != 0 &&
+                mem::k_vmm.copy_out(*pt, set_addr[i], out[i], set_bytes) < 0)
+                return -EFAULT;
+        return ret;
     }
-    uint64 SyscallHandler::sys_pselect6()
+    uint64 SyscallHandler::sys_sync()
     {
-        panic("未实现该系统调用");
+        // sync 不报告错误
+        fs::k_bufm.sync_all();
+        return 0;
     }
-    uint64 SyscallHandler::sys_sync()
+    /// @brief fsync/fdatasync 的公共部分：只写回并等待该文件自己的缓冲区
+    static long _do_fsync(fs::file *f, bool datasync)
     {
-        return 0; // copy from 唐老师
-        panic("未实现该系统调用");
+        if (f->_attrs.filetype == fs::FileTypes::FT_PIPE ||
+            f->_attrs.filetype == fs::FileTypes::FT_DEVICE)
+            return -EINVAL;
+        if (f->_attrs.filetype != fs::FileTypes::FT_NORMAL &&
+            f->_attrs.filetype != fs::FileTypes::FT_DIRECT)
+            return 0;
+        fs::dentry *de = static_cast<fs::normal_file *>(f)->getDentry();
+        if (de == nullptr || de->getNode() == nullptr)
+            return 0;
+        return de->getNode()->sync(datasync) < 0 ? -EIO : 0;
     }
     uint64 SyscallHandler::sys_fsync()
     {
-        return 0; // copy from 唐老师
-        panic("未实现该系统调用");
+        fs::file *f;
+        if (_arg_fd(0, nullptr, &f) < 0)
+            return -EBADF;
+        return _do_fsync(f, false);
+    }
+    uint64 SyscallHandler::sys_fdatasync()
+    {
+        fs::file *f;
+        if (_arg_fd(0, nullptr, &f) < 0)
+            return -EBADF;
+        return _do_fsync(f, true);
     }
     uint64 SyscallHandler::sys_futex()
     {
@@ -2601,7 +2717,7 @@ namespace syscall
             _arg_int(3, val2);
         }
 
-        printf("sys_futex: uaddr=%p, op=%d, val=%d, timeout=%p, uaddr2=%p, val3=%d\n",  uaddr, op, val, timeout_ptr, uaddr2, val3);
+        log_trace("sys_futex: uaddr=%p, op=%d, val=%d, timeout=%p, uaddr2=%p, val3=%d\n",  uaddr, op, val, timeout_ptr, uaddr2, val3);
         // printf("paddr: %p\n", proc::k_pm.get_cur_pcb()->_pt.walk_addr(uaddr));
         switch (op)
         {
@@ -2619,9 +2735,78 @@ namespace syscall
     {
         panic("未实现该系统调用");
     }
+    /// @brief ITIMER_REAL 到期：投递 SIGALRM，有间隔时从本次到期时刻起重新挂上
+    static void _itimer_expire(tmm::Timer *t)
+    {
+        proc::Pcb *p = (proc::Pcb *)t->data;
+        p->_lock.acquire();
+        if (p->_state != proc::ProcState::UNUSED && p->_state != proc::ProcState::ZOMBIE)
+        {
+            p->add_signal(proc::ipc::signal::SIGALRM);
+            if (p->_itimer_interval != 0)
+                tmm::k_twheel.add(t, t->expires + p->_itimer_interval);
+        }
+        p->_lock.release();
+    }
+    static tmm::timeval _ticks_to_tv(uint64 ticks)
+    {
+        uint64 ns = tmm::k_tm.ticks_to_ns(ticks);
+        tmm::timeval tv;
+        tv.tv_sec = ns / tmm::_1G_dec;
+        tv.tv_usec = ns % tmm::_1G_dec / tmm::_1K_dec;
+        return tv;
+    }
     uint64 SyscallHandler::sys_setitimer()
     {
-        panic("未实现该系统调用");
+        int which;
+        uint64 new_addr, old_addr;
+        if (_arg_int(0, which) < 0 || _arg_addr(1, new_addr) < 0 || _arg_addr(2, old_addr) < 0)
+            return -EINVAL;
+        // ITIMER_VIRTUAL/ITIMER_PROF 按进程运行时间计时，暂不支持
+        if (which != tmm::ITIMER_REAL)
+            return -EINVAL;
+
+        proc::Pcb *p = proc::k_pm.get_cur_pcb();
+        mem::PageTable *pt = p->get_pagetable();
+
+        tmm::itimerval nv;
+        if (new_addr != 0 && mem::k_vmm.copy_in(*pt, &nv, new_addr, sizeof(nv)) < 0)
+            return -EFAULT;
+
+        // 先摘下旧的定时器，回调不会再改动它，可以放心读取剩余时间
+        bool armed = tmm::k_twheel.del_sync(&p->_itimer);
+        if (old_addr != 0)
+        {
+            tmm::itimerval ov;
+            uint64 now = tmm::k_twheel.jiffies();
+            uint64 left = 0;
+            if (armed)
+                left = p->_itimer.expires > now ? p->_itimer.expires - now : 1;
+            ov.it_value = _ticks_to_tv(left);
+            ov.it_interval = _ticks_to_tv(p->_itimer_interval);
+            if (mem::k_vmm.copy_out(*pt, old_addr, &ov, sizeof(ov)) < 0)
+            {
+                if (armed)
+                    tmm::k_twheel.add(&p->_itimer, p->_itimer.expires);
+                return -EFAULT;
+            }
+        }
+        if (new_addr == 0)
+        {
+            // 只查询：放回原来的定时器
+            if (armed)
+                tmm::k_twheel.add(&p->_itimer, p->_itimer.expires);
+            return 0;
+        }
+
+        p->_itimer_interval = tmm::k_tm.timeval_to_ticks(nv.it_interval);
+        uint64 value = tmm::k_tm.timeval_to_ticks(nv.it_value);
+        if (value != 0)
+        {
+            p->_itimer.init(_itimer_expire, p);
+            tmm::k_twheel.add(&p->_itimer, tmm::k_twheel.jiffies() + value);
+        }
+        return 0;
     }
     uint64 SyscallHandler::sys_sched_getaffinity()
     {
@@ -2821,24 +3006,25 @@ namespace syscall
         if (_arg_int(2, prot) < 0)
             return -1;
 
-        int perm;
+        if (addr % PGSIZE != 0 || (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0)
+            return -EINVAL;
+        len = PGROUNDUP(len);
+        if (len == 0)
+            return 0;
+        // 陷入帧、跳板等内核专用页在用户空间顶端，不能被改成用户可访问
+        if (addr + len < addr || addr + len > TRAPFRAME_CPU(NUMCPU - 1))
+            return -ENOMEM;
 
-        if (prot & PROT_READ)
-        {
-            perm |= PTE_R;
-        }
-        if (prot & PROT_WRITE)
-        {
-            perm |= PTE_W;
-        }
-        if (prot & PROT_EXEC)
-        {
-            perm |= PTE_X;
-        }
-        if (mem::k_vmm.protectpages(*proc::k_pm.get_cur_pcb()->get_pagetable(), addr, len, perm) < 0)
+        proc::Pcb *p = proc::k_pm.get_cur_pcb();
+        p->_vma->_lock.acquire();
+        int ret = mem::k_vmm.protectpages(*p->get_pagetable(), addr, len, prot, &p->_vma->_vm);
+        p->_vma->_lock.release();
+        if (ret < 0)
         {
             return -1;
         }
+        // 尚未缺页的页面按 VMA 的权限建立映射，权限也要记到覆盖这段地址的 VMA 上
+        proc::k_pm.mprotect_vma(addr, len, prot);
         return 0;
     }
     uint64 SyscallHandler::sys_membarrier()
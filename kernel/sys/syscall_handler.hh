@@ -106,6 +106,8 @@ namespace syscall
         uint64 sys_ppoll();
         uint64 sys_utimensat();
         uint64 sys_sendfile();
+        uint64 sys_splice();
+        uint64 sys_tee();
         uint64 sys_geteuid();
         uint64 sys_madvise();
         uint64 sys_mremap();
@@ -123,6 +125,7 @@ namespace syscall
         uint64 sys_pselect6();
         uint64 sys_sync();
         uint64 sys_fsync();
+        uint64 sys_fdatasync();
         uint64 sys_futex();
         uint64 sys_get_robust_list();
         uint64 sys_setitimer();
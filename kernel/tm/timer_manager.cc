@@ -7,6 +7,7 @@
 //
 
 #include "tm/timer_manager.hh"
+#include "tm/timer_wheel.hh"
 #include "proc/proc_manager.hh"
 #include "klib.hh"
 #include "trap/riscv/trap.hh"
@@ -21,6 +22,7 @@ namespace tmm
 		_lock.init(lock_name);
 
 		trap_mgr.ticks = 0;
+		k_twheel.init();
 		printfGreen("[TM] Timer Manager Init\n");
 		// close_ti_intr();
 	}
@@ -74,25 +76,24 @@ namespace tmm
 		return tv;
 	}
 
-	int TimerManager::sleep_n_ticks(int n)
+	int TimerManager::sleep_n_ticks(long n)
 	{
 		if (n < 0)
 			return -1;
 
-		uint64 tick_tmp;
 		proc::Pcb *p = proc::k_pm.get_cur_pcb();
+		uint64 expires = k_twheel.jiffies() + n;
 
+		// 每个睡眠者挂一个自己的定时器，只在到期时被唤醒一次
 		_lock.acquire();
-		tick_tmp = trap_mgr.ticks;
-		while ((int)trap_mgr.ticks - (int)tick_tmp < (int)n)
+		while (k_twheel.jiffies() < expires)
 		{
-			// printfGreen("ticks now:%d,ticks left:%d\n",(int)trap_mgr.ticks,(int)tick_tmp);
 			if (p->is_killed())
 			{
 				_lock.release();
 				return -2;
 			}
-			proc::k_pm.sleep(&trap_mgr.ticks, &_lock);
+			proc::k_pm.sleep_until(nullptr, &_lock, expires);
 		}
 		_lock.release();
 
@@ -104,19 +105,39 @@ namespace tmm
 	/// @return 
 	int TimerManager::sleep_from_tv(timeval tv)
 	{
-
-		uint64 n = tv.tv_sec * tmm::get_main_frequence();
-		uint64 cpt = tmm::cycles_per_tick();
-		// printfBlue("sleep from tv: %u ticks\n", n);
-		n += tmm::usec_to_time_stamp(tv.tv_usec);
-		// printfBlue("sleep from tv: %u ticks\n", n);
-		n /= cpt;
-		// printfBlue("sleep from tv: %u ticks\n", n);
+		uint64 n = timeval_to_ticks(tv);
 		if (n == 0)
 			return 0; // 如果转换结果为0，直接返回
 		return sleep_n_ticks(n);
 	}
 
+	uint64 TimerManager::ns_to_ticks(uint64 ns)
+	{
+		uint64 freq = tmm::get_main_frequence();
+		uint64 cpt = tmm::cycles_per_tick();
+		uint64 cycles = (ns / _1G_dec) * freq + ((ns % _1G_dec) * freq + _1G_dec - 1) / _1G_dec;
+		return (cycles + cpt - 1) / cpt;
+	}
+
+	uint64 TimerManager::timespec_to_ticks(const timespec &ts)
+	{
+		if (ts.tv_sec < 0 || ts.tv_nsec < 0)
+			return 0;
+		return ns_to_ticks((uint64)ts.tv_sec * _1G_dec + (uint64)ts.tv_nsec);
+	}
+
+	uint64 TimerManager::timeval_to_ticks(const timeval &tv)
+	{
+		return ns_to_ticks(tv.tv_sec * _1G_dec + tv.tv_usec * _1K_dec);
+	}
+
+	uint64 TimerManager::ticks_to_ns(uint64 ticks)
+	{
+		uint64 cycles = ticks * tmm::cycles_per_tick();
+		uint64 freq = tmm::get_main_frequence();
+		return (cycles / freq) * _1G_dec + (cycles % freq) * _1G_dec / freq;
+	}
+
 	int TimerManager::clock_gettime(SystemClockId cid, timespec *tp)
 	{
 		if (tp == nullptr)
@@ -128,7 +149,7 @@ namespace tmm
 
 		_lock.acquire();
 		t_val = tmm::get_hw_time_stamp();
-		t_val += trap_mgr.ticks * cpt;
+		t_val += trap_mgr.account_ticks() * cpt;
 		_lock.release();
 
 		tp->tv_sec = (long)(t_val / freq);
@@ -140,7 +161,7 @@ namespace tmm
 
 		return 0;
 	}
- uint64 TimerManager::get_ticks() { return trap_mgr.ticks; };
+ uint64 TimerManager::get_ticks() { return trap_mgr.account_ticks(); };
 	extern "C"
 	{
 
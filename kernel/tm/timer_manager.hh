@@ -35,6 +35,17 @@ namespace tmm
 		suseconds_t tv_usec;    /* microseconds */
 	};
 
+	// 这个结构体来自Linux的定义 
+	struct itimerval
+	{
+		timeval it_interval; /* 到期后重新装填的间隔 */
+		timeval it_value;	 /* 距下一次到期的时间 */
+	};
+
+	constexpr int ITIMER_REAL	 = 0;
+	constexpr int ITIMER_VIRTUAL = 1;
+	constexpr int ITIMER_PROF	 = 2;
+
 	// 这个结构体来自Linux的定义 
 	struct tms
 	{
@@ -81,10 +92,17 @@ namespace tmm
 
 		timeval get_time_val();
 
-		int sleep_n_ticks( int n );
+		int sleep_n_ticks( long n );
 
 		int sleep_from_tv( timeval tv );
 
+		/// @brief 时间长度换算成 tick 数，向上取整，保证睡眠不短于请求的时长
+		uint64 ns_to_ticks( uint64 ns );
+		uint64 timespec_to_ticks( const timespec &ts );
+		uint64 timeval_to_ticks( const timeval &tv );
+		/// @brief tick 数换算回纳秒
+		uint64 ticks_to_ns( uint64 ticks );
+
 		int clock_gettime( SystemClockId clockid, timespec * tp );
 
 		// void open_ti_intr();
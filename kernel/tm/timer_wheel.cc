@@ -0,0 +1,186 @@
+#include "tm/timer_wheel.hh"
+
+namespace tmm
+{
+	TimerWheel k_twheel;
+
+	void TimerWheel::init()
+	{
+		_lock.init( "timer wheel" );
+		_jiffies = 0;
+		_next = 0;
+		_running = nullptr;
+		_count = 0;
+		for ( int l = 0; l < tw_levels; ++l )
+			for ( int i = 0; i < tw_slots; ++i )
+				_wheel[l][i] = nullptr;
+	}
+
+	void TimerWheel::_enqueue( Timer *t )
+	{
+		uint64 expires = t->expires;
+		uint64 delta = expires - _next;
+		Timer **head;
+
+		if ( (long) delta < 0 )
+			head = &_wheel[0][_next & ( tw_slots - 1 )]; // 已经过期，放到马上要处理的槽
+		else if ( delta < ( 1UL << tw_slot_bits ) )
+			head = &_wheel[0][expires & ( tw_slots - 1 )];
+		else if ( delta < ( 1UL << ( 2 * tw_slot_bits ) ) )
+			head = &_wheel[1][( expires >> tw_slot_bits ) & ( tw_slots - 1 )];
+		else if ( delta < ( 1UL << ( 3 * tw_slot_bits ) ) )
+			head = &_wheel[2][( expires >> ( 2 * tw_slot_bits ) ) & ( tw_slots - 1 )];
+		else
+		{
+			// 超出整个轮的范围时先挂在最远处，转到那里时会按真实的 expires 重新分配
+			if ( delta > tw_max_delta )
+				expires = _next + tw_max_delta;
+			head = &_wheel[3][( expires >> ( 3 * tw_slot_bits ) ) & ( tw_slots - 1 )];
+		}
+
+		t->next = *head;
+		if ( *head ) ( *head )->pprev = &t->next;
+		*head = t;
+		t->pprev = head;
+		_count++;
+	}
+
+	void TimerWheel::_unlink( Timer *t )
+	{
+		*t->pprev = t->next;
+		if ( t->next ) t->next->pprev = t->pprev;
+		t->next = nullptr;
+		t->pprev = nullptr;
+		_count--;
+	}
+
+	/// @brief 把第 level 层当前槽里的定时器重新分配到低层，返回该槽的下标
+	int TimerWheel::_cascade( int level )
+	{
+		int idx = ( _next >> ( level * tw_slot_bits ) ) & ( tw_slots - 1 );
+		Timer *t = _wheel[level][idx];
+		_wheel[level][idx] = nullptr;
+		while ( t )
+		{
+			Timer *n = t->next;
+			_count--;
+			_enqueue( t );
+			t = n;
+		}
+		return idx;
+	}
+
+	void TimerWheel::add( Timer *t, uint64 expires )
+	{
+		_lock.acquire();
+		if ( t->pending() )
+			_unlink( t );
+		t->expires = expires;
+		_enqueue( t );
+		bool early = expires < _event;
+		_lock.release();
+		if ( early && _kick != nullptr )
+			_kick();
+	}
+
+	bool TimerWheel::del( Timer *t )
+	{
+		_lock.acquire();
+		bool was = t->pending();
+		if ( was )
+			_unlink( t );
+		_lock.release();
+		return was;
+	}
+
+	bool TimerWheel::del_sync( Timer *t )
+	{
+		bool was = false;
+		while ( true )
+		{
+			_lock.acquire();
+			// 回调可能把自己重新挂上，所以每一轮都要再摘一次
+			if ( t->pending() )
+			{
+				_unlink( t );
+				was = true;
+			}
+			if ( _running != t )
+			{
+				_lock.release();
+				return was;
+			}
+			_lock.release();
+		}
+	}
+
+	uint64 TimerWheel::next_expiry()
+	{
+		uint64 best = ~0UL;
+		_lock.acquire();
+		if ( _count != 0 )
+		{
+			for ( int i = 0; i < tw_slots; ++i )
+			{
+				if ( _wheel[0][( _next + i ) & ( tw_slots - 1 )] )
+				{
+					best = _next + i;
+					break;
+				}
+			}
+			// 高层槽里的定时器不早于该槽的起点到期，而它们可能早于第 0 层里找到的那个
+			for ( int l = 1; l < tw_levels; ++l )
+			{
+				int	   shift = l * tw_slot_bits;
+				uint64 base	 = _next >> shift;
+				for ( int i = 0; i <= tw_slots; ++i )
+				{
+					uint64 when = ( base + i ) << shift;
+					if ( when < _next ) continue; // 当前槽已经分配过，下一次轮到它是一圈之后
+					if ( _wheel[l][( base + i ) & ( tw_slots - 1 )] )
+					{
+						if ( when < best ) best = when;
+						break;
+					}
+				}
+			}
+		}
+		_lock.release();
+		return best;
+	}
+
+	void TimerWheel::tick( uint64 n )
+	{
+		_lock.acquire();
+		_jiffies += n;
+		while ( _next <= _jiffies )
+		{
+			int idx = _next & ( tw_slots - 1 );
+			// 第 0 层转完一圈时从高层依次补充
+			if ( idx == 0 )
+			{
+				for ( int l = 1; l < tw_levels; ++l )
+					if ( _cascade( l ) != 0 )
+						break;
+			}
+
+			// 先把整个槽摘到本地链表上，放锁执行回调期间别人仍可以在锁下从中取消定时器
+			Timer *work = _wheel[0][idx];
+			_wheel[0][idx] = nullptr;
+			if ( work ) work->pprev = &work;
+			while ( work )
+			{
+				Timer *t = work;
+				_unlink( t );
+				_running = t;
+				_lock.release();
+				t->fn( t );
+				_lock.acquire();
+				_running = nullptr;
+			}
+			_next++;
+		}
+		_lock.release();
+	}
+
+} // namespace tmm
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "types.hh"
+#include "spinlock.hh"
+
+namespace tmm
+{
+	struct Timer;
+	/// @brief 定时器到期回调，在时钟中断里、不持有时间轮锁时调用
+	using TimerFn = void ( * )( Timer *t );
+
+	/// @brief 一个定时器。由使用者嵌入自己的结构（常常就在栈上），时间轮不做任何分配。
+	/// 同一时刻只能挂在轮上一次；到期前可以用 del()/del_sync() 取消。
+	struct Timer
+	{
+		Timer  *next   = nullptr;
+		Timer **pprev  = nullptr; // 指向前驱的 next 字段，nullptr 表示不在轮上
+		uint64	expires = 0;	  // 到期的 tick
+		TimerFn fn	   = nullptr;
+		void   *data   = nullptr;
+
+		void init( TimerFn f, void *d )
+		{
+			next = nullptr;
+			pprev = nullptr;
+			fn = f;
+			data = d;
+		}
+		bool pending() const { return pprev != nullptr; }
+	};
+
+	constexpr int	tw_slot_bits = 6;
+	constexpr int	tw_slots	 = 1 << tw_slot_bits;
+	constexpr int	tw_levels	 = 4;
+	constexpr uint64 tw_max_delta = ( 1UL << ( tw_slot_bits * tw_levels ) ) - 1;
+
+	/// @brief 分层时间轮 (hashed hierarchical timing wheel)。
+	/// 4 层，每层 64 个槽：第 0 层一个槽一个 tick，第 n 层一个槽覆盖 64^n 个 tick。
+	/// 定时器按剩余时间挂到能容纳它的最低一层；每当低一层转完一圈，就把高一层当前槽里的
+	/// 定时器重新分配（cascade）到低层。于是加入和取消都是 O(1)，每个 tick 只看第 0 层的一个槽，
+	/// 睡着的进程不再在每个 tick 被叫醒一次。超出 64^4 个 tick 的定时器先挂在最高层，到时再重排。
+	class TimerWheel
+	{
+	private:
+		SpinLock _lock;
+		uint64	 _jiffies = 0;			// 已经走过的 tick 数
+		uint64	 _next	  = 0;			// 下一个要处理的 tick，不超过 _jiffies + 1
+		Timer	*_wheel[tw_levels][tw_slots];
+		Timer	*_running = nullptr;	// 正在执行回调的定时器
+		uint	 _count	  = 0;			// 挂在轮上的定时器个数
+		uint64	 _event	  = 0;			// 下一次时钟中断预定在哪个 tick
+		void ( *_kick )() = nullptr;	// 加入了比 _event 更早的定时器时调用，让时钟提前到来
+
+	public:
+		TimerWheel() = default;
+		void init();
+
+		uint64 jiffies() { return _jiffies; }
+		bool   empty() { return _count == 0; }
+
+		/// @brief 挂入定时器，在 tick 数到达 expires 时回调；已经挂着的先摘下重挂。
+		/// 已经过期的 expires 在下一个 tick 到期。
+		void add( Timer *t, uint64 expires );
+		/// @brief 取消定时器，返回它取消前是否还挂着。回调可能正在别的核上执行
+		bool del( Timer *t );
+		/// @brief 取消定时器，并等待正在执行的回调结束。不能在持有回调要拿的锁时调用
+		bool del_sync( Timer *t );
+
+		/// @brief 时钟中断中调用：走过 n 个 tick，执行所有到期的回调。
+		/// 无时钟空闲之后一次中断可能补上多个 tick
+		void tick( uint64 n = 1 );
+		/// @brief 不晚于最早到期定时器的一个 tick，时钟中断最迟应在这时到来；
+		/// 高层槽里的定时器给出的是它们要被重新分配的时刻。没有定时器时返回 ~0UL
+		uint64 next_expiry();
+		/// @brief 由时钟中断的设置方告知下一次中断所在的 tick，以及它停着时如何让它提前
+		void set_event( uint64 tick ) { _event = tick; }
+		void set_kick( void ( *fn )() ) { _kick = fn; }
+
+	private:
+		void _enqueue( Timer *t );
+		void _unlink( Timer *t );
+		int _cascade( int level );
+	};
+
+	extern TimerWheel k_twheel;
+} // namespace tmm
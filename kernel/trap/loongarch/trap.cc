@@ -19,34 +19,57 @@
 #include "cpu.hh"
 #include "physical_memory_manager.hh"
 #include "virtual_memory_manager.hh"
+#include "asid.hh"
+#include "tm/timer_wheel.hh"
+#include "smp.hh"
 #include "vfs/file/normal_file.hh"
+#include "fs/vfs/page_cache.hh"
 #include "devs/loongarch/disk_driver.hh"
 // in kernelvec.S, calls kerneltrap().
 extern "C" void kernelvec();
 extern "C" void uservec();
 extern "C" void handle_tlbr();
 extern "C" void handle_merr();
-extern "C" void userret(uint64, uint64);
+extern "C" void userret(uint64, uint64, uint64);
 int mmap_handler(uint64 va, int cause);
+static int mmap_fill(proc::Pcb *p, uint64 va, proc::vma *vm);
 // 创建一个静态对象
 trap_manager trap_mgr;
 
+// 一个 tick 的长度（稳定计时器的计数），须是 4 的倍数
+constexpr uint64 tick_cycles = 0x1000000UL;
+// 时钟停下时最多隔这么多个 tick 也醒来一次
+constexpr uint64 max_idle_ticks = 1024;
+
 // 初始化锁
 void trap_manager::init()
 {
   ticks = 0;
-  timeslice = 0;
+  ticks_time = rdtime();
+  for (HartTick &ht : hart_tick)
+    ht = {0, false, 0};
+  tick_cpu = r_tp();
   tickslock.init("tickslock");
+  // 时间轮只由 tick_cpu 推进，它的时钟停着时要叫醒的是它
+  tmm::k_twheel.set_kick([] {
+    if (r_tp() == trap_mgr.tick_cpu)
+      trap_mgr.tick_restart();
+    else
+      k_smp.send_ipi(trap_mgr.tick_cpu, SmpManager::ipi_resched);
+  });
   printfGreen("[trap] Trap Manager Init\n");
 }
 
 // 架构相关, 设置csr
 void trap_manager::inithart()
 {
-  uint32 ecfg = (0U << CSR_ECFG_VS_SHIFT) | HWI_VEC | TI_VEC;
-  uint64 tcfg = 0x1000000UL | CSR_TCFG_EN | CSR_TCFG_PER;
+  uint32 ecfg = (0U << CSR_ECFG_VS_SHIFT) | HWI_VEC | TI_VEC | IPI_VEC;
+  // 先按周期模式启动；之后在每次时钟中断里改为单次定时
+  uint64 tcfg = tick_cycles | CSR_TCFG_EN | CSR_TCFG_PER;
 
   w_csr_ecfg(ecfg);
+  iocsr_write32(LOONGARCH_IOCSR_IPI_EN, 0xffffffffU);
+  hart_tick[r_tp()].last_tick_time = rdtime();
   w_csr_tcfg(tcfg);
 
   w_csr_eentry((uint64)kernelvec);
@@ -55,6 +78,64 @@ void trap_manager::inithart()
   intr_on();
 }
 
+// 时钟到期后, 重新设置下次超时
+void trap_manager::set_next_timeout()
+{
+  HartTick &ht = hart_tick[r_tp()];
+  bool owner = r_tp() == tick_cpu;
+  uint64 ahead = 1;
+  // 没有别的进程在等 CPU 时不需要周期时钟来抢占，直接睡到最近的定时器；
+  // 定时器只由 tick_cpu 处理，其余的核只是偶尔醒来看一眼
+  if (!proc::k_scheduler.has_runnable())
+  {
+    ahead = max_idle_ticks;
+    if (owner)
+    {
+      uint64 next = tmm::k_twheel.next_expiry();
+      uint64 now = tmm::k_twheel.jiffies();
+      ahead = next > now ? next - now : 1;
+      if (ahead > max_idle_ticks)
+        ahead = max_idle_ticks;
+    }
+  }
+  ht.tick_stopped = ahead > 1;
+  if (owner)
+    tmm::k_twheel.set_event(tmm::k_twheel.jiffies() + ahead);
+  program_timer(ht.last_tick_time + ahead * tick_cycles);
+}
+
+void trap_manager::program_timer(uint64 deadline)
+{
+  // 定时器是倒计数的，初值低两位由硬件补齐；已经过去的时刻取最小值立即触发
+  uint64 now = rdtime();
+  uint64 delta = deadline > now ? deadline - now : 4;
+  w_csr_tcfg(((delta + 3) & ~3UL) | CSR_TCFG_EN);
+}
+
+void trap_manager::tick_restart()
+{
+  Cpu::push_intr_off();
+  HartTick &ht = hart_tick[r_tp()];
+  if (ht.tick_stopped)
+  {
+    uint64 n = (rdtime() - ht.last_tick_time) / tick_cycles + 1;
+    ht.tick_stopped = false;
+    // 停着的这段时间 ticks 没有前进，先补上，免得读时间的人看到它落后之后再跳一大步
+    if (r_tp() == tick_cpu)
+      account_ticks();
+    if (r_tp() == tick_cpu)
+      tmm::k_twheel.set_event(tmm::k_twheel.jiffies() + n);
+    program_timer(ht.last_tick_time + n * tick_cycles);
+  }
+  Cpu::pop_intr_off();
+}
+
+void trap_manager::idle()
+{
+  set_next_timeout();
+  wait_for_interrupt();
+}
+
 // 处理外部中断和软件中断
 int trap_manager::devintr()
 {
@@ -103,36 +184,60 @@ int trap_manager::devintr()
   {
     // timer interrupt,
 
-    if (proc::k_pm.get_cur_cpuid() == 0)
-    {
-      timertick();
-    }
-
     // acknowledge the timer interrupt by clearing
     // the TI bit in TICLR.
+    // 要先清：timertick 会重新设置单次定时，期限很近时新的中断可能马上就到
     w_csr_ticlr(r_csr_ticlr() | CSR_TICLR_CLR);
 
+    timertick();
+    // PCIe 中断不一定送达，时钟中断里顺带回收磁盘已完成的异步请求
+    if (r_tp() == tick_cpu)
+      loongarch::qemu::disk_driver.handle_intr();
+
     return 2;
   }
+  else if (estat & ecfg & IPI_VEC)
+  {
+    // 核间中断：动作记在 k_smp 里，向量只用来唤醒
+    iocsr_write32(LOONGARCH_IOCSR_IPI_CLEAR, iocsr_read32(LOONGARCH_IOCSR_IPI_STATUS));
+    k_smp.handle_ipi();
+    return 1;
+  }
   else
   {
     return 0;
   }
 }
 
-void trap_manager::timertick()
+uint trap_manager::account_ticks()
 {
-  // acquire the lock to protect ticks
+  // 按硬件时间补齐 ticks：时钟停着、tick_restart 提前恢复、读者来取时都可能落后若干个 tick
   tickslock.acquire();
+  uint64 n = (rdtime() - ticks_time) / tick_cycles;
+  ticks_time += n * tick_cycles;
+  ticks += n;
+  uint t = ticks;
+  tickslock.release();
+  return t;
+}
 
-  // increment the ticks count
-  ticks++;
+void trap_manager::timertick()
+{
+  HartTick &ht = hart_tick[r_tp()];
+  // 时钟停过时一次中断要补上中间所有的 tick
+  uint64 n = (rdtime() - ht.last_tick_time) / tick_cycles;
+  ht.last_tick_time += n * tick_cycles;
+
+  if (r_tp() == tick_cpu)
+  {
+    account_ticks();
 
-  // !!写完进城后修改
-  proc::k_pm.wakeup(&ticks);
+    // 睡眠者各自挂在时间轮上，只有到期的才会被唤醒
+    if (n != 0)
+      tmm::k_twheel.tick(n);
+  }
 
-  // release the lock
-  tickslock.release();
+  set_next_timeout();
 }
 
 // !!写完进程后修改
@@ -172,8 +277,10 @@ void trap_manager::usertrap()
     syscall::k_syscall_handler.invoke_syscaller();
   }
 
-  else if (((r_csr_estat() & CSR_ESTAT_ECODE) >> 16 == 0x1 || (r_csr_estat() & CSR_ESTAT_ECODE) >> 16 == 0x2))
+  else if (((r_csr_estat() & CSR_ESTAT_ECODE) >> 16 == 0x1 || (r_csr_estat() & CSR_ESTAT_ECODE) >> 16 == 0x2 ||
+            (r_csr_estat() & CSR_ESTAT_ECODE) >> 16 == 0x3))
   {
+    // PIL/PIS/PIF：读、写、取指时页无效；按需加载的 ELF 代码段第一次取指走 PIF
     // printfRed("p->_trapframe->sp: %p,fault_va: %p,p->sz:%p\n", p->_trapframe->sp, r_csr_badv(), p->_sz);
     if (mmap_handler(r_csr_badv(), (r_csr_estat() & CSR_ESTAT_ECODE) >> 16) != 0)
     {
@@ -182,6 +289,16 @@ void trap_manager::usertrap()
       p->_killed = 1;
     }
   }
+  else if ((r_csr_estat() & CSR_ESTAT_ECODE) >> 16 == 0x4)
+  {
+    // PME：写了 D 位为 0 的页，写时复制页在这里拆分
+    if (mem::k_vmm.cow_fault(*p->get_pagetable(), r_csr_badv()) != 0)
+    {
+      printf("usertrap(): unexpected trapcause %x pid=%d\n", r_csr_estat(), p->_pid);
+      printf("            era=%p badi=%x,badv=%p\n", r_csr_era(), r_csr_badi(), r_csr_badv());
+      p->_killed = 1;
+    }
+  }
   else if ((which_dev = devintr()) != 0)
   {
     // ok
@@ -199,13 +316,14 @@ void trap_manager::usertrap()
   // give up the CPU if this is a timer interrupt.
   if (which_dev == 2)
   {
+    uint &timeslice = hart_tick[r_tp()].timeslice;
     timeslice++; // 让一个进程连续执行若干时间片，printf线程不安全
     if (timeslice >= 10)
     {
       timeslice = 0;
       // 处理信号 - 在返回用户态之前检查并处理待处理的信号
       proc::ipc::signal::handle_signal();
-      printf("yield in usertrap\n");
+      log_trace("yield in usertrap\n");
       proc::k_scheduler.yield();
     }
   }
@@ -215,27 +333,33 @@ void trap_manager::usertrap()
   usertrapret();
 }
 
+/// @brief 让本核的 trapframe 槽位指向 p 的 trapframe。槽位只有本核的 uservec 使用，
+/// 已经指向 p 时什么都不做，换了线程也只需刷本核的 TLB
+static void install_trapframe_slot(proc::Pcb *p, uint64 va, uint64 asid)
+{
+  uint64 tf = PGROUNDDOWN((uint64)p->_trapframe);
+  mem::Pte pte = p->_pt.walk(va, 0);
+  if (!pte.is_null() && pte.is_valid() && to_phy((uint64)pte.pa()) == to_phy(tf))
+    return;
+  // 可能要建中间页表页，和同一地址空间里其他核上的缺页处理互斥
+  p->_vma->_lock.acquire();
+  pte = p->_pt.walk(va, 1);
+  if (pte.is_null())
+    panic("usertrapret: failed to map trapframe slot");
+  pte.set_data(PA2PTE(tf) | PTE_V | PTE_NX | PTE_P | PTE_W | PTE_R | PTE_MAT | PTE_D | loongarch::pte_valid_m);
+  p->_vma->_lock.release();
+  invtlb_page(asid, va);
+}
+
 void trap_manager::usertrapret(void)
 {
 //   printfCyan("==usertrapret== pid=%d\n", proc::k_pm.get_cur_pcb()->_pid);
   proc::Pcb *p = proc::k_pm.get_cur_pcb();
 
-  // 检查进程是否使用共享虚拟内存，如果是则需要动态映射trapframe
-  if (p->_shared_vm || p->_pt.get_ref_count() > 1) {
-    // 页表被共享，需要动态重新映射trapframe
-    printfCyan("[usertrapret] Page table shared (ref count: %d), dynamically mapping trapframe for pid %d\n", 
-               p->_pt.get_ref_count(), p->_pid);
-    
-    // 取消当前trapframe的映射
-    mem::k_vmm.vmunmap(p->_pt, TRAPFRAME, 1, 0);
-    
-    // 重新映射当前进程的trapframe
-    if (mem::k_vmm.map_pages(p->_pt, TRAPFRAME, PGSIZE, (uint64)(p->_trapframe), 
-                             PTE_V | PTE_NX | PTE_P | PTE_W | PTE_R | PTE_MAT | PTE_D) == 0)
-    {
-      panic("usertrapret: failed to dynamically map trapframe");
-    }
-  }
+  // 共享页表的线程不能都用 TRAPFRAME：别的核上的兄弟线程会把它改成自己的 trapframe。
+  // 改用本核的槽位，uservec 经 SAVE0 找到它
+  bool shared_pt = p->_shared_vm || p->_pt.get_ref_count() > 1;
+  uint64 tf_va = shared_pt ? TRAPFRAME_CPU(r_tp()) : TRAPFRAME;
 
   intr_off();
 
@@ -264,11 +388,15 @@ void trap_manager::usertrapret(void)
 
   // tell uservec.S the user page table to switch to.
   volatile uint64 pgdl = (p->_pt.get_base());
+  // 以及用户地址空间的 ASID，带 ASID 时进出内核都不必刷 TLB
+  uint64 asid = mem::k_asid.activate(p->_pt);
+  if (shared_pt)
+    install_trapframe_slot(p, tf_va, asid);
 
   // jump to uservec.S at the top of memory, which
   // switches to the user page table, restores user registers,
   // and switches to user mode with ertn.
-  userret(TRAPFRAME, pgdl);
+  userret(tf_va, pgdl, asid);
 }
 void trap_manager::machine_trap()
 {
@@ -302,16 +430,18 @@ void trap_manager::kerneltrap()
   // give up the CPU if this is a timer interrupt.
   if (which_dev == 2 && Cpu::get_cpu()->get_cur_proc() != nullptr && Cpu::get_cpu()->get_cur_proc()->_state == proc::RUNNING)
   {
+    uint &timeslice = hart_tick[r_tp()].timeslice;
     timeslice++; // 让一个进程连续执行若干时间片，printf线程不安全
     if (timeslice >= 5)
     {
       timeslice = 0;
-      printf("yield in kerneltrap\n");
+      log_trace("yield in kerneltrap\n");
       proc::k_scheduler.yield();
     }
   }
   if (which_dev == 2)
   {
+    uint &timeslice = hart_tick[r_tp()].timeslice;
     timeslice++; // 让一个进程连续执行若干时间片，printf线程不安全
     // printf("timeslice: %d\n", timeslice);
     if (timeslice >= 5)
@@ -327,67 +457,134 @@ void trap_manager::kerneltrap()
 }
 int mmap_handler(uint64 va, int cause)
 {
-  int i;
   proc::Pcb *p = proc::k_pm.get_cur_pcb();
-  // 根据地址查找属于哪一个VMA
-  for (i = 0; i < proc::NVMA; ++i)
+  proc::Pcb::VMA *mm = p->_vma;
+
+  // 根据地址查找属于哪一个VMA，查找和扩展都要持 mm 锁
+  mm->_lock.acquire();
+  proc::vma *vm = mm->_vm.find(va);
+  if (vm == nullptr)
   {
-    if (p->_vma->_vm[i].used)
+    // 检查前一个VMA是否可以扩展到这里，扩展后不能碰到下一个VMA
+    proc::vma *prev = mm->_vm.find_prev(va);
+    if (prev != nullptr && prev->is_expandable)
     {
-
-      // 检查是否在当前VMA范围内
-      if (va >= p->_vma->_vm[i].addr && va < p->_vma->_vm[i].addr + p->_vma->_vm[i].len)
+      proc::vma *nxt = mm->_vm.next(prev);
+      uint64 old_len = prev->len;
+      uint64 new_len = PGROUNDUP(va - prev->addr + PGSIZE);
+      if (new_len <= prev->max_len && (nxt == nullptr || prev->addr + new_len <= nxt->addr))
       {
-        break; // 在当前VMA范围内
-      }
-      // 检查是否可以扩展
-      else if (p->_vma->_vm[i].is_expandable &&
-               va < p->_vma->_vm[i].addr + p->_vma->_vm[i].max_len)
-      {
-        // 扩展当前VMA
-        uint64 old_len = p->_vma->_vm[i].len;
-        uint64 new_len = PGROUNDUP(va - p->_vma->_vm[i].addr + PGSIZE);
-        if (new_len <= p->_vma->_vm[i].max_len)
-        {
-          p->_vma->_vm[i].len = new_len;
-          p->_sz += (new_len - old_len);
-          printfCyan("VMA expanded from %d to %d bytes, p->_sz now %p\n", old_len, new_len, p->_sz);
-          break;
-        }
+        prev->len = new_len;
+        p->_sz += (new_len - old_len);
+        printfCyan("VMA expanded from %d to %d bytes, p->_sz now %p\n", old_len, new_len, p->_sz);
+        vm = prev;
       }
     }
   }
-  if (i == proc::NVMA)
+  if (vm == nullptr)
   {
+    mm->_lock.release();
     printfRed("mmap_handler: no suitable VMA found for va %p\n", va);
     return -1;
   }
-  // 检查该页面是否已经映射
-  // mem::Pte existing_pte = p->get_pagetable()->walk(va, false);
-  // if (!existing_pte.is_null() && existing_pte.is_valid())
-  // {
-  //   // 页面已经映射，不需要重复处理
-  //   return 0;
-  // }
-  // printfCyan("mmap_handler: handling mmap at %p, cause: %d\n", va, cause);
-  int pte_flags = PTE_U |  PTE_P | PTE_D | PTE_MAT;
-  
-  // 特殊处理 prot=0 的情况
-  if (p->_vma->_vm[i].prot == 0) {
-    // 对于 prot=0 的映射，在 LoongArch 上只给予用户态访问权限
-    // 不设置 PTE_NR 和 PTE_NX，使其可读可执行但不可写
-    printfYellow("mmap_handler: prot=0 mapping, using minimal permissions\n");
-  } else {
-    // 正常的权限处理
-    if (!(p->_vma->_vm[i].prot & PROT_READ))
-      pte_flags |= PTE_NR;
-    if (p->_vma->_vm[i].prot & PROT_WRITE)
-      pte_flags |= PTE_W;
-    if (!(p->_vma->_vm[i].prot & PROT_EXEC))
-      pte_flags |= PTE_NX;
+  // PROT_NONE 的区域不建立映射，访问就是越权
+  if (vm->prot == PROT_NONE)
+  {
+    mm->_lock.release();
+    return -1;
+  }
+
+  // 页无效例外时表项却已经有效，说明别的线程刚缺页装上了这一页，重来一次即可
+  mem::Pte pte = p->get_pagetable()->walk(PGROUNDDOWN(va), 0);
+  if (!pte.is_null() && pte.is_valid())
+  {
+    mm->_lock.release();
+    return 0;
   }
 
-  fs::normal_file *vf = p->_vma->_vm[i].vfile;
+  // 读文件可能睡眠，不能持着自旋锁：拷一份区域快照放锁去做，快照自己持一份文件引用
+  proc::vma snap = *vm;
+  if (snap.vfile != nullptr)
+    snap.vfile->dup();
+  mm->_lock.release();
+
+  int ret = mmap_fill(p, va, &snap);
+  if (snap.vfile != nullptr)
+    snap.vfile->free_file();
+  return ret;
+}
+
+/// @brief 重新持 mm 锁确认区域没变、这一页也没被别的线程抢先装上，再把 pa 映射到 va。
+/// 否则放弃 pa 返回 0，让这次访问重来一遍
+/// @param cache_page pa 是页缓存页，按共享页映射，cow 为真时以写时复制方式映射
+static int mmap_install(proc::Pcb *p, uint64 va, proc::vma *snap, void *pa, int pte_flags, bool cache_page, bool cow)
+{
+  proc::Pcb::VMA *mm = p->_vma;
+  mem::PageTable *pt = p->get_pagetable();
+  mm->_lock.acquire();
+  mem::Pte pte = pt->walk(PGROUNDDOWN(va), 0);
+  if (!mm->_vm.same_region(va, *snap) || (!pte.is_null() && pte.is_valid()))
+  {
+    mm->_lock.release();
+    mem::k_pmm.free_page(pa);
+    return 0;
+  }
+  int rc;
+  if (cache_page)
+    rc = mem::k_vmm.map_shared_page(*pt, va, pa, pte_flags, cow);
+  else
+    rc = mem::k_vmm.map_pages(*pt, PGROUNDDOWN(va), PGSIZE, (uint64)pa, pte_flags) ? 0 : -1;
+  mm->_lock.release();
+  if (rc < 0)
+  {
+    printfRed("mmap_handler: map failed");
+    mem::k_pmm.free_page(pa);
+    return -1;
+  }
+  // 缺页时重填已把无效表项装进了 TLB（带用户的 ASID），按 ASID 刷掉这一页
+  mem::k_vmm.tlb_flush(*pt, PGROUNDDOWN(va), 1);
+  return 0;
+}
+
+/// @brief 按区域快照 vm 准备好 va 所在的页：页缓存页、从文件读入的私有页或填零的匿名页
+static int mmap_fill(proc::Pcb *p, uint64 va, proc::vma *vm)
+{
+  // printfCyan("mmap_handler: handling mmap at %p, cause: %d\n", va, cause);
+  int pte_flags = PTE_U |  PTE_P | PTE_MAT;
+
+  // PROT_NONE 在 mmap_handler 里已经拒绝，这里至少有一种权限；
+  // 硬件按 D 位决定能否写，只读的页不能带 D
+  if (!(vm->prot & (PROT_READ | PROT_WRITE)))
+    pte_flags |= PTE_NR;
+  if (vm->prot & PROT_WRITE)
+    pte_flags |= PTE_W | PTE_D;
+  if (!(vm->prot & PROT_EXEC))
+    pte_flags |= PTE_NX;
+
+  fs::normal_file *vf = vm->vfile;
+
+  // 文件映射优先直接映射页缓存页：私有映射写时复制，共享映射各进程看到的是同一页
+  // 整页都由文件提供内容时才能直接用页缓存页，含有填零尾部的页（ELF 段末尾）要私有拷贝
+  uint64 pg_off = PGROUNDDOWN(va - vm->addr);
+  if (vf != nullptr && vf->getDentry() != nullptr && vf->getDentry()->getNode() != nullptr &&
+      pg_off + PGSIZE <= vm->file_sz)
+  {
+    fs::PageCache *pcache = vf->getDentry()->getNode()->pageCache();
+    uint64 foff = vm->offset + pg_off;
+    if (pcache != nullptr && foff % PGSIZE == 0)
+    {
+      void *cpa = pcache->get_page(foff / PGSIZE);
+      if (cpa == nullptr)
+      {
+        printfRed("mmap_handler: read nothing");
+        return -1;
+      }
+      bool shared = (vm->flags & MAP_SHARED) != 0;
+      if (shared && (pte_flags & PTE_W))
+        pcache->mark_dirty(foff / PGSIZE);
+      return mmap_install(p, va, vm, cpa, pte_flags, true, !shared);
+    }
+  }
 
   void *pa = mem::k_pmm.alloc_page();
 
@@ -396,9 +593,9 @@ int mmap_handler(uint64 va, int cause)
   memset(pa, 0, PGSIZE);
 
   // 读取文件内容
-  if (vf == nullptr || p->_vma->_vm[i].vfd == -1)
+  if (vf == nullptr || pg_off >= vm->file_sz)
   {
-    // 匿名映射：页面已经初始化为0，直接映射即可
+    // 匿名映射或文件内容之后的填零部分：页面已经初始化为0，直接映射即可
     // printfCyan("mmap_handler: handling anonymous mapping at %p\n", va);
   }
   else
@@ -418,39 +615,28 @@ int mmap_handler(uint64 va, int cause)
       return -1; // inode is null
     }
 
-    inode->_lock.acquire(); // 锁定inode，防止其他线程修改
-
-    // 计算当前页面读取文件的偏移量，实验中p->_vma->_vm[i].offset总是0
+    // 不持 inode 的自旋锁：nodeRead 可能要等磁盘而睡眠，文件系统自己负责读写的互斥
+    // 计算当前页面读取文件的偏移量，实验中vm->offset总是0
     // 要按顺序读读取，例如内存页面A,B和文件块a,b
     // 则A读取a，B读取b，而不能A读取b，B读取a
-    int offset = p->_vma->_vm[i].offset + PGROUNDDOWN(va - p->_vma->_vm[i].addr);
+    int offset = vm->offset + pg_off;
+    uint64 nread = vm->file_sz - pg_off;
+    if (nread > PGSIZE)
+      nread = PGSIZE;
     ///@details 原本的xv6的readi函数有一个标志位来区分是否读到内核中，此处位于内核里
     /// pa直接是物理地址，所以应该无所谓
-    int readbytes = inode->nodeRead((uint64)pa, offset, PGSIZE);
+    int readbytes = inode->nodeRead((uint64)pa, offset, nread);
 
     // 什么都没有读到
     if (readbytes == 0)
     {
       printfRed("mmap_handler: read nothing");
-      inode->_lock.release();
       mem::k_pmm.free_page(pa);
       return -1;
     }
-    inode->_lock.release(); // 释放inode锁
   }
   // 添加页面映射
   printfCyan("mmap_handler: mapping page at %p to %p with flags %p\n", va, pa, pte_flags);
-  if (mem::k_vmm.map_pages(*p->get_pagetable(), PGROUNDDOWN(va), PGSIZE, (uint64)pa, pte_flags) != 1)
-  {
-    printfRed("mmap_handler: map failed");
-    mem::k_pmm.free_page(pa);
-    return -1;
-  }
-
-  // 在 LoongArch 上刷新 TLB
-  asm volatile("invtlb 0x5, $zero, %0" : : "r"(PGROUNDDOWN(va)) : "memory");
-  
-  // printfCyan("mmap_handler: successfully mapped and returning\n");
-  return 0;
+  return mmap_install(p, va, vm, pa, pte_flags, false, false);
 }
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #ifdef LOONGARCH
 #include "types.hh"
 #include "devs/spinlock.hh"
+#include "param.h"
 
 
 class trap_manager
@@ -18,13 +19,29 @@ public:
     void usertrapret(); // 用户态返回处理
     void machine_trap();
     void kerneltrap();  // 内核态中断处理
+
+    void idle();         // 没有就绪进程时调用（已关中断）：按最近的定时器设置单次中断后停机等待
+    void tick_restart(); // 本核时钟停着而需要尽快处理时（就绪队列变为非空、加入了更早的定时器）恢复下一个 tick
+    uint account_ticks(); // 把 ticks 补到当前硬件时间并返回；tick_cpu 的时钟停着时 ticks 不会自己前进
 private:
     // void syscall();     // 系统调用处理
     void timertick();   // 时钟中断处理
+    void set_next_timeout(); // 设置下次超时：有别的进程等着运行时是下一个 tick，否则是最近的定时器
+    void program_timer(uint64 deadline); // 设置硬件定时器在 deadline 时刻触发
+
+    /// @brief 每个核自己的时钟状态，只在本核关中断时访问
+    struct HartTick
+    {
+        uint64 last_tick_time; // 本核最近一次时钟中断对齐到的 tick 边界（硬件时间）
+        bool tick_stopped;     // 本核下一次时钟中断在一个 tick 之后
+        uint timeslice;        // 本核当前进程连续运行的时间片数
+    };
 
     SpinLock tickslock; // 保护ticks的自旋锁
     uint ticks;        // 时钟中断计数
-    uint timeslice;    // 时间片计数
+    uint64 ticks_time; // ticks 已经计到的 tick 边界（硬件时间），由 tickslock 保护
+    HartTick hart_tick[NCPU];
+    uint64 tick_cpu;   // 推进 ticks 和时间轮的核，其余的核只用时钟做时间片轮转
 };
 
 extern trap_manager trap_mgr; // 创建一个静态的对象, 用于全局访问(其实相当于面向过程, 只是封装了一下)
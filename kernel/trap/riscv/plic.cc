@@ -19,9 +19,7 @@ void plic_manager::init()
 
 void plic_manager::inithart()
 {
-    // !!后续修改
-    // int hart = cpuid();
-    int hart = 0;
+    int hart = r_tp();
   
     // set enable bits for this hart's S-mode
     // for the uart and virtio disk.
@@ -33,9 +31,7 @@ void plic_manager::inithart()
 
 int plic_manager::claim()
 {
-    // !!后续修改
-    // int hart = cpuid();
-    int hart =r_tp();
+    int hart = r_tp();
 
     int irq = *(uint32*)PLIC_SCLAIM(hart);
     return irq;
@@ -43,9 +39,8 @@ int plic_manager::claim()
 
 void plic_manager::complete(int irq)
 {
-    // !!后续修改
-    // int hart = cpuid();
-    int hart = 0;
+    // 必须在 claim 的同一个核上 complete
+    int hart = r_tp();
 
     *(uint32*)PLIC_SCLAIM(hart) = irq;
 }
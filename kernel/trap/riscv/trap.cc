@@ -19,9 +19,13 @@
 #include "mem.hh"
 #include "physical_memory_manager.hh"
 #include "fs/vfs/file/normal_file.hh"
+#include "fs/vfs/page_cache.hh"
 #include "virtual_memory_manager.hh"
+#include "asid.hh"
+#include "tm/timer_wheel.hh"
 #include "timer_interface.hh"
 #include "timer_manager.hh"
+#include "smp.hh"
 
 // #include "fuckyou.hh"
 // in kernelvec.S, calls kerneltrap().
@@ -30,33 +34,100 @@ extern char trampoline[], uservec[], userret[];
 // 创建一个静态对象
 trap_manager trap_mgr;
 
+// 一个 tick 的长度（time CSR 的计数）
+constexpr uint64 tick_cycles = INTERVAL;
+// 时钟停下时最多隔这么多个 tick 也醒来一次
+constexpr uint64 max_idle_ticks = 1024;
+
 // 前置声明，内部函数只有这里使用。
 int mmap_handler(uint64 va, int cause);
+static int mmap_fill(proc::Pcb *p, uint64 va, proc::vma *vm);
 
 // 初始化锁
 void trap_manager::init()
 {
   ticks = 0;
-  timeslice = 0;
+  ticks_time = r_time();
+  for (HartTick &ht : hart_tick)
+    ht = {0, false, 0};
+  tick_cpu = r_tp();
   tickslock.init("tickslock");
+  // 时间轮只由 tick_cpu 推进，它的时钟停着时要叫醒的是它
+  tmm::k_twheel.set_kick([] {
+    if (r_tp() == trap_mgr.tick_cpu)
+      trap_mgr.tick_restart();
+    else
+      k_smp.send_ipi(trap_mgr.tick_cpu, SmpManager::ipi_resched);
+  });
   printfGreen("[trap] Trap Manager Init\n");
 }
 
 // 架构相关, 设置csr
 void trap_manager::inithart()
 {
+  HartTick &ht = hart_tick[r_tp()];
   w_stvec((uint64)kernelvec);
   w_sstatus(r_sstatus() | SSTATUS_SIE);
   w_sie(r_sie() | SIE_SEIE | SIE_STIE | SIE_SSIE);
-  set_next_timeout();
+  ht.last_tick_time = r_time();
+  program_timer(ht.last_tick_time + tick_cycles);
   printfGreen("[trap] Trap Manager Inithart\n");
 }
 
 // 时钟到期后, 重新设置下次超时
 void trap_manager::set_next_timeout()
 {
+  HartTick &ht = hart_tick[r_tp()];
+  bool owner = r_tp() == tick_cpu;
+  uint64 ahead = 1;
+  // 没有别的进程在等 CPU 时不需要周期时钟来抢占，直接睡到最近的定时器；
+  // 定时器只由 tick_cpu 处理，其余的核只是偶尔醒来看一眼
+  if (!proc::k_scheduler.has_runnable())
+  {
+    ahead = max_idle_ticks;
+    if (owner)
+    {
+      uint64 next = tmm::k_twheel.next_expiry();
+      uint64 now = tmm::k_twheel.jiffies();
+      ahead = next > now ? next - now : 1;
+      if (ahead > max_idle_ticks)
+        ahead = max_idle_ticks;
+    }
+  }
+  ht.tick_stopped = ahead > 1;
+  if (owner)
+    tmm::k_twheel.set_event(tmm::k_twheel.jiffies() + ahead);
+  program_timer(ht.last_tick_time + ahead * tick_cycles);
+}
 
-  sbi_set_timer(r_time() + INTERVAL);
+void trap_manager::program_timer(uint64 deadline)
+{
+  // 已经过去的时刻会立即触发
+  sbi_set_timer(deadline);
+}
+
+void trap_manager::tick_restart()
+{
+  Cpu::push_intr_off();
+  HartTick &ht = hart_tick[r_tp()];
+  if (ht.tick_stopped)
+  {
+    uint64 n = (r_time() - ht.last_tick_time) / tick_cycles + 1;
+    ht.tick_stopped = false;
+    // 停着的这段时间 ticks 没有前进，先补上，免得读时间的人看到它落后之后再跳一大步
+    if (r_tp() == tick_cpu)
+      account_ticks();
+    if (r_tp() == tick_cpu)
+      tmm::k_twheel.set_event(tmm::k_twheel.jiffies() + n);
+    program_timer(ht.last_tick_time + n * tick_cycles);
+  }
+  Cpu::pop_intr_off();
+}
+
+void trap_manager::idle()
+{
+  set_next_timeout();
+  wait_for_interrupt();
 }
 
 // 处理外部中断和软件中断
@@ -104,6 +175,13 @@ int trap_manager::devintr()
 
     return 1;
   }
+  if (scause == 0x8000000000000001L)
+  {
+    // 核间中断：SBI 置起的是 SSIP，由我们自己清掉
+    w_sip(r_sip() & ~2UL);
+    k_smp.handle_ipi();
+    return 1;
+  }
   if (scause == 0x8000000000000005L)
   {
     // printfBlue("zzZ");
@@ -122,18 +200,33 @@ int trap_manager::devintr()
   }
 }
 
-void trap_manager::timertick()
+uint trap_manager::account_ticks()
 {
-  // acquire the lock to protect ticks
+  // 按硬件时间补齐 ticks：时钟停着、tick_restart 提前恢复、读者来取时都可能落后若干个 tick
   tickslock.acquire();
+  uint64 n = (r_time() - ticks_time) / tick_cycles;
+  ticks_time += n * tick_cycles;
+  ticks += n;
+  uint t = ticks;
+  tickslock.release();
+  return t;
+}
 
-  // increment the ticks count
-  ticks++;
-  proc::k_pm.wakeup(&ticks);
+void trap_manager::timertick()
+{
+  HartTick &ht = hart_tick[r_tp()];
+  // 时钟停过时一次中断要补上中间所有的 tick
+  uint64 n = (r_time() - ht.last_tick_time) / tick_cycles;
+  ht.last_tick_time += n * tick_cycles;
 
-  // printfCyan("[tm]  timertick here,p->addr:%x \n",Cpu::get_cpu()->get_cur_proc());
-  // release the lock
-  tickslock.release();
+  if (r_tp() == tick_cpu)
+  {
+    account_ticks();
+
+    // 睡眠者各自挂在时间轮上，只有到期的才会被唤醒
+    if (n != 0)
+      tmm::k_twheel.tick(n);
+  }
 
   // set the next timeout
   set_next_timeout();
@@ -170,13 +263,15 @@ void trap_manager::kerneltrap()
 
   if (which_dev == 2 && Cpu::get_cpu()->get_cur_proc() != nullptr && Cpu::get_cpu()->get_cur_proc()->_state == proc::RUNNING)
   {
+    uint &timeslice = hart_tick[r_tp()].timeslice;
     timeslice++; // 让一个进程连续执行若干时间片，printf线程不安全
     // printf("timeslice: %d\n", timeslice);
     if (timeslice >= 5)
     {
-      printfCyan("[kerneltrap]  yield here,p->addr:%x \n",Cpu::get_cpu()->get_cur_proc());
-      proc::k_scheduler.yield();
+      // 让出之后可能在别的核上继续，先清零本核的计数
       timeslice = 0;
+      log_trace("[kerneltrap]  yield here,p->addr:%x \n",Cpu::get_cpu()->get_cur_proc());
+      proc::k_scheduler.yield();
       // print_fuckyou();
     }
   }
@@ -215,14 +310,18 @@ void trap_manager::usertrap()
   {
     // ok
   }
-  else if (cause == 13 || cause == 15)
+  else if (cause == 12 || cause == 13 || cause == 15)
   {
-    // 缺页故障处理
+    // 缺页故障处理；按需加载的 ELF 代码段第一次取指时是指令缺页 (12)
     TODO("pagefault_handler");
     ///@brief 此处处理mmap的缺页异常
     // printfRed("p->_trapframe->sp: %p,printf fault_va:%p, p->_sz:%p\n", PGROUNDUP(p->_trapframe->sp) - 1, fault_va, p->_sz);
 
-    if (mmap_handler(r_stval(), cause) != 0)
+    if (cause == 15 && mem::k_vmm.cow_fault(*p->get_pagetable(), r_stval()) == 0)
+    {
+      // 写时复制页的写错误，拆分后直接返回用户态
+    }
+    else if (mmap_handler(r_stval(), cause) != 0)
     {
       printfRed("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->_pid);
       printfRed("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -242,13 +341,14 @@ void trap_manager::usertrap()
   // give up the CPU if this is a timer interrupt.
   if (which_dev == 2)
   {
+    uint &timeslice = hart_tick[r_tp()].timeslice;
     timeslice++; // 让一个进程连续执行若干时间片，printf线程不安全
     if (timeslice >= 5)
     {
       timeslice = 0;
       // 处理信号 - 在返回用户态之前检查并处理待处理的信号
       proc::ipc::signal::handle_signal();
-      printf("yield in usertrap\n");
+      log_trace("yield in usertrap\n");
       proc::k_scheduler.yield();
     }
   }
@@ -256,6 +356,25 @@ void trap_manager::usertrap()
   usertrapret();
 }
 
+/// @brief 让本核的 trapframe 槽位指向 p 的 trapframe。槽位只有本核的 uservec 使用，
+/// 已经指向 p 时什么都不做，换了线程也只需刷本核的 TLB
+static void install_trapframe_slot(proc::Pcb *p, uint64 va, uint64 asid)
+{
+  uint64 pa = riscv::virt_to_phy_address((uint64)p->get_trapframe());
+  mem::Pte pte = p->_pt.walk(va, 0);
+  if (!pte.is_null() && pte.is_valid() && (uint64)pte.pa() == PGROUNDDOWN(pa))
+    return;
+  // 可能要建中间页表页，和同一地址空间里其他核上的缺页处理互斥
+  p->_vma->_lock.acquire();
+  pte = p->_pt.walk(va, 1);
+  if (pte.is_null())
+    panic("usertrapret: failed to map trapframe slot");
+  pte.set_data(PA2PTE(PGROUNDDOWN(pa)) | riscv::PteEnum::pte_readable_m |
+               riscv::PteEnum::pte_writable_m | riscv::PteEnum::pte_valid_m);
+  p->_vma->_lock.release();
+  sfence_vma_page(va, asid);
+}
+
 void trap_manager::usertrapret()
 {
   // printfMagenta("into usertrapret\n");
@@ -264,22 +383,10 @@ void trap_manager::usertrapret()
   //  printfYellow("[usertrapret] trampoline addr %p\n", trampoline);
 
 
-  // 检查进程是否使用共享虚拟内存，如果是则需要动态映射trapframe
-  if (p->_shared_vm || p->_pt.get_ref_count() > 1) {
-    // 页表被共享，需要动态重新映射trapframe
-    // printfCyan("[usertrapret] Page table shared (ref count: %d), dynamically mapping trapframe for pid %d\n", 
-            //    p->_pt.get_ref_count(), p->_pid);
-    
-    // 取消当前trapframe的映射
-    mem::k_vmm.vmunmap(p->_pt, TRAPFRAME, 1, 0);
-    
-    // 重新映射当前进程的trapframe
-    if (mem::k_vmm.map_pages(p->_pt, TRAPFRAME, PGSIZE, (uint64)(p->get_trapframe()), 
-                             riscv::PteEnum::pte_readable_m | riscv::PteEnum::pte_writable_m) == 0)
-    {
-      panic("usertrapret: failed to dynamically map trapframe");
-    }
-  }
+  // 共享页表的线程不能都用 TRAPFRAME：别的核上的兄弟线程会把它改成自己的 trapframe。
+  // 改用本核的槽位，uservec 经 sscratch 找到它
+  bool shared_pt = p->_shared_vm || p->_pt.get_ref_count() > 1;
+  uint64 tf_va = shared_pt ? TRAPFRAME_CPU(r_tp()) : TRAPFRAME;
   mem::Pte pte = p->_pt.walk(TRAMPOLINE, 0);
   if (pte.is_null() || pte.is_valid() == 0)
   {
@@ -310,7 +417,11 @@ void trap_manager::usertrapret()
   // debug
   // printfYellow("[usertrapret]user pagetable addr: %p\n", p->_pt.get_base());
 
-  uint64 satp = MAKE_SATP(p->_pt.get_base());
+  // 用户页表带上自己的 ASID，trampoline 切换页表时不必再刷 TLB
+  uint64 asid = mem::k_asid.activate(p->_pt);
+  uint64 satp = MAKE_SATP(p->_pt.get_base()) | (asid << riscv::csr::satp_asid_s);
+  if (shared_pt)
+    install_trapframe_slot(p, tf_va, asid);
   // debug
 
   uint64 fn = TRAMPOLINE + (userret - trampoline);
@@ -318,9 +429,7 @@ void trap_manager::usertrapret()
 //   printf("trapframe->epc: %p\n", p->_trapframe->epc);
 //   printf("[usertrapret] trapframe->a0: %p\n", p->_trapframe->a0);
   
-  ((void (*)(uint64, uint64))fn)(TRAPFRAME, satp);
-  // !! 这个地方应该是固定值, 如果上多核的时候出错的话, 就改回下面
-  // ((void (*)(uint64, uint64))fn)(TRAPFRAME + proc::k_pm.get_cur_cpuid() * sizeof(TrapFrame), satp);
+  ((void (*)(uint64, uint64))fn)(tf_va, satp);
 }
 
 /**
@@ -331,54 +440,129 @@ void trap_manager::usertrapret()
  */
 int mmap_handler(uint64 va, int cause)
 {
-  int i;
   proc::Pcb *p = proc::k_pm.get_cur_pcb();
+  proc::Pcb::VMA *mm = p->_vma;
 
-  // 根据地址查找属于哪一个VMA
-  for (i = 0; i < proc::NVMA; ++i)
+  // 根据地址查找属于哪一个VMA，查找和扩展都要持 mm 锁
+  mm->_lock.acquire();
+  proc::vma *vm = mm->_vm.find(va);
+  if (vm == nullptr)
   {
-    if (p->_vma->_vm[i].used)
+    // 检查前一个VMA是否可以扩展到这里，扩展后不能碰到下一个VMA
+    proc::vma *prev = mm->_vm.find_prev(va);
+    if (prev != nullptr && prev->is_expandable)
     {
-
-      // 检查是否在当前VMA范围内
-      if (va >= p->_vma->_vm[i].addr && va < p->_vma->_vm[i].addr + p->_vma->_vm[i].len)
+      proc::vma *nxt = mm->_vm.next(prev);
+      uint64 old_len = prev->len;
+      uint64 new_len = PGROUNDUP(va - prev->addr + PGSIZE);
+      if (new_len <= prev->max_len && (nxt == nullptr || prev->addr + new_len <= nxt->addr))
       {
-
-        break; // 在当前VMA范围内
-      }
-      // 检查是否可以扩展
-      else if (p->_vma->_vm[i].is_expandable &&
-               va < p->_vma->_vm[i].addr + p->_vma->_vm[i].max_len)
-      {
-        // 扩展当前VMA
-        uint64 new_len = PGROUNDUP(va - p->_vma->_vm[i].addr + PGSIZE);
-        if (new_len <= p->_vma->_vm[i].max_len)
-        {
-          p->_vma->_vm[i].len = new_len;
-          p->_sz += (new_len - p->_vma->_vm[i].len);
-          break;
-        }
+        prev->len = new_len;
+        p->_sz += (new_len - old_len);
+        vm = prev;
       }
     }
   }
-  if (i == proc::NVMA)
+  if (vm == nullptr)
+  {
+    mm->_lock.release();
     return -1;
-  int pte_flags = PTE_U;
-  if (p->_vma->_vm[i].prot == 0)
+  }
+  // PROT_NONE 的区域不建立映射，访问就是越权
+  if (vm->prot == PROT_NONE)
+  {
+    mm->_lock.release();
+    return -1;
+  }
+
+  // 页已经有了：别的线程刚缺页装上的话重来一次即可；表项本身不允许这种访问则是真正的越权
+  mem::Pte pte = p->get_pagetable()->walk(PGROUNDDOWN(va), 0);
+  if (!pte.is_null() && pte.is_valid())
+  {
+    uint64 need = (cause == 12 ? PTE_X : cause == 13 ? PTE_R : cause == 15 ? PTE_W : 0) | PTE_U;
+    mm->_lock.release();
+    return (pte.get_data() & need) == need ? 0 : -1;
+  }
+
+  // 读文件可能睡眠，不能持着自旋锁：拷一份区域快照放锁去做，快照自己持一份文件引用
+  proc::vma snap = *vm;
+  if (snap.vfile != nullptr)
+    snap.vfile->dup();
+  mm->_lock.release();
+
+  int ret = mmap_fill(p, va, &snap);
+  if (snap.vfile != nullptr)
+    snap.vfile->free_file();
+  return ret;
+}
+
+/// @brief 重新持 mm 锁确认区域没变、这一页也没被别的线程抢先装上，再把 pa 映射到 va。
+/// 否则放弃 pa 返回 0，让这次访问重来一遍
+/// @param cache_page pa 是页缓存页，按共享页映射，cow 为真时以写时复制方式映射
+static int mmap_install(proc::Pcb *p, uint64 va, proc::vma *snap, void *pa, int pte_flags, bool cache_page, bool cow)
+{
+  proc::Pcb::VMA *mm = p->_vma;
+  mem::PageTable *pt = p->get_pagetable();
+  mm->_lock.acquire();
+  mem::Pte pte = pt->walk(PGROUNDDOWN(va), 0);
+  if (!mm->_vm.same_region(va, *snap) || (!pte.is_null() && pte.is_valid()))
   {
-    pte_flags |= PTE_R | PTE_X | PTE_W;
-    printfYellow("mmap_handler: prot=0 mapping, using minimal permissions\n");
+    mm->_lock.release();
+    mem::k_pmm.free_page(pa);
+    return 0;
   }
+  int rc;
+  if (cache_page)
+    rc = mem::k_vmm.map_shared_page(*pt, va, pa, pte_flags, cow);
   else
+    rc = mem::k_vmm.map_pages(*pt, PGROUNDDOWN(va), PGSIZE, (uint64)pa, pte_flags) ? 0 : -1;
+  mm->_lock.release();
+  if (rc < 0)
+  {
+    printfRed("mmap_handler: map failed");
+    mem::k_pmm.free_page(pa);
+    return -1;
+  }
+  // 规范允许缓存无效表项，按 ASID 刷掉这一页，返回用户态时不再整片刷新
+  mem::k_vmm.tlb_flush(*pt, PGROUNDDOWN(va), 1);
+  return 0;
+}
+
+/// @brief 按区域快照 vm 准备好 va 所在的页：页缓存页、从文件读入的私有页或填零的匿名页
+static int mmap_fill(proc::Pcb *p, uint64 va, proc::vma *vm)
+{
+  // 只写不读是保留编码，可写的页同时可读
+  int pte_flags = PTE_U;
+  if (vm->prot & (PROT_READ | PROT_WRITE))
+    pte_flags |= PTE_R;
+  if (vm->prot & PROT_WRITE)
+    pte_flags |= PTE_W;
+  if (vm->prot & PROT_EXEC)
+    pte_flags |= PTE_X;
+  fs::normal_file *vf = vm->vfile;
+
+  // 文件映射优先直接映射页缓存页：私有映射写时复制，共享映射各进程看到的是同一页
+  // 整页都由文件提供内容时才能直接用页缓存页，含有填零尾部的页（ELF 段末尾）要私有拷贝
+  uint64 pg_off = PGROUNDDOWN(va - vm->addr);
+  if (vf != nullptr && vf->getDentry() != nullptr && vf->getDentry()->getNode() != nullptr &&
+      pg_off + PGSIZE <= vm->file_sz)
   {
-    if (p->_vma->_vm[i].prot & PROT_READ)
-      pte_flags |= PTE_R;
-    if (p->_vma->_vm[i].prot & PROT_WRITE)
-      pte_flags |= PTE_W;
-    if (p->_vma->_vm[i].prot & PROT_EXEC)
-      pte_flags |= PTE_X;
+    fs::PageCache *pcache = vf->getDentry()->getNode()->pageCache();
+    uint64 foff = vm->offset + pg_off;
+    if (pcache != nullptr && foff % PGSIZE == 0)
+    {
+      void *cpa = pcache->get_page(foff / PGSIZE);
+      if (cpa == nullptr)
+      {
+        printfRed("mmap_handler: read nothing");
+        return -1;
+      }
+      bool shared = (vm->flags & MAP_SHARED) != 0;
+      if (shared && (pte_flags & PTE_W))
+        pcache->mark_dirty(foff / PGSIZE);
+      return mmap_install(p, va, vm, cpa, pte_flags, true, !shared);
+    }
   }
-  fs::normal_file *vf = p->_vma->_vm[i].vfile;
 
   void *pa = mem::k_pmm.alloc_page();
   if (pa == nullptr)
@@ -391,9 +575,9 @@ int mmap_handler(uint64 va, int cause)
   memset(pa, 0, PGSIZE);
 
   // 检查是否为匿名映射
-  if (vf == nullptr || p->_vma->_vm[i].vfd == -1)
+  if (vf == nullptr || pg_off >= vm->file_sz)
   {
-    // 匿名映射：页面已经初始化为0，直接映射即可
+    // 匿名映射或文件内容之后的填零部分：页面已经初始化为0，直接映射即可
     // printfCyan("mmap_handler: handling anonymous mapping at %p\n", va);
   }
   else
@@ -414,35 +598,28 @@ int mmap_handler(uint64 va, int cause)
       return -1; // inode is null
     }
 
-    inode->_lock.acquire(); // 锁定inode，防止其他线程修改
-
-    // 计算当前页面读取文件的偏移量，实验中p->_vma->_vm[i].offset总是0
+    // 不持 inode 的自旋锁：nodeRead 可能要等磁盘而睡眠，文件系统自己负责读写的互斥
+    // 计算当前页面读取文件的偏移量，实验中vm->offset总是0
     // 要按顺序读读取，例如内存页面A,B和文件块a,b
     // 则A读取a，B读取b，而不能A读取b，B读取a
-    int offset = p->_vma->_vm[i].offset + PGROUNDDOWN(va - p->_vma->_vm[i].addr);
+    int offset = vm->offset + pg_off;
+    uint64 nread = vm->file_sz - pg_off;
+    if (nread > PGSIZE)
+      nread = PGSIZE;
     ///@details 原本的xv6的readi函数有一个标志位来区分是否读到内核中，此处位于内核里
     /// pa直接是物理地址，所以应该无所谓
-    int readbytes = inode->nodeRead((uint64)pa, offset, PGSIZE);
+    int readbytes = inode->nodeRead((uint64)pa, offset, nread);
 
     // 什么都没有读到
     if (readbytes == 0)
     {
       printfRed("mmap_handler: read nothing");
-      inode->_lock.release();
       mem::k_pmm.free_page(pa);
       return -1;
     }
-    inode->_lock.release(); // 释放inode锁
     // printfCyan("mmap_handler: handling file mapping at %p, read %d bytes\n", va, readbytes);
   }
 
   // 添加页面映射
-  if (mem::k_vmm.map_pages(*p->get_pagetable(), PGROUNDDOWN(va), PGSIZE, (uint64)pa, pte_flags) != 1)
-  {
-    printfRed("mmap_handler: map failed");
-    mem::k_pmm.free_page(pa);
-    return -1;
-  }
-
-  return 0;
+  return mmap_install(p, va, vm, pa, pte_flags, false, false);
 }
\ No newline at end of file